@@ -74,6 +74,8 @@ cli_opts(boost::program_options::options_description_easy_init o) {
     "ip to connect to");
 
   o("port", po::value<uint16_t>()->default_value(20776), "port for service");
+  o("unix-path", po::value<std::string>()->default_value(""),
+    "unix domain socket to connect to instead of ip:port");
 
   o("req-num", po::value<uint32_t>()->default_value(1000),
     "number of request per concurrenct connection");
@@ -102,6 +104,7 @@ main(int args, char **argv, char **env) {
         cfg["req-num"].as<uint32_t>(), cfg["concurrency"].as<uint32_t>(),
         static_cast<uint64_t>(0.9 * seastar::memory::stats().total_memory()),
         smf::rpc::compression_flags::compression_flags_none, cfg);
+      largs.unix_path = cfg["unix-path"].as<std::string>();
 
       // TODO(lumontec): uniform largs instantiation with server side
       auto ca_cert = cfg["ca-cert"].as<std::string>();
@@ -37,6 +37,8 @@ cli_opts(boost::program_options::options_description_easy_init o) {
   o("ip", po::value<std::string>()->default_value("127.0.0.1"),
     "ip to connect to");
   o("port", po::value<uint16_t>()->default_value(20776), "port for service");
+  o("unix-path", po::value<std::string>()->default_value(""),
+    "also listen on this unix domain socket");
   o("httpport", po::value<uint16_t>()->default_value(20777),
     "port for http stats service");
   o("key", po::value<std::string>()->default_value(""),
@@ -70,6 +72,10 @@ main(int args, char **argv, char **env) {
       args.ip = cfg["ip"].as<std::string>().c_str();
       args.rpc_port = cfg["port"].as<uint16_t>();
       args.http_port = cfg["httpport"].as<uint16_t>();
+      auto unix_path = cfg["unix-path"].as<std::string>();
+      if (!unix_path.empty()) {
+        args.unix_address = smf::make_unix_address(unix_path);
+      }
       args.memory_avail_per_core =
         static_cast<uint64_t>(0.9 * seastar::memory::stats().total_memory());
       auto key = cfg["key"].as<std::string>();
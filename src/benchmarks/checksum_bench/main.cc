@@ -8,6 +8,8 @@
 #include <benchmark/benchmark.h>
 #include <xxhash.h>
 
+#include "smf/rpc_checksum.h"
+
 static constexpr uint32_t kPayloadSize = 1 << 29;
 static char kPayload[kPayloadSize]{};
 
@@ -40,4 +42,40 @@ BENCHMARK(BM_hash64)
   ->Args({1 << 20, 1 << 20})
   ->Args({1 << 29, 1 << 29});
 
+static void
+BM_checksum(benchmark::State &state, smf::rpc::checksum_type t) {
+  if (!smf::rpc_checksum_supported(t)) {
+    state.SkipWithError("checksum type not supported by this build");
+    return;
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    std::memset(kPayload, 'x', state.range(0));
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(
+      smf::rpc_checksum(t, kPayload, state.range(0)));
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * state.range(0));
+}
+BENCHMARK_CAPTURE(BM_checksum, xxhash64,
+                  smf::rpc::checksum_type::checksum_type_xxhash64)
+  ->Args({1 << 16, 1 << 16})
+  ->Args({1 << 20, 1 << 20})
+  ->Args({1 << 29, 1 << 29});
+BENCHMARK_CAPTURE(BM_checksum, crc32c,
+                  smf::rpc::checksum_type::checksum_type_crc32c)
+  ->Args({1 << 16, 1 << 16})
+  ->Args({1 << 20, 1 << 20})
+  ->Args({1 << 29, 1 << 29});
+BENCHMARK_CAPTURE(BM_checksum, xxhash3,
+                  smf::rpc::checksum_type::checksum_type_xxhash3)
+  ->Args({1 << 16, 1 << 16})
+  ->Args({1 << 20, 1 << 20})
+  ->Args({1 << 29, 1 << 29});
+BENCHMARK_CAPTURE(BM_checksum, none,
+                  smf::rpc::checksum_type::checksum_type_none)
+  ->Args({1 << 16, 1 << 16})
+  ->Args({1 << 20, 1 << 20})
+  ->Args({1 << 29, 1 << 29});
+
 BENCHMARK_MAIN();
@@ -0,0 +1,174 @@
+// Copyright 2019 SMF Authors
+//
+// Per request cost of the filter plumbing: rpc_filter_apply() as it was,
+// one continuation per filter; as it is, skipping the continuation of
+// ready futures; and rpc_filter_chain, composed at compile time. Runs on
+// the reactor, like the server, so filters that do yield are measured too.
+//
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "smf/log.h"
+#include "smf/rpc_filter.h"
+
+/// \brief move-only, like rpc_recv_context and rpc_envelope
+struct msg {
+  std::unique_ptr<uint64_t> seq = std::make_unique<uint64_t>(0);
+};
+
+struct ready_filter {
+  seastar::future<msg>
+  operator()(msg &&m) {
+    ++*m.seq;
+    return seastar::make_ready_future<msg>(std::move(m));
+  }
+};
+
+struct sync_filter {
+  msg
+  operator()(msg &&m) {
+    ++*m.seq;
+    return std::move(m);
+  }
+};
+
+/// \brief e.g.: a filter waiting on i/o
+struct yield_filter {
+  seastar::future<msg>
+  operator()(msg &&m) {
+    return seastar::later().then([m = std::move(m)]() mutable {
+      ++*m.seq;
+      return std::move(m);
+    });
+  }
+};
+
+using filter_t = std::function<seastar::future<msg>(msg)>;
+
+/// \brief rpc_filter_apply() before it skipped the continuation of ready
+/// futures
+template <typename Iterator>
+static seastar::future<msg>
+chained_filter_apply(Iterator begin, Iterator end, msg &&m) {
+  if (begin == end) { return seastar::make_ready_future<msg>(std::move(m)); }
+  return (*begin)(std::move(m)).then([begin = std::next(begin), end](msg m) {
+    return chained_filter_apply(begin, end, std::move(m));
+  });
+}
+
+/// \brief runs `fn` `iterations` times, one request at a time
+template <typename Fn>
+static seastar::future<>
+bench(const char *name, size_t filters, uint64_t iterations, Fn fn) {
+  const auto begin = std::chrono::steady_clock::now();
+  return seastar::do_with(
+           uint64_t(0), uint64_t(0), std::move(fn),
+           [iterations](uint64_t &i, uint64_t &sink, Fn &fn) {
+             return seastar::repeat([&i, &sink, &fn, iterations] {
+               // ready futures are consumed inline, as the server does
+               while (i < iterations && !seastar::need_preempt()) {
+                 auto f = fn();
+                 ++i;
+                 if (!f.available()) {
+                   return f.then([&sink](msg m) {
+                     sink += *m.seq;
+                     return seastar::stop_iteration::no;
+                   });
+                 }
+                 sink += *f.get0().seq;
+               }
+               return seastar::make_ready_future<seastar::stop_iteration>(
+                 i < iterations ? seastar::stop_iteration::no
+                                : seastar::stop_iteration::yes);
+             });
+           })
+    .then([name, filters, iterations, begin] {
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - begin)
+                        .count();
+      LOG_INFO("{}, {} filters: {:.1f}ns per request", name, filters,
+               static_cast<double>(ns) / iterations);
+    });
+}
+
+template <typename Filter, size_t... I>
+static auto
+make_chain(std::index_sequence<I...>) {
+  return smf::make_rpc_filter_chain<msg>(((void)I, Filter{})...);
+}
+
+template <size_t N>
+static seastar::future<>
+bench_filters(uint64_t iterations) {
+  std::vector<filter_t> ready(N, ready_filter{});
+  std::vector<filter_t> yielding(N, ready_filter{});
+  yielding.back() = yield_filter{};
+  // a static chain registered as the one filter of a server or client
+  std::vector<filter_t> chain_in_vector{
+    make_chain<ready_filter>(std::make_index_sequence<N>{})};
+  return bench("rpc_filter_apply, a continuation per filter", N, iterations,
+               [ready]() mutable {
+                 return chained_filter_apply(ready.begin(), ready.end(),
+                                             msg{});
+               })
+    .then([=]() mutable {
+      return bench("rpc_filter_apply", N, iterations, [ready]() mutable {
+        return smf::rpc_filter_apply(&ready, msg{});
+      });
+    })
+    .then([=] {
+      return bench("rpc_filter_chain", N, iterations,
+                   [c = make_chain<ready_filter>(
+                      std::make_index_sequence<N>{})]() mutable {
+                     return c(msg{});
+                   });
+    })
+    .then([=] {
+      return bench("rpc_filter_chain, synchronous filters", N, iterations,
+                   [c = make_chain<sync_filter>(
+                      std::make_index_sequence<N>{})]() mutable {
+                     return c(msg{});
+                   });
+    })
+    .then([=]() mutable {
+      return bench("rpc_filter_chain in a filter vector", N, iterations,
+                   [chain_in_vector]() mutable {
+                     return smf::rpc_filter_apply(&chain_in_vector, msg{});
+                   });
+    })
+    .then([=]() mutable {
+      return bench("rpc_filter_apply, last filter yields", N, iterations,
+                   [yielding]() mutable {
+                     return smf::rpc_filter_apply(&yielding, msg{});
+                   });
+    });
+}
+
+void
+cli_opts(boost::program_options::options_description_easy_init o) {
+  namespace po = boost::program_options;
+  o("iterations", po::value<uint64_t>()->default_value(1000000),
+    "requests per variant");
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::app_template app;
+  cli_opts(app.add_options());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    const auto iterations = app.configuration()["iterations"].as<uint64_t>();
+    return bench_filters<1>(iterations)
+      .then([iterations] { return bench_filters<2>(iterations); })
+      .then([iterations] { return bench_filters<4>(iterations); })
+      .then([iterations] { return bench_filters<8>(iterations); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
@@ -0,0 +1,139 @@
+// Copyright 2019 SMF Authors
+//
+// Latency of a single outstanding request over tcp loopback, a unix domain
+// socket and the shared-memory transport. The server runs on core 0 and the
+// client on the last core, so with `-c 2` every request crosses cores the
+// way it would across two processes.
+//
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <string>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/histogram.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "demo_service.smf.fb.h"
+
+using client_t = smf_gen::demo::SmfStorageClient;
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    smf::rpc_typed_envelope<response_t> data;
+    if (rec) { data.data->name = rec->name()->str(); }
+    data.envelope.set_status(200);
+    return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+      std::move(data));
+  }
+};
+
+static seastar::future<>
+run(seastar::sstring name, smf::rpc_client_opts opts, uint32_t reqs,
+    std::string payload) {
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  auto hist = smf::histogram::make_lw_shared();
+  return client->connect()
+    .then([client, hist, reqs, payload] {
+      return seastar::do_for_each(
+        boost::counting_iterator<uint32_t>(0),
+        boost::counting_iterator<uint32_t>(reqs),
+        [client, hist, payload](uint32_t) {
+          smf::rpc_typed_envelope<request_t> req;
+          req.data->name = payload;
+          auto begin = std::chrono::steady_clock::now();
+          return client->Get(req.serialize_data())
+            .then([hist, begin](auto reply) {
+              LOG_THROW_IF(!reply, "Bad reply");
+              hist->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - begin)
+                             .count());
+            });
+        });
+    })
+    .then([name, hist] {
+      LOG_INFO("{}: p50={}ns, p99={}ns, p999={}ns, mean={}ns", name,
+               hist->value_at(50.0), hist->value_at(99.0),
+               hist->value_at(99.9), hist->mean());
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+void
+cli_opts(boost::program_options::options_description_easy_init o) {
+  namespace po = boost::program_options;
+  o("req-num", po::value<uint32_t>()->default_value(100000),
+    "sequential requests per transport");
+  o("payload", po::value<uint32_t>()->default_value(64),
+    "bytes of payload per request");
+  o("busy-poll", po::value<bool>()->default_value(false),
+    "shared-memory transport spins instead of sleeping");
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  cli_opts(app.add_options());
+  smf::random rand;
+  const uint16_t port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  const char *home = std::getenv("HOME");
+  const seastar::sstring dir = home ? home : "/tmp";
+  const seastar::sstring unix_path = dir + "/smf_loopback_bench.sock";
+  const seastar::sstring shm_path = dir + "/smf_loopback_bench.shm";
+
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    auto &cfg = app.configuration();
+    const auto reqs = cfg["req-num"].as<uint32_t>();
+    const auto payload = std::string(cfg["payload"].as<uint32_t>(), 'x');
+    const auto busy_poll = cfg["busy-poll"].as<bool>();
+
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = port;
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+    sargs.unix_address = smf::make_unix_address(unix_path);
+    sargs.shm_path = shm_path;
+    sargs.shm.busy_poll = busy_poll;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([=] {
+        return seastar::smp::submit_to(seastar::smp::count - 1, [=] {
+          smf::rpc_client_opts tcp;
+          tcp.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+          smf::rpc_client_opts uds;
+          uds.server_address = smf::make_unix_address(unix_path);
+          smf::rpc_client_opts shm;
+          shm.shm_path = shm_path;
+          shm.shm.busy_poll = busy_poll;
+          return run("tcp", std::move(tcp), reqs, payload)
+            .then([=]() mutable {
+              return run("unix", std::move(uds), reqs, payload);
+            })
+            .then([=]() mutable {
+              return run("shm", std::move(shm), reqs, payload);
+            });
+        });
+      })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
@@ -5,7 +5,6 @@
 #include <utility>
 
 #include "smf/compression.h"
-#include "smf/rpc_header_utils.h"
 #include "smf/rpc_recv_context.h"
 
 namespace smf {
@@ -27,7 +26,8 @@ lz4_compression_filter::operator()(rpc_envelope &&e) {
   e.letter.body = std::move(buf);
   e.letter.header.mutate_compression(
     rpc::compression_flags::compression_flags_lz4);
-  checksum_rpc(e.letter.header, e.letter.body.get(), e.letter.body.size());
+  // checksum is computed once by the rpc_send_queue
+  e.letter.header.mutate_size(e.letter.body.size());
 
   return seastar::make_ready_future<rpc_envelope>(std::move(e));
 }
@@ -40,7 +40,8 @@ lz4_decompression_filter::operator()(rpc_recv_context &&ctx) {
     ctx.payload = std::move(buf);
     ctx.header.mutate_compression(
       rpc::compression_flags::compression_flags_none);
-    checksum_rpc(ctx.header, ctx.payload.get(), ctx.payload.size());
+    // checksum was validated on the compressed bytes
+    ctx.header.mutate_size(ctx.payload.size());
   }
   return seastar::make_ready_future<rpc_recv_context>(std::move(ctx));
 }
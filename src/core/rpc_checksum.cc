@@ -0,0 +1,121 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_checksum.h"
+
+#include <array>
+#include <cstring>
+#include <limits>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#include <xxhash.h>
+
+namespace smf {
+
+#if defined(XXH_VERSION_NUMBER) && XXH_VERSION_NUMBER >= 800
+#define SMF_HAS_XXH3 1
+#endif
+
+namespace {
+constexpr uint32_t kCastagnoliPoly = 0x82f63b78;
+
+constexpr std::array<uint32_t, 256>
+make_crc32c_table() {
+  std::array<uint32_t, 256> t{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t c = i;
+    for (int k = 0; k < 8; ++k) {
+      c = (c & 1) ? (c >> 1) ^ kCastagnoliPoly : c >> 1;
+    }
+    t[i] = c;
+  }
+  return t;
+}
+constexpr auto kCrc32cTable = make_crc32c_table();
+
+uint32_t
+crc32c_sw(uint32_t crc, const char *data, size_t size) {
+  const auto *p = reinterpret_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; ++i) {
+    crc = kCrc32cTable[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2"))) uint32_t
+crc32c_hw(uint32_t crc, const char *data, size_t size) {
+  uint64_t c = crc;
+  while (size >= sizeof(uint64_t)) {
+    uint64_t v;
+    std::memcpy(&v, data, sizeof(v));
+    c = _mm_crc32_u64(c, v);
+    data += sizeof(v);
+    size -= sizeof(v);
+  }
+  uint32_t c32 = static_cast<uint32_t>(c);
+  while (size-- > 0) {
+    c32 = _mm_crc32_u8(c32, static_cast<uint8_t>(*data++));
+  }
+  return c32;
+}
+
+bool
+cpu_has_sse42() {
+  static const bool has = __builtin_cpu_supports("sse4.2");
+  return has;
+}
+#endif
+}  // namespace
+
+uint32_t
+crc32c(const char *data, size_t size) {
+  constexpr uint32_t kInit = std::numeric_limits<uint32_t>::max();
+#if defined(__x86_64__)
+  if (SMF_LIKELY(cpu_has_sse42())) { return ~crc32c_hw(kInit, data, size); }
+#endif
+  return ~crc32c_sw(kInit, data, size);
+}
+
+bool
+rpc_checksum_supported(rpc::checksum_type t) {
+  switch (t) {
+  case rpc::checksum_type_xxhash64:
+  case rpc::checksum_type_crc32c:
+  case rpc::checksum_type_none:
+    return true;
+  case rpc::checksum_type_xxhash3:
+#ifdef SMF_HAS_XXH3
+    return true;
+#else
+    return false;
+#endif
+  }
+  return false;
+}
+
+uint32_t
+rpc_checksum(rpc::checksum_type t, const char *data, size_t size) {
+  constexpr uint64_t kLow32 = std::numeric_limits<uint32_t>::max();
+  switch (t) {
+  case rpc::checksum_type_xxhash64:
+    return kLow32 & XXH64(data, size, 0);
+  case rpc::checksum_type_crc32c:
+    return crc32c(data, size);
+  case rpc::checksum_type_xxhash3:
+#ifdef SMF_HAS_XXH3
+    return kLow32 & XXH3_64bits(data, size);
+#else
+    break;
+#endif
+  case rpc::checksum_type_none:
+    return 0;
+  }
+  // unsupported algorithms never match a real checksum
+  return 0;
+}
+
+}  // namespace smf
@@ -0,0 +1,128 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_circuit_breaker.h"
+
+#include "smf/log.h"
+
+namespace smf {
+
+rpc_circuit_breaker::rpc_circuit_breaker(rpc_circuit_breaker_opts opts)
+  : opts_(opts) {
+  LOG_THROW_IF(opts_.bucket_duration.count() <= 0,
+               "circuit breaker bucket_duration must be positive");
+  LOG_THROW_IF(opts_.half_open_probes == 0,
+               "circuit breaker needs at least one half-open probe");
+  LOG_THROW_IF(
+    opts_.latency_percentile <= 0 || opts_.latency_percentile >= 100,
+    "circuit breaker latency_percentile must be in (0, 100): {}",
+    opts_.latency_percentile);
+}
+
+rpc_circuit_breaker::bucket &
+rpc_circuit_breaker::current_bucket(clock_type::time_point now) {
+  const int64_t epoch = now.time_since_epoch() / opts_.bucket_duration;
+  auto &b = window_[epoch % window_.size()];
+  if (b.epoch != epoch) { b = bucket{epoch}; }
+  return b;
+}
+
+bool
+rpc_circuit_breaker::should_trip(clock_type::time_point now) const {
+  const int64_t epoch = now.time_since_epoch() / opts_.bucket_duration;
+  uint64_t requests = 0, failures = 0, slow = 0;
+  for (auto &b : window_) {
+    if (b.epoch < 0 || epoch - b.epoch >= int64_t(window_.size())) {
+      continue;
+    }
+    requests += b.requests;
+    failures += b.failures;
+    slow += b.slow;
+  }
+  if (requests == 0 || requests < opts_.min_requests) { return false; }
+  if (failures >= opts_.max_error_rate * requests) { return true; }
+  if (opts_.latency_threshold.count() == 0) { return false; }
+  // the percentile is above the threshold iff more than (100 - p)% of the
+  // requests were slower
+  return slow * 100.0 > (100.0 - opts_.latency_percentile) * requests;
+}
+
+void
+rpc_circuit_breaker::transition(state s, clock_type::time_point now) {
+  if (s == state::open) {
+    stats_.trips++;
+    opened_at_ = now;
+  }
+  if (s == state::closed) { window_.fill(bucket{}); }
+  state_ = s;
+  probes_inflight_ = 0;
+  probes_ok_ = 0;
+  generation_++;
+}
+
+std::optional<rpc_circuit_breaker::permit>
+rpc_circuit_breaker::allow(clock_type::time_point now) {
+  if (state_ == state::open && now - opened_at_ >= opts_.open_duration) {
+    transition(state::half_open, now);
+  }
+  switch (state_) {
+  case state::closed:
+    return permit{generation_};
+  case state::half_open:
+    if (probes_inflight_ + probes_ok_ < opts_.half_open_probes) {
+      probes_inflight_++;
+      return permit{generation_};
+    }
+    break;
+  case state::open:
+    break;
+  }
+  stats_.rejected++;
+  return std::nullopt;
+}
+
+void
+rpc_circuit_breaker::record(permit p, clock_type::time_point now, bool failed,
+                            clock_type::duration latency) {
+  if (p.generation != generation_) { return; }
+  const bool slow = opts_.latency_threshold.count() > 0 &&
+                    latency > opts_.latency_threshold;
+  if (state_ == state::half_open) {
+    probes_inflight_--;
+    if (failed || slow) {
+      transition(state::open, now);
+    } else if (++probes_ok_ >= opts_.half_open_probes) {
+      transition(state::closed, now);
+    }
+    return;
+  }
+  // state_ == closed
+  auto &b = current_bucket(now);
+  b.requests++;
+  b.failures += failed;
+  b.slow += slow;
+  if (should_trip(now)) { transition(state::open, now); }
+}
+
+void
+rpc_circuit_breaker::cancel(permit p) {
+  if (p.generation != generation_) { return; }
+  if (state_ == state::half_open) { probes_inflight_--; }
+}
+
+}  // namespace smf
+
+namespace std {
+ostream &
+operator<<(ostream &o, smf::rpc_circuit_breaker::state s) {
+  switch (s) {
+  case smf::rpc_circuit_breaker::state::closed:
+    return o << "closed";
+  case smf::rpc_circuit_breaker::state::open:
+    return o << "open";
+  case smf::rpc_circuit_breaker::state::half_open:
+    return o << "half_open";
+  }
+  return o << "unknown";
+}
+}  // namespace std
@@ -2,12 +2,16 @@
 //
 #include "smf/rpc_client.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <memory>
 #include <optional>
 #include <seastar/core/future.hh>
 #include <utility>
 // seastar
 #include <seastar/core/execution_stage.hh>
+#include <seastar/core/metrics.hh>
 #include <seastar/core/reactor.hh>
 #include <seastar/core/sleep.hh>
 #include <seastar/core/thread.hh>
@@ -15,6 +19,8 @@
 #include <seastar/net/api.hh>
 // smf
 #include "smf/log.h"
+#include "smf/rpc_checksum.h"
+#include "smf/rpc_frame_parser.h"
 #include "smf/rpc_recv_context.h"
 
 using namespace std::chrono_literals;
@@ -35,38 +41,111 @@ class remote_connection_error final : public std::exception {
   }
 };
 
-rpc_client::rpc_client(seastar::ipv4_addr addr) : server_addr(addr) {
+static std::optional<rpc::handshake>
+local_handshake(const rpc_client_opts &opts) {
+  if (!opts.handshake) { return std::nullopt; }
+  uint32_t checksums = std::numeric_limits<uint32_t>::max();
+  if (opts.checksum != rpc::checksum_type::checksum_type_none) {
+    // never negotiate away integrity checks the user asked for
+    checksums &= ~(uint32_t(1) << rpc::checksum_type::checksum_type_none);
+  }
+  // a reply larger than our memory would never be read
+  const auto max_frame_size = static_cast<uint32_t>(std::min<uint64_t>(
+    FLATBUFFERS_MAX_BUFFER_SIZE, opts.memory_avail_for_client));
+  return rpc_handshake::make(opts.codecs, checksums, max_frame_size);
+}
+
+void
+rpc_client::register_breaker_metrics(breaker_state *b,
+                                     const seastar::socket_address &server) {
+  namespace sm = seastar::metrics;
+  // many clients may talk to the same server
+  static thread_local uint64_t next_id = 0;
+  std::vector<sm::label_instance> labels{
+    sm::label_instance("upstream", fmt::format("{}", server)),
+    sm::label_instance("client", next_id++)};
+  auto &cb = b->breaker;
+  b->metrics.add_group(
+    "smf::rpc_client",
+    {
+      sm::make_gauge(
+        "circuit_breaker_state",
+        [&cb] { return static_cast<uint8_t>(cb.current_state()); },
+        sm::description("0: closed, 1: open, 2: half-open"), labels),
+      sm::make_derive("circuit_breaker_trips",
+                      [&cb] { return cb.stats().trips; },
+                      sm::description("Times the breaker opened"), labels),
+      sm::make_derive(
+        "circuit_breaker_rejected", [&cb] { return cb.stats().rejected; },
+        sm::description("Requests failed fast by the breaker"), labels),
+    });
+}
+
+rpc_client::rpc_client(seastar::ipv4_addr addr)
+  : server_addr(addr), server_address(seastar::make_ipv4_address(addr)) {
   rpc_client_opts opts;
   limits_ = seastar::make_lw_shared<rpc_connection_limits>(
     opts.memory_avail_for_client, opts.recv_timeout);
   creds_ = opts.credentials;
+  max_write_cork_ = opts.max_write_cork;
+  checksum_ = opts.checksum;
+  max_fragment_size_ = opts.max_fragment_size;
+  handshake_ = local_handshake(opts);
+  min_compression_size_ = opts.min_compression_size;
   dispatch_gate_ = std::make_unique<seastar::gate>();
-  serialize_writes_.ensure_space_for_waiters(1);
 }
 
-rpc_client::rpc_client(rpc_client_opts opts) : server_addr(opts.server_addr) {
+rpc_client::rpc_client(rpc_client_opts opts)
+  : server_addr(opts.server_addr),
+    server_address(opts.server_address
+                     ? *opts.server_address
+                     : seastar::make_ipv4_address(opts.server_addr)),
+    shm_path(opts.shm_path) {
   limits_ = seastar::make_lw_shared<rpc_connection_limits>(
     opts.memory_avail_for_client, opts.recv_timeout);
   creds_ = opts.credentials;
+  max_write_cork_ = opts.max_write_cork;
+  checksum_ = opts.checksum;
+  max_fragment_size_ = opts.max_fragment_size;
+  handshake_ = local_handshake(opts);
+  min_compression_size_ = opts.min_compression_size;
+  shm_ = opts.shm;
   dispatch_gate_ = std::make_unique<seastar::gate>();
-  serialize_writes_.ensure_space_for_waiters(1);
+  if (opts.circuit_breaker) {
+    breaker_ = seastar::make_lw_shared<breaker_state>(*opts.circuit_breaker);
+    register_breaker_metrics(breaker_.get(), server_address);
+  }
 }
 
 rpc_client::rpc_client(rpc_client &&o) noexcept
-  : server_addr(o.server_addr), limits_(std::move(o.limits_)),
+  : server_addr(o.server_addr), server_address(o.server_address),
+    shm_path(o.shm_path), limits_(std::move(o.limits_)),
     creds_(std::move(o.creds_)), read_counter_(o.read_counter_),
     conn_(std::move(o.conn_)), rpc_slots_(std::move(o.rpc_slots_)),
+    streams_(std::move(o.streams_)), cancelled_(std::move(o.cancelled_)),
+    payload_headers_(std::move(o.payload_headers_)),
+    fragments_(std::move(o.fragments_)),
     in_filters_(std::move(o.in_filters_)),
     out_filters_(std::move(o.out_filters_)),
     dispatch_gate_(std::move(o.dispatch_gate_)),
-    serialize_writes_(std::move(o.serialize_writes_)),
-    hist_(std::move(o.hist_)), session_idx_(o.session_idx_) {}
+    max_write_cork_(o.max_write_cork_), checksum_(o.checksum_),
+    max_fragment_size_(o.max_fragment_size_),
+    handshake_(std::move(o.handshake_)),
+    min_compression_size_(o.min_compression_size_), shm_(o.shm_),
+    handshake_pr_(std::move(o.handshake_pr_)),
+    negotiated_(std::move(o.negotiated_)), breaker_(std::move(o.breaker_)),
+    hist_(std::move(o.hist_)), priority_hist_(std::move(o.priority_hist_)),
+    session_idx_(o.session_idx_) {}
 
 seastar::future<>
 rpc_client::stop() {
   fail_outstanding_futures();
   // now wait for all the fibers to finish
-  return dispatch_gate_->close();
+  return dispatch_gate_->close().then([conn = conn_] {
+    if (!conn) { return seastar::make_ready_future<>(); }
+    // the write in progress uses the connection
+    return conn->send_queue.close().finally([conn] {});
+  });
 }
 
 rpc_client::~rpc_client() {}
@@ -74,47 +153,106 @@ rpc_client::~rpc_client() {}
 void
 rpc_client::disable_histogram_metrics() {
   hist_ = nullptr;
+  for (auto &h : priority_hist_) {
+    h = nullptr;
+  }
 }
 void
 rpc_client::enable_histogram_metrics() {
   if (!hist_) hist_ = histogram::make_lw_shared();
+  for (auto &h : priority_hist_) {
+    if (!h) h = histogram::make_lw_shared();
+  }
+}
+
+seastar::future<std::optional<rpc_recv_context>>
+rpc_client::raw_send(rpc_envelope e, seastar::abort_source *as) {
+  using opt_recv_t = std::optional<rpc_recv_context>;
+  if (!breaker_) { return send_on_connection(std::move(e), as); }
+  using clock_type = rpc_circuit_breaker::clock_type;
+  auto permit = breaker_->breaker.allow(clock_type::now());
+  if (!permit) {
+    return seastar::make_exception_future<opt_recv_t>(
+      rpc_circuit_open_error());
+  }
+  return send_on_connection(std::move(e), as)
+    .then_wrapped([b = breaker_, p = *permit,
+                   begin = clock_type::now()](seastar::future<opt_recv_t> f) {
+      auto &cb = b->breaker;
+      const auto now = clock_type::now();
+      if (f.failed()) {
+        auto ep = f.get_exception();
+        try {
+          std::rethrow_exception(ep);
+        } catch (const seastar::abort_requested_exception &) {
+          // the caller gave up; says nothing about the server
+          cb.cancel(p);
+        } catch (...) { cb.record(p, now, true, now - begin); }
+        return seastar::make_exception_future<opt_recv_t>(ep);
+      }
+      auto r = f.get0();
+      // 5xx: the server could not do it, as opposed to a bad request
+      cb.record(p, now, !r || r->status() >= 500, now - begin);
+      return seastar::make_ready_future<opt_recv_t>(std::move(r));
+    });
 }
 
 seastar::future<std::optional<rpc_recv_context>>
-rpc_client::raw_send(rpc_envelope e) {
+rpc_client::send_on_connection(rpc_envelope e, seastar::abort_source *as) {
   using opt_recv_t = std::optional<rpc_recv_context>;
   if (SMF_UNLIKELY(!is_conn_valid())) {
     return seastar::make_exception_future<opt_recv_t>(
       invalid_connection_state());
   }
+  if (as != nullptr && as->abort_requested()) {
+    return seastar::make_exception_future<opt_recv_t>(
+      seastar::abort_requested_exception());
+  }
   // create the work item
   ++session_idx_;
   ++read_counter_;
+  // the session wrapped around; a reply to the old request can't be told
+  // apart anymore
+  cancelled_.erase(session_idx_);
 
   DLOG_THROW_IF(rpc_slots_.find(session_idx_) != rpc_slots_.end(),
                 "RPC slot already allocated");
   auto work = seastar::make_lw_shared<work_item>(session_idx_);
+  work->priority = rpc_priority_of(e.letter.header);
   auto measure = is_histogram_enabled() ? hist_->auto_measure() : nullptr;
+  auto priority_measure =
+    is_histogram_enabled()
+      ? get_histogram(rpc_priority_of(e.letter.header))->auto_measure()
+      : nullptr;
+  seastar::optimized_optional<seastar::abort_source::subscription> sub;
+  if (as != nullptr) {
+    sub = as->subscribe(
+      [this, session = session_idx_]() noexcept { cancel_session(session); });
+  }
 
   rpc_slots_.insert({session_idx_, work});
   // critical - without this nothing works
   e.letter.header.mutate_session(session_idx_);
+  set_rpc_checksum_type(e.letter.header, checksum_);
 
   // apply the first set of outgoing filters, then return promise
   return stage_outgoing_filters(std::move(e))
     .then([this, work](rpc_envelope e) {
+      if (negotiated_) { negotiated_->encode(e); }
       // dispatch the write concurrently!
-      (void)dispatch_write(std::move(e));
+      (void)dispatch_write(std::move(e), work);
       return work->pr.get_future();
     })
-    .then([this, m = std::move(measure)](opt_recv_t r) mutable {
+    .then([this, m = std::move(measure), pm = std::move(priority_measure),
+           sub = std::move(sub)](opt_recv_t r) mutable {
       if (!r) {
         // nothing to do
         return seastar::make_ready_future<opt_recv_t>(std::move(r));
       }
       // something to do
+      if (negotiated_) { rpc_negotiated::decode(r.value()); }
       return stage_incoming_filters(std::move(r.value()))
-        .then([m = std::move(m)](rpc_recv_context ctx) {
+        .then([m = std::move(m), pm = std::move(pm)](rpc_recv_context ctx) {
           LOG_THROW_IF(ctx.header.compression() !=
                          rpc::compression_flags::compression_flags_none,
                        "client is communicating with a server speaking "
@@ -125,6 +263,34 @@ rpc_client::raw_send(rpc_envelope e) {
         });
     });
 }
+void
+rpc_client::cancel_session(uint16_t session) {
+  auto it = rpc_slots_.find(session);
+  if (it == rpc_slots_.end()) {
+    // already answered
+    return;
+  }
+  --read_counter_;
+  auto work = it->second;
+  rpc_slots_.erase(it);
+  work->cancelled = true;
+  work->pr.set_exception(seastar::abort_requested_exception());
+  // still in the filters or waiting for memory: it is never written, and
+  // a cancel frame must not reach the server before its request
+  if (!work->enqueued || !is_conn_valid()) { return; }
+  cancelled_.insert(session);
+  rpc_envelope e;
+  e.letter.header.mutate_bitflags(
+    rpc::header_bit_flags::header_bit_flags_control);
+  e.letter.header.mutate_session(session);
+  e.letter.header.mutate_meta(rpc::control_type::control_type_cancel);
+  set_rpc_checksum_type(e.letter.header, checksum_);
+  // same lane as the request, so it is written after it
+  set_rpc_priority(e.letter.header, work->priority);
+  (void)conn_->send_queue.enqueue(std::move(e)).handle_exception(
+    [](auto ep) { DLOG_INFO("Could not send cancel frame: {}", ep); });
+}
+
 seastar::future<>
 rpc_client::reconnect() {
   fail_outstanding_futures();
@@ -144,18 +310,25 @@ rpc_client::connect() {
   LOG_THROW_IF(is_conn_valid(),
                "Client already connected to server: `{}'. connect "
                "called more than once.",
-               server_addr);
+               server_address);
 
   return seastar::async([&] {
-    auto socket = seastar::make_lw_shared<seastar::socket>(
-      seastar::engine().net().socket());
-    auto servaddr = seastar::make_ipv4_address(server_addr);
-    auto sockaddr =
-      seastar::socket_address(sockaddr_in{AF_INET, INADDR_ANY, {0}});
-    auto fd =
-      socket->connect(servaddr, sockaddr, seastar::transport::TCP).get();
-    if (creds_) {
-
+    auto sockaddr = server_address;
+    seastar::connected_socket fd;
+    if (!shm_path.empty()) {
+      sockaddr = make_unix_address(shm_path);
+      fd = shm_connect(shm_path, shm_).get0();
+    } else if (server_address.is_af_unix()) {
+      fd = seastar::connect(server_address).get0();
+    } else {
+      auto socket = seastar::make_lw_shared<seastar::socket>(
+        seastar::engine().net().socket());
+      sockaddr =
+        seastar::socket_address(sockaddr_in{AF_INET, INADDR_ANY, {0}});
+      fd = socket->connect(server_address, sockaddr, seastar::transport::TCP)
+             .get0();
+    }
+    if (creds_ && shm_path.empty()) {
       fd = seastar::tls::wrap_client(std::move(creds_), std::move(fd),
                                      seastar::sstring{})
              .get();
@@ -163,31 +336,52 @@ rpc_client::connect() {
 
     conn_ = seastar::make_lw_shared<rpc_connection>(
       std::move(fd), std::move(sockaddr), limits_);
+    conn_->send_queue.set_max_cork(max_write_cork_);
+    conn_->send_queue.set_max_fragment_size(max_fragment_size_);
+    // partial replies of a previous connection are gone with it
+    fragments_.clear();
 
     // dispatch in background
     (void)seastar::with_gate(*dispatch_gate_,
                              [this]() mutable { return do_reads(); });
+    if (handshake_) {
+      negotiated_ = std::nullopt;
+      handshake_pr_.emplace();
+      auto f = handshake_pr_->get_future();
+      try {
+        conn_->send_queue.enqueue(rpc_handshake::encode(*handshake_)).get();
+        seastar::with_timeout(seastar::timer<>::clock::now() +
+                                limits_->max_body_parsing_duration,
+                              std::move(f))
+          .get();
+      } catch (...) {
+        // i.e.: an old server closing the connection on the unknown frame
+        fail_outstanding_futures();
+        throw;
+      }
+    }
     seastar::make_ready_future<>().get();
   });
 };
 
 seastar::future<>
-rpc_client::dispatch_write(rpc_envelope e) {
+rpc_client::dispatch_write(rpc_envelope e,
+                           seastar::lw_shared_ptr<work_item> work) {
   // NOTE: The reason for the double gate, is that this future
   // is dispatched in the background
   return seastar::with_gate(
-    *dispatch_gate_, [this, e = std::move(e)]() mutable {
+    *dispatch_gate_, [this, e = std::move(e), work]() mutable {
       auto payload_size = e.size();
       return seastar::with_semaphore(
         conn_->limits->resources_available, payload_size,
-        [this, e = std::move(e)]() mutable {
-          return seastar::with_semaphore(
-            serialize_writes_, 1, [this, e = std::move(e)]() mutable {
-              return rpc_envelope::send(&conn_->ostream, std::move(e))
-                .handle_exception([this](auto _) {
-                  LOG_INFO("Handling exception(2): {}", _);
-                  fail_outstanding_futures();
-                });
+        [this, e = std::move(e), work]() mutable {
+          if (work->cancelled) { return seastar::make_ready_future<>(); }
+          work->enqueued = true;
+          // coalesced with every other request of this tick
+          return conn_->send_queue.enqueue(std::move(e))
+            .handle_exception([this](auto _) {
+              LOG_INFO("Handling exception(2): {}", _);
+              fail_outstanding_futures();
             });
         });
     });
@@ -196,7 +390,7 @@ rpc_client::dispatch_write(rpc_envelope e) {
 void
 rpc_client::fail_outstanding_futures() {
   if (is_conn_valid()) {
-    DLOG_TRACE("Disabling connection to: {}", server_addr);
+    DLOG_TRACE("Disabling connection to: {}", server_address);
     try {
       // NOTE: This is critical. If we don't shutdown the input
       // the server *might* return data which we will leak since the
@@ -214,41 +408,207 @@ rpc_client::fail_outstanding_futures() {
     promise_ptr->pr.set_exception(remote_connection_error());
     rpc_slots_.erase(rpc_slots_.begin());
   }
+  cancelled_.clear();
+  payload_headers_.clear();
+  if (handshake_pr_) {
+    handshake_pr_->set_exception(remote_connection_error());
+    handshake_pr_ = std::nullopt;
+  }
+  auto streams = std::move(streams_);
+  for (auto &p : streams) {
+    p.second->abort(std::make_exception_ptr(rpc_stream_closed_error()));
+  }
+}
+
+seastar::future<seastar::lw_shared_ptr<rpc_stream>>
+rpc_client::open_stream(uint32_t request_id, rpc_priority priority) {
+  using ret_type = seastar::lw_shared_ptr<rpc_stream>;
+  if (SMF_UNLIKELY(!is_conn_valid())) {
+    return seastar::make_exception_future<ret_type>(
+      invalid_connection_state());
+  }
+  const uint16_t session = ++session_idx_;
+  DLOG_THROW_IF(streams_.find(session) != streams_.end(),
+                "Stream session already allocated");
+  auto conn = conn_;
+  rpc_stream_io io;
+  io.write = [this, conn, priority](rpc_envelope e) {
+    set_rpc_checksum_type(e.letter.header, checksum_);
+    set_rpc_priority(e.letter.header, priority);
+    return stage_outgoing_filters(std::move(e)).then([conn](rpc_envelope e) {
+      if (!conn->is_valid()) {
+        return seastar::make_exception_future<>(invalid_connection_state());
+      }
+      return conn->send_queue.enqueue(std::move(e));
+    });
+  };
+  io.write_control = [this, conn, priority](rpc_envelope e) {
+    set_rpc_checksum_type(e.letter.header, checksum_);
+    set_rpc_priority(e.letter.header, priority);
+    if (!conn->is_valid()) {
+      return seastar::make_exception_future<>(invalid_connection_state());
+    }
+    return conn->send_queue.enqueue(std::move(e));
+  };
+  io.read_filter = [this](rpc_recv_context ctx) {
+    return stage_incoming_filters(std::move(ctx));
+  };
+  io.on_done = [this, session] { streams_.erase(session); };
+  auto s = seastar::make_lw_shared<rpc_stream>(session, request_id,
+                                               std::move(io));
+  streams_.emplace(session, s);
+  return seastar::make_ready_future<ret_type>(std::move(s));
+}
+
+bool
+rpc_client::complete_stream_frame(seastar::lw_shared_ptr<rpc_connection> conn,
+                                  rpc_recv_context &&ctx) {
+  if ((ctx.header.bitflags() &
+       rpc::header_bit_flags::header_bit_flags_control) &&
+      ctx.header.meta() == rpc::control_type::control_type_handshake) {
+    return complete_handshake(conn, ctx);
+  }
+  if ((ctx.header.bitflags() &
+       rpc::header_bit_flags::header_bit_flags_control) &&
+      ctx.header.meta() == rpc::control_type::control_type_payload_headers) {
+    // sent right before the reply it describes
+    auto ph = ctx.payload.size() <= rpc_payload_headers::kMaxSize
+                ? rpc_payload_headers::decode(ctx.payload)
+                : std::nullopt;
+    if (!ph) {
+      conn->set_error("Invalid payload_headers from server");
+      fail_outstanding_futures();
+      return false;
+    }
+    payload_headers_[ctx.session()] = std::move(ph.value());
+    return true;
+  }
+  auto it = streams_.find(ctx.session());
+  if (it == streams_.end()) {
+    // caller dropped the stream; late frames are harmless
+    DLOG_INFO("Frame for unknown stream session: {}", ctx.session());
+    return true;
+  }
+  auto s = it->second;
+  if (ctx.header.bitflags() & rpc::header_bit_flags::header_bit_flags_control) {
+    if (ctx.header.meta() == rpc::control_type::control_type_credit &&
+        ctx.payload.size() == sizeof(rpc::stream_credit)) {
+      rpc::stream_credit c;
+      std::memcpy(&c, ctx.payload.get(), sizeof(c));
+      s->add_credits(c.credits());
+      return true;
+    }
+    conn->set_error("Invalid control frame from server");
+    fail_outstanding_futures();
+    return false;
+  }
+  if (!s->push(std::move(ctx))) {
+    conn->set_error("Server violated stream flow control");
+    fail_outstanding_futures();
+    return false;
+  }
+  return true;
+}
+
+bool
+rpc_client::complete_handshake(seastar::lw_shared_ptr<rpc_connection> conn,
+                               const rpc_recv_context &ctx) {
+  auto remote = rpc_handshake::decode(ctx);
+  if (!remote || !handshake_pr_) {
+    conn->set_error("Unexpected handshake from server");
+    fail_outstanding_futures();
+    return false;
+  }
+  negotiated_ =
+    rpc_handshake::negotiate(*handshake_, *remote, min_compression_size_);
+  checksum_ = negotiated_->checksum;
+  conn->send_queue.set_max_fragment_size(
+    negotiated_->fragment_size(max_fragment_size_));
+  handshake_pr_->set_value();
+  handshake_pr_ = std::nullopt;
+  return true;
+}
+
+bool
+rpc_client::complete_session(seastar::lw_shared_ptr<rpc_connection> conn,
+                             std::optional<rpc_recv_context> opt) {
+  if (SMF_UNLIKELY(!opt)) {
+    conn->set_error("Could not parse response from server. Bad payload");
+    fail_outstanding_futures();
+    return false;
+  }
+  switch (fragments_.add(*opt)) {
+  case rpc_fragment_assembler::result::buffered:
+    return true;
+  case rpc_fragment_assembler::result::too_large:
+    conn->set_error("Fragmented reply exceeds the max message size");
+    fail_outstanding_futures();
+    return false;
+  case rpc_fragment_assembler::result::complete:
+    // filters and typed contexts need a contiguous body
+    if (opt->is_fragmented()) { opt->linearize(); }
+    break;
+  }
+  static constexpr uint8_t kStreamFlags =
+    rpc::header_bit_flags::header_bit_flags_stream |
+    rpc::header_bit_flags::header_bit_flags_control;
+  if (static_cast<uint8_t>(opt->header.bitflags()) & kStreamFlags) {
+    return complete_stream_frame(conn, std::move(opt.value()));
+  }
+  uint16_t sess = opt->session();
+  if (opt->header.bitflags() &
+      rpc::header_bit_flags::header_bit_flags_has_payload_headers) {
+    auto ph = payload_headers_.find(sess);
+    if (ph == payload_headers_.end()) {
+      conn->set_error("Missing payload_headers for reply");
+      fail_outstanding_futures();
+      return false;
+    }
+    opt->dynamic_headers = std::move(ph->second.dynamic_headers);
+    opt->deadline = ph->second.deadline;
+    payload_headers_.erase(ph);
+  }
+  auto it = rpc_slots_.find(sess);
+  if (it == rpc_slots_.end() && cancelled_.erase(sess) > 0) {
+    // the server answered before it saw our cancel
+    return true;
+  }
+  DLOG_THROW_IF(read_counter_ <= 0, "Internal error. Invalid counter: {}",
+                read_counter_);
+  if (SMF_UNLIKELY(it == rpc_slots_.end())) {
+    LOG_ERROR("Cannot find session: {}", sess);
+    conn->set_error("Invalid session");
+    fail_outstanding_futures();
+    return false;
+  }
+  --read_counter_;
+  it->second->pr.set_value(std::move(opt));
+  rpc_slots_.erase(it);
+  return true;
 }
 
 seastar::future<>
 rpc_client::process_one_request() {
   // due to a timeout exception, we make a copy of the conn in the
   // lambda capture param of the lw_shared_ptr
-  return rpc_recv_context::parse_header(conn_.get())
-    .then([this, conn = conn_](auto hdr) {
-      if (SMF_UNLIKELY(!hdr)) {
+  return rpc_frame_parser::parse(conn_.get())
+    .then([this, conn = conn_](rpc_frame_batch batch) {
+      if (SMF_UNLIKELY(batch.error || batch.empty())) {
         conn->set_error("Could not parse header from server");
         fail_outstanding_futures();
         return seastar::make_ready_future<>();
       }
-      return rpc_recv_context::parse_payload(conn.get(), std::move(hdr.value()))
-        .then([this, conn](std::optional<rpc_recv_context> opt) mutable {
-          DLOG_THROW_IF(read_counter_ <= 0,
-                        "Internal error. Invalid counter: {}", read_counter_);
-          if (SMF_UNLIKELY(!opt)) {
-            conn->set_error(
-              "Could not parse response from server. Bad payload");
-            fail_outstanding_futures();
-            return seastar::make_ready_future<>();
-          }
-          uint16_t sess = opt->session();
-          auto it = rpc_slots_.find(sess);
-          if (SMF_UNLIKELY(it == rpc_slots_.end())) {
-            LOG_ERROR("Cannot find session: {}", sess);
-            conn->set_error("Invalid session");
-            fail_outstanding_futures();
-            return seastar::make_ready_future<>();
-          }
-          --read_counter_;
-          it->second->pr.set_value(std::move(opt));
-          rpc_slots_.erase(it);
+      for (auto &f : batch.frames) {
+        if (!complete_session(conn, rpc_recv_context::from_frame(
+                                      conn.get(), f.header, std::move(f.body)))) {
           return seastar::make_ready_future<>();
+        }
+      }
+      if (!batch.pending) { return seastar::make_ready_future<>(); }
+      return rpc_recv_context::parse_payload(conn.get(),
+                                             std::move(batch.pending.value()))
+        .then([this, conn](std::optional<rpc_recv_context> opt) mutable {
+          complete_session(conn, std::move(opt));
         });
     });
 }
@@ -0,0 +1,36 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_codel.h"
+
+#include <algorithm>
+
+#include "smf/log.h"
+
+namespace smf {
+
+rpc_codel::rpc_codel(rpc_codel_opts opts) : opts_(opts) {
+  LOG_THROW_IF(opts_.target <= duration::zero() ||
+                 opts_.interval <= duration::zero(),
+               "CoDel target and interval must be positive");
+  LOG_THROW_IF(opts_.min_free_memory < 0 || opts_.min_free_memory >= 1,
+               "CoDel min_free_memory must be in [0, 1): {}",
+               opts_.min_free_memory);
+}
+
+bool
+rpc_codel::should_drop(clock_type::time_point now, duration sojourn,
+                       bool memory_pressure) {
+  if (now >= interval_end_) {
+    // judge the interval that just ended; this sample starts the next one
+    overloaded_ = min_delay_ > opts_.target;
+    interval_end_ = now + opts_.interval;
+    min_delay_ = sojourn;
+  } else {
+    min_delay_ = std::min(min_delay_, sojourn);
+  }
+  if (memory_pressure) { return sojourn > opts_.target; }
+  return overloaded_ && sojourn > 2 * opts_.target;
+}
+
+}  // namespace smf
@@ -0,0 +1,64 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_concurrency_limiter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "smf/log.h"
+
+namespace smf {
+
+rpc_concurrency_limiter::rpc_concurrency_limiter(
+  rpc_concurrency_limiter_opts opts)
+  : opts_(opts), limit_(opts.initial_limit) {
+  LOG_THROW_IF(opts_.min_limit == 0 || opts_.min_limit > opts_.max_limit,
+               "Invalid concurrency limits: min {}, max {}", opts_.min_limit,
+               opts_.max_limit);
+  LOG_THROW_IF(opts_.smoothing <= 0 || opts_.smoothing > 1,
+               "Concurrency limit smoothing must be in (0, 1]: {}",
+               opts_.smoothing);
+  limit_ = std::clamp<double>(limit_, opts_.min_limit, opts_.max_limit);
+}
+
+void
+rpc_concurrency_limiter::update(double estimate) {
+  estimate = std::clamp<double>(estimate, opts_.min_limit, opts_.max_limit);
+  limit_ = limit_ * (1 - opts_.smoothing) + estimate * opts_.smoothing;
+}
+
+void
+rpc_concurrency_limiter::release(duration rtt, bool dropped) {
+  // in flight when this request finished, itself included
+  const uint32_t used = inflight_;
+  --inflight_;
+  const double l = std::max(1.0, std::log10(limit_));
+  if (dropped) {
+    update(limit_ - l);
+    return;
+  }
+  if (rtt <= duration::zero()) { return; }
+  if (++samples_ >= opts_.baseline_samples) {
+    samples_ = 0;
+    baseline_ = rtt;
+    return;
+  }
+  if (baseline_ == duration::zero() || rtt < baseline_) {
+    baseline_ = rtt;
+    return;
+  }
+  if (used * 2 < limit_) { return; }
+  const double queue =
+    std::ceil(limit_ * (1 - static_cast<double>(baseline_.count()) /
+                              static_cast<double>(rtt.count())));
+  if (queue <= l) {
+    update(limit_ + 6 * l);
+  } else if (queue < 3 * l) {
+    update(limit_ + l);
+  } else if (queue > 6 * l) {
+    update(limit_ - l);
+  }
+}
+
+}  // namespace smf
@@ -17,9 +17,8 @@ namespace smf {
 seastar::future<>
 rpc_envelope::send(seastar::output_stream<char> *out, rpc_envelope e) {
   seastar::temporary_buffer<char> header_buf(kHeaderSize);
-  DLOG_THROW_IF(e.letter.header.size() == 0, "Invalid header size");
-  DLOG_THROW_IF(e.letter.header.checksum() == 0, "Invalid header checksum");
   DLOG_ERROR_IF(e.letter.body.size() == 0, "Invalid payload. 0-size");
+  checksum_rpc(e.letter.header, e.letter.body.get(), e.letter.body.size());
   // use 0 copy iface in seastar
   // prepare the header locally
   std::memcpy(header_buf.get_write(),
@@ -47,8 +46,8 @@ rpc_envelope::rpc_envelope(rpc_envelope &&o) noexcept
 
 void
 rpc_envelope::add_dynamic_header(const char *header, const char *value) {
-  DLOG_THROW_IF(header != nullptr, "Cannot add header with empty key");
-  DLOG_THROW_IF(value != nullptr, "Cannot add header with empty value");
+  DLOG_THROW_IF(header == nullptr, "Cannot add header with empty key");
+  DLOG_THROW_IF(value == nullptr, "Cannot add header with empty value");
   letter.dynamic_headers.emplace(header, value);
 }
 }  // namespace smf
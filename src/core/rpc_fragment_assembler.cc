@@ -0,0 +1,93 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_fragment_assembler.h"
+
+#include <utility>
+
+#include "smf/log.h"
+
+namespace smf {
+
+rpc_fragment_assembler::result
+rpc_fragment_assembler::add(rpc_recv_context &ctx) {
+  const bool is_fragment =
+    ctx.header.bitflags() & rpc::header_bit_flags::header_bit_flags_fragment;
+  auto it = partials_.find(ctx.session());
+  if (!is_fragment && it == partials_.end()) {
+    // common case. not part of a fragmented message
+    return result::complete;
+  }
+  if (it == partials_.end()) {
+    it = partials_.emplace(ctx.session(), partial{}).first;
+  }
+  auto &p = it->second;
+  if (p.discarded) {
+    if (!is_fragment) { partials_.erase(it); }
+    return result::discarded;
+  }
+  const uint64_t size = ctx.payload.size();
+  if (p.size + size > max_message_size_) {
+    LOG_ERROR("Fragmented message for session:{} exceeds {} bytes",
+              ctx.session(), max_message_size_);
+    buffered_bytes_ -= p.size;
+    partials_.erase(it);
+    return result::too_large;
+  }
+  if (is_fragment && max_buffered_bytes_ != 0 &&
+      buffered_bytes_ + size > max_buffered_bytes_) {
+    LOG_ERROR("Fragment of session:{} exceeds {} bytes of partial messages",
+              ctx.session(), max_buffered_bytes_);
+    buffered_bytes_ -= p.size;
+    partials_.erase(it);
+    return result::too_large;
+  }
+  p.size += size;
+  p.fragments.push_back(std::move(ctx.payload));
+  if (is_fragment) {
+    buffered_bytes_ += size;
+    return result::buffered;
+  }
+  // last fragment
+  buffered_bytes_ -= p.size - size;
+  ctx.fragments = std::move(p.fragments);
+  ctx.header.mutate_size(static_cast<uint32_t>(p.size));
+  partials_.erase(it);
+  return result::complete;
+}
+
+uint64_t
+rpc_fragment_assembler::partial_size(uint16_t session) const {
+  auto it = partials_.find(session);
+  return it == partials_.end() ? 0 : it->second.size;
+}
+
+bool
+rpc_fragment_assembler::discarding(uint16_t session) const {
+  auto it = partials_.find(session);
+  return it != partials_.end() && it->second.discarded;
+}
+
+uint64_t
+rpc_fragment_assembler::discard(const rpc_recv_context &ctx) {
+  uint64_t released = 0;
+  auto it = partials_.find(ctx.session());
+  if (it != partials_.end()) {
+    released = it->second.size;
+    buffered_bytes_ -= released;
+    partials_.erase(it);
+  }
+  if (ctx.header.bitflags() &
+      rpc::header_bit_flags::header_bit_flags_fragment) {
+    partials_[ctx.session()].discarded = true;
+  }
+  return released;
+}
+
+uint64_t
+rpc_fragment_assembler::clear() {
+  partials_.clear();
+  return std::exchange(buffered_bytes_, 0);
+}
+
+}  // namespace smf
@@ -0,0 +1,110 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_frame_parser.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "smf/log.h"
+#include "smf/rpc_header_ostream.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+namespace {
+struct frame_consumer {
+  using unconsumed_remainder = rpc_frame_parser::unconsumed_remainder;
+  rpc_frame_parser *parser;
+  seastar::future<unconsumed_remainder>
+  operator()(rpc_frame_parser::tmp_buf data) {
+    return parser->consume(std::move(data));
+  }
+};
+}  // namespace
+
+seastar::future<rpc_frame_batch>
+rpc_frame_parser::parse(rpc_connection *conn) {
+  DLOG_THROW_IF(
+    conn->istream_active_parser != 0,
+    "without this line you can have interleaved reads on the buffer");
+  conn->istream_active_parser++;
+  return seastar::do_with(rpc_frame_parser{},
+                          [conn](rpc_frame_parser &p) {
+                            return conn->istream.consume(frame_consumer{&p})
+                              .then([&p] {
+                                return seastar::make_ready_future<
+                                  rpc_frame_batch>(std::move(p.batch));
+                              });
+                          })
+    .finally([conn] { conn->istream_active_parser--; });
+}
+
+seastar::future<rpc_frame_parser::unconsumed_remainder>
+rpc_frame_parser::stop(tmp_buf remainder) {
+  return seastar::make_ready_future<unconsumed_remainder>(std::move(remainder));
+}
+
+bool
+rpc_frame_parser::on_header(const char *data) {
+  rpc::header hdr;
+  std::memcpy(&hdr, data, kHeaderSize);
+  if (!rpc_recv_context::validate_header(&hdr)) {
+    batch.error = true;
+    return false;
+  }
+  header_ = hdr;
+  return true;
+}
+
+seastar::future<rpc_frame_parser::unconsumed_remainder>
+rpc_frame_parser::consume(tmp_buf data) {
+  if (data.empty()) {
+    // eof. anything partially parsed is lost with the connection
+    return stop(tmp_buf());
+  }
+  buffer_size_ = data.size();
+  while (true) {
+    if (!header_) {
+      if (partial_size_ == 0 && data.size() >= kHeaderSize) {
+        if (!on_header(data.get())) { return stop(tmp_buf()); }
+        data.trim_front(kHeaderSize);
+      } else {
+        if (!batch.frames.empty()) {
+          // hand out what we have; the next parse() picks up these bytes
+          return stop(std::move(data));
+        }
+        if (data.empty()) { return stop(tmp_buf()); }
+        const size_t n = std::min(kHeaderSize - partial_size_, data.size());
+        std::memcpy(partial_.data() + partial_size_, data.get(), n);
+        partial_size_ += n;
+        data.trim_front(n);
+        if (partial_size_ < kHeaderSize) {
+          // header straddles two socket reads
+          return seastar::make_ready_future<unconsumed_remainder>(
+            std::nullopt);
+        }
+        partial_size_ = 0;
+        if (!on_header(partial_.data())) { return stop(tmp_buf()); }
+      }
+    }
+    const size_t body_size = header_->size();
+    if (data.size() < body_size) {
+      // leave the partial body in the stream. Caller must reserve memory
+      // for it first
+      batch.pending = header_;
+      header_ = std::nullopt;
+      return stop(std::move(data));
+    }
+    // small requests running for long must not pin the whole read buffer
+    auto body = body_size * 2 >= buffer_size_ ? data.share(0, body_size)
+                                              : tmp_buf(data.get(), body_size);
+    batch.frames.push_back(rpc_frame{*header_, std::move(body)});
+    data.trim_front(body_size);
+    header_ = std::nullopt;
+    if (data.empty()) { return stop(tmp_buf()); }
+  }
+}
+
+}  // namespace smf
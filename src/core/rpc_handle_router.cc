@@ -2,6 +2,10 @@
 //
 #include "smf/rpc_handle_router.h"
 
+#include <seastar/core/reactor.hh>
+
+#include "smf/log.h"
+
 namespace smf {
 
 smf::rpc_service_method_handle *
@@ -13,9 +17,95 @@ rpc_handle_router::get_handle_for_request(const uint32_t &request_id) {
   return nullptr;
 }
 
+uint32_t
+rpc_handle_router::owner_shard(rpc_recv_context &ctx) {
+  for (auto &p : services_) {
+    auto x = p->method_for_request_id(ctx.request_id());
+    if (x == nullptr) continue;
+    auto &fn = x->shard_key ? x->shard_key : p->shard_key;
+    if (!fn || seastar::smp::count == 1) { break; }
+    // the key is read from the body. The handler would copy it anyway
+    ctx.linearize();
+    return fn(ctx) % seastar::smp::count;
+  }
+  return seastar::engine().cpu_id();
+}
+
+void
+rpc_handle_router::set_scheduling_groups(
+  std::unordered_map<seastar::sstring, seastar::scheduling_group> groups) {
+  groups_ = std::move(groups);
+}
+
+seastar::scheduling_group
+rpc_handle_router::scheduling_group_for(uint32_t request_id) {
+  for (auto &p : services_) {
+    auto x = p->method_for_request_id(request_id);
+    if (x == nullptr) continue;
+    return x->bound_group.value_or(seastar::default_scheduling_group());
+  }
+  return seastar::default_scheduling_group();
+}
+
+void
+rpc_handle_router::resolve_filters(
+  const std::vector<rpc_incoming_filter> &in,
+  const std::vector<rpc_outgoing_filter> &out) {
+  auto find = [](auto &map, const auto &key) -> const rpc_scoped_filters * {
+    auto it = map.find(key);
+    return it == map.end() ? nullptr : &it->second;
+  };
+  for (auto &p : services_) {
+    const rpc_scoped_filters *service =
+      find(service_filters_, seastar::sstring(p->service_name()));
+    for (auto request_id : p->request_ids()) {
+      auto method = p->method_for_request_id(request_id);
+      const rpc_scoped_filters *own = find(method_filters_, request_id);
+      std::vector<rpc_incoming_filter> incoming = in;
+      std::vector<rpc_outgoing_filter> outgoing;
+      for (auto s : {service, own}) {
+        if (s == nullptr) continue;
+        incoming.insert(incoming.end(), s->incoming.begin(), s->incoming.end());
+      }
+      for (auto s : {own, service}) {
+        if (s == nullptr) continue;
+        outgoing.insert(outgoing.end(), s->outgoing.begin(), s->outgoing.end());
+      }
+      outgoing.insert(outgoing.end(), out.begin(), out.end());
+      // replaced, never mutated: requests may be iterating the old ones
+      method->incoming_filters = nullptr;
+      method->outgoing_filters = nullptr;
+      if (!incoming.empty()) {
+        method->incoming_filters =
+          seastar::make_lw_shared<std::vector<rpc_incoming_filter>>(
+            std::move(incoming));
+      }
+      if (!outgoing.empty()) {
+        method->outgoing_filters =
+          seastar::make_lw_shared<std::vector<rpc_outgoing_filter>>(
+            std::move(outgoing));
+      }
+    }
+  }
+}
+
 void
 rpc_handle_router::register_service(std::unique_ptr<rpc_service> s) {
   assert(s != nullptr);
+  // a typo in a group name fails here, not at the first request
+  for (auto id : s->request_ids()) {
+    auto x = s->method_for_request_id(id);
+    auto &name =
+      x->scheduling_group.empty() ? s->scheduling_group : x->scheduling_group;
+    if (name.empty()) { continue; }
+    auto it = groups_.find(name);
+    LOG_THROW_IF(it == groups_.end(),
+                 "Unknown scheduling group: {} for request_id: {} of service: "
+                 "{}. Missing from rpc_server_args::scheduling_groups",
+                 name, id, s->service_name());
+    x->bound_group = it->second;
+    x->bound_group_key = it->first;
+  }
   services_.push_back(std::move(s));
 }
 }  // namespace smf
@@ -0,0 +1,144 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_handshake.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include "smf/compression.h"
+#include "smf/log.h"
+#include "smf/rpc_checksum.h"
+
+namespace smf {
+
+static thread_local auto lz4_codec =
+  codec::make_unique(codec_type::lz4, compression_level::fastest);
+static thread_local auto zstd_codec =
+  codec::make_unique(codec_type::zstd, compression_level::fastest);
+
+static constexpr uint32_t
+bit(uint32_t value) {
+  return uint32_t(1) << value;
+}
+
+uint32_t
+rpc_negotiated::fragment_size(uint32_t local_max_fragment_size) const {
+  if (!peer_has(rpc::handshake_feature::handshake_feature_fragments)) {
+    return 0;
+  }
+  if (local_max_fragment_size == 0) { return peer_max_frame_size; }
+  return std::min(local_max_fragment_size, peer_max_frame_size);
+}
+
+void
+rpc_negotiated::encode(rpc_envelope &e) const {
+  if (compression == rpc::compression_flags::compression_flags_none ||
+      e.letter.header.compression() !=
+        rpc::compression_flags::compression_flags_none ||
+      e.letter.body.size() <= min_compression_size) {
+    return;
+  }
+  auto &c = compression == rpc::compression_flags::compression_flags_lz4
+              ? lz4_codec
+              : zstd_codec;
+  e.letter.body = c->compress(e.letter.body);
+  e.letter.header.mutate_compression(compression);
+  // checksum is computed once by the rpc_send_queue
+  e.letter.header.mutate_size(e.letter.body.size());
+}
+
+void
+rpc_negotiated::decode(rpc_recv_context &ctx) {
+  switch (ctx.header.compression()) {
+  case rpc::compression_flags::compression_flags_lz4:
+    ctx.payload = lz4_codec->uncompress(ctx.payload);
+    break;
+  case rpc::compression_flags::compression_flags_zstd:
+    ctx.payload = zstd_codec->uncompress(ctx.payload);
+    break;
+  default:
+    return;
+  }
+  ctx.header.mutate_compression(rpc::compression_flags::compression_flags_none);
+  // checksum was validated on the compressed bytes
+  ctx.header.mutate_size(ctx.payload.size());
+}
+
+rpc::handshake
+rpc_handshake::make(uint32_t codecs, uint32_t checksums,
+                    uint32_t max_frame_size, uint16_t shard_count,
+                    uint16_t shard_port_base) {
+  uint32_t supported = 0;
+  for (auto t : rpc::EnumValueschecksum_type()) {
+    if ((checksums & bit(t)) && rpc_checksum_supported(t)) {
+      supported |= bit(t);
+    }
+  }
+  return rpc::handshake(codecs & kDefaultCodecs, supported, max_frame_size,
+                        kFeatures, shard_count, shard_port_base);
+}
+
+rpc_envelope
+rpc_handshake::encode(const rpc::handshake &h) {
+  rpc_envelope e;
+  e.letter.body = seastar::temporary_buffer<char>(sizeof(h));
+  std::memcpy(e.letter.body.get_write(), &h, sizeof(h));
+  e.letter.header.mutate_bitflags(
+    rpc::header_bit_flags::header_bit_flags_control);
+  e.letter.header.mutate_session(0);
+  e.letter.header.mutate_meta(rpc::control_type::control_type_handshake);
+  return e;
+}
+
+std::optional<rpc::handshake>
+rpc_handshake::decode(const rpc_recv_context &ctx) {
+  if (ctx.payload.size() != sizeof(rpc::handshake)) {
+    LOG_ERROR("Invalid handshake of {} bytes", ctx.payload.size());
+    return std::nullopt;
+  }
+  rpc::handshake h;
+  std::memcpy(&h, ctx.payload.get(), sizeof(h));
+  return h;
+}
+
+rpc_negotiated
+rpc_handshake::negotiate(const rpc::handshake &local,
+                         const rpc::handshake &remote,
+                         uint32_t min_compression_size) {
+  rpc_negotiated n;
+  n.peer_max_frame_size = remote.max_frame_size();
+  n.peer_features = remote.features();
+  n.min_compression_size = min_compression_size;
+  n.peer_shard_count = remote.shard_count();
+  n.peer_shard_port_base = remote.shard_port_base();
+
+  // cheapest first
+  static constexpr rpc::compression_flags kCodecs[] = {
+    rpc::compression_flags::compression_flags_lz4,
+    rpc::compression_flags::compression_flags_zstd};
+  const uint32_t codecs = local.codecs() & remote.codecs();
+  for (auto c : kCodecs) {
+    if (codecs & bit(c)) {
+      n.compression = c;
+      break;
+    }
+  }
+  // `none` is only offered by peers configured to skip checksums
+  static constexpr rpc::checksum_type kChecksums[] = {
+    rpc::checksum_type::checksum_type_none,
+    rpc::checksum_type::checksum_type_xxhash3,
+    rpc::checksum_type::checksum_type_crc32c,
+    rpc::checksum_type::checksum_type_xxhash64};
+  const uint32_t checksums = local.checksums() & remote.checksums();
+  for (auto c : kChecksums) {
+    if (checksums & bit(c)) {
+      n.checksum = c;
+      break;
+    }
+  }
+  return n;
+}
+
+}  // namespace smf
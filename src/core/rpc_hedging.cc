@@ -0,0 +1,52 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_hedging.h"
+
+#include <algorithm>
+
+#include <hdr_histogram.h>
+
+namespace smf {
+
+rpc_hedging_policy::rpc_hedging_policy(rpc_hedging_opts opts) : opts_(opts) {
+  // ~185KB; not worth it for pools that never hedge
+  if (opts_.enabled) { window_ = histogram::make_unique(); }
+}
+
+std::optional<typename seastar::timer<>::duration>
+rpc_hedging_policy::begin() {
+  if (!opts_.enabled) { return std::nullopt; }
+  stats_.requests++;
+  tokens_ = std::min(opts_.max_burst, tokens_ + opts_.max_hedge_ratio);
+  const auto now = seastar::lowres_clock::now();
+  if (window_count_ > 0 && now >= next_refresh_) {
+    next_refresh_ = now + opts_.refresh;
+    // the histogram records microseconds
+    delay_ = std::max<typename seastar::timer<>::duration>(
+      opts_.min_delay,
+      std::chrono::microseconds(window_->value_at(opts_.percentile)));
+    ::hdr_reset(window_->get());
+    window_count_ = 0;
+  }
+  return delay_;
+}
+
+void
+rpc_hedging_policy::record(typename seastar::timer<>::duration latency) {
+  if (!window_) { return; }
+  auto micros =
+    std::chrono::duration_cast<std::chrono::microseconds>(latency).count();
+  window_->record(std::max<int64_t>(micros, 1));
+  window_count_++;
+}
+
+bool
+rpc_hedging_policy::try_hedge() {
+  if (tokens_ < 1) { return false; }
+  tokens_ -= 1;
+  stats_.hedges++;
+  return true;
+}
+
+}  // namespace smf
@@ -14,17 +14,20 @@ rpc_letter &
 rpc_letter::operator=(rpc_letter &&l) noexcept {
   header = l.header;
   dynamic_headers = std::move(l.dynamic_headers);
+  deadline = l.deadline;
   body = std::move(l.body);
   return *this;
 }
 rpc_letter
 rpc_letter::share() {
-  return rpc_letter(header, dynamic_headers, body.share());
+  rpc_letter l(header, dynamic_headers, body.share());
+  l.deadline = deadline;
+  return l;
 }
 
 rpc_letter::rpc_letter(rpc_letter &&o) noexcept
   : header(o.header), dynamic_headers(std::move(o.dynamic_headers)),
-    body(std::move(o.body)) {}
+    deadline(o.deadline), body(std::move(o.body)) {}
 
 rpc_letter::~rpc_letter() {}
 
@@ -0,0 +1,77 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_payload_headers.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+
+#include "smf/log.h"
+
+namespace smf {
+
+std::optional<rpc_envelope>
+rpc_payload_headers::encode(const rpc_letter &l) {
+  if (l.dynamic_headers.empty() && !l.deadline) { return std::nullopt; }
+  flatbuffers::FlatBufferBuilder bdr;
+  std::vector<flatbuffers::Offset<rpc::dynamic_header>> hdrs;
+  hdrs.reserve(l.dynamic_headers.size());
+  for (auto &[k, v] : l.dynamic_headers) {
+    hdrs.push_back(rpc::Createdynamic_header(
+      bdr, bdr.CreateString(k.data(), k.size()),
+      bdr.CreateString(v.data(), v.size())));
+  }
+  uint64_t timeout_us = 0;
+  if (l.deadline) {
+    auto left = std::chrono::duration_cast<std::chrono::microseconds>(
+      *l.deadline - seastar::timer<>::clock::now());
+    // already late; let the server account for it
+    timeout_us = std::max<int64_t>(left.count(), 1);
+  }
+  bdr.Finish(rpc::Createpayload_headers(
+    bdr, bdr.CreateVectorOfSortedTables(&hdrs), 0, 0,
+    rpc::compression_flags::compression_flags_none, timeout_us));
+
+  auto mem = bdr.Release();
+  auto ptr = reinterpret_cast<char *>(mem.data());
+  auto sz = mem.size();
+  rpc_envelope e;
+  e.letter.body = seastar::temporary_buffer<char>(
+    ptr, sz, seastar::make_object_deleter(std::move(mem)));
+  e.letter.header.mutate_bitflags(
+    rpc::header_bit_flags::header_bit_flags_control);
+  e.letter.header.mutate_session(l.header.session());
+  e.letter.header.mutate_meta(rpc::control_type::control_type_payload_headers);
+  return e;
+}
+
+std::optional<rpc_payload_headers>
+rpc_payload_headers::decode(const seastar::temporary_buffer<char> &buf) {
+  auto ptr = reinterpret_cast<const uint8_t *>(buf.get());
+  flatbuffers::Verifier verifier(ptr, buf.size());
+  if (!verifier.VerifyBuffer<rpc::payload_headers>(nullptr)) {
+    LOG_ERROR("Invalid payload_headers of {} bytes", buf.size());
+    return std::nullopt;
+  }
+  auto ph = flatbuffers::GetRoot<rpc::payload_headers>(ptr);
+  rpc_payload_headers ret;
+  if (ph->dynamic_headers() != nullptr) {
+    for (auto h : *ph->dynamic_headers()) {
+      if (h->key() == nullptr || h->value() == nullptr) { continue; }
+      ret.dynamic_headers.emplace(
+        seastar::sstring(h->key()->c_str(), h->key()->size()),
+        seastar::sstring(h->value()->c_str(), h->value()->size()));
+    }
+  }
+  if (ph->timeout_us() > 0) {
+    ret.deadline = seastar::timer<>::clock::now() +
+                   std::chrono::microseconds(ph->timeout_us());
+  }
+  return ret;
+}
+
+}  // namespace smf
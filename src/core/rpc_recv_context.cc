@@ -3,6 +3,7 @@
 #include "smf/rpc_recv_context.h"
 
 #include <chrono>
+#include <cstring>
 #include <optional>
 
 #include <seastar/core/timer.hh>
@@ -31,10 +32,29 @@ rpc_recv_context::rpc_recv_context(
 
 rpc_recv_context::rpc_recv_context(rpc_recv_context &&o) noexcept
   : rpc_server_limits(o.rpc_server_limits), remote_address(o.remote_address),
-    header(std::move(o.header)), payload(std::move(o.payload)) {}
+    header(std::move(o.header)), payload(std::move(o.payload)),
+    fragments(std::move(o.fragments)),
+    cancellation(std::move(o.cancellation)),
+    dynamic_headers(std::move(o.dynamic_headers)), deadline(o.deadline),
+    received(o.received) {}
 
 rpc_recv_context::~rpc_recv_context() {}
 
+void
+rpc_recv_context::linearize() {
+  if (fragments.empty()) { return; }
+  seastar::temporary_buffer<char> buf(header.size());
+  char *dst = buf.get_write();
+  for (auto &f : fragments) {
+    std::memcpy(dst, f.get(), f.size());
+    dst += f.size();
+  }
+  DLOG_THROW_IF(dst != buf.get() + buf.size(),
+                "Fragments do not add up to header size: {}", header);
+  fragments.clear();
+  payload = std::move(buf);
+}
+
 constexpr uint32_t
 max_flatbuffers_size() {
   // 2GB - 1 is the max a flatbuffers::vector<uint8_t> can hold
@@ -44,40 +64,84 @@ max_flatbuffers_size() {
   return static_cast<uint32_t>(FLATBUFFERS_MAX_BUFFER_SIZE);
 }
 
+std::optional<rpc_recv_context>
+rpc_recv_context::from_frame(rpc_connection *conn, rpc::header hdr,
+                             seastar::temporary_buffer<char> body) {
+  if (hdr.size() != body.size()) {
+    LOG_ERROR("Read incorrect number of bytes `{}`, expected header: `{}`",
+              body.size(), hdr);
+    return std::nullopt;
+  }
+  if (hdr.size() > max_flatbuffers_size()) {
+    LOG_ERROR("Bad payload. Body is >  FLATBUFFERS_MAX_BUFFER_SIZE");
+    return std::nullopt;
+  }
+  const uint32_t xx = body.empty() ? 0
+                                    : rpc_checksum(rpc_checksum_type(hdr),
+                                                   body.get(), body.size());
+  if (xx != hdr.checksum()) {
+    LOG_ERROR("Payload checksum `{}` does not match header checksum `{}`", xx,
+              hdr.checksum());
+    return std::nullopt;
+  }
+  return rpc_recv_context(conn->limits, conn->remote_address, hdr,
+                          std::move(body));
+}
+
 seastar::future<std::optional<rpc_recv_context>>
 rpc_recv_context::parse_payload(rpc_connection *conn, rpc::header hdr) {
   using ret_type = std::optional<rpc_recv_context>;
   return conn->istream.read_exactly(hdr.size())
     .then([conn, hdr](seastar::temporary_buffer<char> body) mutable {
-      if (hdr.size() != body.size()) {
-        LOG_ERROR("Read incorrect number of bytes `{}`, expected header: `{}`",
-                  body.size(), hdr);
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-      if (hdr.size() > max_flatbuffers_size()) {
-        LOG_ERROR("Bad payload. Body is >  FLATBUFFERS_MAX_BUFFER_SIZE");
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-      if (hdr.bitflags() &
-          rpc::header_bit_flags::header_bit_flags_has_payload_headers) {
-        LOG_ERROR("Reading payload headers is not yet implemented");
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-
-      const uint32_t xx = rpc_checksum_payload(body.get(), body.size());
-      if (xx != hdr.checksum()) {
-        LOG_ERROR("Payload checksum `{}` does not match header checksum `{}`",
-                  xx, hdr.checksum());
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-
-      rpc_recv_context ctx(conn->limits, conn->remote_address, hdr,
-                           std::move(body));
       return seastar::make_ready_future<ret_type>(
-        std::optional<rpc_recv_context>(std::move(ctx)));
+        from_frame(conn, hdr, std::move(body)));
     });
 }
 
+bool
+rpc_recv_context::validate_header(rpc::header *hdr) {
+  if (hdr->size() == 0) {
+    // only end_of_stream and control frames may be empty; they carry no
+    // checksum
+    static constexpr uint8_t kEmptyFlags =
+      rpc::header_bit_flags::header_bit_flags_end_of_stream |
+      rpc::header_bit_flags::header_bit_flags_control;
+    if (!(static_cast<uint8_t>(hdr->bitflags()) & kEmptyFlags)) {
+      LOG_ERROR("Emty body to parse. skipping");
+      return false;
+    }
+    if (hdr->meta() <= 0) {
+      LOG_ERROR("meta is empty");
+      return false;
+    }
+    return true;
+  }
+  if (hdr->compression() > rpc::compression_flags_MAX) {
+    LOG_ERROR("Compression out of range", *hdr);
+    return false;
+  }
+  const auto checksum_type = rpc_checksum_type(*hdr);
+  if (!rpc_checksum_supported(checksum_type)) {
+    LOG_ERROR("Unsupported checksum type: {}",
+              rpc::EnumNamechecksum_type(checksum_type));
+    return false;
+  }
+  if (checksum_type != rpc::checksum_type::checksum_type_none &&
+      hdr->checksum() <= 0) {
+    LOG_ERROR("checksum is empty");
+    return false;
+  }
+  if (hdr->meta() <= 0) {
+    LOG_ERROR("meta is empty");
+    return false;
+  }
+  if (hdr->compression() ==
+      rpc::compression_flags::compression_flags_disabled) {
+    hdr->mutate_compression(rpc::compression_flags::compression_flags_none);
+  }
+  return true;
+}
+
 seastar::future<std::optional<rpc::header>>
 rpc_recv_context::parse_header(rpc_connection *conn) {
   using ret_type = std::optional<rpc::header>;
@@ -98,26 +162,9 @@ rpc_recv_context::parse_header(rpc_connection *conn) {
       }
       auto hdr = rpc::header();
       std::memcpy(&hdr, header.get(), kRPCHeaderSize);
-      if (hdr.size() == 0) {
-        LOG_ERROR("Emty body to parse. skipping");
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-      if (hdr.compression() > rpc::compression_flags_MAX) {
-        LOG_ERROR("Compression out of range", hdr);
+      if (!validate_header(&hdr)) {
         return seastar::make_ready_future<ret_type>(std::nullopt);
       }
-      if (hdr.checksum() <= 0) {
-        LOG_ERROR("checksum is empty");
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-      if (hdr.meta() <= 0) {
-        LOG_ERROR("meta is empty");
-        return seastar::make_ready_future<ret_type>(std::nullopt);
-      }
-      if (hdr.compression() ==
-          rpc::compression_flags::compression_flags_disabled) {
-        hdr.mutate_compression(rpc::compression_flags::compression_flags_none);
-      }
       return seastar::make_ready_future<ret_type>(std::move(hdr));
     })
     .finally([conn] { conn->istream_active_parser--; });
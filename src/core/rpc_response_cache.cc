@@ -0,0 +1,98 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_response_cache.h"
+
+#include <cstring>
+#include <iterator>
+#include <utility>
+
+#include <xxhash.h>
+
+#include "smf/rpc_checksum.h"
+
+namespace smf {
+
+rpc_response_cache::key
+rpc_response_cache::make_key(const rpc_recv_context &ctx,
+                             const rpc::header &request) {
+  const auto t = rpc_checksum_type(request);
+  if (t == rpc::checksum_type::checksum_type_none) {
+    return key{ctx.request_id(),
+               XXH64(ctx.payload.get(), ctx.payload.size(), 0)};
+  }
+  // computed by the client, checked by the server already
+  return key{ctx.request_id(), (uint64_t(t) << 32) | request.checksum()};
+}
+
+void
+rpc_response_cache::erase(lru_list::iterator it) {
+  bytes_ -= it->bytes();
+  index_.erase(it->k);
+  lru_.erase(it);
+}
+
+seastar::future<rpc_envelope>
+rpc_response_cache::apply(rpc_recv_context &&ctx, const rpc::header &request,
+                          std::chrono::milliseconds ttl, apply_fn fn) {
+  if (max_bytes_ == 0 || ttl.count() <= 0 || ctx.is_fragmented() ||
+      !ctx.dynamic_headers.empty()) {
+    return fn(std::move(ctx));
+  }
+  const key k = make_key(ctx, request);
+  auto it = index_.find(k);
+  if (it != index_.end()) {
+    auto e = it->second;
+    if (e->expires <= clock_type::now()) {
+      stats_.evictions++;
+      erase(e);
+    } else if (e->request.size() == ctx.payload.size() &&
+               std::memcmp(e->request.get(), ctx.payload.get(),
+                           ctx.payload.size()) == 0) {
+      stats_.hits++;
+      lru_.splice(lru_.begin(), lru_, e);
+      rpc_envelope ret;
+      ret.letter.header = e->reply_header;
+      ret.letter.header.mutate_session(ctx.session());
+      ret.letter.dynamic_headers = e->reply_headers;
+      ret.letter.body = e->reply.share();
+      return seastar::make_ready_future<rpc_envelope>(std::move(ret));
+    }
+  }
+  stats_.misses++;
+  // the receive buffer may be much larger than the payload; don't pin it
+  auto req = ctx.payload.clone();
+  return fn(std::move(ctx))
+    .then([this, k, req = std::move(req), ttl](rpc_envelope e) mutable {
+      const auto status = e.letter.header.meta();
+      if (status >= 200 && status < 300) {
+        put(k, std::move(req), e, ttl);
+      }
+      return e;
+    });
+}
+
+void
+rpc_response_cache::put(key k, seastar::temporary_buffer<char> request,
+                        const rpc_envelope &reply,
+                        std::chrono::milliseconds ttl) {
+  entry e{k,
+          std::move(request),
+          reply.letter.header,
+          reply.letter.dynamic_headers,
+          reply.letter.body.clone(),
+          clock_type::now() + ttl};
+  const size_t bytes = e.bytes();
+  if (bytes > max_bytes_) { return; }
+  // an older reply, or another request with the same prefilter
+  if (auto it = index_.find(k); it != index_.end()) { erase(it->second); }
+  while (bytes_ + bytes > max_bytes_ && !lru_.empty()) {
+    stats_.evictions++;
+    erase(std::prev(lru_.end()));
+  }
+  lru_.push_front(std::move(e));
+  index_.emplace(k, lru_.begin());
+  bytes_ += bytes;
+}
+
+}  // namespace smf
@@ -0,0 +1,226 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_send_queue.h"
+
+#include <cstring>
+#include <utility>
+
+#include <seastar/core/future-util.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/reactor.hh>
+
+#include "smf/log.h"
+#include "smf/rpc_header_utils.h"
+#include "smf/rpc_payload_headers.h"
+
+namespace smf {
+
+static inline seastar::temporary_buffer<char>
+header_as_buffer(const rpc::header &hdr) {
+  seastar::temporary_buffer<char> buf(sizeof(rpc::header));
+  std::memcpy(buf.get_write(), reinterpret_cast<const char *>(&hdr),
+              sizeof(rpc::header));
+  return buf;
+}
+
+rpc_send_queue::rpc_send_queue(seastar::output_stream<char> *out,
+                               duration max_cork)
+  : out_(out), max_cork_(max_cork),
+    next_flush_(seastar::make_lw_shared<seastar::shared_promise<>>()) {
+  cork_timer_.set_callback([this] { flush_in_background(); });
+}
+
+rpc_send_queue::~rpc_send_queue() { cork_timer_.cancel(); }
+
+seastar::future<>
+rpc_send_queue::close() {
+  if (gate_.is_closed()) { return seastar::make_ready_future<>(); }
+  cork_timer_.cancel();
+  return gate_.close().then([this] {
+    if (!error_) {
+      error_ = std::make_exception_ptr(seastar::gate_closed_exception());
+    }
+    fail(error_);
+  });
+}
+
+seastar::future<>
+rpc_send_queue::enqueue(rpc_envelope e) {
+  if (SMF_UNLIKELY(error_)) {
+    return seastar::make_exception_future<>(error_);
+  }
+  static constexpr uint8_t kStreamFlags =
+    rpc::header_bit_flags::header_bit_flags_stream |
+    rpc::header_bit_flags::header_bit_flags_control;
+  auto flags = static_cast<uint8_t>(e.letter.header.bitflags());
+  // control frames are tiny and often unblock the peer, i.e.: credits.
+  // Cancels stay in the lane of their request, so they never overtake it
+  const bool control = flags & rpc::header_bit_flags::header_bit_flags_control;
+  auto &l = lanes_[static_cast<uint8_t>(
+    control && e.letter.header.meta() != rpc::control_type::control_type_cancel
+      ? rpc_priority::high
+      : rpc_priority_of(e.letter.header))];
+  if (SMF_UNLIKELY(l.frames.size() >= kMaxFramesPerBatch)) {
+    // lane is full, wait for a flush to drain it and retry
+    return next_flush_->get_shared_future().then(
+      [this, e = std::move(e)]() mutable { return enqueue(std::move(e)); });
+  }
+  if (!(flags & kStreamFlags)) {
+    if (auto ph = rpc_payload_headers::encode(e.letter)) {
+      // encoded here so the deadline accounts for the time spent in filters
+      set_rpc_checksum_type(ph->letter.header,
+                            rpc_checksum_type(e.letter.header));
+      append(l, ph->letter.header, std::move(ph->letter.body));
+      flags |= rpc::header_bit_flags::header_bit_flags_has_payload_headers;
+      e.letter.header.mutate_bitflags(
+        static_cast<rpc::header_bit_flags>(flags));
+    }
+  }
+  const bool can_fragment = max_fragment_size_ > 0 &&
+                            e.letter.body.size() > max_fragment_size_ &&
+                            !(flags & kStreamFlags);
+  if (!can_fragment) {
+    append(l, e.letter.header, std::move(e.letter.body));
+  } else {
+    auto &body = e.letter.body;
+    auto fragment_hdr = e.letter.header;
+    fragment_hdr.mutate_bitflags(static_cast<rpc::header_bit_flags>(
+      flags | rpc::header_bit_flags::header_bit_flags_fragment));
+    while (body.size() > max_fragment_size_) {
+      append(l, fragment_hdr, body.share(0, max_fragment_size_));
+      body.trim_front(max_fragment_size_);
+    }
+    // last one w/o the fragment flag completes the message
+    append(l, e.letter.header, std::move(body));
+  }
+  auto &last = l.frames.back();
+  last.done.emplace();
+  auto f = last.done->get_future();
+  schedule_flush();
+  return f;
+}
+
+void
+rpc_send_queue::append(lane &l, rpc::header hdr,
+                       seastar::temporary_buffer<char> body) {
+  // the only place the checksum is computed for managed connections
+  checksum_rpc(hdr, body.get(), body.size());
+  l.bytes += sizeof(hdr) + body.size();
+  l.frames.push_back(frame{header_as_buffer(hdr), std::move(body), {}});
+}
+
+void
+rpc_send_queue::take(lane &l, uint64_t budget, uint32_t max_frags,
+                     seastar::net::packet &p,
+                     std::vector<seastar::promise<>> &done) {
+  uint64_t taken = 0;
+  while (!l.frames.empty() &&
+         (taken == 0 || (taken < budget && p.nr_frags() < max_frags))) {
+    auto &f = l.frames.front();
+    const uint64_t bytes = f.header.size() + f.body.size();
+    taken += bytes;
+    l.bytes -= bytes;
+    p = seastar::net::packet(std::move(p), std::move(f.header));
+    if (!f.body.empty()) {
+      p = seastar::net::packet(std::move(p), std::move(f.body));
+    }
+    if (f.done) { done.push_back(std::move(f.done.value())); }
+    l.frames.pop_front();
+    ++stats_->frames;
+  }
+}
+
+void
+rpc_send_queue::schedule_flush() {
+  if (flushing_) {
+    // the in-flight flush re-schedules itself on completion
+    return;
+  }
+  if (pending_frames() >= kMaxFramesPerBatch ||
+      lanes_[0].bytes + lanes_[1].bytes >= kMaxCorkedBytes) {
+    flush_in_background();
+    return;
+  }
+  if (flush_scheduled_ || gate_.is_closed()) { return; }
+  flush_scheduled_ = true;
+  if (max_cork_.count() == 0) {
+    // yield to the reactor so that every continuation that becomes ready in
+    // this tick can append its frame before we pay for the syscall
+    (void)seastar::with_gate(gate_, [this] {
+      return seastar::later().then([this] { return flush(); });
+    });
+  } else {
+    cork_timer_.arm(max_cork_);
+  }
+}
+
+void
+rpc_send_queue::flush_in_background() {
+  if (gate_.is_closed()) { return; }
+  // flush() never fails; close() waits for it
+  (void)seastar::with_gate(gate_, [this] { return flush(); });
+}
+
+seastar::future<>
+rpc_send_queue::flush() {
+  flush_scheduled_ = false;
+  if (flushing_ || pending_frames() == 0) {
+    return seastar::make_ready_future<>();
+  }
+  flushing_ = true;
+  cork_timer_.cancel();
+
+  seastar::net::packet p;
+  std::vector<seastar::promise<>> done;
+  // half of the iovecs at most, so small high priority frames can't crowd
+  // out normal ones either
+  take(lanes_[static_cast<uint8_t>(rpc_priority::high)],
+       kMaxPriorityBytesPerFlush, kMaxFramesPerBatch, p, done);
+  take(lanes_[static_cast<uint8_t>(rpc_priority::normal)],
+       kMaxBulkBytesPerFlush, 2 * kMaxFramesPerBatch, p, done);
+  auto flushed = std::exchange(
+    next_flush_, seastar::make_lw_shared<seastar::shared_promise<>>());
+  stats_->bytes += p.len();
+  stats_->flushes++;
+
+  return out_->write(std::move(p))
+    .then([this] { return out_->flush(); })
+    .then_wrapped([this, done = std::move(done),
+                   flushed](seastar::future<> f) mutable {
+      flushing_ = false;
+      if (SMF_UNLIKELY(f.failed())) {
+        error_ = f.get_exception();
+        LOG_INFO("Failed to flush rpc frames: {}", error_);
+        for (auto &pr : done) {
+          pr.set_exception(error_);
+        }
+        // waiters retry enqueue(), which fails with error_
+        flushed->set_value();
+        fail(error_);
+        return;
+      }
+      for (auto &pr : done) {
+        pr.set_value();
+      }
+      flushed->set_value();
+      if (pending_frames() > 0) { schedule_flush(); }
+    });
+}
+
+void
+rpc_send_queue::fail(std::exception_ptr e) {
+  for (auto &l : lanes_) {
+    for (auto &f : l.frames) {
+      if (f.done) { f.done->set_exception(e); }
+    }
+    l.frames.clear();
+    l.bytes = 0;
+  }
+  // a failed flush and then close() both get here; a promise is set once
+  std::exchange(next_flush_,
+                seastar::make_lw_shared<seastar::shared_promise<>>())
+    ->set_value();
+}
+
+}  // namespace smf
@@ -4,16 +4,23 @@
 
 // seastar
 #include <seastar/core/execution_stage.hh>
+#include <seastar/core/memory.hh>
 #include <seastar/core/metrics.hh>
 #include <seastar/core/prometheus.hh>
+#include <seastar/core/reactor.hh>
 #include <seastar/core/with_timeout.hh>
 
 #include "smf/histogram_seastar_utils.h"
 #include "smf/log.h"
+#include "smf/rpc_checksum.h"
 #include "smf/rpc_connection_limits.h"
 #include "smf/rpc_envelope.h"
+#include "smf/rpc_frame_parser.h"
 #include "smf/rpc_header_ostream.h"
+#include "smf/rpc_typed_envelope.h"
 
+#include <cstring>
+#include <limits>
 #include <optional>
 #include <seastar/net/tls.hh>
 
@@ -23,7 +30,23 @@ std::ostream &
 operator<<(std::ostream &o, const smf::rpc_server &s) {
   o << "rpc_server{args.ip=" << s.args_.ip << ", args.flags=" << s.args_.flags
     << ", args.rpc_port=" << s.args_.rpc_port
-    << ", args.http_port=" << s.args_.http_port << ", rpc_routes=" << s.routes_
+    << ", args.http_port=" << s.args_.http_port;
+  if (s.args_.unix_address) {
+    o << ", args.unix_address=" << *s.args_.unix_address;
+  }
+  if (!s.args_.shm_path.empty()) {
+    o << ", args.shm_path=" << s.args_.shm_path
+      << ", args.shm.ring_size=" << s.args_.shm.ring_size
+      << ", args.shm.busy_poll=" << s.args_.shm.busy_poll;
+  }
+  o << ", args.max_write_cork="
+    << std::chrono::duration_cast<std::chrono::microseconds>(
+         s.args_.max_write_cork)
+         .count()
+    << "us, args.max_fragment_size=" << s.args_.max_fragment_size
+    << ", args.codecs=" << s.args_.codecs
+    << ", args.min_compression_size=" << s.args_.min_compression_size
+    << ", rpc_routes=" << s.routes_
     << ", has_tls_credentials: " << (s.creds_ ? "yes" : "no")
     << ", limits=" << *s.limits_ << ", limits=" << *s.limits_
     << ", incoming_filters=" << s.in_filters_.size()
@@ -34,7 +57,10 @@ operator<<(std::ostream &o, const smf::rpc_server &s) {
 rpc_server::rpc_server(rpc_server_args args)
   : args_(args), limits_(seastar::make_lw_shared<rpc_connection_limits>(
                    args.memory_avail_per_core, args.recv_timeout)),
-    creds_(args_.credentials) {
+    response_cache_(args.response_cache_size), creds_(args_.credentials) {
+  if (args_.concurrency_limit) { limiter_.emplace(*args_.concurrency_limit); }
+  if (args_.load_shedding) { codel_.emplace(*args_.load_shedding); }
+  routes_.set_scheduling_groups(args_.scheduling_groups);
   namespace sm = seastar::metrics;
   metrics_.add_group(
     "smf::rpc_server",
@@ -60,14 +86,142 @@ rpc_server::rpc_server(rpc_server_args args)
         "too_large_requests", stats_->too_large_requests,
         sm::description(
           "Requests made to this server larger than max allowedd (2GB)")),
+      sm::make_derive(
+        "cancelled_requests", stats_->cancelled_requests,
+        sm::description("Requests cancelled by the client before the reply")),
+      sm::make_derive(
+        "deadline_exceeded_requests", stats_->deadline_exceeded_requests,
+        sm::description("Requests dropped because their deadline expired "
+                        "before the handler ran")),
+      sm::make_derive(
+        "forwarded_requests", stats_->forwarded_requests,
+        sm::description("Requests forwarded to the core owning their shard "
+                        "key")),
+      sm::make_derive(
+        "coalesced_requests", [this] { return single_flight_.coalesced(); },
+        sm::description("Requests answered with the reply of an identical "
+                        "request in flight")),
+      sm::make_derive(
+        "response_cache_hits", [this] { return response_cache_.stats().hits; },
+        sm::description("Requests answered from the response cache")),
+      sm::make_derive(
+        "response_cache_misses",
+        [this] { return response_cache_.stats().misses; },
+        sm::description("Requests of cached methods that ran the handler")),
+      sm::make_derive(
+        "response_cache_evictions",
+        [this] { return response_cache_.stats().evictions; },
+        sm::description("Cached replies dropped for room or past their ttl")),
+      sm::make_gauge("response_cache_bytes",
+                     [this] { return response_cache_.size_bytes(); },
+                     sm::description("Bytes held by the response cache")),
+      sm::make_derive(
+        "overloaded_requests", stats_->overloaded_requests,
+        sm::description("Requests rejected with kOverloadedStatus by the "
+                        "adaptive concurrency limit")),
+      sm::make_derive(
+        "over_quota_requests", stats_->over_quota_requests,
+        sm::description("Requests rejected by the rpc_method_quota of their "
+                        "method")),
+      sm::make_derive(
+        "shed_requests", stats_->shed_requests,
+        sm::description("Requests rejected with kOverloadedStatus because "
+                        "they queued for too long")),
+      sm::make_gauge(
+        "queue_delay_min_us",
+        [this] {
+          return codel_ ? std::chrono::duration_cast<std::chrono::microseconds>(
+                            codel_->min_delay())
+                            .count()
+                        : 0;
+        },
+        sm::description("Minimum time requests queued before dispatch, "
+                        "in the current load shedding interval")),
+      sm::make_gauge(
+        "load_shedding",
+        [this] { return codel_ && codel_->overloaded() ? 1 : 0; },
+        sm::description("1 while the core sheds requests that queued too "
+                        "long")),
+      sm::make_gauge(
+        "concurrency_limit",
+        [this] { return limiter_ ? limiter_->limit() : 0u; },
+        sm::description("Current adaptive limit of requests in flight. 0 "
+                        "if disabled")),
+      sm::make_gauge(
+        "concurrency_limit_inflight",
+        [this] { return limiter_ ? limiter_->inflight() : 0u; },
+        sm::description("Requests holding a concurrency limit slot")),
+      sm::make_derive("active_streams", stats_->active_streams,
+                      sm::description("Currently open streaming rpcs")),
+      sm::make_derive("total_streams", stats_->total_streams,
+                      sm::description("Streaming rpcs opened")),
+      sm::make_derive("outgoing_frames", stats_->send_queue.frames,
+                      sm::description("Frames written to clients")),
+      sm::make_derive(
+        "outgoing_flushes", stats_->send_queue.flushes,
+        sm::description("Socket flushes. outgoing_frames / outgoing_flushes "
+                        "is the write batching factor")),
+      sm::make_gauge(
+        "frames_per_flush",
+        [this] {
+          auto &q = stats_->send_queue;
+          return q.flushes == 0 ? 0.0
+                                : static_cast<double>(q.frames) / q.flushes;
+        },
+        sm::description("Average number of frames coalesced per flush")),
       sm::make_histogram("handler_dispatch_latency",
                          sm::description("Server handler dispatch latency"),
                          [this] { return hist_->seastar_histogram_logform(); }),
+      sm::make_histogram(
+        "handler_dispatch_latency_normal_priority",
+        sm::description("Server handler dispatch latency of normal priority "
+                        "requests, including the time their reply was queued"),
+        [this] {
+          return priority_hist_[static_cast<uint8_t>(rpc_priority::normal)]
+            ->seastar_histogram_logform();
+        }),
+      sm::make_histogram(
+        "handler_dispatch_latency_high_priority",
+        sm::description("Server handler dispatch latency of high priority "
+                        "requests, including the time their reply was queued"),
+        [this] {
+          return priority_hist_[static_cast<uint8_t>(rpc_priority::high)]
+            ->seastar_histogram_logform();
+        }),
     });
+  // seastar exports the runtime of each group, as scheduler_runtime_ms
+  for (auto &p : args_.scheduling_groups) {
+    auto &n = group_requests_[p.first];
+    metrics_.add_group(
+      "smf::rpc_server",
+      {sm::make_derive("scheduling_group_requests", n,
+                       sm::description("Requests run in a scheduling group"),
+                       {sm::label_instance("group", p.first)})});
+  }
 }
 
 rpc_server::~rpc_server() {}
 
+seastar::future<std::unordered_map<seastar::sstring, seastar::scheduling_group>>
+rpc_server::create_scheduling_groups(
+  std::unordered_map<seastar::sstring, float> shares) {
+  using groups_t =
+    std::unordered_map<seastar::sstring, seastar::scheduling_group>;
+  return seastar::do_with(
+    std::move(shares), groups_t{}, [](auto &shares, groups_t &groups) {
+      return seastar::do_for_each(shares,
+                                  [&groups](auto &p) {
+                                    return seastar::create_scheduling_group(
+                                             p.first, p.second)
+                                      .then([&groups, name = p.first](
+                                              seastar::scheduling_group sg) {
+                                        groups.emplace(name, sg);
+                                      });
+                                  })
+        .then([&groups] { return std::move(groups); });
+    });
+}
+
 seastar::future<std::unique_ptr<smf::histogram>>
 rpc_server::copy_histogram() {
   auto h = smf::histogram::make_unique();
@@ -75,6 +229,13 @@ rpc_server::copy_histogram() {
   return seastar::make_ready_future<std::unique_ptr<smf::histogram>>(
     std::move(h));
 }
+seastar::future<std::unique_ptr<smf::histogram>>
+rpc_server::copy_priority_histogram(rpc_priority p) {
+  auto h = smf::histogram::make_unique();
+  *h += *priority_hist_[static_cast<uint8_t>(p)];
+  return seastar::make_ready_future<std::unique_ptr<smf::histogram>>(
+    std::move(h));
+}
 
 void
 rpc_server::start() {
@@ -119,20 +280,72 @@ rpc_server::start() {
                       lo));
   }
 
-  (void)seastar::keep_doing([this] {
-    return listener_->accept().then([this, stats = stats_, limits = limits_](
-                                      seastar::accept_result result) mutable {
+  if (args_.flags & rpc_server_flags_shard_ports) {
+    const uint32_t port =
+      uint32_t(args_.rpc_port) + 1 + seastar::engine().cpu_id();
+    LOG_THROW_IF(port > std::numeric_limits<uint16_t>::max(),
+                 "Shard port {} out of range. rpc_port: {}, cores: {}", port,
+                 args_.rpc_port, seastar::smp::count);
+    auto l = seastar::listen(
+      seastar::make_ipv4_address(
+        args_.ip.empty() ? seastar::ipv4_addr{uint16_t(port)}
+                         : seastar::ipv4_addr{args_.ip, uint16_t(port)}),
+      lo);
+    local_listeners_.push_back(seastar::make_lw_shared(
+      creds_ ? seastar::tls::listen(creds_, std::move(l)) : std::move(l)));
+  }
+  if (seastar::engine().cpu_id() == 0) {
+    if (args_.unix_address) {
+      if (args_.unix_address->is_af_unix()) {
+        remove_stale_unix_socket(args_.unix_address->u.un.sun_path);
+      }
+      auto l = seastar::listen(*args_.unix_address, lo);
+      local_listeners_.push_back(seastar::make_lw_shared(
+        creds_ ? seastar::tls::listen(creds_, std::move(l)) : std::move(l)));
+    }
+    if (!args_.shm_path.empty()) {
+      local_listeners_.push_back(seastar::make_lw_shared(
+        shm_listen(args_.shm_path, args_.shm)));
+    }
+  }
+
+  (void)seastar::when_all(accept_loop(listener_),
+                          seastar::parallel_for_each(
+                            local_listeners_,
+                            [this](auto l) { return accept_loop(l); }))
+    .then([this](auto) { stopped_.set_value(); });
+}
+
+seastar::future<>
+rpc_server::accept_loop(
+  seastar::lw_shared_ptr<seastar::server_socket> listener) {
+  return seastar::keep_doing([this, listener] {
+    return listener->accept().then([this, stats = stats_, limits = limits_](
+                                     seastar::accept_result result) mutable {
       auto conn = seastar::make_lw_shared<rpc_server_connection>(
         std::move(result.connection), limits, result.remote_address, stats,
         ++connection_idx_);
+      conn->conn.send_queue.set_max_cork(args_.max_write_cork);
+      conn->conn.send_queue.set_max_fragment_size(args_.max_fragment_size);
+      conn->max_inflight_requests = args_.max_inflight_requests_per_connection;
+      conn->max_inflight_bytes = args_.max_inflight_bytes_per_connection;
+      conn->fragments.set_limits(
+        max_message_size(), args_.max_fragmented_bytes_per_connection != 0
+                              ? args_.max_fragmented_bytes_per_connection
+                              : args_.memory_avail_per_core / 2);
+      if (args_.connection_weight) {
+        conn->weight = args_.connection_weight(result.remote_address);
+      }
+      if (args_.flags & rpc_server_flags_connection_metrics) {
+        register_connection_metrics(conn);
+      }
 
       open_connections_.insert({connection_idx_, conn});
 
       // DO NOT return the future. Need to execute in parallel
       (void)handle_client_connection(conn);
     });
-  }).handle_exception([this](std::exception_ptr eptr) {
-    stopped_.set_value();
+  }).handle_exception([](std::exception_ptr eptr) {
     try {
       std::rethrow_exception(eptr);
     } catch (const std::system_error &e) {
@@ -153,6 +366,7 @@ seastar::future<>
 rpc_server::stop() {
   LOG_INFO("Stopped seastar::accept() calls");
   listener_->abort_accept();
+  for (auto &l : local_listeners_) { l->abort_accept(); }
   return stopped_.get_future().then([this] {
     std::for_each(
       open_connections_.begin(), open_connections_.end(),
@@ -178,32 +392,73 @@ rpc_server::stop() {
 // come *right* after parsing the header in the same continuation chain.
 // therwise you will run into incorrect parsing
 //
+// rpc_frame_parser hands us every frame already sitting in the read buffer
+// and, at most, the header of a frame whose body is still in flight.
+//
 seastar::future<>
 rpc_server::handle_one_client_session(
   seastar::lw_shared_ptr<rpc_server_connection> conn) {
-  return rpc_recv_context::parse_header(&conn->conn)
-    .then([this, conn](std::optional<rpc::header> hdr) {
-      if (!hdr) {
+  return conn->wait_under_inflight_caps()
+    .then([conn] { return rpc_frame_parser::parse(&conn->conn); })
+    .then([this, conn](rpc_frame_batch batch) {
+      if (batch.error || batch.empty()) {
         conn->set_error("Error parsing connection header");
         return seastar::make_ready_future<>();
       }
-      auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
-                          conn->limits()->max_body_parsing_duration)
-                          .count();
-      auto payload_size = hdr->size();
-      return conn->limits()
-        ->resources_available.wait(payload_size)
-        .then([conn, h = hdr.value(), timeout_ms] {
-          auto timeout = seastar::timer<>::clock::now() +
-                         std::chrono::milliseconds(timeout_ms);
-          return seastar::with_timeout(timeout, rpc_recv_context::parse_payload(
-                                                  &conn->conn, std::move(h)));
-        })
-        .then([this, conn, payload_size](auto maybe_payload) {
-          // Launch the actual processing on a background
-          (void)dispatch_rpc(payload_size, conn, std::move(maybe_payload));
-          return seastar::make_ready_future<>();
-        });
+      const auto received = seastar::timer<>::clock::now();
+      // Frames that are fully buffered are already in memory, but still
+      // queue for it behind every other connection; nothing more is read
+      // from this socket meanwhile. One wait for the batch, so one socket
+      // read dispatches many requests
+      uint64_t buffered = 0;
+      for (auto &f : batch.frames) { buffered += f.header.size(); }
+      auto admitted = batch.frames.empty()
+                        ? seastar::make_ready_future<>()
+                        : conn->limits()->fair_wait(conn->id, conn->weight,
+                                                    buffered);
+      return admitted.then([this, conn, batch = std::move(batch),
+                            received]() mutable {
+        for (auto &f : batch.frames) {
+          auto payload_size = f.header.size();
+          auto ctx = rpc_recv_context::from_frame(&conn->conn, f.header,
+                                                  std::move(f.body));
+          if (ctx) { ctx->received = received; }
+          dispatch_frame(payload_size, conn, std::move(ctx));
+        }
+        if (!batch.pending) { return seastar::make_ready_future<>(); }
+        return handle_pending_frame(conn, *batch.pending, received);
+      });
+    });
+}
+
+seastar::future<>
+rpc_server::handle_pending_frame(
+  seastar::lw_shared_ptr<rpc_server_connection> conn, rpc::header hdr,
+  seastar::timer<>::clock::time_point received) {
+  if (auto status = check_method_quota(hdr)) {
+    // never buffered: the body goes straight from the socket to nowhere
+    conn->stats->in_bytes += hdr.size() + sizeof(rpc::header);
+    conn->payload_headers.erase(hdr.session());
+    return conn->conn.istream.skip(hdr.size()).then([this, conn, hdr, status] {
+      return reply_status(conn, hdr, status);
+    });
+  }
+  auto timeout_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      conn->limits()->max_body_parsing_duration)
+                      .count();
+  auto payload_size = hdr.size();
+  return conn->limits()
+    ->fair_wait(conn->id, conn->weight, payload_size)
+    .then([conn, hdr, timeout_ms] {
+      auto timeout =
+        seastar::timer<>::clock::now() + std::chrono::milliseconds(timeout_ms);
+      return seastar::with_timeout(
+        timeout, rpc_recv_context::parse_payload(&conn->conn, hdr));
+    })
+    .then([this, conn, payload_size, received](auto maybe_payload) {
+      if (maybe_payload) { maybe_payload->received = received; }
+      dispatch_frame(payload_size, conn, std::move(maybe_payload));
+      return seastar::make_ready_future<>();
     });
 }
 
@@ -213,35 +468,305 @@ rpc_server::handle_client_connection(
   return seastar::do_until(
            [conn] { return !conn->is_valid(); },
            [this, conn]() mutable { return handle_one_client_session(conn); })
-    .finally([this, conn] { return cleanup_dispatch_rpc(conn); })
+    .finally([this, conn] {
+      // no more frames will arrive for these
+      conn->limits()->release(conn->fragments.clear());
+      auto streams = std::move(conn->streams);
+      for (auto &p : streams) {
+        p.second->abort(std::make_exception_ptr(rpc_stream_closed_error()));
+      }
+      // nobody is left to read the replies
+      for (auto &p : conn->inflight) {
+        p.second->request_abort();
+      }
+      return cleanup_dispatch_rpc(conn);
+    })
     .handle_exception([this, conn](auto ptr) {
       LOG_INFO("Error with client rpc session: {}", ptr);
       conn->set_error("handling client session exception");
       return cleanup_dispatch_rpc(conn);
+    })
+    .then([conn] {
+      // replies still running are dropped; the one being written is waited
+      return conn->conn.send_queue.close();
+    });
+}
+
+void
+rpc_server::dispatch_frame(int32_t payload_size,
+                           seastar::lw_shared_ptr<rpc_server_connection> conn,
+                           std::optional<rpc_recv_context> ctx) {
+  if (ctx) {
+    if (auto status = check_fragment_quota(*conn, *ctx)) {
+      conn->limits()->release(payload_size +
+                              conn->fragments.discard(ctx.value()));
+      conn->payload_headers.erase(ctx->session());
+      (void)seastar::with_gate(reply_gate_, [this, conn, status,
+                                             hdr = ctx->header] {
+        return reply_status(conn, hdr, status);
+      }).handle_exception([conn](auto ep) {
+        LOG_INFO("Could not reply to remote:{}: {}", conn->conn.remote_address,
+                 ep);
+      });
+      return;
+    }
+    const uint64_t buffered = conn->fragments.buffered_bytes();
+    switch (conn->fragments.add(ctx.value())) {
+    case rpc_fragment_assembler::result::buffered:
+      // memory of the fragment stays reserved until the message completes
+      return;
+    case rpc_fragment_assembler::result::discarded:
+      // the request was already answered by check_fragment_quota()
+      conn->limits()->release(payload_size);
+      return;
+    case rpc_fragment_assembler::result::too_large:
+      conn->limits()->release(
+        payload_size + buffered - conn->fragments.buffered_bytes());
+      conn->stats->too_large_requests++;
+      conn->set_error("Fragmented request is too large");
+      return;
+    case rpc_fragment_assembler::result::complete:
+      // every fragment reserved its own bytes
+      payload_size = ctx->header.size();
+      break;
+    }
+  }
+  static constexpr uint8_t kStreamFlags =
+    rpc::header_bit_flags::header_bit_flags_stream |
+    rpc::header_bit_flags::header_bit_flags_control;
+  if (ctx && (static_cast<uint8_t>(ctx->header.bitflags()) & kStreamFlags)) {
+    dispatch_stream_frame(conn, std::move(ctx.value()));
+    return;
+  }
+  // Launch the actual processing on a background
+  (void)dispatch_rpc(payload_size, conn, std::move(ctx))
+    .handle_exception([conn](auto ep) {
+      // i.e.: the handler threw, or the reply could not be written
+      LOG_INFO("Could not reply to remote:{}: {}", conn->conn.remote_address,
+               ep);
     });
 }
 
+/// \brief replies use the checksum algorithm and the priority of the request
+static inline void
+mirror_request_flags(const rpc::header &request, rpc::header &reply) {
+  set_rpc_checksum_type(reply, rpc_checksum_type(request));
+  set_rpc_priority(reply, rpc_priority_of(request));
+}
+
+seastar::lw_shared_ptr<rpc_stream>
+rpc_server::open_stream(seastar::lw_shared_ptr<rpc_server_connection> conn,
+                        rpc_service_method_handle *method, uint16_t session,
+                        rpc::header request) {
+  // every frame mirrors the first request frame, and goes through the
+  // filters the stream was opened with
+  rpc_stream_io io;
+  io.write = [this, conn, request,
+              filters = method->outgoing_filters](rpc_envelope e) {
+    mirror_request_flags(request, e.letter.header);
+    return stage_apply_outgoing_filters(filters, std::move(e))
+      .then([conn](rpc_envelope e) {
+        if (!conn->is_valid()) {
+          return seastar::make_exception_future<>(rpc_stream_closed_error());
+        }
+        conn->stats->out_bytes += e.letter.size();
+        return conn->conn.send_queue.enqueue(std::move(e));
+      });
+  };
+  io.write_control = [conn, request](rpc_envelope e) {
+    mirror_request_flags(request, e.letter.header);
+    if (!conn->is_valid()) {
+      return seastar::make_exception_future<>(rpc_stream_closed_error());
+    }
+    return conn->conn.send_queue.enqueue(std::move(e));
+  };
+  io.read_filter = [this, filters = method->incoming_filters](
+                     rpc_recv_context ctx) {
+    return stage_apply_incoming_filters(filters, std::move(ctx));
+  };
+  io.on_done = [conn, session] { conn->streams.erase(session); };
+  auto s = seastar::make_lw_shared<rpc_stream>(session, 200, std::move(io),
+                                               conn->limits());
+  conn->streams.emplace(session, s);
+  conn->stats->active_streams++;
+  conn->stats->total_streams++;
+
+  const auto sg = routes_.scheduling_group_for(request.meta());
+  (void)seastar::with_gate(reply_gate_, [this, conn, method, s, sg] {
+    return seastar::with_scheduling_group(
+             sg, [method, s] { return method->apply_stream(s); })
+      .then_wrapped([s](seastar::future<> f) {
+        uint32_t status = 200;
+        if (f.failed()) {
+          LOG_ERROR("Streaming handler failed: {}", f.get_exception());
+          status = 500;
+        }
+        return s->close(status);
+      })
+      .handle_exception([](auto ep) {
+        DLOG_INFO("Could not close stream: {}", ep);
+      })
+      .finally([this, conn, s, m = hist_->auto_measure()] {
+        conn->stats->active_streams--;
+      });
+  });
+  return s;
+}
+
+void
+rpc_server::dispatch_stream_frame(
+  seastar::lw_shared_ptr<rpc_server_connection> conn, rpc_recv_context &&ctx) {
+  conn->stats->in_bytes += ctx.header.size() + sizeof(rpc::header);
+  const auto session = ctx.session();
+  auto it = conn->streams.find(session);
+  if (ctx.header.bitflags() & rpc::header_bit_flags::header_bit_flags_control) {
+    conn->limits()->release(ctx.header.size());
+    if (ctx.header.meta() == rpc::control_type::control_type_credit &&
+        ctx.payload.size() == sizeof(rpc::stream_credit)) {
+      rpc::stream_credit c;
+      std::memcpy(&c, ctx.payload.get(), sizeof(c));
+      // the stream may have finished already
+      if (it != conn->streams.end()) { it->second->add_credits(c.credits()); }
+      return;
+    }
+    if (ctx.header.meta() == rpc::control_type::control_type_handshake) {
+      auto remote = rpc_handshake::decode(ctx);
+      if (!remote || conn->negotiated) {
+        conn->set_error("Invalid handshake");
+        return;
+      }
+      const auto max_frame_size = static_cast<uint32_t>(max_message_size());
+      const bool shard_ports = args_.flags & rpc_server_flags_shard_ports;
+      auto local = rpc_handshake::make(
+        args_.codecs, args_.checksums, max_frame_size,
+        shard_ports ? seastar::smp::count : 0,
+        shard_ports ? shard_port_base() : 0);
+      conn->negotiated =
+        rpc_handshake::negotiate(local, *remote, args_.min_compression_size);
+      conn->conn.send_queue.set_max_fragment_size(
+        conn->negotiated->fragment_size(args_.max_fragment_size));
+      (void)conn->conn.send_queue.enqueue(rpc_handshake::encode(local))
+        .handle_exception(
+          [](auto ep) { DLOG_INFO("Could not send handshake: {}", ep); });
+      return;
+    }
+    if (ctx.header.meta() ==
+        rpc::control_type::control_type_payload_headers) {
+      if (ctx.payload.size() > rpc_payload_headers::kMaxSize) {
+        conn->set_error("payload_headers too large");
+        return;
+      }
+      auto ph = rpc_payload_headers::decode(ctx.payload);
+      if (!ph) {
+        conn->set_error("Invalid payload_headers");
+        return;
+      }
+      conn->payload_headers[session] = std::move(ph.value());
+      return;
+    }
+    if (ctx.header.meta() == rpc::control_type::control_type_cancel) {
+      // the request may have been answered already
+      if (auto r = conn->inflight.find(session); r != conn->inflight.end()) {
+        r->second->request_abort();
+      } else if (it != conn->streams.end()) {
+        conn->stats->cancelled_requests++;
+        it->second->abort(
+          std::make_exception_ptr(seastar::abort_requested_exception()));
+      }
+      return;
+    }
+    conn->set_error(fmt::format("Invalid control frame: {}", ctx.header));
+    return;
+  }
+  seastar::lw_shared_ptr<rpc_stream> s;
+  if (it == conn->streams.end()) {
+    // first frame of a stream: meta is the request_id
+    auto method = routes_.get_handle_for_request(ctx.request_id());
+    if (method == nullptr || !method->is_streaming()) {
+      conn->limits()->release(ctx.header.size());
+      conn->stats->no_route_requests++;
+      conn->set_error("Can't find streaming route for request. Invalid");
+      return;
+    }
+    s = open_stream(conn, method, session, ctx.header);
+  } else {
+    s = it->second;
+  }
+  if (!s->push(std::move(ctx))) {
+    conn->set_error(
+      fmt::format("Stream session:{} violated flow control", session));
+  }
+}
+
 seastar::future<>
 rpc_server::dispatch_rpc(int32_t payload_size,
                          seastar::lw_shared_ptr<rpc_server_connection> conn,
                          std::optional<rpc_recv_context> ctx) {
   if (!ctx) {
-    conn->limits()->resources_available.signal(payload_size);
+    conn->limits()->release(payload_size);
     conn->set_error("Could not parse payload");
     return seastar::make_ready_future<>();
   }
 
+  auto route = routes_.get_handle_for_request(ctx->request_id());
+  auto method = route;
+  if (method != nullptr && !method->is_streaming()) {
+    if (auto status = check_method_quota(method, payload_size)) {
+      conn->limits()->release(payload_size);
+      conn->payload_headers.erase(ctx->session());
+      return seastar::with_gate(reply_gate_, [this, conn, status,
+                                              hdr = ctx->header] {
+        return reply_status(conn, hdr, status);
+      });
+    }
+    method->inflight_requests++;
+    method->inflight_bytes += payload_size;
+  } else {
+    // do_dispatch_rpc() rejects it
+    method = nullptr;
+  }
+  const auto priority = static_cast<uint8_t>(rpc_priority_of(ctx->header));
+  auto sg = seastar::default_scheduling_group();
+  if (route != nullptr && route->bound_group) {
+    sg = *route->bound_group;
+    // the metric is labelled by the rpc_server_args::scheduling_groups key
+    group_requests_[route->bound_group_key]++;
+  }
+  conn->admit_request(payload_size);
+  // registered on the read fiber: a cancel frame is read after its request,
+  // so it always finds it here, however long the request waits to run
+  const auto session = ctx->session();
+  auto cancellation = seastar::make_lw_shared<seastar::abort_source>();
+  conn->inflight[session] = cancellation;
+  ctx->cancellation = cancellation;
   return seastar::with_gate(
     reply_gate_,
-    [this, conn, context = std::move(ctx.value()), payload_size]() mutable {
-      return do_dispatch_rpc(conn, std::move(context))
+    [this, conn, context = std::move(ctx.value()), payload_size, priority, sg,
+     method, session, cancellation]() mutable {
+      // every continuation of the request inherits the group
+      return seastar::with_scheduling_group(
+               sg,
+               [this, conn, context = std::move(context)]() mutable {
+                 return do_dispatch_rpc(conn, std::move(context));
+               })
         .then([this, conn] { return cleanup_dispatch_rpc(conn); })
         .finally(
-          [m = hist_->auto_measure(), limits = conn->limits(), payload_size] {
+          [m = hist_->auto_measure(),
+           pm = priority_hist_[priority]->auto_measure(), conn, payload_size,
+           method, session, cancellation] {
+            auto it = conn->inflight.find(session);
+            if (it != conn->inflight.end() && it->second == cancellation) {
+              conn->inflight.erase(it);
+            }
             // these limits are acquired *BEFORE* the call to dispatch_rpc()
             // happens. Critical to understand memory ownership since it happens
             // accross multiple futures.
-            limits->resources_available.signal(payload_size);
+            conn->limits()->release(payload_size);
+            conn->retire_request(payload_size);
+            if (method != nullptr) {
+              method->inflight_requests--;
+              method->inflight_bytes -= payload_size;
+            }
           });
     });
 }
@@ -254,20 +779,73 @@ rpc_server::do_dispatch_rpc(seastar::lw_shared_ptr<rpc_server_connection> conn,
     return seastar::make_ready_future<>();
   }
   auto method_dispatch = routes_.get_handle_for_request(ctx.request_id());
-  if (method_dispatch == nullptr) {
+  if (method_dispatch == nullptr || method_dispatch->is_streaming()) {
     conn->stats->no_route_requests++;
     conn->set_error("Can't find route for request. Invalid");
     return seastar::make_ready_future<>();
   }
   conn->stats->in_bytes += ctx.header.size() + ctx.payload.size();
+  if (ctx.header.bitflags() &
+      rpc::header_bit_flags::header_bit_flags_has_payload_headers) {
+    auto it = conn->payload_headers.find(ctx.session());
+    if (it == conn->payload_headers.end()) {
+      conn->set_error("Missing payload_headers for request");
+      return seastar::make_ready_future<>();
+    }
+    ctx.dynamic_headers = std::move(it->second.dynamic_headers);
+    ctx.deadline = it->second.deadline;
+    conn->payload_headers.erase(it);
+  }
+  if (ctx.is_cancelled()) {
+    // cancelled while it waited to run
+    conn->stats->cancelled_requests++;
+    return seastar::make_ready_future<>();
+  }
+  if (ctx.is_expired()) {
+    // waited too long for memory; don't even run the filters
+    return reply_deadline_exceeded(conn, ctx);
+  }
+  if (codel_ && should_shed(ctx)) {
+    conn->stats->shed_requests++;
+    return reply_status(conn, ctx.header, kOverloadedStatus);
+  }
+  if (limiter_ && !limiter_->try_acquire()) {
+    // cheaper for everyone than queueing behind the requests in flight
+    conn->stats->overloaded_requests++;
+    return reply_status(conn, ctx.header, kOverloadedStatus);
+  }
+  // filters and typed handlers need a contiguous body
+  if (ctx.is_fragmented() &&
+      (!method_dispatch->accepts_fragments ||
+       ctx.header.compression() !=
+         rpc::compression_flags::compression_flags_none)) {
+    ctx.linearize();
+  }
+  // before the filters, which expect to see what the client sent by hand
+  if (conn->negotiated) { rpc_negotiated::decode(ctx); }
 
   /// the request follow [filters] -> handle -> [filters]
   /// the only way for the handle not to receive the information is if
   /// the filters invalidate the request - they have full mutable access
   /// to it, or they throw an exception if they wish to interrupt the entire
   /// connection
-  return stage_apply_incoming_filters(std::move(ctx))
-    .then([this, conn, method_dispatch](auto ctx) {
+  // replies mirror the checksum algorithm and the priority of the request
+  const rpc::header request = ctx.header;
+  auto cancellation = ctx.cancellation;
+  const auto deadline = ctx.deadline;
+  // a filter registered meanwhile does not change the chains of this request
+  auto f =
+    stage_apply_incoming_filters(method_dispatch->incoming_filters,
+                                 std::move(ctx))
+    .then([this, conn, method_dispatch, request, cancellation, deadline,
+           out_filters = method_dispatch->outgoing_filters](auto ctx) {
+      // filters may have built a new context
+      ctx.cancellation = cancellation;
+      ctx.deadline = deadline;
+      if (ctx.is_expired()) {
+        // queued behind other requests in the incoming stage
+        return reply_deadline_exceeded(conn, ctx);
+      }
       if (ctx.header.compression() !=
           rpc::compression_flags::compression_flags_none) {
         conn->set_error(fmt::format("There was no decompression filter for "
@@ -275,11 +853,41 @@ rpc_server::do_dispatch_rpc(seastar::lw_shared_ptr<rpc_server_connection> conn,
                                     ctx.header.compression()));
         return seastar::make_ready_future<>();
       }
-      return method_dispatch->apply(std::move(ctx))
-        .then([this](rpc_envelope e) {
-          return stage_apply_outgoing_filters(std::move(e));
+      auto run = [this, method_dispatch](rpc_recv_context &&c) {
+        if (!method_dispatch->single_flight) {
+          return apply_on_owner(method_dispatch, std::move(c));
+        }
+        return single_flight_.apply(
+          std::move(c), [this, method_dispatch](rpc_recv_context &&c) {
+            return apply_on_owner(method_dispatch, std::move(c));
+          });
+      };
+      auto reply = method_dispatch->cache_ttl.count() > 0
+                     ? response_cache_.apply(std::move(ctx), request,
+                                             method_dispatch->cache_ttl,
+                                             std::move(run))
+                     : run(std::move(ctx));
+      return std::move(reply)
+        .then([this, conn, request, cancellation,
+               out_filters](rpc_envelope e) {
+          if (cancellation->abort_requested()) {
+            // the client is not waiting for it. don't filter, don't write
+            conn->stats->cancelled_requests++;
+            return seastar::make_ready_future<std::optional<rpc_envelope>>();
+          }
+          mirror_request_flags(request, e.letter.header);
+          return stage_apply_outgoing_filters(out_filters, std::move(e))
+            .then([](rpc_envelope e) {
+              return seastar::make_ready_future<std::optional<rpc_envelope>>(
+                std::move(e));
+            });
         })
-        .then([conn](rpc_envelope e) {
+        .then([conn, cancellation](std::optional<rpc_envelope> e) {
+          if (!e) { return seastar::make_ready_future<>(); }
+          if (cancellation->abort_requested()) {
+            conn->stats->cancelled_requests++;
+            return seastar::make_ready_future<>();
+          }
           if (!conn->is_valid()) {
             DLOG_INFO(
               "Invalid client connection remote={} server_id={} Skipping "
@@ -287,19 +895,252 @@ rpc_server::do_dispatch_rpc(seastar::lw_shared_ptr<rpc_server_connection> conn,
               conn->conn.remote_address, conn->id);
             return seastar::make_ready_future<>();
           }
-          conn->stats->out_bytes += e.letter.size();
-          return seastar::with_semaphore(
-            conn->serialize_writes, 1, [conn, ee = std::move(e)]() mutable {
-              return smf::rpc_envelope::send(&conn->conn.ostream,
-                                             std::move(ee));
-            });
+          if (conn->negotiated) { conn->negotiated->encode(e.value()); }
+          conn->stats->out_bytes += e->letter.size();
+          // coalesced with every other response of this tick
+          return conn->conn.send_queue.enqueue(std::move(e.value()));
+        })
+        .handle_exception([conn, cancellation](std::exception_ptr ep) {
+          // e.g.: seastar::sleep_aborted from a handler that honored it
+          if (!cancellation->abort_requested()) {
+            return seastar::make_exception_future<>(ep);
+          }
+          conn->stats->cancelled_requests++;
+          return seastar::make_ready_future<>();
         });
-    })
-    .then([conn] {
-      if (conn->is_valid()) { return conn->conn.ostream.flush(); }
-      return seastar::make_ready_future<>();
     });
+  if (!limiter_) { return f; }
+  return f.then_wrapped(
+    [this, begin = std::chrono::steady_clock::now()](seastar::future<> r) {
+      limiter_->release(std::chrono::steady_clock::now() - begin, r.failed());
+      return r;
+    });
+}
+namespace {
+/// \brief view of a buffer owned by another core. `owner` - and with it
+/// the buffer - lives as long as the view; foreign_ptr then hands it back to
+/// its core to be freed
+template <typename Owner>
+seastar::temporary_buffer<char>
+foreign_view(const seastar::temporary_buffer<char> &b, Owner owner) {
+  return seastar::temporary_buffer<char>(
+    const_cast<char *>(b.get()), b.size(),
+    seastar::make_object_deleter(std::move(owner)));
+}
+}  // namespace
+
+seastar::future<rpc_envelope>
+rpc_server::apply_on_owner(rpc_service_method_handle *method,
+                           rpc_recv_context &&ctx) {
+  const auto owner = routes_.owner_shard(ctx);
+  if (owner == seastar::engine().cpu_id()) {
+    return method->apply(std::move(ctx));
+  }
+  if (ctx.is_cancelled()) {
+    return seastar::make_exception_future<rpc_envelope>(
+      seastar::abort_requested_exception());
+  }
+  stats_->forwarded_requests++;
+  // the abort_source of the request belongs to this core. The owner gets its
+  // own, and a cancel is passed on to it
+  const uint64_t token = (uint64_t(seastar::engine().cpu_id()) << 48) |
+                         (++forward_seq_ & ((uint64_t(1) << 48) - 1));
+  seastar::optimized_optional<seastar::abort_source::subscription> sub;
+  if (ctx.cancellation) {
+    sub = ctx.cancellation->subscribe([this, owner, token]() noexcept {
+      (void)container().invoke_on(
+        owner, [token](rpc_server &s) { s.cancel_forwarded(token); });
+    });
+  }
+  auto request =
+    seastar::make_foreign(std::make_unique<rpc_recv_context>(std::move(ctx)));
+  // groups are global; the owner runs the handler in ours
+  return container()
+    .invoke_on(owner,
+               [request = std::move(request), token,
+                sg = seastar::current_scheduling_group()](
+                 rpc_server &s) mutable {
+                 // before the group defers it: a cancel sent after the
+                 // request is delivered after it too
+                 auto as = seastar::make_lw_shared<seastar::abort_source>();
+                 s.forwarded_.emplace(token, as);
+                 return seastar::with_scheduling_group(
+                          sg,
+                          [&s, request = std::move(request), as]() mutable {
+                            return s.apply_forwarded(std::move(request), as);
+                          })
+                   .finally([&s, token] { s.forwarded_.erase(token); });
+               })
+    .then([sub = std::move(sub)](
+            seastar::foreign_ptr<std::unique_ptr<rpc_envelope>> e) {
+      rpc_envelope ret;
+      ret.letter.header = e->letter.header;
+      ret.letter.dynamic_headers = e->letter.dynamic_headers;
+      ret.letter.deadline = e->letter.deadline;
+      const auto &body = e->letter.body;
+      ret.letter.body = foreign_view(body, std::move(e));
+      return ret;
+    });
+}
+
+seastar::future<seastar::foreign_ptr<std::unique_ptr<rpc_envelope>>>
+rpc_server::apply_forwarded(
+  seastar::foreign_ptr<std::unique_ptr<rpc_recv_context>> request,
+  seastar::lw_shared_ptr<seastar::abort_source> cancellation) {
+  using ret_type = seastar::foreign_ptr<std::unique_ptr<rpc_envelope>>;
+  auto owner = seastar::make_lw_shared(std::move(request));
+  const rpc_recv_context &src = **owner;
+  auto method = routes_.get_handle_for_request(src.request_id());
+  if (method == nullptr || method->is_streaming()) {
+    return seastar::make_exception_future<ret_type>(std::runtime_error(
+      fmt::format("No route on core {} for forwarded request_id: {}",
+                  seastar::engine().cpu_id(), src.request_id())));
+  }
+  // the constructor checks the payload against the header size
+  rpc::header hdr = src.header;
+  hdr.mutate_size(src.payload.size());
+  rpc_recv_context ctx(limits_, src.remote_address, hdr,
+                       foreign_view(src.payload, owner));
+  ctx.header = src.header;
+  for (auto &f : src.fragments) {
+    ctx.fragments.push_back(foreign_view(f, owner));
+  }
+  ctx.dynamic_headers = src.dynamic_headers;
+  ctx.deadline = src.deadline;
+  ctx.cancellation = std::move(cancellation);
+  return method->apply(std::move(ctx)).then([](rpc_envelope e) {
+    return seastar::make_foreign(std::make_unique<rpc_envelope>(std::move(e)));
+  });
+}
+
+void
+rpc_server::cancel_forwarded(uint64_t token) {
+  // the handler may be done already
+  if (auto it = forwarded_.find(token); it != forwarded_.end()) {
+    it->second->request_abort();
+  }
+}
+
+void
+rpc_server::register_connection_metrics(
+  seastar::lw_shared_ptr<rpc_server_connection> conn) {
+  namespace sm = seastar::metrics;
+  // raw pointers: the groups go away with the connection
+  auto c = conn.get();
+  std::vector<sm::label_instance> labels{
+    sm::label_instance("connection", conn->id),
+    sm::label_instance("remote", fmt::format("{}", conn->conn.remote_address))};
+  c->metrics.add_group(
+    "smf::rpc_server_connection",
+    {
+      sm::make_gauge("inflight_requests", [c] { return c->inflight_requests; },
+                     sm::description("Unary requests being dispatched"),
+                     labels),
+      sm::make_gauge("inflight_bytes", [c] { return c->inflight_bytes; },
+                     sm::description("Bytes of the core memory budget held "
+                                     "by requests being dispatched"),
+                     labels),
+      sm::make_gauge(
+        "memory_waiting_bytes",
+        [c] { return c->limits()->fair_waiters.waiting(c->id); },
+        sm::description("Bytes waiting for the core memory budget"), labels),
+    });
+}
+
+bool
+rpc_server::should_shed(const rpc_recv_context &ctx) {
+  const auto now = seastar::timer<>::clock::now();
+  // waiting for request memory is the other queue a backed up core builds
+  bool memory_pressure = limits_->waiters() > 0;
+  if (!memory_pressure) {
+    const auto mem = seastar::memory::stats();
+    memory_pressure = mem.free_memory() <
+                      mem.total_memory() * codel_->opts().min_free_memory;
+  }
+  return codel_->should_drop(now, now - ctx.received, memory_pressure);
+}
+
+uint32_t
+rpc_server::check_method_quota(const rpc_service_method_handle *method,
+                               uint64_t size) {
+  auto &q = method->quota;
+  if (q.max_payload_size != 0 && size > q.max_payload_size) {
+    stats_->too_large_requests++;
+    return kPayloadTooLargeStatus;
+  }
+  // a request larger than max_inflight_bytes still runs alone
+  if ((q.max_concurrency != 0 &&
+       method->inflight_requests >= q.max_concurrency) ||
+      (q.max_inflight_bytes != 0 && method->inflight_bytes != 0 &&
+       method->inflight_bytes + size > q.max_inflight_bytes)) {
+    stats_->over_quota_requests++;
+    return kOverQuotaStatus;
+  }
+  return 0;
 }
+
+uint32_t
+rpc_server::check_method_quota(const rpc::header &hdr) {
+  // only whole unary requests name their method
+  static constexpr uint8_t kSkipFlags =
+    rpc::header_bit_flags::header_bit_flags_stream |
+    rpc::header_bit_flags::header_bit_flags_control |
+    rpc::header_bit_flags::header_bit_flags_fragment;
+  if (static_cast<uint8_t>(hdr.bitflags()) & kSkipFlags) { return 0; }
+  auto method = routes_.get_handle_for_request(hdr.meta());
+  if (method == nullptr || method->is_streaming()) { return 0; }
+  return check_method_quota(method, hdr.size());
+}
+
+uint32_t
+rpc_server::check_fragment_quota(const rpc_server_connection &conn,
+                                 const rpc_recv_context &ctx) {
+  static constexpr uint8_t kStreamFlags =
+    rpc::header_bit_flags::header_bit_flags_stream |
+    rpc::header_bit_flags::header_bit_flags_control;
+  const auto flags = static_cast<uint8_t>(ctx.header.bitflags());
+  if (flags & kStreamFlags) { return 0; }
+  const bool is_fragment =
+    flags & rpc::header_bit_flags::header_bit_flags_fragment;
+  const uint64_t buffered = conn.fragments.partial_size(ctx.session());
+  // a whole request is checked by dispatch_rpc(); every frame of a
+  // fragmented one names its method, so it is checked as it grows
+  if ((!is_fragment && buffered == 0) ||
+      conn.fragments.discarding(ctx.session())) {
+    return 0;
+  }
+  auto method = routes_.get_handle_for_request(ctx.request_id());
+  if (method == nullptr || method->is_streaming()) { return 0; }
+  const auto max = method->quota.max_payload_size;
+  if (max != 0 && buffered + ctx.payload.size() > max) {
+    stats_->too_large_requests++;
+    return kPayloadTooLargeStatus;
+  }
+  return 0;
+}
+
+seastar::future<>
+rpc_server::reply_deadline_exceeded(
+  seastar::lw_shared_ptr<rpc_server_connection> conn,
+  const rpc_recv_context &ctx) {
+  conn->stats->deadline_exceeded_requests++;
+  return reply_status(conn, ctx.header, kDeadlineExceededStatus);
+}
+
+seastar::future<>
+rpc_server::reply_status(seastar::lw_shared_ptr<rpc_server_connection> conn,
+                         const rpc::header &request, uint32_t status) {
+  if (!conn->is_valid()) { return seastar::make_ready_future<>(); }
+  // an empty table is a valid root of every response type
+  rpc_typed_envelope<rpc::null_type> data;
+  data.envelope.set_status(status);
+  auto e = data.serialize_data();
+  e.letter.header.mutate_session(request.session());
+  mirror_request_flags(request, e.letter.header);
+  conn->stats->out_bytes += e.letter.size();
+  return conn->conn.send_queue.enqueue(std::move(e));
+}
+
 seastar::future<>
 rpc_server::cleanup_dispatch_rpc(
   seastar::lw_shared_ptr<rpc_server_connection> conn) {
@@ -327,11 +1168,24 @@ rpc_server::cleanup_dispatch_rpc(
   return seastar::make_ready_future<>();
 }
 
-static thread_local auto incoming_stage = seastar::make_execution_stage(
-  "smf::rpc_server::incoming::filter", &rpc_server::apply_incoming_filters);
+// one stage per scheduling group, so filters run in the group of the request
+static thread_local seastar::inheriting_concrete_execution_stage<
+  seastar::future<rpc_recv_context>, rpc_incoming_chain, rpc_recv_context>
+  incoming_stage("smf::rpc_server::incoming::filter",
+                 [](rpc_incoming_chain filters, rpc_recv_context ctx) {
+                   auto f = rpc_filter_apply(filters.get(), std::move(ctx));
+                   if (f.available()) { return f; }
+                   return f.finally([filters = std::move(filters)] {});
+                 });
 
-static thread_local auto outgoing_stage = seastar::make_execution_stage(
-  "smf::rpc_server::outgoing::filter", &rpc_server::apply_outgoing_filters);
+static thread_local seastar::inheriting_concrete_execution_stage<
+  seastar::future<rpc_envelope>, rpc_outgoing_chain, rpc_envelope>
+  outgoing_stage("smf::rpc_server::outgoing::filter",
+                 [](rpc_outgoing_chain filters, rpc_envelope e) {
+                   auto f = rpc_filter_apply(filters.get(), std::move(e));
+                   if (f.available()) { return f; }
+                   return f.finally([filters = std::move(filters)] {});
+                 });
 
 seastar::future<rpc_recv_context>
 rpc_server::apply_incoming_filters(rpc_recv_context ctx) {
@@ -343,11 +1197,19 @@ rpc_server::apply_outgoing_filters(rpc_envelope e) {
 }
 
 seastar::future<rpc_recv_context>
-rpc_server::stage_apply_incoming_filters(rpc_recv_context ctx) {
-  return incoming_stage(this, std::move(ctx));
+rpc_server::stage_apply_incoming_filters(rpc_incoming_chain filters,
+                                         rpc_recv_context ctx) {
+  if (!filters) {
+    return seastar::make_ready_future<rpc_recv_context>(std::move(ctx));
+  }
+  return incoming_stage(std::move(filters), std::move(ctx));
 }
 seastar::future<rpc_envelope>
-rpc_server::stage_apply_outgoing_filters(rpc_envelope e) {
-  return outgoing_stage(this, std::move(e));
+rpc_server::stage_apply_outgoing_filters(rpc_outgoing_chain filters,
+                                         rpc_envelope e) {
+  if (!filters) {
+    return seastar::make_ready_future<rpc_envelope>(std::move(e));
+  }
+  return outgoing_stage(std::move(filters), std::move(e));
 }
 }  // namespace smf
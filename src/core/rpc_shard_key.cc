@@ -0,0 +1,15 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_shard_key.h"
+
+#include <xxhash.h>
+
+namespace smf {
+
+uint64_t
+rpc_shard_hash(std::string_view key) {
+  return XXH64(key.data(), key.size(), 0);
+}
+
+}  // namespace smf
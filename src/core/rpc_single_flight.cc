@@ -0,0 +1,125 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_single_flight.h"
+
+#include <cstring>
+#include <utility>
+
+#include <xxhash.h>
+
+namespace smf {
+
+uint64_t
+rpc_single_flight::xxhash(const char *data, size_t size) {
+  return XXH64(data, size, 0);
+}
+
+void
+rpc_single_flight::join(flight *f, const rpc_recv_context &ctx) {
+  if (!ctx.cancellation) {
+    // can't cancel: waits until the end
+    ++f->waiting;
+    return;
+  }
+  auto sub = ctx.cancellation->subscribe([f]() noexcept {
+    if (--f->waiting == 0) { f->cancellation->request_abort(); }
+  });
+  // already cancelled: it never waits
+  if (!sub) { return; }
+  ++f->waiting;
+  f->subscription = std::move(*sub);
+}
+
+seastar::future<rpc_envelope>
+rpc_single_flight::follow(flight_ptr f, rpc_recv_context &ctx) {
+  ++coalesced_;
+  auto reply = [f, session = ctx.session()] {
+    rpc_envelope e(f->reply->letter.share());
+    e.letter.header.mutate_session(session);
+    return e;
+  };
+  if (!ctx.cancellation) {
+    ++f->waiting;
+    return f->done.get_shared_future().then(std::move(reply));
+  }
+  struct follower {
+    seastar::promise<rpc_envelope> p;
+    std::optional<seastar::abort_source::subscription> subscription;
+    bool resolved{false};
+  };
+  auto w = seastar::make_lw_shared<follower>();
+  // kept alive by the continuation on `done` below, which always runs
+  auto sub = ctx.cancellation->subscribe([f, w = w.get()]() noexcept {
+    if (w->resolved) { return; }
+    w->resolved = true;
+    // frees the slot of the request now, not when the handler returns
+    w->p.set_exception(seastar::abort_requested_exception());
+    if (--f->waiting == 0) { f->cancellation->request_abort(); }
+  });
+  if (!sub) {
+    return seastar::make_exception_future<rpc_envelope>(
+      seastar::abort_requested_exception());
+  }
+  ++f->waiting;
+  w->subscription = std::move(*sub);
+  auto ret = w->p.get_future();
+  (void)f->done.get_shared_future().then_wrapped(
+    [w, reply = std::move(reply)](seastar::future<> r) {
+      w->subscription = std::nullopt;
+      if (w->resolved) {
+        r.ignore_ready_future();
+        return;
+      }
+      w->resolved = true;
+      if (r.failed()) {
+        w->p.set_exception(r.get_exception());
+        return;
+      }
+      w->p.set_value(reply());
+    });
+  return ret;
+}
+
+seastar::future<rpc_envelope>
+rpc_single_flight::apply(rpc_recv_context &&ctx, apply_fn fn) {
+  if (ctx.is_fragmented() || !ctx.dynamic_headers.empty()) {
+    return fn(std::move(ctx));
+  }
+  const key k{ctx.request_id(), hash_(ctx.payload.get(), ctx.payload.size())};
+  auto it = flights_.find(k);
+  if (it != flights_.end()) {
+    auto f = it->second;
+    const bool same = f->payload.size() == ctx.payload.size() &&
+                      std::memcmp(f->payload.get(), ctx.payload.get(),
+                                  ctx.payload.size()) == 0;
+    if (!same || f->cancellation->abort_requested()) {
+      return fn(std::move(ctx));
+    }
+    return follow(std::move(f), ctx);
+  }
+
+  auto f = seastar::make_lw_shared<flight>();
+  f->payload = ctx.payload.share();
+  join(f.get(), ctx);
+  ctx.cancellation = f->cancellation;
+  flights_.emplace(k, f);
+  return fn(std::move(ctx))
+    .then_wrapped([this, k, f](seastar::future<rpc_envelope> fut) {
+      // late arrivals start a new flight from now on
+      auto it = flights_.find(k);
+      if (it != flights_.end() && it->second == f) { flights_.erase(it); }
+      f->subscription = std::nullopt;
+      if (fut.failed()) {
+        auto ep = fut.get_exception();
+        f->done.set_exception(ep);
+        return seastar::make_exception_future<rpc_envelope>(ep);
+      }
+      f->reply = fut.get0();
+      f->done.set_value();
+      return seastar::make_ready_future<rpc_envelope>(
+        rpc_envelope(f->reply->letter.share()));
+    });
+}
+
+}  // namespace smf
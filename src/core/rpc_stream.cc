@@ -0,0 +1,161 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_stream.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "smf/log.h"
+
+namespace smf {
+
+rpc_stream::rpc_stream(uint16_t session, uint32_t meta, rpc_stream_io io,
+                       seastar::lw_shared_ptr<rpc_connection_limits> limits,
+                       uint32_t window)
+  : session_(session), meta_(meta), io_(std::move(io)),
+    limits_(std::move(limits)), window_(window),
+    // + the end_of_stream marker and a message sharing its frame
+    inbound_(window + 2), credits_(window) {
+  DLOG_THROW_IF(window_ < 2, "Stream window must be at least 2");
+}
+
+rpc_stream::~rpc_stream() {}
+
+void
+rpc_stream::stamp(rpc::header &hdr, bool end_of_stream) const {
+  uint8_t flags = static_cast<uint8_t>(hdr.bitflags()) |
+                  rpc::header_bit_flags::header_bit_flags_stream;
+  if (end_of_stream) {
+    flags |= rpc::header_bit_flags::header_bit_flags_end_of_stream;
+  }
+  hdr.mutate_bitflags(static_cast<rpc::header_bit_flags>(flags));
+  hdr.mutate_session(session_);
+  // handlers may set their own status per message
+  if (hdr.meta() == 0) { hdr.mutate_meta(meta_); }
+}
+
+seastar::future<std::optional<rpc_recv_context>>
+rpc_stream::read() {
+  using ret_type = std::optional<rpc_recv_context>;
+  return inbound_.pop_eventually().then([this](ret_type m) {
+    if (!m) {
+      // keep returning end of stream to later reads
+      inbound_.push(std::nullopt);
+      return seastar::make_ready_future<ret_type>(std::nullopt);
+    }
+    if (limits_) {
+      limits_->release(m->header.size());
+    }
+    if (++consumed_ >= window_ / 2) { send_credits(); }
+    return io_.read_filter(std::move(m.value()))
+      .then([](rpc_recv_context ctx) {
+        return seastar::make_ready_future<ret_type>(std::move(ctx));
+      });
+  });
+}
+
+seastar::future<>
+rpc_stream::write(rpc_envelope e) {
+  if (SMF_UNLIKELY(local_closed_)) {
+    return seastar::make_exception_future<>(
+      std::logic_error("rpc_stream: write after close"));
+  }
+  return credits_.wait(1).then([this, e = std::move(e)]() mutable {
+    stamp(e.letter.header, false);
+    return io_.write(std::move(e));
+  });
+}
+
+seastar::future<>
+rpc_stream::close() {
+  return close(meta_);
+}
+
+seastar::future<>
+rpc_stream::close(uint32_t status) {
+  if (local_closed_) { return seastar::make_ready_future<>(); }
+  local_closed_ = true;
+  rpc_envelope e;
+  e.set_status(status);
+  stamp(e.letter.header, true);
+  auto f = io_.write_control(std::move(e));
+  maybe_done();
+  return f;
+}
+
+void
+rpc_stream::send_credits() {
+  if (remote_closed_) { return; }
+  rpc::stream_credit c(consumed_);
+  consumed_ = 0;
+  rpc_envelope e;
+  e.letter.body = seastar::temporary_buffer<char>(sizeof(c));
+  std::memcpy(e.letter.body.get_write(), &c, sizeof(c));
+  e.letter.header.mutate_bitflags(
+    rpc::header_bit_flags::header_bit_flags_control);
+  e.letter.header.mutate_session(session_);
+  e.letter.header.mutate_meta(rpc::control_type::control_type_credit);
+  // errors surface on the connection itself
+  (void)io_.write_control(std::move(e)).handle_exception([](auto ep) {
+    DLOG_INFO("Could not send stream credits: {}", ep);
+  });
+}
+
+bool
+rpc_stream::push(rpc_recv_context ctx) {
+  const bool eos = ctx.header.bitflags() &
+                   rpc::header_bit_flags::header_bit_flags_end_of_stream;
+  const auto size = ctx.header.size();
+  const auto meta = ctx.header.meta();
+  if (remote_closed_) {
+    if (limits_) { limits_->release(size); }
+    return false;
+  }
+  if (size > 0) {
+    if (local_closed_ && !eos) {
+      // handler finished; nobody will read it
+      if (limits_) { limits_->release(size); }
+    } else if (!inbound_.push(std::move(ctx))) {
+      if (limits_) { limits_->release(size); }
+      return false;
+    }
+  }
+  if (eos) {
+    remote_closed_ = true;
+    remote_status_ = meta;
+    inbound_.push(std::nullopt);
+    maybe_done();
+  }
+  return true;
+}
+
+void
+rpc_stream::add_credits(uint32_t credits) {
+  credits_.signal(credits);
+}
+
+void
+rpc_stream::abort(std::exception_ptr e) {
+  local_closed_ = true;
+  remote_closed_ = true;
+  while (!inbound_.empty()) {
+    auto m = inbound_.pop();
+    if (m && limits_) {
+      limits_->release(m->header.size());
+    }
+  }
+  inbound_.abort(e);
+  credits_.broken(e);
+  maybe_done();
+}
+
+void
+rpc_stream::maybe_done() {
+  if (done_ || !local_closed_ || !remote_closed_) { return; }
+  done_ = true;
+  if (io_.on_done) { io_.on_done(); }
+}
+
+}  // namespace smf
@@ -0,0 +1,33 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/rpc_unix_address.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <system_error>
+
+#include "smf/log.h"
+
+namespace smf {
+
+void
+remove_stale_unix_socket(const char *path) {
+  if (path[0] == '\0') { return; }
+  struct stat st;
+  if (::lstat(path, &st) != 0) {
+    if (errno == ENOENT) { return; }
+    throw std::system_error(errno, std::system_category(), path);
+  }
+  // never delete a file we did not create because of a wrong path
+  LOG_THROW_IF(!S_ISSOCK(st.st_mode),
+               "Cannot listen on {}: it exists and is not a unix socket",
+               path);
+  if (::unlink(path) != 0 && errno != ENOENT) {
+    throw std::system_error(errno, std::system_category(), path);
+  }
+}
+
+}  // namespace smf
@@ -0,0 +1,127 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/shm_ring.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+#include "smf/log.h"
+
+namespace smf {
+
+namespace {
+constexpr bool
+is_power_of_2(size_t x) {
+  return x != 0 && (x & (x - 1)) == 0;
+}
+}  // namespace
+
+shm_ring
+shm_ring::create(char *base, size_t capacity) {
+  LOG_THROW_IF(!is_power_of_2(capacity),
+               "shm_ring capacity must be a power of 2: {}", capacity);
+  auto ctrl = new (base) control{};
+  ctrl->magic = kMagic;
+  ctrl->capacity = capacity;
+  ctrl->head.store(0, std::memory_order_relaxed);
+  ctrl->tail.store(0, std::memory_order_relaxed);
+  ctrl->writer_closed.store(0, std::memory_order_relaxed);
+  ctrl->writer_waiting.store(0, std::memory_order_relaxed);
+  ctrl->reader_closed.store(0, std::memory_order_relaxed);
+  ctrl->reader_waiting.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  return shm_ring(ctrl, base + mapping_size(0), capacity);
+}
+
+shm_ring
+shm_ring::attach(char *base, size_t capacity) {
+  std::atomic_thread_fence(std::memory_order_acquire);
+  auto ctrl = reinterpret_cast<control *>(base);
+  LOG_THROW_IF(ctrl->magic != kMagic, "Not an shm_ring, magic: {}",
+               ctrl->magic);
+  LOG_THROW_IF(ctrl->capacity != capacity,
+               "shm_ring capacity mismatch. expected: {}, found: {}",
+               capacity, ctrl->capacity);
+  return shm_ring(ctrl, base + mapping_size(0), capacity);
+}
+
+size_t
+shm_ring::write(const char *data, size_t size) {
+  const uint64_t head = ctrl_->head.load(std::memory_order_relaxed);
+  const uint64_t tail = ctrl_->tail.load(std::memory_order_acquire);
+  // both positions live in memory the peer can write
+  LOG_THROW_IF(head - tail > capacity_,
+               "shm_ring corrupted by the peer. head: {}, tail: {}", head,
+               tail);
+  const size_t n = std::min<size_t>(size, capacity_ - (head - tail));
+  if (n == 0) { return 0; }
+  const size_t offset = head & (capacity_ - 1);
+  const size_t first = std::min(n, capacity_ - offset);
+  std::memcpy(data_ + offset, data, first);
+  std::memcpy(data_, data + first, n - first);
+  ctrl_->head.store(head + n, std::memory_order_release);
+  return n;
+}
+
+size_t
+shm_ring::read(char *data, size_t size) {
+  const uint64_t tail = ctrl_->tail.load(std::memory_order_relaxed);
+  const uint64_t head = ctrl_->head.load(std::memory_order_acquire);
+  LOG_THROW_IF(head - tail > capacity_,
+               "shm_ring corrupted by the peer. head: {}, tail: {}", head,
+               tail);
+  const size_t n = std::min<size_t>(size, head - tail);
+  if (n == 0) { return 0; }
+  const size_t offset = tail & (capacity_ - 1);
+  const size_t first = std::min(n, capacity_ - offset);
+  std::memcpy(data, data_ + offset, first);
+  std::memcpy(data + first, data_, n - first);
+  ctrl_->tail.store(tail + n, std::memory_order_release);
+  return n;
+}
+
+void
+shm_ring::close_writer() {
+  ctrl_->writer_closed.store(1, std::memory_order_release);
+}
+bool
+shm_ring::writer_closed() const {
+  return ctrl_->writer_closed.load(std::memory_order_acquire) != 0;
+}
+void
+shm_ring::close_reader() {
+  ctrl_->reader_closed.store(1, std::memory_order_release);
+}
+bool
+shm_ring::reader_closed() const {
+  return ctrl_->reader_closed.load(std::memory_order_acquire) != 0;
+}
+
+// The flag store and the re-check of the ring on one side, and the position
+// store and the flag load on the other, must not be reordered. Otherwise
+// both sides can miss each other and the sleeper never wakes up. Hence the
+// full fences.
+void
+shm_ring::set_reader_waiting(bool waiting) {
+  ctrl_->reader_waiting.store(waiting, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+bool
+shm_ring::reader_waiting() const {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return ctrl_->reader_waiting.load(std::memory_order_seq_cst) != 0;
+}
+void
+shm_ring::set_writer_waiting(bool waiting) {
+  ctrl_->writer_waiting.store(waiting, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+bool
+shm_ring::writer_waiting() const {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  return ctrl_->writer_waiting.load(std::memory_order_seq_cst) != 0;
+}
+
+}  // namespace smf
@@ -0,0 +1,576 @@
+// Copyright 2019 SMF Authors
+//
+
+#include "smf/shm_transport.h"
+
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <seastar/core/future-util.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/net/packet.hh>
+#include <seastar/net/stack.hh>
+
+#include "smf/log.h"
+#include "smf/rpc_unix_address.h"
+#include "smf/shm_ring.h"
+
+namespace smf {
+
+namespace {
+constexpr uint32_t kHelloMagic = 0x736d6673;  // "smfs"
+constexpr char kAck = 1;
+/// \brief largest buffer handed to the input_stream per get()
+constexpr size_t kMaxReadSize = 1 << 17;
+
+struct hello {
+  uint32_t magic;
+  uint32_t ring_size;
+};
+
+/// \brief order of the descriptors sent with the hello
+enum fd_index : size_t {
+  fd_memfd = 0,
+  fd_c2s_data,
+  fd_c2s_space,
+  fd_s2c_data,
+  fd_s2c_space,
+  fd_count
+};
+
+/// \brief the listener maps what the peer sized; it must stay that size
+constexpr int kRequiredSeals = F_SEAL_SHRINK | F_SEAL_GROW;
+
+constexpr bool
+is_power_of_2(size_t x) {
+  return x != 0 && (x & (x - 1)) == 0;
+}
+
+size_t
+memfd_size(uint32_t ring_size) {
+  return 2 * shm_ring::mapping_size(ring_size);
+}
+
+void
+signal(int efd) {
+  // only fails with EAGAIN when the counter would overflow; the peer is
+  // already signaled in that case
+  (void)::eventfd_write(efd, 1);
+}
+
+/// \brief sendmsg()/recvmsg() state that must outlive the future
+struct fd_message {
+  /// \brief points the msghdr at our own members; call once the struct is
+  /// at its final address
+  msghdr *
+  header() {
+    iov.iov_base = &h;
+    iov.iov_len = sizeof(h);
+    std::memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    return &hdr;
+  }
+  msghdr *
+  header(const std::array<int, fd_count> &fds) {
+    header();
+    auto cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    std::memcpy(CMSG_DATA(cmsg), fds.data(), sizeof(int) * fd_count);
+    return &hdr;
+  }
+  /// \brief owns every received descriptor, even on error
+  std::vector<seastar::file_desc>
+  take_fds() {
+    std::vector<seastar::file_desc> ret;
+    for (auto cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        continue;
+      }
+      const size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for (size_t i = 0; i < n; ++i) {
+        int fd;
+        std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+        ret.push_back(seastar::file_desc::from_fd(fd));
+      }
+    }
+    return ret;
+  }
+
+  hello h{};
+  iovec iov{};
+  msghdr hdr{};
+  alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * fd_count)]{};
+};
+
+/// \brief one side of a connection: both rings and their wakeups
+class shm_channel : public seastar::enable_lw_shared_from_this<shm_channel> {
+ public:
+  /// \param efds - fd_c2s_data..fd_s2c_space, i.e.: without the memfd
+  shm_channel(seastar::pollable_fd peer, seastar::mmap_area area,
+              uint32_t ring_size, bool is_client,
+              std::array<seastar::file_desc, 4> efds, bool busy_poll)
+    : peer_(std::move(peer)), area_(std::move(area)),
+      in_(shm_ring::attach(
+        area_.get() + (is_client ? shm_ring::mapping_size(ring_size) : 0),
+        ring_size)),
+      out_(shm_ring::attach(
+        area_.get() + (is_client ? 0 : shm_ring::mapping_size(ring_size)),
+        ring_size)),
+      in_data_(std::move(efds[is_client ? 2 : 0])),
+      out_space_(std::move(efds[is_client ? 1 : 3])),
+      out_data_(std::move(efds[is_client ? 0 : 2])),
+      in_space_(std::move(efds[is_client ? 3 : 1])), busy_poll_(busy_poll) {}
+
+  seastar::pollable_fd &
+  peer() {
+    return peer_;
+  }
+
+  /// \brief the peer socket carries no data after the hello: anything read
+  /// from it, eof included, means the peer is gone
+  void
+  watch() {
+    (void)peer_.read_some(&peer_buf_, 1).then_wrapped(
+      [self = shared_from_this()](seastar::future<size_t> f) {
+        f.ignore_ready_future();
+        self->on_hangup();
+      });
+  }
+
+  /// \brief eof is an empty buffer
+  seastar::future<seastar::temporary_buffer<char>>
+  read() {
+    return wait_readable().then([self = shared_from_this()] {
+      using ret_type = seastar::temporary_buffer<char>;
+      const size_t n = std::min(self->in_.readable(), kMaxReadSize);
+      if (n == 0 || self->in_.reader_closed()) {
+        return seastar::make_ready_future<ret_type>();
+      }
+      ret_type buf(n);
+      self->in_.read(buf.get_write(), n);
+      if (self->in_.writer_waiting()) { signal(self->in_space_.get()); }
+      return seastar::make_ready_future<ret_type>(std::move(buf));
+    });
+  }
+
+  seastar::future<>
+  write(seastar::net::packet p) {
+    return seastar::do_with(
+      std::move(p), 0u, size_t(0),
+      [self = shared_from_this()](seastar::net::packet &p, unsigned &frag,
+                                  size_t &offset) {
+        return seastar::repeat([self, &p, &frag, &offset] {
+          if (self->write_closed()) {
+            return seastar::make_exception_future<seastar::stop_iteration>(
+              std::system_error(EPIPE, std::system_category(),
+                                "shm transport: peer closed"));
+          }
+          while (frag < p.nr_frags()) {
+            auto &f = p.frag(frag);
+            offset += self->out_.write(f.base + offset, f.size - offset);
+            if (offset == f.size) {
+              ++frag;
+              offset = 0;
+              continue;
+            }
+            // ring is full. let the reader drain it
+            self->notify_reader();
+            return self->wait_writable().then(
+              [] { return seastar::stop_iteration::no; });
+          }
+          self->notify_reader();
+          return seastar::make_ready_future<seastar::stop_iteration>(
+            seastar::stop_iteration::yes);
+        });
+      });
+  }
+
+  void
+  shutdown_input() {
+    in_.close_reader();
+    // wake our reader and a peer writer waiting for space
+    signal(in_data_.get_file_desc().get());
+    signal(in_space_.get());
+    maybe_hangup();
+  }
+  void
+  shutdown_output() {
+    out_.close_writer();
+    signal(out_data_.get());
+    signal(out_space_.get_file_desc().get());
+    maybe_hangup();
+  }
+
+ private:
+  bool
+  read_ready() const {
+    return in_.readable() > 0 || in_.writer_closed() || in_.reader_closed() ||
+           hangup_;
+  }
+  bool
+  write_closed() const {
+    return out_.reader_closed() || out_.writer_closed() || hangup_;
+  }
+  bool
+  write_ready() const {
+    return out_.writable() > 0 || write_closed();
+  }
+  void
+  notify_reader() {
+    if (out_.reader_waiting()) { signal(out_data_.get()); }
+  }
+
+  seastar::future<>
+  wait_readable() {
+    return seastar::repeat([self = shared_from_this()] {
+      using seastar::stop_iteration;
+      if (self->read_ready()) {
+        return seastar::make_ready_future<stop_iteration>(stop_iteration::yes);
+      }
+      if (self->busy_poll_) {
+        return seastar::later().then([] { return stop_iteration::no; });
+      }
+      self->in_.set_reader_waiting(true);
+      if (self->read_ready()) {
+        self->in_.set_reader_waiting(false);
+        return seastar::make_ready_future<stop_iteration>(stop_iteration::yes);
+      }
+      return self->in_data_
+        .read_some(reinterpret_cast<char *>(&self->in_counter_),
+                   sizeof(self->in_counter_))
+        .then([self](size_t) {
+          self->in_.set_reader_waiting(false);
+          return stop_iteration::no;
+        });
+    });
+  }
+  seastar::future<>
+  wait_writable() {
+    return seastar::repeat([self = shared_from_this()] {
+      using seastar::stop_iteration;
+      if (self->write_ready()) {
+        return seastar::make_ready_future<stop_iteration>(stop_iteration::yes);
+      }
+      if (self->busy_poll_) {
+        return seastar::later().then([] { return stop_iteration::no; });
+      }
+      self->out_.set_writer_waiting(true);
+      if (self->write_ready()) {
+        self->out_.set_writer_waiting(false);
+        return seastar::make_ready_future<stop_iteration>(stop_iteration::yes);
+      }
+      return self->out_space_
+        .read_some(reinterpret_cast<char *>(&self->out_counter_),
+                   sizeof(self->out_counter_))
+        .then([self](size_t) {
+          self->out_.set_writer_waiting(false);
+          return stop_iteration::no;
+        });
+    });
+  }
+
+  /// \brief both directions closed locally: tell the peer
+  void
+  maybe_hangup() {
+    if (in_.reader_closed() && out_.writer_closed() && !peer_shutdown_) {
+      peer_shutdown_ = true;
+      peer_.shutdown(SHUT_RDWR);
+    }
+  }
+  void
+  on_hangup() {
+    hangup_ = true;
+    // wake our own sleepers; they see hangup_ and give up
+    signal(in_data_.get_file_desc().get());
+    signal(out_space_.get_file_desc().get());
+  }
+
+ private:
+  seastar::pollable_fd peer_;
+  seastar::mmap_area area_;
+  shm_ring in_;
+  shm_ring out_;
+  /// \brief we sleep on these
+  seastar::pollable_fd in_data_;
+  seastar::pollable_fd out_space_;
+  /// \brief the peer sleeps on these
+  seastar::file_desc out_data_;
+  seastar::file_desc in_space_;
+  const bool busy_poll_;
+  bool hangup_{false};
+  bool peer_shutdown_{false};
+  char peer_buf_{0};
+  uint64_t in_counter_{0};
+  uint64_t out_counter_{0};
+};
+
+class shm_data_source_impl final : public seastar::data_source_impl {
+ public:
+  explicit shm_data_source_impl(seastar::lw_shared_ptr<shm_channel> ch)
+    : ch_(std::move(ch)) {}
+  seastar::future<seastar::temporary_buffer<char>>
+  get() final {
+    return ch_->read();
+  }
+
+ private:
+  seastar::lw_shared_ptr<shm_channel> ch_;
+};
+
+class shm_data_sink_impl final : public seastar::data_sink_impl {
+ public:
+  explicit shm_data_sink_impl(seastar::lw_shared_ptr<shm_channel> ch)
+    : ch_(std::move(ch)) {}
+  seastar::future<>
+  put(seastar::net::packet p) final {
+    return ch_->write(std::move(p));
+  }
+  seastar::future<>
+  close() final {
+    ch_->shutdown_output();
+    return seastar::make_ready_future<>();
+  }
+
+ private:
+  seastar::lw_shared_ptr<shm_channel> ch_;
+};
+
+class shm_connected_socket_impl final
+  : public seastar::net::connected_socket_impl {
+ public:
+  explicit shm_connected_socket_impl(seastar::lw_shared_ptr<shm_channel> ch)
+    : ch_(std::move(ch)) {}
+  ~shm_connected_socket_impl() {
+    ch_->shutdown_input();
+    ch_->shutdown_output();
+  }
+
+  seastar::data_source
+  source() final {
+    return seastar::data_source(std::make_unique<shm_data_source_impl>(ch_));
+  }
+  seastar::data_sink
+  sink() final {
+    return seastar::data_sink(std::make_unique<shm_data_sink_impl>(ch_));
+  }
+  void
+  shutdown_input() final {
+    ch_->shutdown_input();
+  }
+  void
+  shutdown_output() final {
+    ch_->shutdown_output();
+  }
+  // there is no network underneath. writes are never delayed and the peer
+  // socket notices a dead process
+  void
+  set_nodelay(bool) final {}
+  bool
+  get_nodelay() const final {
+    return true;
+  }
+  void
+  set_keepalive(bool) final {}
+  bool
+  get_keepalive() const final {
+    return false;
+  }
+  void
+  set_keepalive_parameters(const seastar::net::keepalive_params &) final {}
+  seastar::net::keepalive_params
+  get_keepalive_parameters() const final {
+    return seastar::net::tcp_keepalive_params{std::chrono::seconds(0),
+                                              std::chrono::seconds(0), 0};
+  }
+
+ private:
+  seastar::lw_shared_ptr<shm_channel> ch_;
+};
+
+seastar::connected_socket
+make_socket(seastar::lw_shared_ptr<shm_channel> ch) {
+  ch->watch();
+  return seastar::connected_socket(
+    std::make_unique<shm_connected_socket_impl>(std::move(ch)));
+}
+
+std::array<seastar::file_desc, 4>
+take_eventfds(std::vector<seastar::file_desc> &fds) {
+  return {std::move(fds[fd_c2s_data]), std::move(fds[fd_c2s_space]),
+          std::move(fds[fd_s2c_data]), std::move(fds[fd_s2c_space])};
+}
+
+/// \brief listening side of the hello
+seastar::future<seastar::connected_socket>
+accept_channel(seastar::pollable_fd fd, shm_transport_opts opts) {
+  struct state {
+    explicit state(seastar::pollable_fd f) : fd(std::move(f)) {}
+    seastar::pollable_fd fd;
+    fd_message msg;
+  };
+  auto st = seastar::make_lw_shared<state>(std::move(fd));
+  return st->fd.recvmsg(st->msg.header()).then([st, opts](size_t n) {
+    auto fds = st->msg.take_fds();
+    const auto &h = st->msg.h;
+    LOG_THROW_IF(n != sizeof(hello) || h.magic != kHelloMagic,
+                 "shm transport: bad hello from peer");
+    LOG_THROW_IF(fds.size() != fd_count,
+                 "shm transport: expected {} descriptors, got {}", fd_count,
+                 fds.size());
+    LOG_THROW_IF(!is_power_of_2(h.ring_size) ||
+                   h.ring_size < shm_transport_opts::kMinRingSize ||
+                   h.ring_size > opts.ring_size,
+                 "shm transport: refusing ring of {} bytes. min: {}, max: {}",
+                 h.ring_size, shm_transport_opts::kMinRingSize,
+                 opts.ring_size);
+    // a short memfd would SIGBUS us on first touch; the seals keep the
+    // peer from shrinking it after we mapped it
+    const int seals = ::fcntl(fds[fd_memfd].get(), F_GET_SEALS);
+    LOG_THROW_IF(seals < 0 || (seals & kRequiredSeals) != kRequiredSeals,
+                 "shm transport: memfd is not sealed against resizing");
+    LOG_THROW_IF(fds[fd_memfd].size() < memfd_size(h.ring_size),
+                 "shm transport: memfd smaller than its rings");
+    auto area = fds[fd_memfd].map_shared_rw(memfd_size(h.ring_size), 0);
+    auto ch = seastar::make_lw_shared<shm_channel>(
+      std::move(st->fd), std::move(area), h.ring_size, false,
+      take_eventfds(fds), opts.busy_poll);
+    return ch->peer().write_all(&kAck, 1).then([ch] { return make_socket(ch); });
+  });
+}
+
+class shm_server_socket_impl final : public seastar::net::server_socket_impl {
+ public:
+  shm_server_socket_impl(seastar::pollable_fd listener,
+                         seastar::socket_address address,
+                         shm_transport_opts opts)
+    : listener_(std::move(listener)), address_(address), opts_(opts) {}
+
+  seastar::future<seastar::accept_result>
+  accept() final {
+    using ret_type = std::optional<seastar::accept_result>;
+    return seastar::repeat_until_value([this] {
+      return listener_.accept().then(
+        [this](std::tuple<seastar::pollable_fd, seastar::socket_address> t) {
+          auto addr = std::get<1>(t);
+          return accept_channel(std::move(std::get<0>(t)), opts_)
+            .then_wrapped([addr](seastar::future<seastar::connected_socket> f) {
+              try {
+                return ret_type(seastar::accept_result{f.get0(), addr});
+              } catch (...) {
+                // one bad peer must not stop the accept loop
+                LOG_WARN("shm transport: dropping connection: {}",
+                         std::current_exception());
+                return ret_type(std::nullopt);
+              }
+            });
+        });
+    });
+  }
+  void
+  abort_accept() final {
+    listener_.shutdown(SHUT_RD);
+  }
+
+ private:
+  seastar::pollable_fd listener_;
+  seastar::socket_address address_;
+  const shm_transport_opts opts_;
+};
+
+}  // namespace
+
+seastar::future<seastar::connected_socket>
+shm_connect(const seastar::sstring &path, shm_transport_opts opts) {
+  LOG_THROW_IF(!is_power_of_2(opts.ring_size) ||
+                 opts.ring_size < shm_transport_opts::kMinRingSize,
+               "shm transport: ring_size must be a power of 2, at least {}: {}",
+               shm_transport_opts::kMinRingSize, opts.ring_size);
+  const int raw_memfd =
+    ::memfd_create("smf-shm-rings", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (raw_memfd < 0) {
+    throw std::system_error(errno, std::system_category(), "memfd_create");
+  }
+  auto memfd = seastar::file_desc::from_fd(raw_memfd);
+  memfd.truncate(memfd_size(opts.ring_size));
+  if (::fcntl(memfd.get(), F_ADD_SEALS, kRequiredSeals) < 0) {
+    throw std::system_error(errno, std::system_category(), "F_ADD_SEALS");
+  }
+  auto area = memfd.map_shared_rw(memfd_size(opts.ring_size), 0);
+  // the peer attaches to both as soon as it gets the memfd
+  shm_ring::create(area.get(), opts.ring_size);
+  shm_ring::create(area.get() + shm_ring::mapping_size(opts.ring_size),
+                   opts.ring_size);
+
+  std::array<seastar::file_desc, 4> efds{
+    {seastar::file_desc::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+     seastar::file_desc::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+     seastar::file_desc::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+     seastar::file_desc::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}};
+
+  struct state {
+    seastar::pollable_fd fd;
+    seastar::socket_address address;
+    seastar::file_desc memfd;
+    seastar::mmap_area area;
+    std::array<seastar::file_desc, 4> efds;
+    fd_message msg;
+    char ack{0};
+  };
+  auto st = seastar::make_lw_shared<state>(state{
+    seastar::pollable_fd(seastar::file_desc::socket(
+      AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)),
+    make_unix_address(path), std::move(memfd), std::move(area),
+    std::move(efds)});
+  st->msg.h = hello{kHelloMagic, opts.ring_size};
+
+  return st->fd.connect(st->address)
+    .then([st] {
+      return st->fd.sendmsg(st->msg.header(
+        {st->memfd.get(), st->efds[0].get(), st->efds[1].get(),
+         st->efds[2].get(), st->efds[3].get()}));
+    })
+    .then([st](size_t) { return st->fd.read_some(&st->ack, 1); })
+    .then([st, opts](size_t n) {
+      if (n != 1 || st->ack != kAck) {
+        throw std::system_error(ECONNREFUSED, std::system_category(),
+                                "shm transport: peer refused the rings");
+      }
+      auto ch = seastar::make_lw_shared<shm_channel>(
+        std::move(st->fd), std::move(st->area), opts.ring_size, true,
+        std::move(st->efds), opts.busy_poll);
+      return make_socket(std::move(ch));
+    });
+}
+
+seastar::server_socket
+shm_listen(const seastar::sstring &path, shm_transport_opts opts) {
+  auto address = make_unix_address(path);
+  if (!path.empty()) { remove_stale_unix_socket(path.c_str()); }
+  auto fd = seastar::file_desc::socket(
+    AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  fd.bind(address.u.sa, sizeof(address.u.un));
+  fd.listen(128);
+  return seastar::server_socket(std::make_unique<shm_server_socket_impl>(
+    seastar::pollable_fd(std::move(fd)), address, opts));
+}
+
+}  // namespace smf
@@ -24,10 +24,14 @@ struct load_channel {
 
   load_channel(uint64_t id, const char *ip, uint16_t port, uint64_t mem,
                smf::rpc::compression_flags compression, 
-               seastar::shared_ptr<seastar::tls::certificate_credentials> credentials)
+               seastar::shared_ptr<seastar::tls::certificate_credentials> credentials,
+               const seastar::sstring &unix_path = "")
     : channel_id_(id) {
     smf::rpc_client_opts opts{};
     opts.server_addr = seastar::ipv4_addr{ip, port};
+    if (!unix_path.empty()) {
+      opts.server_address = smf::make_unix_address(unix_path);
+    }
     opts.memory_avail_for_client = mem;
     opts.credentials = credentials;
     client = seastar::make_shared<ClientService>(std::move(opts));
@@ -42,7 +42,8 @@ class __attribute__((visibility("default"))) load_generator {
       channels_.push_back(
         std::make_unique<channel_t>(rand.next(), args.ip, args.port,
                                     args.memory_per_core / args.concurrency,
-                                    args.compression, args.credentials));
+                                    args.compression, args.credentials,
+                                    args.unix_path));
     }
   }
   ~load_generator() {}
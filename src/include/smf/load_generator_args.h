@@ -34,6 +34,9 @@ struct load_generator_args {
   size_t memory_per_core;
   smf::rpc::compression_flags compression;
   seastar::shared_ptr<seastar::tls::certificate_credentials> credentials;
+  /// \brief if not empty, connect to this unix domain socket instead of
+  /// ip:port
+  seastar::sstring unix_path;
   const boost::program_options::variables_map cfg;
 };
 
@@ -43,6 +46,7 @@ namespace std {
 inline std::ostream &
 operator<<(std::ostream &o, const smf::load_generator_args &args) {
   o << "generator_args{ip=" << args.ip << ", port=" << args.port
+    << ", unix_path=" << args.unix_path
     << ", num_of_req=" << args.num_of_req
     << ", concurrency=" << args.concurrency
     << ", memory_per_client=" << args.memory_per_core / args.concurrency
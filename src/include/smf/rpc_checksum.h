@@ -0,0 +1,43 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "smf/macros.h"
+#include "smf/rpc_generated.h"
+
+namespace smf {
+
+/// \brief false if this build cannot compute `t`, i.e.: xxhash3 requires
+/// xxhash >= 0.8.0
+bool rpc_checksum_supported(rpc::checksum_type t);
+
+/// \brief 32 bit checksum of the payload with the given algorithm.
+/// Returns 0 for rpc::checksum_type_none
+uint32_t rpc_checksum(rpc::checksum_type t, const char *data, size_t size);
+
+/// \brief castagnoli crc32. Uses the SSE4.2 instruction if the cpu has it,
+/// falls back to a table driven implementation otherwise
+uint32_t crc32c(const char *data, size_t size);
+
+SMF_ALWAYS_INLINE rpc::checksum_type
+rpc_checksum_type(const rpc::header &hdr) {
+  constexpr uint8_t kMask = rpc::header_bit_flags_checksum_type_lo |
+                            rpc::header_bit_flags_checksum_type_hi;
+  return static_cast<rpc::checksum_type>(
+    (static_cast<uint8_t>(hdr.bitflags()) & kMask) >> 1);
+}
+
+SMF_ALWAYS_INLINE void
+set_rpc_checksum_type(rpc::header &hdr, rpc::checksum_type t) {
+  constexpr uint8_t kMask = rpc::header_bit_flags_checksum_type_lo |
+                            rpc::header_bit_flags_checksum_type_hi;
+  const uint8_t flags = static_cast<uint8_t>(hdr.bitflags()) & ~kMask;
+  hdr.mutate_bitflags(static_cast<rpc::header_bit_flags>(
+    flags | ((static_cast<uint8_t>(t) << 1) & kMask)));
+}
+
+}  // namespace smf
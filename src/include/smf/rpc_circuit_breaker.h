@@ -0,0 +1,127 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <optional>
+#include <ostream>
+
+#include <seastar/core/lowres_clock.hh>
+
+#include "smf/macros.h"
+
+namespace smf {
+
+/// \brief failure of requests rejected by an open rpc_circuit_breaker.
+/// Nothing was sent
+class rpc_circuit_open_error final : public std::exception {
+ public:
+  virtual const char *
+  what() const noexcept {
+    return "circuit breaker open: request not sent";
+  }
+};
+
+struct rpc_circuit_breaker_opts {
+  /// \brief the rolling window is `buckets` slices of `bucket_duration`
+  std::chrono::milliseconds bucket_duration{1000};
+  static constexpr size_t buckets = 10;
+  /// \brief never trips on fewer requests than this in the window
+  uint32_t min_requests = 20;
+  /// \brief trips when at least this fraction of the window failed
+  double max_error_rate = 0.5;
+  /// \brief trips when the `latency_percentile` of the window is above
+  /// `latency_threshold`, i.e.: when more than 1% of the requests took
+  /// longer than 500ms. 0 disables latency tripping
+  std::chrono::milliseconds latency_threshold{0};
+  double latency_percentile = 99.0;
+  /// \brief time spent open before letting probes through
+  std::chrono::milliseconds open_duration{5000};
+  /// \brief half-open: probes in flight at once, and successes in a row
+  /// needed to close again. Any failed or slow probe reopens
+  uint32_t half_open_probes = 3;
+};
+
+struct rpc_circuit_breaker_stats {
+  /// \brief requests failed fast while open or half-open
+  uint64_t rejected{0};
+  /// \brief closed -> open and half-open -> open transitions
+  uint64_t trips{0};
+};
+
+/// \brief closed/open/half-open breaker for one upstream. See
+/// rpc_client_opts::circuit_breaker.
+///
+/// Counts requests, failures and requests slower than the latency
+/// threshold over a rolling window. Latency percentiles are checked
+/// through their definition: the percentile is above the threshold iff more
+/// than `1 - percentile` of the requests were slower; so no histogram is
+/// needed. Time is passed in by the caller.
+///
+class rpc_circuit_breaker {
+ public:
+  using clock_type = seastar::lowres_clock;
+  enum class state : uint8_t { closed = 0, open = 1, half_open = 2 };
+
+  explicit rpc_circuit_breaker(rpc_circuit_breaker_opts opts);
+
+  /// \brief handed out by allow(). Outcomes of requests let through
+  /// before the last state change are ignored
+  struct permit {
+    uint64_t generation;
+  };
+
+  /// \brief std::nullopt if the request must fail fast. Every permit must
+  /// be given back to record() exactly once
+  std::optional<permit> allow(clock_type::time_point now);
+  /// \brief outcome of a request allow() let through
+  void record(permit p, clock_type::time_point now, bool failed,
+              clock_type::duration latency);
+  /// \brief gives back the permit of a request the caller gave up on.
+  /// Counts neither as a success nor as a failure
+  void cancel(permit p);
+
+  SMF_ALWAYS_INLINE state
+  current_state() const {
+    return state_;
+  }
+  SMF_ALWAYS_INLINE const rpc_circuit_breaker_stats &
+  stats() const {
+    return stats_;
+  }
+  SMF_ALWAYS_INLINE const rpc_circuit_breaker_opts &
+  opts() const {
+    return opts_;
+  }
+
+ private:
+  struct bucket {
+    int64_t epoch{-1};
+    uint32_t requests{0};
+    uint32_t failures{0};
+    uint32_t slow{0};
+  };
+  bucket &current_bucket(clock_type::time_point now);
+  bool should_trip(clock_type::time_point now) const;
+  void transition(state s, clock_type::time_point now);
+
+ private:
+  const rpc_circuit_breaker_opts opts_;
+  state state_{state::closed};
+  std::array<bucket, rpc_circuit_breaker_opts::buckets> window_{};
+  uint64_t generation_{0};
+  clock_type::time_point opened_at_{};
+  uint32_t probes_inflight_{0};
+  uint32_t probes_ok_{0};
+  rpc_circuit_breaker_stats stats_;
+};
+
+}  // namespace smf
+
+namespace std {
+ostream &operator<<(ostream &o, smf::rpc_circuit_breaker::state s);
+}  // namespace std
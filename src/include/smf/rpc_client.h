@@ -2,26 +2,46 @@
 //
 #pragma once
 // std
+#include <array>
 #include <memory>
 #include <utility>
 #include <vector>
 #include <optional>
 #include <map>
+#include <unordered_set>
 
+#include <seastar/core/abort_source.hh>
 #include <seastar/core/gate.hh>
+#include <seastar/core/metrics_registration.hh>
 #include <seastar/net/tls.hh>
 #include <seastar/core/shared_ptr.hh>
 #include "smf/histogram.h"
 #include "smf/macros.h"
+#include "smf/rpc_circuit_breaker.h"
 #include "smf/rpc_connection.h"
 #include "smf/rpc_envelope.h"
 #include "smf/rpc_filter.h"
+#include "smf/rpc_fragment_assembler.h"
+#include "smf/rpc_handshake.h"
+#include "smf/rpc_payload_headers.h"
 #include "smf/rpc_recv_typed_context.h"
+#include "smf/rpc_stream.h"
+#include "smf/rpc_unix_address.h"
+#include "smf/shm_transport.h"
 
 namespace smf {
 
 struct rpc_client_opts {
   seastar::ipv4_addr server_addr;
+  /// \brief if set, connect() uses this address instead of `server_addr`.
+  /// i.e.: `smf::make_unix_address("/run/app.sock")` for a unix domain
+  /// socket served by rpc_server_args::unix_address
+  std::optional<seastar::socket_address> server_address;
+  /// \brief if not empty, connect() over shared memory to a server on this
+  /// host listening on rpc_server_args::shm_path. Takes precedence over the
+  /// addresses above. `credentials` are not used
+  seastar::sstring shm_path;
+  shm_transport_opts shm;
   /// \ brief rpc client tls trust certficate
   ///
   seastar::shared_ptr<seastar::tls::certificate_credentials> credentials;
@@ -33,6 +53,33 @@ struct rpc_client_opts {
   /// \brief 1GB. After this limit, each connection
   /// will block until there are enough bytes free in memory to continue
   uint64_t memory_avail_for_client = uint64_t(1) << 30 /*1GB*/;
+  /// \brief max time a request may wait for other requests to share the
+  /// same flush() of the socket. 0 means flush once per reactor tick
+  typename seastar::timer<>::duration max_write_cork =
+    std::chrono::microseconds(0);
+  /// \brief checksum algorithm for requests. The server replies with the
+  /// same one. Defaults to xxhash64, understood by every server version.
+  /// Use checksum_type_none only on trusted links or with TLS
+  rpc::checksum_type checksum = rpc::checksum_type::checksum_type_xxhash64;
+  /// \brief request bodies larger than this are sent as a train of
+  /// fragment frames, so the server reserves memory one fragment at a time.
+  /// 0 disables fragmentation. Needs a server that understands fragments
+  uint32_t max_fragment_size = 0;
+  /// \brief connect() exchanges a control_type::handshake with the server
+  /// before returning. The cheapest codec and checksum both sides support
+  /// are then used automatically; see rpc_negotiated. Needs a server that
+  /// understands handshakes
+  bool handshake = false;
+  /// \brief codecs offered in the handshake. 0 disables automatic
+  /// compression
+  uint32_t codecs = rpc_handshake::kDefaultCodecs;
+  /// \brief requests up to this size are not compressed by the negotiated
+  /// codec
+  uint32_t min_compression_size = 1024;
+  /// \brief if set, requests fail fast with rpc_circuit_open_error - without
+  /// touching the socket - while the server is failing or slow. The state
+  /// is exported as metrics of the `smf::rpc_client` group
+  std::optional<rpc_circuit_breaker_opts> circuit_breaker;
 };
 
 /// \brief class intented for communicating with a remote host
@@ -72,6 +119,10 @@ class rpc_client {
 
     promise_t pr;
     uint16_t session{0};
+    rpc_priority priority{rpc_priority::normal};
+    /// \brief handed to the send queue. Only then can a cancel frame follow
+    bool enqueued{false};
+    bool cancelled{false};
   };
 
   using in_filter_t =
@@ -100,6 +151,33 @@ class rpc_client {
         });
       });
   }
+  /// \brief same as send(), but gives up once `as` fires: the future fails
+  /// with seastar::abort_requested_exception and a control_type::cancel
+  /// frame tells the server to stop working on the request.
+  /// `as` must outlive the returned future
+  /// \code{.cpp}
+  ///    seastar::abort_source as;
+  ///    seastar::timer<> t([&as] { as.request_abort(); });
+  ///    t.arm(10ms);
+  ///    return client->send<Response>(std::move(e), as);
+  /// \endcode
+  template <typename T>
+  seastar::future<rpc_recv_typed_context<T>>
+  send(rpc_envelope e, seastar::abort_source &as) {
+    using ret_type = rpc_recv_typed_context<T>;
+    return seastar::with_gate(
+      *dispatch_gate_, [this, e = std::move(e), &as]() mutable {
+        return raw_send(std::move(e), &as).then([](auto opt_ctx) {
+          return seastar::make_ready_future<ret_type>(std::move(opt_ctx));
+        });
+      });
+  }
+
+  /// \brief allocates a session for a streaming rpc. Nothing is sent until
+  /// the first write() or close() on the stream. Used by smfc stubs
+  virtual seastar::future<seastar::lw_shared_ptr<rpc_stream>>
+  open_stream(uint32_t request_id,
+              rpc_priority priority = rpc_priority::normal) final;
 
   virtual seastar::future<> connect() final;
   /// \brief if connection is open, it will
@@ -124,6 +202,11 @@ class rpc_client {
   get_histogram() final {
     return hist_;
   }
+  /// \brief latency of the requests sent with priority `p` only
+  SMF_ALWAYS_INLINE virtual seastar::lw_shared_ptr<histogram>
+  get_histogram(rpc_priority p) final {
+    return priority_hist_[static_cast<uint8_t>(p)];
+  }
 
   /// \brief use to enqueue or dequeue filters
   /// \code{.cpp}
@@ -141,26 +224,71 @@ class rpc_client {
   outgoing_filters() final {
     return out_filters_;
   }
+  /// \brief what connect() agreed on with the server, if opts.handshake
+  SMF_ALWAYS_INLINE virtual const std::optional<rpc_negotiated> &
+  negotiated() const final {
+    return negotiated_;
+  }
   SMF_ALWAYS_INLINE virtual bool
   is_conn_valid() const final {
     return conn_ && conn_->is_valid();
   }
+  /// \brief nullptr unless rpc_client_opts::circuit_breaker was set
+  SMF_ALWAYS_INLINE virtual const rpc_circuit_breaker *
+  circuit_breaker() const final {
+    return breaker_ ? &breaker_->breaker : nullptr;
+  }
+  /// \brief unary requests sent and not answered yet
+  SMF_ALWAYS_INLINE virtual size_t
+  outstanding() const final {
+    return rpc_slots_.size();
+  }
+  /// \brief frames per flush of the current connection.
+  /// i.e.: `frames / flushes` is the write batching factor
+  SMF_ALWAYS_INLINE virtual rpc_send_queue_stats
+  send_queue_stats() const final {
+    if (!conn_) { return rpc_send_queue_stats{}; }
+    return conn_->send_queue.stats();
+  }
 
   SMF_DISALLOW_COPY_AND_ASSIGN(rpc_client);
 
  public:
   const seastar::ipv4_addr server_addr;
+  /// \brief what connect() dials. `server_addr` unless
+  /// rpc_client_opts::server_address was set
+  const seastar::socket_address server_address;
+  /// \brief rpc_client_opts::shm_path
+  const seastar::sstring shm_path;
 
   // public for the stage pipelines
   seastar::future<rpc_recv_context> apply_incoming_filters(rpc_recv_context);
   seastar::future<rpc_envelope> apply_outgoing_filters(rpc_envelope);
 
  private:
-  seastar::future<std::optional<rpc_recv_context>> raw_send(rpc_envelope e);
+  /// \brief goes through the circuit breaker, if any
+  seastar::future<std::optional<rpc_recv_context>>
+  raw_send(rpc_envelope e, seastar::abort_source *as = nullptr);
+  seastar::future<std::optional<rpc_recv_context>>
+  send_on_connection(rpc_envelope e, seastar::abort_source *as);
+  /// \brief fails the pending request and sends control_type::cancel
+  void cancel_session(uint16_t session);
   seastar::future<> do_reads();
-  seastar::future<> dispatch_write(rpc_envelope e);
+  /// \brief not written at all if `work` is cancelled first
+  seastar::future<> dispatch_write(rpc_envelope e,
+                                   seastar::lw_shared_ptr<work_item> work);
   seastar::future<> process_one_request();
+  /// \brief returns false if the connection was invalidated
+  bool complete_session(seastar::lw_shared_ptr<rpc_connection> conn,
+                        std::optional<rpc_recv_context> opt);
+  bool complete_stream_frame(seastar::lw_shared_ptr<rpc_connection> conn,
+                             rpc_recv_context &&ctx);
+  bool complete_handshake(seastar::lw_shared_ptr<rpc_connection> conn,
+                          const rpc_recv_context &ctx);
   void fail_outstanding_futures();
+  struct breaker_state;
+  static void register_breaker_metrics(breaker_state *b,
+                                       const seastar::socket_address &server);
   // stage pipeline applications
   seastar::future<rpc_recv_context> stage_incoming_filters(rpc_recv_context);
   seastar::future<rpc_envelope> stage_outgoing_filters(rpc_envelope);
@@ -172,13 +300,37 @@ class rpc_client {
   uint64_t read_counter_{0};
   seastar::lw_shared_ptr<rpc_connection> conn_;
   std::unordered_map<uint16_t, seastar::lw_shared_ptr<work_item>> rpc_slots_;
+  std::unordered_map<uint16_t, seastar::lw_shared_ptr<rpc_stream>> streams_;
+  /// \brief sessions given up on. Their replies - if any - are dropped
+  std::unordered_set<uint16_t> cancelled_;
+  /// \brief control_type::payload_headers waiting for their reply, keyed by
+  /// header.session
+  std::unordered_map<uint16_t, rpc_payload_headers> payload_headers_;
+  rpc_fragment_assembler fragments_{FLATBUFFERS_MAX_BUFFER_SIZE};
 
   std::vector<in_filter_t> in_filters_;
   std::vector<out_filter_t> out_filters_;
 
   std::unique_ptr<seastar::gate> dispatch_gate_ = nullptr;
-  seastar::semaphore serialize_writes_{1};
+  typename seastar::timer<>::duration max_write_cork_;
+  rpc::checksum_type checksum_;
+  uint32_t max_fragment_size_;
+  /// \brief our side of the handshake. std::nullopt if disabled
+  std::optional<rpc::handshake> handshake_;
+  uint32_t min_compression_size_;
+  shm_transport_opts shm_;
+  std::optional<seastar::promise<>> handshake_pr_;
+  std::optional<rpc_negotiated> negotiated_;
+  /// \brief never moves, so the metrics can point into it
+  struct breaker_state {
+    explicit breaker_state(rpc_circuit_breaker_opts o) : breaker(o) {}
+    rpc_circuit_breaker breaker;
+    seastar::metrics::metric_groups metrics;
+  };
+  seastar::lw_shared_ptr<breaker_state> breaker_;
   seastar::lw_shared_ptr<histogram> hist_ = nullptr;
+  /// \brief same as hist_, indexed by rpc_priority
+  std::array<seastar::lw_shared_ptr<histogram>, kRpcPriorities> priority_hist_;
   uint16_t session_idx_{0};
 };
 
@@ -0,0 +1,325 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/metrics.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
+
+#include "smf/log.h"
+#include "smf/macros.h"
+#include "smf/random.h"
+#include "smf/reconnect_client.h"
+#include "smf/rpc_client.h"
+#include "smf/rpc_hedging.h"
+
+namespace smf {
+
+template <typename Client>
+struct rpc_client_pool_opts {
+  /// \brief one or more servers of the same service
+  std::vector<rpc_client_opts> endpoints;
+  /// \brief opened by connect()
+  uint32_t min_connections_per_endpoint = 1;
+  uint32_t max_connections_per_endpoint = 8;
+  /// \brief a new connection to the endpoint is opened in the background
+  /// when the least loaded pick already has this many requests in flight
+  uint32_t max_outstanding_per_connection = 128;
+  /// \brief called on every new client before it connects, i.e.: to push
+  /// filters or enable histograms
+  std::function<void(Client &)> configure;
+  /// \brief see hedged()
+  rpc_hedging_opts hedging;
+  /// \brief if not empty, the hedging stats are exported as metrics of the
+  /// `smf::rpc_client_pool` group with this `pool` label
+  seastar::sstring name;
+};
+
+/// \brief N connections - `Client` is an smfc generated client - to one
+/// or more endpoints. get() picks two connections at random and returns the
+/// one with fewer unary requests in flight ("power of two choices").
+///
+/// Broken connections are skipped and handed to reconnect_client, which
+/// reconnects them in the background with exponential backoff.
+///
+/// \code{.cpp}
+///    return pool.get()->Get(std::move(req));
+/// \endcode
+///
+template <typename Client>
+class rpc_client_pool {
+ public:
+  static_assert(std::is_base_of<rpc_client, Client>::value,
+                "rpc_client_pool needs a derived class of smf::rpc_client");
+  using opts_type = rpc_client_pool_opts<Client>;
+
+  explicit rpc_client_pool(opts_type opts)
+    : opts_(std::move(opts)), hedging_(opts_.hedging) {
+    LOG_THROW_IF(opts_.endpoints.empty(), "rpc_client_pool needs endpoints");
+    LOG_THROW_IF(opts_.min_connections_per_endpoint == 0 ||
+                   opts_.min_connections_per_endpoint >
+                     opts_.max_connections_per_endpoint,
+                 "Invalid rpc_client_pool connection bounds: min {}, max {}",
+                 opts_.min_connections_per_endpoint,
+                 opts_.max_connections_per_endpoint);
+    endpoints_.resize(opts_.endpoints.size());
+    if (!opts_.name.empty()) { register_metrics(); }
+  }
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_client_pool);
+
+  seastar::future<>
+  connect() {
+    std::vector<uint32_t> todo;
+    for (auto i = 0u; i < endpoints_.size(); ++i) {
+      for (auto j = 0u; j < opts_.min_connections_per_endpoint; ++j) {
+        todo.push_back(i);
+      }
+    }
+    return seastar::parallel_for_each(
+      std::move(todo), [this](uint32_t e) { return add_connection(e); });
+  }
+  seastar::future<>
+  stop() {
+    return gate_.close().then([this] {
+      return seastar::parallel_for_each(
+        conns_, [](auto &c) { return c->rc.stop(); });
+    });
+  }
+
+  /// \brief least loaded of two random healthy connections. Never fails:
+  /// if no connection is healthy, requests on the returned client fail
+  seastar::shared_ptr<Client>
+  get() {
+    const size_t n = conns_.size();
+    LOG_THROW_IF(n == 0, "rpc_client_pool::get() before connect()");
+    const size_t i = rand_.next() % n;
+    const size_t j = n > 1 ? (i + 1 + rand_.next() % (n - 1)) % n : i;
+    connection *a = conns_[i].get();
+    connection *b = conns_[j].get();
+    connection *best = nullptr;
+    for (auto c : {a, b}) {
+      if (!healthy(c)) { continue; }
+      if (!best ||
+          c->client()->outstanding() < best->client()->outstanding()) {
+        best = c;
+      }
+    }
+    if (best == nullptr) {
+      for (auto &c : conns_) {
+        if (healthy(c.get())) {
+          best = c.get();
+          break;
+        }
+      }
+    }
+    if (best == nullptr) { return a->client(); }
+    if (best->client()->outstanding() >= opts_.max_outstanding_per_connection) {
+      maybe_grow(best->endpoint);
+    }
+    return best->client();
+  }
+
+  /// \brief `fn(Client &, seastar::abort_source &)` sends one request and
+  /// returns its future. If it did not resolve after the hedge delay - see
+  /// rpc_hedging_policy - and the budget allows it, `fn` is called again
+  /// with another connection. The first reply wins; the other request is
+  /// aborted, which cancels it on the server. Falls back to one call of
+  /// `fn` with hedging disabled. Only for idempotent requests.
+  /// \code{.cpp}
+  ///    return pool.hedged([&req](auto &c, seastar::abort_source &as) {
+  ///      return c.Get(smf::rpc_envelope(req.share()), as);
+  ///    });
+  /// \endcode
+  template <typename Fn>
+  auto
+  hedged(Fn fn) {
+    using result_type =
+      std::result_of_t<Fn(Client &, seastar::abort_source &)>;
+    using race_type =
+      race<typename seastar::futurize<result_type>::type, Fn>;
+    auto primary = get();
+    auto delay = hedging_.begin();
+    auto r = seastar::make_lw_shared<race_type>(std::move(fn), &hedging_);
+    auto f = r->pr.get_future();
+    r->send(0, std::move(primary));
+    if (delay) {
+      // a raw `r`: the timer is a member of it, so the callback can't run
+      // once it is gone, and complete() cancels it before the reply is
+      // handed out. The pool must outlive its requests, as with get()
+      r->timer.set_callback([this, r = r.get()] {
+        if (r->done || !hedging_.try_hedge()) { return; }
+        auto secondary = get();
+        if (secondary == r->clients[0]) {
+          // one healthy connection only: a duplicate would queue behind
+          return;
+        }
+        r->send(1, std::move(secondary));
+      });
+      if (!r->done) { r->timer.arm(*delay); }
+    }
+    return f;
+  }
+  SMF_ALWAYS_INLINE const rpc_hedging_stats &
+  hedging_stats() const {
+    return hedging_.stats();
+  }
+
+  /// \brief open connections, healthy or not
+  SMF_ALWAYS_INLINE size_t
+  size() const {
+    return conns_.size();
+  }
+
+ private:
+  struct connection {
+    connection(uint32_t e, rpc_client_opts o)
+      : endpoint(e), rc(std::move(o)) {}
+    seastar::shared_ptr<Client>
+    client() {
+      return rc.get();
+    }
+    const uint32_t endpoint;
+    reconnect_client<Client> rc;
+    bool connecting{false};
+  };
+  /// \brief one request of hedged(): up to two copies in flight
+  template <typename Future, typename Fn>
+  struct race : public seastar::enable_lw_shared_from_this<race<Future, Fn>> {
+    using promise_type = typename Future::promise_type;
+    race(Fn f, rpc_hedging_policy *p) : fn(std::move(f)), policy(p) {}
+
+    void
+    send(int i, seastar::shared_ptr<Client> c) {
+      clients[i] = std::move(c);
+      sent[i] = seastar::timer<>::clock::now();
+      outstanding++;
+      // never fails: complete() consumes the result of either copy
+      (void)seastar::futurize_apply(fn, *clients[i], as[i])
+        .then_wrapped([i, self = this->shared_from_this()](Future f) mutable {
+          self->complete(i, std::move(f));
+        });
+    }
+    void
+    complete(int i, Future f) {
+      outstanding--;
+      if (done) {
+        f.ignore_ready_future();
+        return;
+      }
+      if (f.failed() && outstanding > 0) {
+        // the other copy may still succeed
+        f.ignore_ready_future();
+        return;
+      }
+      done = true;
+      timer.cancel();
+      if (outstanding > 0) { as[1 - i].request_abort(); }
+      if (!f.failed()) {
+        policy->record(seastar::timer<>::clock::now() - sent[i]);
+        if (i == 1) { policy->hedge_won(); }
+      }
+      f.forward_to(std::move(pr));
+    }
+
+    Fn fn;
+    promise_type pr;
+    seastar::abort_source as[2];
+    seastar::shared_ptr<Client> clients[2];
+    seastar::timer<>::clock::time_point sent[2];
+    rpc_hedging_policy *policy;
+    seastar::timer<> timer;
+    uint32_t outstanding{0};
+    bool done{false};
+  };
+  struct endpoint_state {
+    uint32_t connections{0};
+    bool growing{false};
+  };
+
+  /// \brief kicks a background reconnect of broken connections
+  bool
+  healthy(connection *c) {
+    if (c->client()->is_conn_valid()) { return true; }
+    // a reconnect is running or scheduled already
+    if (c->connecting || c->rc.backoff() != reconnect_backoff::none ||
+        gate_.is_closed()) {
+      return false;
+    }
+    (void)seastar::with_gate(gate_, [c] { return connect(c); });
+    return false;
+  }
+  static seastar::future<>
+  connect(connection *c) {
+    c->connecting = true;
+    return c->rc.connect().finally([c] { c->connecting = false; });
+  }
+  void
+  register_metrics() {
+    namespace sm = seastar::metrics;
+    auto pool = sm::label_instance("pool", opts_.name);
+    metrics_.add_group(
+      "smf::rpc_client_pool",
+      {
+        sm::make_derive("hedged_requests",
+                        [this] { return hedging_.stats().requests; },
+                        sm::description("Requests sent through hedged()"),
+                        {pool}),
+        sm::make_derive("hedges", [this] { return hedging_.stats().hedges; },
+                        sm::description("Duplicate requests sent"), {pool}),
+        sm::make_derive("hedges_won",
+                        [this] { return hedging_.stats().hedges_won; },
+                        sm::description("Duplicates that answered first"),
+                        {pool}),
+        sm::make_gauge("connections", [this] { return conns_.size(); },
+                       sm::description("Open connections"), {pool}),
+      });
+  }
+  void
+  maybe_grow(uint32_t e) {
+    auto &ep = endpoints_[e];
+    if (ep.growing || ep.connections >= opts_.max_connections_per_endpoint ||
+        gate_.is_closed()) {
+      return;
+    }
+    ep.growing = true;
+    (void)seastar::with_gate(gate_, [this, e] {
+      return add_connection(e).finally([this, e] {
+        endpoints_[e].growing = false;
+      });
+    }).handle_exception([](auto ep) {
+      LOG_INFO("rpc_client_pool could not grow: {}", ep);
+    });
+  }
+  /// \brief the connection joins the pool even if it could not connect yet;
+  /// reconnect_client keeps trying
+  seastar::future<>
+  add_connection(uint32_t e) {
+    auto c = std::make_unique<connection>(e, opts_.endpoints[e]);
+    if (opts_.configure) { opts_.configure(*c->client()); }
+    auto p = c.get();
+    conns_.push_back(std::move(c));
+    endpoints_[e].connections++;
+    return connect(p);
+  }
+
+ private:
+  opts_type opts_;
+  std::vector<endpoint_state> endpoints_;
+  std::vector<std::unique_ptr<connection>> conns_;
+  rpc_hedging_policy hedging_;
+  random rand_;
+  seastar::gate gate_;
+  seastar::metrics::metric_groups metrics_;
+};
+
+}  // namespace smf
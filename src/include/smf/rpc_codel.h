@@ -0,0 +1,68 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <chrono>
+
+#include "smf/macros.h"
+
+namespace smf {
+
+struct rpc_codel_opts {
+  using duration = std::chrono::steady_clock::duration;
+  /// \brief queue delay a core may keep standing
+  duration target = std::chrono::milliseconds(5);
+  /// \brief the minimum queue delay must stay above `target` for this long
+  /// before the core counts as overloaded
+  duration interval = std::chrono::milliseconds(100);
+  /// \brief rpc_server counts the core as under memory pressure when less
+  /// than this fraction of its memory is free
+  double min_free_memory = 0.05;
+};
+
+/// \brief CoDel style load shedding of requests that queued on one core.
+/// See rpc_server_args::load_shedding.
+///
+/// A standing queue shows as a minimum queue delay - sojourn time - that
+/// stays above `target` for a whole `interval`. Bursts do not: someone
+/// always gets through them quickly. While overloaded, requests that queued
+/// for more than `2 * target` are dropped, which drains the queue faster
+/// than CoDel's increasing drop rate and suits RPCs whose callers retry.
+/// Under memory pressure, anything that queued more than `target` is
+/// dropped right away.
+///
+class rpc_codel {
+ public:
+  using clock_type = std::chrono::steady_clock;
+  using duration = clock_type::duration;
+
+  explicit rpc_codel(rpc_codel_opts opts);
+
+  /// \brief records one request that queued for `sojourn`; true if it
+  /// should be rejected instead of dispatched
+  bool should_drop(clock_type::time_point now, duration sojourn,
+                   bool memory_pressure = false);
+
+  SMF_ALWAYS_INLINE bool
+  overloaded() const {
+    return overloaded_;
+  }
+  /// \brief minimum queue delay of the current interval, so far
+  SMF_ALWAYS_INLINE duration
+  min_delay() const {
+    return min_delay_;
+  }
+  SMF_ALWAYS_INLINE const rpc_codel_opts &
+  opts() const {
+    return opts_;
+  }
+
+ private:
+  const rpc_codel_opts opts_;
+  clock_type::time_point interval_end_{};
+  duration min_delay_{duration::zero()};
+  bool overloaded_{false};
+};
+
+}  // namespace smf
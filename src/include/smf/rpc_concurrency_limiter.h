@@ -0,0 +1,77 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#include "smf/macros.h"
+
+namespace smf {
+
+struct rpc_concurrency_limiter_opts {
+  uint32_t initial_limit = 20;
+  uint32_t min_limit = 4;
+  uint32_t max_limit = 1000;
+  /// \brief weight of each new estimate. 1 follows it immediately
+  double smoothing = 1.0;
+  /// \brief the no-load baseline is re-measured after this many samples,
+  /// so it follows changes in the handlers themselves
+  uint32_t baseline_samples = 1000;
+};
+
+/// \brief adaptive limit of requests in flight on one core, in the style
+/// of TCP Vegas. See rpc_server_args::concurrency_limit.
+///
+/// The lowest dispatch latency seen is the no-load baseline. From a sample
+/// `rtt`, the requests queued - as opposed to being worked on - are about
+/// `limit * (1 - baseline / rtt)`. With `l = max(1, log10(limit))`, the
+/// limit grows by `6l` while the queue is under `l`, by `l` while it is
+/// under `3l`, and shrinks by `l` when it is over `6l` or the request
+/// failed. Samples taken while less than half the limit was in use say
+/// nothing about the limit and are only used for the baseline.
+///
+class rpc_concurrency_limiter {
+ public:
+  using duration = std::chrono::steady_clock::duration;
+
+  explicit rpc_concurrency_limiter(rpc_concurrency_limiter_opts opts);
+
+  /// \brief false if the limit is reached. Every acquired slot must be
+  /// given back with release()
+  SMF_ALWAYS_INLINE bool
+  try_acquire() {
+    if (inflight_ >= limit()) { return false; }
+    ++inflight_;
+    return true;
+  }
+  /// \brief `rtt` is the time since try_acquire(). `dropped` if the
+  /// request failed or timed out
+  void release(duration rtt, bool dropped = false);
+
+  SMF_ALWAYS_INLINE uint32_t
+  limit() const {
+    return static_cast<uint32_t>(limit_);
+  }
+  SMF_ALWAYS_INLINE uint32_t
+  inflight() const {
+    return inflight_;
+  }
+  SMF_ALWAYS_INLINE duration
+  baseline() const {
+    return baseline_;
+  }
+
+ private:
+  void update(double estimate);
+
+ private:
+  const rpc_concurrency_limiter_opts opts_;
+  double limit_;
+  uint32_t inflight_{0};
+  duration baseline_{duration::zero()};
+  uint32_t samples_{0};
+};
+
+}  // namespace smf
@@ -10,6 +10,7 @@
 
 #include "smf/macros.h"
 #include "smf/rpc_connection_limits.h"
+#include "smf/rpc_send_queue.h"
 
 namespace smf {
 
@@ -26,7 +27,7 @@ class rpc_connection final {
     seastar::connected_socket fd, seastar::socket_address address,
     seastar::lw_shared_ptr<rpc_connection_limits> conn_limits = nullptr)
     : socket(std::move(fd)), remote_address(address), istream(socket.input()),
-      ostream(socket.output()), limits(conn_limits) {
+      ostream(socket.output()), send_queue(&ostream), limits(conn_limits) {
     socket.set_nodelay(true);
     socket.set_keepalive(true);
   }
@@ -35,6 +36,8 @@ class rpc_connection final {
   const seastar::socket_address remote_address;
   seastar::input_stream<char> istream;
   seastar::output_stream<char> ostream;
+  /// \brief all writes to `ostream` must go through here
+  rpc_send_queue send_queue;
   seastar::lw_shared_ptr<rpc_connection_limits> limits;
   uint32_t istream_active_parser{0};
 
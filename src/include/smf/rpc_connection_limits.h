@@ -1,13 +1,16 @@
 // Copyright (c) 2016 Alexander Gallego. All rights reserved.
 //
 #pragma once
+#include <algorithm>
 #include <chrono>
 #include <ostream>
 
+#include <seastar/core/future.hh>
 #include <seastar/core/semaphore.hh>
 #include <seastar/core/timer.hh>
 
 #include <smf/human_bytes.h>
+#include <smf/rpc_fair_queue.h>
 
 namespace smf {
 /// Currently, it contains the limit to prase the body of the connection to be
@@ -25,10 +28,57 @@ struct rpc_connection_limits {
 
   ~rpc_connection_limits() = default;
 
+  /// \brief reserves `units` of `resources_available` for connection
+  /// `flow`. While memory is short, connections are served in deficit round
+  /// robin order, weighted by `weight`, so that one connection pipelining
+  /// large requests cannot stall the rest. Requests larger than
+  /// `max_memory` are admitted alone, once all of it is free
+  seastar::future<>
+  fair_wait(uint64_t flow, uint32_t weight, uint64_t units) {
+    if (fair_waiters.empty() && resources_available.try_wait(units)) {
+      return seastar::make_ready_future<>();
+    }
+    fair_waiter w{units, seastar::promise<>()};
+    auto f = w.admitted.get_future();
+    fair_waiters.push(flow, weight, std::min(units, max_memory), std::move(w));
+    admit_fair_waiters();
+    return f;
+  }
+  /// \brief gives back `units` of `resources_available`. Use instead of
+  /// signal() for memory fair_wait() callers may be waiting for
+  void
+  release(uint64_t units) {
+    resources_available.signal(units);
+    admit_fair_waiters();
+  }
+  size_t
+  waiters() const {
+    return fair_waiters.size() + resources_available.waiters();
+  }
+
   const uint64_t max_memory;
   const timer_duration_t max_body_parsing_duration;
 
+  struct fair_waiter {
+    uint64_t units;
+    seastar::promise<> admitted;
+  };
+
   seastar::semaphore resources_available;
+  rpc_fair_queue<fair_waiter> fair_waiters{kFairQuantum};
+
+ private:
+  static constexpr uint64_t kFairQuantum = 64 * 1024;
+
+  void
+  admit_fair_waiters() {
+    const auto available = resources_available.available_units();
+    if (fair_waiters.empty() || available <= 0) { return; }
+    fair_waiters.drain(available, [this](uint64_t, fair_waiter w) {
+      resources_available.consume(w.units);
+      w.admitted.set_value();
+    });
+  }
 };
 inline std::ostream &
 operator<<(std::ostream &o, const ::smf::rpc_connection_limits &l) {
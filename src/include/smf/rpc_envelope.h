@@ -7,6 +7,7 @@
 // smf
 #include "smf/macros.h"
 #include "smf/rpc_letter.h"
+#include "smf/rpc_priority.h"
 
 namespace smf {
 /// \brief send rpc request to stablished remote host.
@@ -16,6 +17,8 @@ namespace smf {
 ///
 struct rpc_envelope {
   constexpr static size_t kHeaderSize = sizeof(rpc::header);
+  /// \brief writes *and* flushes one envelope. Connections managed by
+  /// rpc_server and rpc_client use the coalescing rpc_send_queue instead
   static seastar::future<> send(seastar::output_stream<char> *out,
                                 rpc_envelope req);
 
@@ -48,6 +51,24 @@ struct rpc_envelope {
     letter.header.mutate_meta(status);
   }
 
+  /// \brief the server drops the request - replying with status 504 - if
+  /// it cannot start on it before `deadline`
+  SMF_ALWAYS_INLINE void
+  set_deadline(seastar::timer<>::clock::time_point deadline) {
+    letter.deadline = deadline;
+  }
+  SMF_ALWAYS_INLINE void
+  set_timeout(seastar::timer<>::duration timeout) {
+    letter.deadline = seastar::timer<>::clock::now() + timeout;
+  }
+
+  /// \brief high priority frames overtake queued normal ones on the wire.
+  /// The server replies with the same priority
+  SMF_ALWAYS_INLINE void
+  set_priority(rpc_priority p) {
+    set_rpc_priority(letter.header, p);
+  }
+
   SMF_ALWAYS_INLINE size_t
   size() const {
     return letter.size();
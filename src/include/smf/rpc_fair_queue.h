@@ -0,0 +1,111 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <unordered_map>
+#include <utility>
+
+namespace smf {
+
+/// \brief deficit round robin across flows of waiters, each with a cost.
+///
+/// Every turn, a flow earns `quantum * weight` of credit and serves its
+/// waiters in order while they fit in it; leftover credit is kept for the
+/// next turn, and dropped once the flow runs out of waiters. Waiters are
+/// only served while they also fit in the budget given to drain(). A flow
+/// whose waiter is due but does not fit is skipped, so the others are not
+/// held behind it; it keeps its credit and goes first on the next drain(),
+/// so it is served as soon as enough budget comes back.
+///
+template <typename T>
+class rpc_fair_queue {
+ public:
+  explicit rpc_fair_queue(uint64_t quantum) : quantum_(quantum) {}
+
+  void
+  push(uint64_t flow_id, uint32_t weight, uint64_t cost, T waiter) {
+    auto &f = flows_[flow_id];
+    f.weight = std::max<uint32_t>(weight, 1);
+    f.waiters.emplace_back(cost, std::move(waiter));
+    if (f.waiters.size() == 1) { active_.push_back(flow_id); }
+    ++size_;
+  }
+
+  /// \brief calls `fn(cost, T&&)` for every waiter served out of `budget`
+  template <typename Fn>
+  void
+  drain(uint64_t budget, Fn &&fn) {
+    // flows whose due waiter does not fit in `budget`
+    std::deque<uint64_t> skipped;
+    while (!active_.empty()) {
+      const auto id = active_.front();
+      auto &f = flows_[id];
+      if (!f.in_turn) {
+        f.deficit += quantum_ * f.weight;
+        f.in_turn = true;
+      }
+      auto &head = f.waiters.front();
+      if (head.first > f.deficit) {
+        // turn over; next flow
+        f.in_turn = false;
+        active_.pop_front();
+        active_.push_back(id);
+        continue;
+      }
+      if (head.first > budget) {
+        active_.pop_front();
+        skipped.push_back(id);
+        continue;
+      }
+      budget -= head.first;
+      f.deficit -= head.first;
+      auto w = std::move(head);
+      f.waiters.pop_front();
+      --size_;
+      if (f.waiters.empty()) {
+        active_.pop_front();
+        flows_.erase(id);
+      }
+      fn(w.first, std::move(w.second));
+    }
+    active_.insert(active_.begin(), skipped.begin(), skipped.end());
+  }
+
+  size_t
+  size() const {
+    return size_;
+  }
+  bool
+  empty() const {
+    return size_ == 0;
+  }
+  /// \brief sum of the waiting costs of `flow_id`
+  uint64_t
+  waiting(uint64_t flow_id) const {
+    auto it = flows_.find(flow_id);
+    if (it == flows_.end()) { return 0; }
+    uint64_t ret = 0;
+    for (auto &w : it->second.waiters) { ret += w.first; }
+    return ret;
+  }
+
+ private:
+  struct flow {
+    uint32_t weight{1};
+    uint64_t deficit{0};
+    bool in_turn{false};
+    std::deque<std::pair<uint64_t, T>> waiters;
+  };
+
+  const uint64_t quantum_;
+  std::unordered_map<uint64_t, flow> flows_;
+  /// \brief flows with waiters, in round robin order
+  std::deque<uint64_t> active_;
+  size_t size_{0};
+};
+
+}  // namespace smf
@@ -1,7 +1,13 @@
 // Copyright (c) 2016 Alexander Gallego. All rights reserved.
 //
 #pragma once
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
 #include <seastar/core/future.hh>
+#include <seastar/core/shared_ptr.hh>
 namespace smf {
 
 /// brief - generic filter interface (c++ conept'ish) that gets
@@ -13,7 +19,8 @@ struct rpc_filter {
 };
 
 /// brief - applies a functor `future<T> operator()(T t)` to all the filters
-/// useful for incoming and outgoing filters. Taking a pair of iterators
+/// useful for incoming and outgoing filters. Taking a pair of iterators.
+/// Filters that return a ready future are chained without a continuation
 ///
 template <typename Iterator, typename Arg, typename... Ret>
 seastar::future<Ret...>
@@ -22,18 +29,86 @@ rpc_filter_apply(const Iterator &b, const Iterator &end, Arg &&arg) {
   if (begin == end) {
     return seastar::make_ready_future<Ret...>(std::forward<Arg>(arg));
   }
-  return (*begin)(std::forward<Arg>(arg))
-    .then([begin = std::next(begin), end](Arg &&a) {
-      return rpc_filter_apply<Iterator, Arg, Ret...>(begin, end,
-                                                     std::forward<Arg>(a));
-    });
+  auto f = (*begin)(std::forward<Arg>(arg));
+  if (f.available() && !f.failed()) {
+    return rpc_filter_apply<Iterator, Arg, Ret...>(std::next(begin), end,
+                                                   f.get0());
+  }
+  return f.then([begin = std::next(begin), end](Arg &&a) {
+    return rpc_filter_apply<Iterator, Arg, Ret...>(begin, end,
+                                                   std::forward<Arg>(a));
+  });
 }
 
 template <class Container, typename Arg>
 seastar::future<Arg>
 rpc_filter_apply(Container *c, Arg &&arg) {
-  return rpc_filter_apply<typename Container::iterator, Arg, Arg>(
+  return rpc_filter_apply<decltype(c->begin()), Arg, Arg>(
     c->begin(), c->end(), std::forward<Arg>(arg));
 }
 
+/// \brief filters composed at compile time: one call, and no continuation
+/// for filters that return a ready future. Filters may also be synchronous,
+/// `T operator()(T)`. The chain is itself a filter, e.g.:
+/// \code{.cpp}
+///    client->outgoing_filters().push_back(
+///      smf::make_rpc_filter_chain<smf::rpc_envelope>(
+///        add_trace_id{}, smf::zstd_compression_filter(1000)));
+/// \endcode
+///
+template <typename T, typename... Filters>
+class rpc_filter_chain {
+ public:
+  explicit rpc_filter_chain(Filters... filters)
+    : filters_(seastar::make_lw_shared<std::tuple<Filters...>>(
+        std::move(filters)...)) {}
+
+  seastar::future<T>
+  operator()(T t) {
+    return apply<0>(std::move(t));
+  }
+
+ private:
+  template <size_t I>
+  seastar::future<T>
+  apply(T &&t) {
+    if constexpr (I == sizeof...(Filters)) {
+      return seastar::make_ready_future<T>(std::move(t));
+    } else {
+      using filter = std::tuple_element_t<I, std::tuple<Filters...>>;
+      auto &fn = std::get<I>(*filters_);
+      if constexpr (std::is_same_v<std::invoke_result_t<filter &, T &&>, T>) {
+        std::optional<T> ret;
+        try {
+          ret.emplace(fn(std::move(t)));
+        } catch (...) {
+          return seastar::make_exception_future<T>(std::current_exception());
+        }
+        return apply<I + 1>(std::move(*ret));
+      } else {
+        static_assert(
+          std::is_same_v<std::invoke_result_t<filter &, T &&>,
+                         seastar::future<T>>,
+          "filters must be `T operator()(T)` or `future<T> operator()(T)`");
+        auto f = fn(std::move(t));
+        if (f.available() && !f.failed()) { return apply<I + 1>(f.get0()); }
+        return f.then([self = *this](T &&r) mutable {
+          return self.template apply<I + 1>(std::move(r));
+        });
+      }
+    }
+  }
+
+  /// \brief shared by copies, i.e.: the std::function filter vectors, and
+  /// by pending continuations
+  seastar::lw_shared_ptr<std::tuple<Filters...>> filters_;
+};
+
+template <typename T, typename... Filters>
+rpc_filter_chain<T, std::decay_t<Filters>...>
+make_rpc_filter_chain(Filters &&... filters) {
+  return rpc_filter_chain<T, std::decay_t<Filters>...>(
+    std::forward<Filters>(filters)...);
+}
+
 }  // namespace smf
@@ -0,0 +1,86 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <seastar/core/temporary_buffer.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+/// \brief reassembles messages sent as header_bit_flags::fragment frames.
+///
+/// Fragments are kept as they came off the socket, i.e.: the body is never
+/// copied into one contiguous buffer unless the caller asks for it with
+/// rpc_recv_context::linearize()
+///
+class rpc_fragment_assembler {
+ public:
+  enum class result {
+    /// \brief frame was a fragment and is now owned by the assembler
+    buffered,
+    /// \brief the context holds a full message; possibly fragmented
+    complete,
+    /// \brief sum of fragments exceeds the max message size, or the
+    /// fragment would take buffered_bytes() over max_buffered_bytes. Every
+    /// buffered fragment of the session was dropped
+    too_large,
+    /// \brief frame of a message dropped with discard(). Not kept
+    discarded
+  };
+
+  /// \param max_buffered_bytes - of every partial message together. 0 means
+  /// no cap
+  explicit rpc_fragment_assembler(uint64_t max_message_size,
+                                  uint64_t max_buffered_bytes = 0)
+    : max_message_size_(max_message_size),
+      max_buffered_bytes_(max_buffered_bytes) {}
+  rpc_fragment_assembler(rpc_fragment_assembler &&) noexcept = default;
+
+  result add(rpc_recv_context &ctx);
+
+  /// \brief only applies to fragments added after the call
+  SMF_ALWAYS_INLINE void
+  set_limits(uint64_t max_message_size, uint64_t max_buffered_bytes) {
+    max_message_size_ = max_message_size;
+    max_buffered_bytes_ = max_buffered_bytes;
+  }
+
+  /// \brief bytes held for messages that are not complete yet
+  SMF_ALWAYS_INLINE uint64_t
+  buffered_bytes() const {
+    return buffered_bytes_;
+  }
+  /// \brief bytes buffered so far of the message of `session`
+  uint64_t partial_size(uint16_t session) const;
+  /// \brief true while the rest of a discard()ed message comes in
+  bool discarding(uint16_t session) const;
+  /// \brief drops the fragments buffered so far of the message `ctx` is a
+  /// frame of and, unless `ctx` is its last frame, the ones still to come.
+  /// `ctx` itself is not kept. returns the bytes released
+  uint64_t discard(const rpc_recv_context &ctx);
+  /// \brief drops every partial message. returns the bytes released
+  uint64_t clear();
+
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_fragment_assembler);
+
+ private:
+  struct partial {
+    bool discarded{false};
+    uint64_t size{0};
+    std::vector<seastar::temporary_buffer<char>> fragments;
+  };
+
+  uint64_t max_message_size_;
+  uint64_t max_buffered_bytes_;
+  uint64_t buffered_bytes_{0};
+  std::unordered_map<uint16_t, partial> partials_;
+};
+
+}  // namespace smf
@@ -0,0 +1,76 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <array>
+#include <optional>
+#include <vector>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/temporary_buffer.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_connection.h"
+#include "smf/rpc_generated.h"
+
+namespace smf {
+
+struct rpc_frame {
+  rpc::header header;
+  /// \brief zero copy slice - share()'d - of the socket read buffer if the
+  /// body is at least half of it. A copy otherwise: a slice keeps the whole
+  /// buffer alive, but only the body is counted against the memory limits
+  seastar::temporary_buffer<char> body;
+};
+
+struct rpc_frame_batch {
+  /// \brief frames whose header *and* body were already buffered
+  std::vector<rpc_frame> frames;
+  /// \brief header of a frame whose body has not fully arrived. The body
+  /// bytes are left in the input_stream, so the caller can reserve memory
+  /// *before* calling read_exactly(pending->size())
+  std::optional<rpc::header> pending;
+  /// \brief malformed header. The connection must be closed
+  bool error{false};
+
+  /// \brief nothing was parsed; usually means eof
+  bool
+  empty() const {
+    return frames.empty() && !pending;
+  }
+};
+
+/// \brief single pass framer built on seastar::input_stream::consume()
+///
+/// Splits as many complete rpc::header + body frames as the current read
+/// buffer holds, in one continuation. Small pipelined requests no longer pay
+/// two read_exactly() hops per frame.
+///
+class rpc_frame_parser {
+ public:
+  using tmp_buf = seastar::temporary_buffer<char>;
+  using unconsumed_remainder = std::optional<tmp_buf>;
+  static constexpr size_t kHeaderSize = sizeof(rpc::header);
+
+  /// \brief returns as soon as at least one frame - or the header of a
+  /// partially buffered frame - is available
+  static seastar::future<rpc_frame_batch> parse(rpc_connection *conn);
+
+  seastar::future<unconsumed_remainder> consume(tmp_buf data);
+
+  rpc_frame_batch batch;
+
+ private:
+  seastar::future<unconsumed_remainder> stop(tmp_buf remainder);
+  bool on_header(const char *data);
+
+ private:
+  std::array<char, kHeaderSize> partial_{};
+  size_t partial_size_{0};
+  std::optional<rpc::header> header_;
+  /// \brief of the buffer handed to consume(); what a slice keeps alive
+  size_t buffer_size_{0};
+};
+
+}  // namespace smf
@@ -3,6 +3,9 @@
 #pragma once
 
 #include <iostream>
+#include <unordered_map>
+
+#include <seastar/core/scheduling.hh>
 
 #include "smf/macros.h"
 #include "smf/rpc_envelope.h"
@@ -10,6 +13,23 @@
 #include "smf/rpc_service.h"
 
 namespace smf {
+/// \brief filters scoped to a service or a method. See
+/// rpc_server::register_service_incoming_filter()
+struct rpc_scoped_filters {
+  std::vector<rpc_incoming_filter> incoming;
+  std::vector<rpc_outgoing_filter> outgoing;
+};
+
+/// \brief a filter of type `Filter` calling one `Function` instance,
+/// however many chains it ends up in. i.e.: stateful filters are not copied
+/// into every method
+template <typename Filter, typename Function, typename... Args>
+Filter
+rpc_shared_filter(Args &&... args) {
+  auto fn = seastar::make_lw_shared<Function>(std::forward<Args>(args)...);
+  return [fn](auto x) { return (*fn)(std::move(x)); };
+}
+
 /// \brief used to host many services
 /// multiple services can use this class to handle the routing for them
 ///
@@ -24,6 +44,37 @@ class rpc_handle_router {
   smf::rpc_service_method_handle *
   get_handle_for_request(const uint32_t &request_id);
 
+  /// \brief core that must run the request: the key of the method's
+  /// shard_key, else of its service's, modulo smp::count. This core if
+  /// neither is set. A fragmented body is linearized first, even for
+  /// methods that accept fragments
+  uint32_t owner_shard(rpc_recv_context &ctx);
+
+  /// \brief filters of the methods of the service named `service_name`.
+  /// Take effect on the next resolve_filters()
+  SMF_ALWAYS_INLINE rpc_scoped_filters &
+  service_filters(const seastar::sstring &service_name) {
+    return service_filters_[service_name];
+  }
+  /// \brief filters of the method of `request_id`
+  SMF_ALWAYS_INLINE rpc_scoped_filters &
+  method_filters(uint32_t request_id) {
+    return method_filters_[request_id];
+  }
+  /// \brief builds the filter chains of every method: incoming `in`, then
+  /// its service's, then its own; outgoing in the reverse order, ending with
+  /// `out`. Requests in flight keep the chains they started with
+  void resolve_filters(const std::vector<rpc_incoming_filter> &in,
+                       const std::vector<rpc_outgoing_filter> &out);
+
+  /// \brief groups the scheduling_group of services and methods refer to.
+  /// Before register_service()
+  void set_scheduling_groups(
+    std::unordered_map<seastar::sstring, seastar::scheduling_group> groups);
+  /// \brief group of the method's scheduling_group, else of its service's.
+  /// The default group if neither is set
+  seastar::scheduling_group scheduling_group_for(uint32_t request_id);
+
   /// \brief multiple rpc_services can register w/ this  handle router
   void register_rpc_service(rpc_service *s);
   SMF_DISALLOW_COPY_AND_ASSIGN(rpc_handle_router);
@@ -35,6 +86,9 @@ class rpc_handle_router {
 
  private:
   std::vector<std::unique_ptr<rpc_service>> services_{};
+  std::unordered_map<seastar::sstring, seastar::scheduling_group> groups_;
+  std::unordered_map<seastar::sstring, rpc_scoped_filters> service_filters_;
+  std::unordered_map<uint32_t, rpc_scoped_filters> method_filters_;
 };
 }  // namespace smf
 
@@ -0,0 +1,89 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include "smf/macros.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_generated.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+/// \brief outcome of the control_type::handshake exchange. Both ends of the
+/// connection compute the same values from the same pair of handshakes.
+///
+/// Replaces pushing matching compression filters on the client and the
+/// server by hand: the cheapest codec both sides decode is applied after the
+/// outgoing filters - unless a filter already compressed the body - and
+/// undone before the incoming filters.
+///
+struct rpc_negotiated {
+  /// \brief compression_flags_none if the peers share no codec
+  rpc::compression_flags compression{
+    rpc::compression_flags::compression_flags_none};
+  rpc::checksum_type checksum{rpc::checksum_type::checksum_type_xxhash64};
+  /// \brief largest frame body the peer accepts
+  uint32_t peer_max_frame_size{0};
+  /// \brief rpc::handshake_feature bits of the peer
+  uint32_t peer_features{0};
+  /// \brief bodies up to this size are never compressed
+  uint32_t min_compression_size{0};
+  /// \brief cores of the server, if it has a port per core. 0 otherwise.
+  /// See rpc_shard_router
+  uint16_t peer_shard_count{0};
+  uint16_t peer_shard_port_base{0};
+
+  SMF_ALWAYS_INLINE bool
+  peer_has(rpc::handshake_feature f) const {
+    return (peer_features & f) != 0;
+  }
+  /// \brief fragment size to use when sending: the smaller of ours - if
+  /// any - and the peer's max frame size. 0 - no fragmentation - if the peer
+  /// can't reassemble fragments
+  uint32_t fragment_size(uint32_t local_max_fragment_size) const;
+
+  /// \brief compresses `e` with `compression`, see min_compression_size
+  void encode(rpc_envelope &e) const;
+  /// \brief decompresses any codec rpc_handshake advertises. Expects a
+  /// linearize()'d context
+  static void decode(rpc_recv_context &ctx);
+};
+
+struct rpc_handshake {
+  /// \brief every codec smf links. Cheapest first
+  static constexpr uint32_t kDefaultCodecs =
+    (1 << rpc::compression_flags::compression_flags_lz4) |
+    (1 << rpc::compression_flags::compression_flags_zstd);
+  /// \brief every checksum but checksum_type_none. make() drops the ones
+  /// this build does not support
+  static constexpr uint32_t kDefaultChecksums =
+    ~(uint32_t(1) << rpc::checksum_type::checksum_type_none);
+  static constexpr uint32_t kFeatures =
+    rpc::handshake_feature::handshake_feature_streams |
+    rpc::handshake_feature::handshake_feature_fragments |
+    rpc::handshake_feature::handshake_feature_cancellation |
+    rpc::handshake_feature::handshake_feature_payload_headers;
+
+  /// \brief our side. `checksums` is intersected with what this build
+  /// supports. Only servers publish a shard layout
+  static rpc::handshake make(uint32_t codecs, uint32_t checksums,
+                             uint32_t max_frame_size,
+                             uint16_t shard_count = 0,
+                             uint16_t shard_port_base = 0);
+  /// \brief control frame on session 0
+  static rpc_envelope encode(const rpc::handshake &h);
+  static std::optional<rpc::handshake> decode(const rpc_recv_context &ctx);
+
+  /// \brief picks the cheapest codec and checksum in both handshakes.
+  /// Symmetric in the checksum and codec choice: the result does not depend
+  /// on which side is `local`
+  static rpc_negotiated negotiate(const rpc::handshake &local,
+                                  const rpc::handshake &remote,
+                                  uint32_t min_compression_size);
+};
+
+}  // namespace smf
@@ -2,21 +2,30 @@
 //
 
 #pragma once
-#include <xxhash.h>
 
+#include "smf/rpc_checksum.h"
 #include "smf/rpc_generated.h"
 
 namespace smf {
 
+/// \brief legacy, always (xxhash64 & UINT32_MAX).
+/// prefer rpc_checksum() with the type of the header
 SMF_ALWAYS_INLINE static uint32_t
 rpc_checksum_payload(const char *payload, uint32_t size) {
-  return std::numeric_limits<uint32_t>::max() & XXH64(payload, size, 0);
+  return rpc_checksum(rpc::checksum_type::checksum_type_xxhash64, payload,
+                      size);
 }
 
+/// \brief sets the size and the checksum - with the algorithm selected in the
+/// header bitflags - of the payload.
+/// Called exactly once per frame by the rpc_send_queue right before writing
+/// to the socket. Filters only need to update the size.
+/// Empty bodies, i.e.: end_of_stream frames, have no checksum
 template <typename T>
 SMF_ALWAYS_INLINE void
 checksum_rpc(T &hdr, const char *payload, uint32_t size) {
-  hdr.mutate_checksum(rpc_checksum_payload(payload, size));
+  hdr.mutate_checksum(
+    size == 0 ? 0 : rpc_checksum(rpc_checksum_type(hdr), payload, size));
   hdr.mutate_size(size);
 }
 
@@ -0,0 +1,90 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include <seastar/core/lowres_clock.hh>
+#include <seastar/core/timer.hh>
+
+#include "smf/histogram.h"
+#include "smf/macros.h"
+
+namespace smf {
+
+struct rpc_hedging_opts {
+  /// \brief off by default. Only hedge idempotent requests
+  bool enabled = false;
+  /// \brief a duplicate is sent once the first copy has been outstanding
+  /// longer than this percentile of the latency of recent replies
+  double percentile = 95.0;
+  /// \brief lower bound of the hedge delay
+  typename seastar::timer<>::duration min_delay = std::chrono::milliseconds(1);
+  /// \brief at most this many hedges per request, on average. i.e.: 0.05
+  /// caps the extra load at 5%
+  double max_hedge_ratio = 0.05;
+  /// \brief unused budget saved up for bursts, in hedges
+  double max_burst = 10;
+  /// \brief how often the delay is recomputed, from the replies since the
+  /// last time
+  typename seastar::lowres_clock::duration refresh =
+    std::chrono::milliseconds(500);
+};
+
+struct rpc_hedging_stats {
+  uint64_t requests{0};
+  /// \brief duplicates sent
+  uint64_t hedges{0};
+  /// \brief duplicates that answered first
+  uint64_t hedges_won{0};
+};
+
+/// \brief when to hedge, and whether the budget allows it. Used by
+/// rpc_client_pool::hedged()
+///
+/// The delay comes from a histogram of the replies of the last
+/// `opts.refresh`, emptied every time the delay is computed, so it follows
+/// the servers as they slow down or recover. The budget is a token bucket
+/// earning `max_hedge_ratio` tokens per request.
+///
+class rpc_hedging_policy {
+ public:
+  explicit rpc_hedging_policy(rpc_hedging_opts opts);
+
+  /// \brief counts a new request. The delay before hedging it, if hedging
+  /// is enabled and a reply was recorded
+  std::optional<typename seastar::timer<>::duration> begin();
+  /// \brief latency of the copy that answered a request
+  void record(typename seastar::timer<>::duration latency);
+  /// \brief true, and spends a token, if a hedge may be sent now
+  bool try_hedge();
+  SMF_ALWAYS_INLINE void
+  hedge_won() {
+    stats_.hedges_won++;
+  }
+
+  SMF_ALWAYS_INLINE const rpc_hedging_stats &
+  stats() const {
+    return stats_;
+  }
+  SMF_ALWAYS_INLINE const rpc_hedging_opts &
+  opts() const {
+    return opts_;
+  }
+
+ private:
+  const rpc_hedging_opts opts_;
+  rpc_hedging_stats stats_;
+  double tokens_{0};
+  std::optional<typename seastar::timer<>::duration> delay_;
+  seastar::lowres_clock::time_point next_refresh_{};
+  /// \brief replies since the delay was last computed
+  std::unique_ptr<histogram> window_;
+  uint64_t window_count_{0};
+};
+
+}  // namespace smf
@@ -2,8 +2,12 @@
 //
 #pragma once
 
+#include <optional>
+#include <unordered_map>
+
 #include <seastar/core/sstring.hh>
 #include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/timer.hh>
 
 #include "smf/macros.h"
 #include "smf/rpc_generated.h"
@@ -31,7 +35,11 @@ struct rpc_letter {
   bool empty() const;
 
   rpc::header header;
+  /// \brief sent with the letter as rpc::payload_headers, see
+  /// control_type::payload_headers
   std::unordered_map<seastar::sstring, seastar::sstring> dynamic_headers;
+  /// \brief sent as the time left when the letter is written to the socket
+  std::optional<seastar::timer<>::clock::time_point> deadline;
   seastar::temporary_buffer<char> body;
 };
 
@@ -0,0 +1,40 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <optional>
+#include <unordered_map>
+
+#include <seastar/core/sstring.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/timer.hh>
+
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_generated.h"
+
+namespace smf {
+
+/// \brief decoded rpc::payload_headers.
+///
+/// They travel in a control_type::payload_headers frame written right before
+/// the frame they describe - which carries header_bit_flags::has_payload_headers
+/// - so the body is never copied to make room for them, and letters without
+/// dynamic headers or deadline pay nothing.
+///
+struct rpc_payload_headers {
+  /// \brief larger control frames close the connection
+  static constexpr uint32_t kMaxSize = 16 * 1024;
+
+  /// \brief the control frame to send before `l`. std::nullopt if the letter
+  /// has neither dynamic headers nor a deadline
+  static std::optional<rpc_envelope> encode(const rpc_letter &l);
+  /// \brief verifies the flatbuffer. The deadline is relative to now
+  static std::optional<rpc_payload_headers>
+  decode(const seastar::temporary_buffer<char> &buf);
+
+  std::unordered_map<seastar::sstring, seastar::sstring> dynamic_headers;
+  std::optional<seastar::timer<>::clock::time_point> deadline;
+};
+
+}  // namespace smf
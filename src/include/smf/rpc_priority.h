@@ -0,0 +1,33 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include "smf/macros.h"
+#include "smf/rpc_generated.h"
+
+namespace smf {
+
+/// \brief write lane of a frame. See rpc_send_queue
+enum class rpc_priority : uint8_t { normal = 0, high = 1 };
+
+static constexpr uint32_t kRpcPriorities = 2;
+
+SMF_ALWAYS_INLINE rpc_priority
+rpc_priority_of(const rpc::header &hdr) {
+  return (hdr.bitflags() & rpc::header_bit_flags::header_bit_flags_high_priority)
+           ? rpc_priority::high
+           : rpc_priority::normal;
+}
+
+SMF_ALWAYS_INLINE void
+set_rpc_priority(rpc::header &hdr, rpc_priority p) {
+  constexpr uint8_t kMask = rpc::header_bit_flags::header_bit_flags_high_priority;
+  uint8_t flags = static_cast<uint8_t>(hdr.bitflags()) & ~kMask;
+  if (p == rpc_priority::high) { flags |= kMask; }
+  hdr.mutate_bitflags(static_cast<rpc::header_bit_flags>(flags));
+}
+
+}  // namespace smf
@@ -2,9 +2,16 @@
 //
 #pragma once
 // std
+#include <algorithm>
 #include <optional>
+#include <unordered_map>
+#include <vector>
 // seastar
+#include <seastar/core/abort_source.hh>
 #include <seastar/core/iostream.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/core/timer.hh>
 #include <seastar/net/api.hh>
 // smf
 #include "smf/macros.h"
@@ -27,6 +34,15 @@ struct rpc_recv_context {
   static seastar::future<std::optional<rpc_recv_context>>
   parse_payload(rpc_connection *conn, rpc::header hdr);
 
+  /// \brief sanity checks on a header *before* reading the body.
+  /// normalizes compression_flags_disabled to compression_flags_none
+  static bool validate_header(rpc::header *hdr);
+  /// \brief validates the body against the header, i.e.: checksums.
+  /// used by parse_payload() and the rpc_frame_parser
+  static std::optional<rpc_recv_context>
+  from_frame(rpc_connection *conn, rpc::header hdr,
+             seastar::temporary_buffer<char> body);
+
   explicit rpc_recv_context(
     seastar::lw_shared_ptr<rpc_connection_limits> server_instance_limits,
     seastar::socket_address remote_address, rpc::header hdr,
@@ -52,10 +68,56 @@ struct rpc_recv_context {
     return header.session();
   }
 
+  /// \brief true if the body arrived as fragment frames and is still split
+  /// across `fragments`. `payload` is empty in that case
+  SMF_ALWAYS_INLINE bool
+  is_fragmented() const {
+    return !fragments.empty();
+  }
+  /// \brief true once the client cancelled this request. Handlers doing
+  /// long work should check it, or subscribe to `cancellation`
+  SMF_ALWAYS_INLINE bool
+  is_cancelled() const {
+    return cancellation && cancellation->abort_requested();
+  }
+  /// \brief true if the caller stopped waiting for the reply
+  SMF_ALWAYS_INLINE bool
+  is_expired() const {
+    return deadline && *deadline <= seastar::timer<>::clock::now();
+  }
+  /// \brief budget left for downstream calls. Propagate it with
+  /// rpc_envelope::set_deadline(*ctx.deadline)
+  SMF_ALWAYS_INLINE seastar::timer<>::duration
+  remaining() const {
+    if (!deadline) { return seastar::timer<>::duration::max(); }
+    return std::max(*deadline - seastar::timer<>::clock::now(),
+                    seastar::timer<>::duration::zero());
+  }
+  /// \brief copies `fragments` into one contiguous `payload`.
+  /// No-op if the body is not fragmented
+  void linearize();
+
   seastar::lw_shared_ptr<rpc_connection_limits> rpc_server_limits;
   const seastar::socket_address remote_address;
   rpc::header header;
   seastar::temporary_buffer<char> payload;
+  /// \brief see rpc_fragment_assembler. `header.size()` is the sum of all
+  std::vector<seastar::temporary_buffer<char>> fragments;
+  /// \brief server side only. Fires when a control_type::cancel frame for
+  /// this session arrives or the connection goes away. Handlers of requests
+  /// forwarded by rpc_service::shard_key get one of the owner core, which
+  /// the connection's core aborts in turn, e.g.:
+  /// \code{.cpp}
+  ///    seastar::sleep_abortable(100ms, *ctx.cancellation)
+  /// \endcode
+  seastar::lw_shared_ptr<seastar::abort_source> cancellation;
+  /// \brief from the rpc::payload_headers sent with the request - or, on
+  /// the client side, with the reply - if any
+  std::unordered_map<seastar::sstring, seastar::sstring> dynamic_headers;
+  std::optional<seastar::timer<>::clock::time_point> deadline;
+  /// \brief server side only. When the header was parsed; the time since
+  /// is how long the request queued. See rpc_server_args::load_shedding
+  seastar::timer<>::clock::time_point received{};
   SMF_DISALLOW_COPY_AND_ASSIGN(rpc_recv_context);
 };
 }  // namespace smf
@@ -0,0 +1,111 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/lowres_clock.hh>
+#include <seastar/core/temporary_buffer.hh>
+#include <seastar/util/noncopyable_function.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+struct rpc_response_cache_stats {
+  uint64_t hits{0};
+  uint64_t misses{0};
+  /// \brief entries dropped to make room or because their ttl expired
+  uint64_t evictions{0};
+};
+
+/// \brief per core, memory bounded cache of serialized replies. For methods
+/// whose reply is a pure function of the request - see the `cache_ttl_ms`
+/// smfc attribute and rpc_service_method_handle::cache_ttl.
+///
+/// Entries are keyed by request_id and the checksum the client put in the
+/// header, so a lookup costs no hashing. A hit is confirmed by comparing
+/// the payload byte by byte. Only 2xx replies are stored. Requests with
+/// dynamic headers or a fragmented body bypass the cache.
+///
+class rpc_response_cache {
+ public:
+  using clock_type = seastar::lowres_clock;
+  using apply_fn = seastar::noncopyable_function<seastar::future<rpc_envelope>(
+    rpc_recv_context &&)>;
+
+  /// \brief bytes of requests plus replies held. 0 disables the cache
+  explicit rpc_response_cache(size_t max_bytes) : max_bytes_(max_bytes) {}
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_response_cache);
+
+  /// \brief the cached reply to `ctx`, or `fn(ctx)` stored for `ttl`.
+  /// `request` is the header as read off the wire
+  seastar::future<rpc_envelope> apply(rpc_recv_context &&ctx,
+                                      const rpc::header &request,
+                                      std::chrono::milliseconds ttl,
+                                      apply_fn fn);
+
+  SMF_ALWAYS_INLINE const rpc_response_cache_stats &
+  stats() const {
+    return stats_;
+  }
+  SMF_ALWAYS_INLINE size_t
+  size_bytes() const {
+    return bytes_;
+  }
+  SMF_ALWAYS_INLINE size_t
+  size() const {
+    return index_.size();
+  }
+
+ private:
+  struct key {
+    uint32_t request_id;
+    uint64_t prefilter;
+    bool
+    operator==(const key &o) const {
+      return request_id == o.request_id && prefilter == o.prefilter;
+    }
+  };
+  struct key_hash {
+    size_t
+    operator()(const key &k) const {
+      return k.prefilter ^ (uint64_t(k.request_id) << 32);
+    }
+  };
+  struct entry {
+    key k;
+    seastar::temporary_buffer<char> request;
+    rpc::header reply_header;
+    std::unordered_map<seastar::sstring, seastar::sstring> reply_headers;
+    seastar::temporary_buffer<char> reply;
+    clock_type::time_point expires;
+    size_t
+    bytes() const {
+      return sizeof(entry) + request.size() + reply.size();
+    }
+  };
+  /// \brief most recently used first
+  using lru_list = std::list<entry>;
+
+  static key make_key(const rpc_recv_context &ctx, const rpc::header &request);
+  void put(key k, seastar::temporary_buffer<char> request,
+           const rpc_envelope &reply, std::chrono::milliseconds ttl);
+  void erase(lru_list::iterator it);
+
+ private:
+  const size_t max_bytes_;
+  size_t bytes_{0};
+  lru_list lru_;
+  std::unordered_map<key, lru_list::iterator, key_hash> index_;
+  rpc_response_cache_stats stats_;
+};
+
+}  // namespace smf
@@ -0,0 +1,150 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <optional>
+#include <vector>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/net/packet.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_priority.h"
+
+namespace smf {
+
+struct rpc_send_queue_stats {
+  /// \brief number of frames written to the socket
+  uint64_t frames{0};
+  /// \brief number of output_stream::flush() calls, i.e.: syscalls
+  uint64_t flushes{0};
+  /// \brief header + body bytes written to the socket
+  uint64_t bytes{0};
+};
+
+/// \brief per connection write coalescing.
+///
+/// Every envelope that becomes ready during the same reactor tick is gathered
+/// into one net::packet (one iovec entry per header and per body) and written
+/// with a single flush(). When `max_cork` is non-zero, the flush is delayed up
+/// to that duration so that pipelined responses produced by slower handlers
+/// can share the same syscall.
+///
+/// Frames wait in one lane per rpc_priority. A flush writes high priority
+/// frames first, up to kMaxPriorityBytesPerFlush, then normal ones up to
+/// kMaxBulkBytesPerFlush, so a heartbeat queued behind a large - fragmented -
+/// response waits for at most that many bytes instead of the whole response,
+/// and a flood of high priority frames still lets normal ones through.
+///
+/// The returned future of `enqueue()` resolves once the last frame of the
+/// envelope has been flushed. Callers must keep the owning connection alive
+/// until then, and the owner must wait for close() before destroying the
+/// queue.
+///
+class rpc_send_queue {
+ public:
+  using duration = typename seastar::timer<>::duration;
+  /// \brief after this many frames a batch is sealed and flushed right away.
+  /// keeps the number of iovecs for a single sendmsg bounded
+  static constexpr uint32_t kMaxFramesPerBatch = 256;
+  /// \brief bytes after which a corked batch is flushed without waiting
+  static constexpr uint64_t kMaxCorkedBytes = 1 << 16;
+  /// \brief normal priority bytes per flush while more are queued. Bounds
+  /// the head-of-line blocking of high priority frames
+  static constexpr uint64_t kMaxBulkBytesPerFlush = 1 << 18;
+  /// \brief high priority bytes per flush while more are queued. Normal
+  /// frames get at least 1/5th of the socket under a high priority flood
+  static constexpr uint64_t kMaxPriorityBytesPerFlush = 1 << 20;
+
+  explicit rpc_send_queue(seastar::output_stream<char> *out,
+                          duration max_cork = duration(0));
+  ~rpc_send_queue();
+
+  seastar::future<> enqueue(rpc_envelope e);
+  /// \brief waits for the flush in progress, if any. Frames not written yet
+  /// fail, and so does every enqueue() after it
+  seastar::future<> close();
+
+  void
+  set_max_cork(duration d) {
+    max_cork_ = d;
+  }
+  /// \brief bodies larger than this are split in fragment frames so that
+  /// the receiver can reserve memory per fragment. 0 disables it
+  void
+  set_max_fragment_size(uint32_t s) {
+    max_fragment_size_ = s;
+  }
+  /// \brief useful for aggregating counters of many connections, i.e.: all
+  /// connections of an rpc_server core share the same counters.
+  /// pointer must outlive this queue.
+  void
+  set_stats(rpc_send_queue_stats *s) {
+    stats_ = s;
+  }
+  const rpc_send_queue_stats &
+  stats() const {
+    return *stats_;
+  }
+  /// \brief frames waiting for the next flush
+  uint32_t
+  pending_frames() const {
+    return lanes_[0].frames.size() + lanes_[1].frames.size();
+  }
+
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_send_queue);
+
+ private:
+  struct frame {
+    seastar::temporary_buffer<char> header;
+    seastar::temporary_buffer<char> body;
+    /// \brief set on the last frame of an envelope
+    std::optional<seastar::promise<>> done;
+  };
+  struct lane {
+    std::deque<frame> frames;
+    uint64_t bytes{0};
+  };
+
+  void append(lane &l, rpc::header hdr, seastar::temporary_buffer<char> body);
+  /// \brief moves frames of `l` into `p` until `budget` bytes are taken or
+  /// `p` has `max_frags` iovecs. At least one frame, if any
+  void take(lane &l, uint64_t budget, uint32_t max_frags,
+            seastar::net::packet &p, std::vector<seastar::promise<>> &done);
+  void schedule_flush();
+  void flush_in_background();
+  seastar::future<> flush();
+  void fail(std::exception_ptr e);
+
+ private:
+  seastar::output_stream<char> *out_;
+  duration max_cork_;
+  uint32_t max_fragment_size_{0};
+  rpc_send_queue_stats local_stats_{};
+  rpc_send_queue_stats *stats_{&local_stats_};
+
+  /// \brief indexed by rpc_priority
+  std::array<lane, kRpcPriorities> lanes_;
+  /// \brief resolved after every flush. Only used for back pressure
+  seastar::lw_shared_ptr<seastar::shared_promise<>> next_flush_;
+
+  bool flush_scheduled_{false};
+  bool flushing_{false};
+  seastar::timer<> cork_timer_;
+  /// \brief every flush, and the yield before it
+  seastar::gate gate_;
+  std::exception_ptr error_;
+};
+
+}  // namespace smf
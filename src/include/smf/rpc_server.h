@@ -3,11 +3,14 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <type_traits>
 #include <unordered_map>
 #include <optional>
+#include <vector>
 
 #include <seastar/core/distributed.hh>
+#include <seastar/core/sharded.hh>
 #include <seastar/core/gate.hh>
 #include <seastar/core/metrics_registration.hh>
 #include <seastar/core/timer.hh>
@@ -16,27 +19,46 @@
 
 #include "smf/histogram.h"
 #include "smf/macros.h"
+#include "smf/rpc_codel.h"
+#include "smf/rpc_concurrency_limiter.h"
 #include "smf/rpc_connection_limits.h"
 #include "smf/rpc_filter.h"
 #include "smf/rpc_handle_router.h"
+#include "smf/rpc_priority.h"
+#include "smf/rpc_response_cache.h"
 #include "smf/rpc_server_args.h"
 #include "smf/rpc_server_connection.h"
 #include "smf/rpc_server_stats.h"
+#include "smf/rpc_single_flight.h"
 #include "smf/zstd_filter.h"
 
 namespace smf {
 
-class rpc_server {
+/// \brief one per core, in a seastar::sharded<rpc_server>. Requests of
+/// services with an rpc_service::shard_key are forwarded to the instance on
+/// the owning core
+class rpc_server : public seastar::peering_sharded_service<rpc_server> {
 
   /// \brief filter type to process data *before* it hits main handle
-  using in_filter_t =
-    std::function<seastar::future<rpc_recv_context>(rpc_recv_context)>;
+  using in_filter_t = rpc_incoming_filter;
 
   /// \brief filter type for sending data back out to clients
-  using out_filter_t =
-    std::function<seastar::future<rpc_envelope>(rpc_envelope)>;
+  using out_filter_t = rpc_outgoing_filter;
 
  public:
+  /// \brief HTTP style status of requests whose deadline expired before
+  /// they reached the handler. See rpc_envelope::set_deadline()
+  static constexpr uint32_t kDeadlineExceededStatus = 504;
+  /// \brief HTTP style status of requests rejected by the adaptive
+  /// concurrency limit. Safe to retry, preferably on another server
+  static constexpr uint32_t kOverloadedStatus = 503;
+  /// \brief HTTP style status of requests larger than
+  /// rpc_method_quota::max_payload_size
+  static constexpr uint32_t kPayloadTooLargeStatus = 413;
+  /// \brief HTTP style status of requests over the max_concurrency or
+  /// max_inflight_bytes rpc_method_quota of their method
+  static constexpr uint32_t kOverQuotaStatus = 429;
+
   explicit rpc_server(rpc_server_args args);
   ~rpc_server();
 
@@ -47,7 +69,17 @@ class rpc_server {
   /// \brief copy histogram. Cannot be made const due to seastar::map_reduce
   /// const-ness bugs
   seastar::future<std::unique_ptr<smf::histogram>> copy_histogram();
+  /// \brief latency of the requests sent with priority `p` only
+  seastar::future<std::unique_ptr<smf::histogram>>
+  copy_priority_histogram(rpc_priority p);
+  /// \brief of this core, every connection included
+  SMF_ALWAYS_INLINE const rpc_server_stats &
+  stats() const {
+    return *stats_;
+  }
 
+  /// \brief throws if the service, or one of its methods, names a
+  /// scheduling group missing from rpc_server_args::scheduling_groups
   template <typename T, typename... Args>
   void
   register_service(Args &&... args) {
@@ -55,17 +87,72 @@ class rpc_server {
                   "register_service can only be called with a derived class of "
                   "smf::rpc_service");
     routes_.register_service(std::make_unique<T>(std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
   }
+  /// \brief creates seastar scheduling groups with these shares, for
+  /// rpc_server_args::scheduling_groups. Groups are global: call it once,
+  /// before starting the servers on every core
+  static seastar::future<
+    std::unordered_map<seastar::sstring, seastar::scheduling_group>>
+  create_scheduling_groups(std::unordered_map<seastar::sstring, float> shares);
+
   template <typename Function, typename... Args>
   void
   register_incoming_filter(Args &&... args) {
-    in_filters_.push_back(Function(std::forward<Args>(args)...));
+    in_filters_.push_back(rpc_shared_filter<in_filter_t, Function>(
+      std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
   }
 
   template <typename Function, typename... Args>
   void
   register_outgoing_filter(Args &&... args) {
-    out_filters_.push_back(Function(std::forward<Args>(args)...));
+    out_filters_.push_back(rpc_shared_filter<out_filter_t, Function>(
+      std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
+  }
+
+  /// \brief only requests for the methods of the service named
+  /// `service_name` pay for these, after the server's incoming filters.
+  /// Methods left without filters skip the filter execution stage. The
+  /// filter is shared by every method of the service, not copied
+  template <typename Function, typename... Args>
+  void
+  register_service_incoming_filter(const seastar::sstring &service_name,
+                                   Args &&... args) {
+    routes_.service_filters(service_name)
+      .incoming.push_back(rpc_shared_filter<in_filter_t, Function>(
+        std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
+  }
+  /// \brief run before the server's outgoing filters
+  template <typename Function, typename... Args>
+  void
+  register_service_outgoing_filter(const seastar::sstring &service_name,
+                                   Args &&... args) {
+    routes_.service_filters(service_name)
+      .outgoing.push_back(rpc_shared_filter<out_filter_t, Function>(
+        std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
+  }
+  /// \brief like register_service_incoming_filter(), for the one method
+  /// of `request_id`. Runs after its service's filters
+  template <typename Function, typename... Args>
+  void
+  register_method_incoming_filter(uint32_t request_id, Args &&... args) {
+    routes_.method_filters(request_id)
+      .incoming.push_back(rpc_shared_filter<in_filter_t, Function>(
+        std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
+  }
+  /// \brief runs before its service's outgoing filters
+  template <typename Function, typename... Args>
+  void
+  register_method_outgoing_filter(uint32_t request_id, Args &&... args) {
+    routes_.method_filters(request_id)
+      .outgoing.push_back(rpc_shared_filter<out_filter_t, Function>(
+        std::forward<Args>(args)...));
+    routes_.resolve_filters(in_filters_, out_filters_);
   }
 
   SMF_DISALLOW_COPY_AND_ASSIGN(rpc_server);
@@ -74,11 +161,35 @@ class rpc_server {
   seastar::future<rpc_envelope> apply_outgoing_filters(rpc_envelope);
 
  private:
+  /// \brief accepts until abort_accept(). Never fails
+  seastar::future<>
+  accept_loop(seastar::lw_shared_ptr<seastar::server_socket> listener);
+
   seastar::future<>
   handle_client_connection(seastar::lw_shared_ptr<rpc_server_connection> conn);
 
   seastar::future<>
   handle_one_client_session(seastar::lw_shared_ptr<rpc_server_connection> conn);
+  /// \brief reads the body of `hdr`, once there is memory for it
+  seastar::future<>
+  handle_pending_frame(seastar::lw_shared_ptr<rpc_server_connection> conn,
+                       rpc::header hdr,
+                       seastar::timer<>::clock::time_point received);
+
+  /// \brief unary requests go to dispatch_rpc(); stream and control frames
+  /// are routed in order, on the read fiber, to dispatch_stream_frame()
+  void dispatch_frame(int32_t payload_size,
+                      seastar::lw_shared_ptr<rpc_server_connection> conn,
+                      std::optional<rpc_recv_context> ctx);
+
+  void
+  dispatch_stream_frame(seastar::lw_shared_ptr<rpc_server_connection> conn,
+                        rpc_recv_context &&ctx);
+
+  seastar::lw_shared_ptr<rpc_stream>
+  open_stream(seastar::lw_shared_ptr<rpc_server_connection> conn,
+              rpc_service_method_handle *method, uint16_t session,
+              rpc::header request);
 
   seastar::future<>
   dispatch_rpc(int32_t payload_size,
@@ -94,11 +205,66 @@ class rpc_server {
   seastar::future<>
   cleanup_dispatch_rpc(seastar::lw_shared_ptr<rpc_server_connection> conn);
 
+  /// \brief runs the handler here, or on the core returned by
+  /// rpc_handle_router::owner_shard() without copying the payload or the
+  /// reply
+  seastar::future<rpc_envelope>
+  apply_on_owner(rpc_service_method_handle *method, rpc_recv_context &&ctx);
+  /// \brief owner core side of apply_on_owner(). `cancellation` fires when
+  /// the request is cancelled on the core that read it
+  seastar::future<seastar::foreign_ptr<std::unique_ptr<rpc_envelope>>>
+  apply_forwarded(
+    seastar::foreign_ptr<std::unique_ptr<rpc_recv_context>> request,
+    seastar::lw_shared_ptr<seastar::abort_source> cancellation);
+  /// \brief owner core side of the cancellation of a forwarded request
+  void cancel_forwarded(uint64_t token);
+
+  /// \brief port of core 0 with rpc_server_flags_shard_ports
+  SMF_ALWAYS_INLINE uint16_t
+  shard_port_base() const {
+    return args_.rpc_port + 1;
+  }
+  /// \brief largest request, fragmented or not, the handshake advertises.
+  /// One larger than the memory of the core would never be read
+  SMF_ALWAYS_INLINE uint64_t
+  max_message_size() const {
+    return std::min<uint64_t>(FLATBUFFERS_MAX_BUFFER_SIZE,
+                              args_.memory_avail_per_core);
+  }
+
+  /// \brief rpc_server_flags_connection_metrics
+  void
+  register_connection_metrics(
+    seastar::lw_shared_ptr<rpc_server_connection> conn);
+  /// \brief rpc_server_args::load_shedding verdict for `ctx`
+  bool should_shed(const rpc_recv_context &ctx);
+  /// \brief kPayloadTooLargeStatus or kOverQuotaStatus if a `size` bytes
+  /// request is over the rpc_method_quota of `method`; 0 otherwise
+  uint32_t check_method_quota(const rpc_service_method_handle *method,
+                              uint64_t size);
+  /// \brief quota check of a request whose body was not read yet
+  uint32_t check_method_quota(const rpc::header &hdr);
+  /// \brief kPayloadTooLargeStatus once the frames of a fragmented request
+  /// add up to more than the max_payload_size of its method
+  uint32_t check_fragment_quota(const rpc_server_connection &conn,
+                                const rpc_recv_context &ctx);
+  /// \brief fast, empty reply with `status`
+  seastar::future<>
+  reply_status(seastar::lw_shared_ptr<rpc_server_connection> conn,
+               const rpc::header &request, uint32_t status);
+  /// \brief fast, empty, kDeadlineExceededStatus reply
+  seastar::future<>
+  reply_deadline_exceeded(seastar::lw_shared_ptr<rpc_server_connection> conn,
+                          const rpc_recv_context &ctx);
+
   // SEDA piplines
+  /// \brief skip the stage if `filters` is null. The chain lives until the
+  /// filters are done
   seastar::future<rpc_recv_context>
-    stage_apply_incoming_filters(rpc_recv_context);
+  stage_apply_incoming_filters(rpc_incoming_chain filters, rpc_recv_context);
 
-  seastar::future<rpc_envelope> stage_apply_outgoing_filters(rpc_envelope);
+  seastar::future<rpc_envelope>
+  stage_apply_outgoing_filters(rpc_outgoing_chain filters, rpc_envelope);
 
  private:
   const rpc_server_args args_;
@@ -107,8 +273,27 @@ class rpc_server {
   rpc_handle_router routes_;
   std::vector<in_filter_t> in_filters_;
   std::vector<out_filter_t> out_filters_;
+  /// \brief rpc_service_method_handle::single_flight methods
+  rpc_single_flight single_flight_;
+  /// \brief rpc_service_method_handle::cache_ttl methods
+  rpc_response_cache response_cache_;
+  /// \brief rpc_server_args::concurrency_limit
+  std::optional<rpc_concurrency_limiter> limiter_;
+  /// \brief rpc_server_args::load_shedding
+  std::optional<rpc_codel> codel_;
+  /// \brief cancellation of the requests other cores forwarded here, by
+  /// the token apply_on_owner() gave them
+  std::unordered_map<uint64_t, seastar::lw_shared_ptr<seastar::abort_source>>
+    forwarded_;
+  uint64_t forward_seq_{0};
+  /// \brief requests run in each rpc_server_args::scheduling_groups entry
+  std::unordered_map<seastar::sstring, uint64_t> group_requests_;
   // -- http & rpc sockets
   seastar::lw_shared_ptr<seastar::server_socket> listener_;
+  /// \brief rpc_server_args::unix_address and shm_path on core 0, and the
+  /// port of this core with rpc_server_flags_shard_ports
+  std::vector<seastar::lw_shared_ptr<seastar::server_socket>>
+    local_listeners_;
   seastar::lw_shared_ptr<seastar::http_server> admin_ = nullptr;
   // connection counting happens in different future
   // must survive this instance
@@ -117,13 +302,16 @@ class rpc_server {
 
   /// \brief keeps latency measurements per request flow
   seastar::lw_shared_ptr<histogram> hist_ = histogram::make_lw_shared();
+  /// \brief same as hist_, indexed by rpc_priority
+  std::array<seastar::lw_shared_ptr<histogram>, kRpcPriorities>
+    priority_hist_{{histogram::make_lw_shared(), histogram::make_lw_shared()}};
 
   // this is needed for shutdown procedures
   uint64_t connection_idx_{0};
   std::unordered_map<uint64_t, seastar::lw_shared_ptr<rpc_server_connection>>
     open_connections_;
 
-  /// \brief set once keep_listening has exited
+  /// \brief set once every accept loop has exited
   seastar::promise<> stopped_;
   /// \brief keeps server alive until all continuations have finished
   seastar::gate reply_gate_;
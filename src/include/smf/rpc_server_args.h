@@ -4,18 +4,52 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
 
+#include <seastar/core/scheduling.hh>
 #include <seastar/core/sstring.hh>
 #include <seastar/core/timer.hh>
 #include <seastar/net/tls.hh>
 
+#include "smf/rpc_codel.h"
+#include "smf/rpc_concurrency_limiter.h"
+#include "smf/rpc_handshake.h"
+#include "smf/rpc_unix_address.h"
+#include "smf/shm_transport.h"
+
 namespace smf {
-enum rpc_server_flags : uint32_t { rpc_server_flags_disable_http_server = 1 };
+enum rpc_server_flags : uint32_t {
+  rpc_server_flags_disable_http_server = 1,
+  /// \brief core `i` also listens on `rpc_port + 1 + i`, and handshakes
+  /// publish the core count and `rpc_port + 1`. Lets an rpc_shard_router
+  /// send each request straight to the core owning it, instead of going
+  /// through the core the kernel picked for `rpc_port`. Needs SO_REUSEPORT
+  /// with the posix stack
+  rpc_server_flags_shard_ports = 2,
+  /// \brief exports in-flight requests and bytes, and memory waited for,
+  /// of every connection, labelled by connection id and remote address
+  rpc_server_flags_connection_metrics = 4
+};
 
 struct rpc_server_args {
   seastar::sstring ip = "";
   uint16_t rpc_port = 11225;
   uint16_t http_port = 33140;
+  /// \brief if set, also listen on this address - usually
+  /// `smf::make_unix_address(path)` - next to `rpc_port`. A unix socket path
+  /// can only be bound once, so only core 0 listens on it. A stale socket
+  /// file left at the path is removed first
+  ///
+  std::optional<seastar::socket_address> unix_address;
+  /// \brief if not empty, core 0 also accepts shared-memory connections
+  /// from clients on this host. See shm_transport.h. Never uses tls
+  ///
+  seastar::sstring shm_path;
+  /// \brief ring_size is the largest ring a client may ask for
+  ///
+  shm_transport_opts shm;
   /// \brief rpc_server_flags are bitwise flags.
   ///
   uint32_t flags = 0;
@@ -32,6 +66,65 @@ struct rpc_server_args {
   /// continue
   ///
   uint64_t memory_avail_per_core = uint64_t(1) << 31 /*2GB per core*/;
+  /// \brief max time a response may wait for other responses to share the
+  /// same flush() of the socket. 0 means flush once per reactor tick
+  ///
+  typename seastar::timer<>::duration max_write_cork =
+    std::chrono::microseconds(0);
+  /// \brief responses larger than this are sent as fragment frames.
+  /// Only enable if every client understands fragments. 0 disables it
+  ///
+  uint32_t max_fragment_size = 0;
+  /// \brief codecs offered to clients that send a handshake. See
+  /// rpc_negotiated. 0 disables automatic compression
+  ///
+  uint32_t codecs = rpc_handshake::kDefaultCodecs;
+  /// \brief checksums offered to clients that send a handshake, as bits of
+  /// rpc::checksum_type. Add checksum_type_none only on trusted links or
+  /// with TLS
+  ///
+  uint32_t checksums = rpc_handshake::kDefaultChecksums;
+  /// \brief replies up to this size are not compressed by the negotiated
+  /// codec
+  ///
+  uint32_t min_compression_size = 1024;
+  /// \brief bytes per core of the rpc_response_cache used by methods with
+  /// a `cache_ttl_ms` attribute. 0 disables it
+  ///
+  uint64_t response_cache_size = uint64_t(64) << 20 /*64MB per core*/;
+  /// \brief if set, each core adapts a limit of unary requests in flight to
+  /// the dispatch latency it measures, and rejects requests over it with
+  /// rpc_server::kOverloadedStatus. See rpc_concurrency_limiter
+  ///
+  std::optional<rpc_concurrency_limiter_opts> concurrency_limit;
+  /// \brief if set, each core measures how long requests queue - from the
+  /// parsed header, through the memory semaphore, to dispatch - and, while
+  /// that stays too long or memory runs low, rejects the ones that waited
+  /// the longest with rpc_server::kOverloadedStatus. See rpc_codel
+  ///
+  std::optional<rpc_codel_opts> load_shedding;
+  /// \brief caps of unary requests in flight per connection, and of the
+  /// bytes they hold of `memory_avail_per_core`. A connection at either cap
+  /// is not read from until a request finishes. 0 disables a cap
+  ///
+  uint32_t max_inflight_requests_per_connection = 0;
+  uint64_t max_inflight_bytes_per_connection = 0;
+  /// \brief bytes of `memory_avail_per_core` the incomplete fragmented
+  /// requests of one connection may hold. A connection going over it is
+  /// closed. 0 means half of `memory_avail_per_core`
+  ///
+  uint64_t max_fragmented_bytes_per_connection = 0;
+  /// \brief weight of a new connection in the fair sharing of the core
+  /// memory budget; 1 if unset
+  ///
+  std::function<uint32_t(const seastar::socket_address &)> connection_weight;
+  /// \brief groups rpc_service::scheduling_group and
+  /// rpc_service_method_handle::scheduling_group refer to, by name. Their
+  /// requests - filters, handler and reply - run in that group, and get
+  /// its share of the reactor. See rpc_server::create_scheduling_groups()
+  ///
+  std::unordered_map<seastar::sstring, seastar::scheduling_group>
+    scheduling_groups;
 };
 
 }  // namespace smf
@@ -3,12 +3,21 @@
 #pragma once
 // std
 #include <chrono>
+#include <optional>
+#include <unordered_map>
 // seastar
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/metrics_registration.hh>
 #include <seastar/net/api.hh>
 // smf
 #include "smf/log.h"
 #include "smf/rpc_connection.h"
+#include "smf/rpc_fragment_assembler.h"
+#include "smf/rpc_handshake.h"
+#include "smf/rpc_payload_headers.h"
 #include "smf/rpc_server_stats.h"
+#include "smf/rpc_stream.h"
 namespace smf {
 struct rpc_server_connection_options {
   explicit rpc_server_connection_options(bool _nodelay = false,
@@ -76,6 +85,7 @@ class rpc_server_connection final {
       conn.socket.set_keepalive(true);
       conn.socket.set_keepalive_parameters(opts_.keepalive);
     }
+    conn.send_queue.set_stats(&stats->send_queue);
     stats->active_connections++;
     stats->total_connections++;
   }
@@ -104,14 +114,70 @@ class rpc_server_connection final {
     return conn.limits;
   }
 
+  /// \brief true while unary requests in flight are at either cap
+  SMF_ALWAYS_INLINE bool
+  over_inflight_caps() const {
+    return (max_inflight_requests != 0 &&
+            inflight_requests >= max_inflight_requests) ||
+           (max_inflight_bytes != 0 && inflight_bytes >= max_inflight_bytes);
+  }
+  /// \brief resolves once the connection is under its in-flight caps. The
+  /// server stops reading from a connection until then
+  seastar::future<>
+  wait_under_inflight_caps() {
+    if (!over_inflight_caps()) { return seastar::make_ready_future<>(); }
+    under_caps_.emplace();
+    return under_caps_->get_future();
+  }
+  SMF_ALWAYS_INLINE void
+  admit_request(uint64_t bytes) {
+    inflight_requests++;
+    inflight_bytes += bytes;
+  }
+  void
+  retire_request(uint64_t bytes) {
+    inflight_requests--;
+    inflight_bytes -= bytes;
+    if (under_caps_ && !over_inflight_caps()) {
+      under_caps_->set_value();
+      under_caps_ = std::nullopt;
+    }
+  }
+
   rpc_connection conn;
   const uint64_t id;
   seastar::lw_shared_ptr<rpc_server_stats> stats;
-  seastar::semaphore serialize_writes{1};
+  /// \brief requests sent as fragment frames, keyed by header.session.
+  /// The server caps it to its memory budget on accept
+  rpc_fragment_assembler fragments{FLATBUFFERS_MAX_BUFFER_SIZE};
+  /// \brief open streaming rpcs, keyed by header.session
+  std::unordered_map<uint16_t, seastar::lw_shared_ptr<rpc_stream>> streams;
+  /// \brief requests being dispatched, keyed by header.session, so a
+  /// control_type::cancel frame can reach the handler
+  std::unordered_map<uint16_t, seastar::lw_shared_ptr<seastar::abort_source>>
+    inflight;
+  /// \brief control_type::payload_headers waiting for their request,
+  /// keyed by header.session
+  std::unordered_map<uint16_t, rpc_payload_headers> payload_headers;
+  /// \brief set once the client sent a control_type::handshake
+  std::optional<rpc_negotiated> negotiated;
+  /// \brief unary requests being dispatched, and the bytes they hold of
+  /// the core memory budget
+  uint32_t inflight_requests{0};
+  uint64_t inflight_bytes{0};
+  /// \brief see rpc_server_args. 0 means no cap
+  uint32_t max_inflight_requests{0};
+  uint64_t max_inflight_bytes{0};
+  /// \brief share of the core memory budget while it is short, relative to
+  /// other connections. See rpc_connection_limits::fair_wait()
+  uint32_t weight{1};
+  /// \brief rpc_server_flags_connection_metrics
+  seastar::metrics::metric_groups metrics;
 
   SMF_DISALLOW_COPY_AND_ASSIGN(rpc_server_connection);
 
  private:
   rpc_server_connection_options opts_;
+  std::optional<seastar::promise<>> under_caps_;
 };
 }  // namespace smf
@@ -3,6 +3,8 @@
 
 #pragma once
 
+#include "smf/rpc_send_queue.h"
+
 namespace smf {
 
 // NEEDED on their *own* header
@@ -16,6 +18,20 @@ struct rpc_server_stats {
   uint64_t no_route_requests{};
   uint64_t completed_requests{};
   uint64_t too_large_requests{};
+  uint64_t cancelled_requests{};
+  uint64_t deadline_exceeded_requests{};
+  /// \brief requests run on the core owning their shard key
+  uint64_t forwarded_requests{};
+  /// \brief rejected by the adaptive concurrency limit
+  uint64_t overloaded_requests{};
+  /// \brief rejected by load shedding after queueing for too long
+  uint64_t shed_requests{};
+  /// \brief rejected by the rpc_method_quota of their method
+  uint64_t over_quota_requests{};
+  uint64_t active_streams{};
+  uint64_t total_streams{};
+  /// \brief shared by every connection's rpc_send_queue on this core
+  rpc_send_queue_stats send_queue{};
 };
 
 }  // namespace smf
@@ -2,16 +2,56 @@
 //
 #pragma once
 
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include <seastar/core/scheduling.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/core/sstring.hh>
 #include <seastar/util/noncopyable_function.hh>
 
 #include "smf/rpc_envelope.h"
 #include "smf/rpc_recv_context.h"
+#include "smf/rpc_stream.h"
 
 namespace smf {
+/// \brief maps a request to a key. The request runs on core
+/// `key % seastar::smp::count`, see rpc_handle_router::owner_shard().
+/// Called after the incoming filters, on the core that read the request,
+/// with a contiguous payload. See rpc_shard_key.h for a typed version
+using rpc_shard_key_fn =
+  seastar::noncopyable_function<uint64_t(const rpc_recv_context &)>;
+
+using rpc_incoming_filter =
+  std::function<seastar::future<rpc_recv_context>(rpc_recv_context)>;
+using rpc_outgoing_filter =
+  std::function<seastar::future<rpc_envelope>(rpc_envelope)>;
+/// \brief a resolved filter chain. Never changes once built: requests hold
+/// their own reference, registering a filter builds new chains
+using rpc_incoming_chain =
+  seastar::lw_shared_ptr<const std::vector<rpc_incoming_filter>>;
+using rpc_outgoing_chain =
+  seastar::lw_shared_ptr<const std::vector<rpc_outgoing_filter>>;
+
+/// \brief per core admission limits of one unary method, checked right
+/// after the request header is parsed. 0 disables a limit
+struct rpc_method_quota {
+  /// \brief larger requests get rpc_server::kPayloadTooLargeStatus and
+  /// their body is skipped, never buffered
+  uint64_t max_payload_size{0};
+  /// \brief requests of the method being dispatched. Over it, requests get
+  /// rpc_server::kOverQuotaStatus
+  uint32_t max_concurrency{0};
+  /// \brief bytes of the requests of the method being dispatched. Over it,
+  /// requests get rpc_server::kOverQuotaStatus
+  uint64_t max_inflight_bytes{0};
+};
+
 // https://github.com/grpc/grpc/blob/d0fbba52d6e379b76a69016bc264b96a2318315f/include/grpc%2B%2B/impl/codegen/rpc_method.h
 struct rpc_service_method_handle {
-  // TODO(agallego) - expose through generator
-  // now it  the default is server_streaming
+  /// \brief set by smfc from the `streaming` attribute of the rpc method
   enum rpc_type {
     NORMAL_RPC = 0,
     CLIENT_STREAMING,  // request streaming
@@ -22,19 +62,80 @@ struct rpc_service_method_handle {
   using fn_t = seastar::noncopyable_function<seastar::future<rpc_envelope>(
     rpc_recv_context &&recv)>;
 
-  rpc_service_method_handle(fn_t &&f) : apply(std::move(f)) {}
+  /// \brief streaming methods own the stream until the returned future
+  /// resolves. The server closes it afterwards if the handler did not
+  using stream_fn_t = seastar::noncopyable_function<seastar::future<>(
+    seastar::lw_shared_ptr<rpc_stream>)>;
+
+  rpc_service_method_handle(fn_t &&f) : type(NORMAL_RPC), apply(std::move(f)) {}
+  rpc_service_method_handle(rpc_type t, stream_fn_t &&f)
+    : type(t), apply_stream(std::move(f)) {}
   ~rpc_service_method_handle() = default;
 
+  SMF_ALWAYS_INLINE bool
+  is_streaming() const {
+    return type != NORMAL_RPC;
+  }
+
+  const rpc_type type;
+  /// \brief if true, requests sent as fragments reach `apply` with
+  /// rpc_recv_context::fragments set instead of one contiguous payload.
+  /// Set by smfc for methods with the `fragmented` attribute
+  bool accepts_fragments{false};
+  /// \brief set iff type == NORMAL_RPC
   fn_t apply;
+  /// \brief set iff is_streaming()
+  stream_fn_t apply_stream;
+  /// \brief if set, wins over rpc_service::shard_key. Unary methods only
+  rpc_shard_key_fn shard_key;
+  /// \brief byte-identical requests arriving while one is running share its
+  /// reply instead of running the handler again. For idempotent reads only.
+  /// Unary methods only, see rpc_single_flight
+  bool single_flight{false};
+  /// \brief if > 0, replies are kept in the rpc_response_cache of the core
+  /// for this long. Set by smfc from the `cache_ttl_ms` attribute
+  std::chrono::milliseconds cache_ttl{0};
+  /// \brief name of the rpc_server_args::scheduling_groups entry requests
+  /// of this method run in. Wins over rpc_service::scheduling_group. Set by
+  /// smfc from the `scheduling_group` attribute
+  seastar::sstring scheduling_group;
+  /// \brief `scheduling_group` resolved by
+  /// rpc_handle_router::register_service(), which throws if it is unknown
+  std::optional<seastar::scheduling_group> bound_group;
+  /// \brief key of `bound_group` in rpc_server_args::scheduling_groups; not
+  /// necessarily the name the group was created with
+  seastar::sstring bound_group_key;
+  /// \brief unary methods only
+  rpc_method_quota quota;
+  /// \brief requests being dispatched on this core, see `quota`
+  uint32_t inflight_requests{0};
+  uint64_t inflight_bytes{0};
+  /// \brief every filter requests of this method go through: the server's,
+  /// its service's and its own. Built by rpc_handle_router::
+  /// resolve_filters(); null if there are none, which skips the filter
+  /// execution stages
+  rpc_incoming_chain incoming_filters;
+  rpc_outgoing_chain outgoing_filters;
 };
 
 struct rpc_service {
   virtual const char *service_name() const = 0;
   virtual uint32_t service_id() const = 0;
   virtual rpc_service_method_handle *method_for_request_id(uint32_t idx) = 0;
+  /// \brief request_id of every method, for method_for_request_id()
+  virtual std::vector<uint32_t> request_ids() const = 0;
   virtual std::ostream &print(std::ostream &) const = 0;
   virtual ~rpc_service() {}
   rpc_service() {}
+
+  /// \brief if set, every unary method of this service runs on the core
+  /// owning its key instead of the core that accepted the connection.
+  /// The payload and the reply cross cores without a copy
+  rpc_shard_key_fn shard_key;
+  /// \brief if set, every method of this service without a
+  /// scheduling_group of its own runs in this group. See
+  /// rpc_server_args::scheduling_groups
+  seastar::sstring scheduling_group;
 };
 }  // namespace smf
 
@@ -0,0 +1,40 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include <flatbuffers/flatbuffers.h>
+
+#include "smf/rpc_recv_context.h"
+#include "smf/rpc_service.h"
+
+namespace smf {
+
+/// \brief XXH64 of `key` with seed 0. Fixed across builds, compilers and
+/// languages: the server and rpc_shard_router clients must agree on it
+uint64_t rpc_shard_hash(std::string_view key);
+
+/// \brief shard key computed from the flatbuffer root of the request.
+/// Like rpc_recv_typed_context, the buffer is not verified.
+/// smfc generates a typed setter per unary method, i.e.:
+/// \code{.cpp}
+///    storage_service() {
+///      ShardGet([](const Request &r) {
+///        return smf::rpc_shard_hash(r.name()->string_view());
+///      });
+///    }
+/// \endcode
+template <typename T, typename Fn>
+rpc_shard_key_fn
+rpc_typed_shard_key(Fn fn) {
+  return [fn = std::move(fn)](const rpc_recv_context &ctx) -> uint64_t {
+    if (ctx.payload.empty()) { return 0; }
+    return fn(*flatbuffers::GetRoot<T>(ctx.payload.get()));
+  };
+}
+
+}  // namespace smf
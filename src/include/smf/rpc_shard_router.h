@@ -0,0 +1,124 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <flatbuffers/flatbuffers.h>
+#include <seastar/core/future-util.hh>
+
+#include "smf/log.h"
+#include "smf/macros.h"
+#include "smf/rpc_client.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_shard_key.h"
+
+namespace smf {
+
+/// \brief one `Client` - an smfc generated client - per core of a server
+/// started with rpc_server_flags_shard_ports. Requests go straight to the
+/// core owning their shard key, as computed by the server's
+/// rpc_service::shard_key, instead of being forwarded by the core that
+/// accepted the connection.
+///
+/// connect() learns the layout from a handshake on `opts.server_addr`. If
+/// the server does not publish one, every request goes to that connection.
+///
+/// \code{.cpp}
+///    // same functor the service passes to ShardGet()
+///    struct by_name {
+///      uint64_t operator()(const Request &r) const {
+///        return smf::rpc_shard_hash(r.name()->string_view());
+///      }
+///    };
+///    auto e = req.serialize_data();
+///    return router.route<Request>(e, by_name{}).Get(std::move(e));
+/// \endcode
+///
+template <typename Client>
+class rpc_shard_router {
+ public:
+  static_assert(std::is_base_of<rpc_client, Client>::value,
+                "rpc_shard_router needs a derived class of smf::rpc_client");
+
+  /// \brief tcp only: `opts.server_address` and `opts.shm_path` must be
+  /// empty. Not movable: connect() holds on to `this`, e.g.: keep it in a
+  /// seastar::lw_shared_ptr
+  explicit rpc_shard_router(rpc_client_opts opts) : opts_(std::move(opts)) {
+    LOG_THROW_IF(opts_.server_address || !opts_.shm_path.empty(),
+                 "rpc_shard_router only routes tcp connections");
+  }
+  rpc_shard_router(rpc_shard_router &&) = delete;
+
+  seastar::future<>
+  connect() {
+    auto o = opts_;
+    o.handshake = true;
+    auto probe = std::make_unique<Client>(std::move(o));
+    auto p = probe.get();
+    return p->connect().then([this, probe = std::move(probe)]() mutable {
+      const auto &n = probe->negotiated();
+      if (!n || n->peer_shard_count == 0) {
+        LOG_INFO("{} does not publish its shards, using one connection",
+                 opts_.server_addr);
+        clients_.push_back(std::move(probe));
+        return seastar::make_ready_future<>();
+      }
+      const uint16_t count = n->peer_shard_count;
+      const uint16_t base = n->peer_shard_port_base;
+      for (uint16_t i = 0; i < count; ++i) {
+        auto o = opts_;
+        o.server_addr = seastar::ipv4_addr(opts_.server_addr.ip, base + i);
+        clients_.push_back(std::make_unique<Client>(std::move(o)));
+      }
+      auto p = probe.get();
+      return p->stop()
+        .finally([probe = std::move(probe)] {})
+        .then([this] {
+          return seastar::parallel_for_each(
+            clients_, [](auto &c) { return c->connect(); });
+        });
+    });
+  }
+  seastar::future<>
+  stop() {
+    return seastar::parallel_for_each(clients_,
+                                      [](auto &c) { return c->stop(); });
+  }
+
+  /// \brief the client of core `key % shard_count()`, like
+  /// rpc_handle_router::owner_shard()
+  SMF_ALWAYS_INLINE Client &
+  shard_for(uint64_t key) {
+    return *clients_[key % clients_.size()];
+  }
+  /// \brief same key as `rpc_typed_shard_key<T>(fn)` computes on the server.
+  /// `e` is a serialize_data()'d envelope of a `T`
+  template <typename T, typename Fn>
+  Client &
+  route(const rpc_envelope &e, Fn &&fn) {
+    if (e.letter.body.empty()) { return shard_for(0); }
+    return shard_for(fn(*flatbuffers::GetRoot<T>(e.letter.body.get())));
+  }
+  /// \brief number of connections. 0 before connect()
+  SMF_ALWAYS_INLINE uint32_t
+  shard_count() const {
+    return clients_.size();
+  }
+  std::vector<std::unique_ptr<Client>> &
+  clients() {
+    return clients_;
+  }
+
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_shard_router);
+
+ private:
+  rpc_client_opts opts_;
+  std::vector<std::unique_ptr<Client>> clients_;
+};
+
+}  // namespace smf
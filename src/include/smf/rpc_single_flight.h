@@ -0,0 +1,101 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/future.hh>
+#include <seastar/core/shared_future.hh>
+#include <seastar/core/shared_ptr.hh>
+#include <seastar/util/noncopyable_function.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+/// \brief coalesces byte-identical unary requests that arrive while the
+/// first one is still running. One per core, see
+/// rpc_service_method_handle::single_flight.
+///
+/// Requests match on request_id and payload; the handler runs once and
+/// every waiter gets a share() of the same reply body with its own session.
+/// Requests with dynamic headers or a fragmented payload always run on
+/// their own. A cancelled waiter stops waiting right away; the handler is
+/// only cancelled once every waiter cancelled.
+///
+class rpc_single_flight {
+ public:
+  using apply_fn = seastar::noncopyable_function<seastar::future<rpc_envelope>(
+    rpc_recv_context &&)>;
+  using hash_fn = uint64_t (*)(const char *, size_t);
+
+  /// \brief `hash` picks the candidates to compare byte by byte. Tests pass
+  /// one that collides
+  explicit rpc_single_flight(hash_fn hash = xxhash) : hash_(hash) {}
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_single_flight);
+
+  /// \brief runs `fn(ctx)`, or waits for an identical request in flight
+  seastar::future<rpc_envelope> apply(rpc_recv_context &&ctx, apply_fn fn);
+
+  /// \brief requests answered with the reply of another
+  SMF_ALWAYS_INLINE uint64_t
+  coalesced() const {
+    return coalesced_;
+  }
+  /// \brief handlers currently running
+  SMF_ALWAYS_INLINE size_t
+  size() const {
+    return flights_.size();
+  }
+
+ private:
+  struct key {
+    uint32_t request_id;
+    uint64_t hash;
+    bool
+    operator==(const key &o) const {
+      return request_id == o.request_id && hash == o.hash;
+    }
+  };
+  struct key_hash {
+    size_t
+    operator()(const key &k) const {
+      return k.hash ^ k.request_id;
+    }
+  };
+  struct flight {
+    /// \brief what the leader was called with; compared byte by byte so
+    /// hash collisions never coalesce
+    seastar::temporary_buffer<char> payload;
+    seastar::shared_promise<> done;
+    std::optional<rpc_envelope> reply;
+    /// \brief fires once every waiter cancelled. Handed to the handler
+    seastar::lw_shared_ptr<seastar::abort_source> cancellation =
+      seastar::make_lw_shared<seastar::abort_source>();
+    uint32_t waiting{0};
+    /// \brief of the first request; followers hold their own
+    std::optional<seastar::abort_source::subscription> subscription;
+  };
+  using flight_ptr = seastar::lw_shared_ptr<flight>;
+
+  static uint64_t xxhash(const char *data, size_t size);
+  /// \brief counts the first request as a waiter of `f` until it is
+  /// cancelled
+  static void join(flight *f, const rpc_recv_context &ctx);
+  /// \brief waits for `f`, or resolves with abort_requested_exception as
+  /// soon as `ctx` is cancelled
+  seastar::future<rpc_envelope> follow(flight_ptr f, rpc_recv_context &ctx);
+
+ private:
+  const hash_fn hash_;
+  std::unordered_map<key, flight_ptr, key_hash> flights_;
+  uint64_t coalesced_{0};
+};
+
+}  // namespace smf
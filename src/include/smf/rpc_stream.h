@@ -0,0 +1,138 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <optional>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/queue.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_ptr.hh>
+
+#include "smf/macros.h"
+#include "smf/rpc_connection_limits.h"
+#include "smf/rpc_envelope.h"
+#include "smf/rpc_recv_context.h"
+
+namespace smf {
+
+class rpc_stream_closed_error final : public std::exception {
+ public:
+  virtual const char *
+  what() const noexcept {
+    return "rpc stream closed: connection went away";
+  }
+};
+
+/// \brief how a stream talks to its connection. Supplied by the rpc_server or
+/// the rpc_client that owns the stream
+struct rpc_stream_io {
+  using write_fn = std::function<seastar::future<>(rpc_envelope)>;
+  using read_filter_fn =
+    std::function<seastar::future<rpc_recv_context>(rpc_recv_context)>;
+
+  /// \brief data frames. Goes through the outgoing filters
+  write_fn write;
+  /// \brief end of stream and credit frames. Straight to the rpc_send_queue
+  write_fn write_control;
+  /// \brief incoming filters, applied as messages are read
+  read_filter_fn read_filter;
+  /// \brief called once both directions are closed. Owner drops the stream
+  std::function<void()> on_done;
+};
+
+/// \brief one side of a streaming rpc multiplexed on a connection by the
+/// 16-bit `session` of the header.
+///
+/// Flow control is credit based and counted in messages: each side may have at
+/// most `window` unread messages in flight. The reader hands credits back with
+/// a control frame every `window / 2` reads, so memory per stream is bounded
+/// by `window` messages regardless of the stream length.
+///
+/// Callers must hold a seastar::lw_shared_ptr to the stream for as long as
+/// they call into it.
+///
+class rpc_stream {
+ public:
+  static constexpr uint32_t kDefaultWindow = 16;
+
+  /// \param meta - stamped on outgoing frames: the request_id on the client,
+  /// the status on the server
+  /// \param limits - if set, the payload of every pushed message was taken
+  /// from `limits->resources_available` and is given back, with
+  /// rpc_connection_limits::release(), once read
+  rpc_stream(uint16_t session, uint32_t meta, rpc_stream_io io,
+             seastar::lw_shared_ptr<rpc_connection_limits> limits = nullptr,
+             uint32_t window = kDefaultWindow);
+  ~rpc_stream();
+
+  /// \brief next message. std::nullopt once the peer closed its side
+  seastar::future<std::optional<rpc_recv_context>> read();
+  /// \brief waits for a credit, then sends the message
+  seastar::future<> write(rpc_envelope e);
+  /// \brief sends end_of_stream with `meta()`. Idempotent
+  seastar::future<> close();
+  /// \brief sends end_of_stream with `status`. Idempotent
+  seastar::future<> close(uint32_t status);
+
+  // -- called by the owning connection
+
+  /// \brief queue an incoming frame. false if the peer overran its credits
+  bool push(rpc_recv_context ctx);
+  void add_credits(uint32_t credits);
+  /// \brief fails every pending and future read and write
+  void abort(std::exception_ptr e);
+
+  SMF_ALWAYS_INLINE uint16_t
+  session() const {
+    return session_;
+  }
+  SMF_ALWAYS_INLINE uint32_t
+  meta() const {
+    return meta_;
+  }
+  /// \brief `meta` of the end_of_stream frame from the peer, 0 until then.
+  /// On the client this is the status of the call
+  SMF_ALWAYS_INLINE uint32_t
+  remote_status() const {
+    return remote_status_;
+  }
+  SMF_ALWAYS_INLINE bool
+  local_closed() const {
+    return local_closed_;
+  }
+  SMF_ALWAYS_INLINE bool
+  remote_closed() const {
+    return remote_closed_;
+  }
+
+  SMF_DISALLOW_COPY_AND_ASSIGN(rpc_stream);
+
+ private:
+  void stamp(rpc::header &hdr, bool end_of_stream) const;
+  void send_credits();
+  void maybe_done();
+
+ private:
+  const uint16_t session_;
+  uint32_t meta_;
+  rpc_stream_io io_;
+  seastar::lw_shared_ptr<rpc_connection_limits> limits_;
+  const uint32_t window_;
+
+  /// \brief std::nullopt is the end_of_stream marker
+  seastar::queue<std::optional<rpc_recv_context>> inbound_;
+  /// \brief messages we are allowed to send
+  seastar::semaphore credits_;
+  /// \brief messages read since we last returned credits
+  uint32_t consumed_{0};
+  uint32_t remote_status_{0};
+  bool local_closed_{false};
+  bool remote_closed_{false};
+  bool done_{false};
+};
+
+}  // namespace smf
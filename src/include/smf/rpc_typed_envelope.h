@@ -36,8 +36,8 @@ struct rpc_typed_envelope {
   serialize_data() {
     envelope.letter.body =
       std::move(smf::native_table_as_buffer<RootType>(*(data.get())));
-    smf::checksum_rpc(envelope.letter.header, envelope.letter.body.get(),
-                      envelope.letter.body.size());
+    // the checksum is computed by the rpc_send_queue, after the filters
+    envelope.letter.header.mutate_size(envelope.letter.body.size());
     data = nullptr;
     return std::move(envelope);
   }
@@ -0,0 +1,108 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <optional>
+#include <utility>
+
+#include <seastar/core/shared_ptr.hh>
+
+#include "smf/rpc_recv_typed_context.h"
+#include "smf/rpc_stream.h"
+#include "smf/rpc_typed_envelope.h"
+
+namespace smf {
+
+/// \brief typed view of the incoming side of an rpc_stream
+/// \code{.cpp}
+///    return seastar::repeat([r = std::move(reader)]() mutable {
+///      return r.read().then([](auto msg) {
+///        if (!msg) { return seastar::stop_iteration::yes; }
+///        // ... consume msg->name()
+///        return seastar::stop_iteration::no;
+///      });
+///    });
+/// \endcode
+template <typename T>
+class rpc_stream_reader {
+ public:
+  using type = T;
+  explicit rpc_stream_reader(seastar::lw_shared_ptr<rpc_stream> s)
+    : stream_(std::move(s)) {}
+  rpc_stream_reader(rpc_stream_reader &&) noexcept = default;
+  rpc_stream_reader &operator=(rpc_stream_reader &&) noexcept = default;
+
+  /// \brief an empty context - operator bool() == false - means end of stream
+  seastar::future<rpc_recv_typed_context<T>>
+  read() {
+    return stream_->read().then([](std::optional<rpc_recv_context> c) {
+      return seastar::make_ready_future<rpc_recv_typed_context<T>>(
+        rpc_recv_typed_context<T>(std::move(c)));
+    });
+  }
+  /// \brief status sent by the peer with its end_of_stream
+  uint32_t
+  status() const {
+    return stream_->remote_status();
+  }
+  seastar::lw_shared_ptr<rpc_stream>
+  stream() const {
+    return stream_;
+  }
+
+ private:
+  seastar::lw_shared_ptr<rpc_stream> stream_;
+};
+
+/// \brief typed view of the outgoing side of an rpc_stream
+template <typename T>
+class rpc_stream_writer {
+ public:
+  using type = T;
+  explicit rpc_stream_writer(seastar::lw_shared_ptr<rpc_stream> s)
+    : stream_(std::move(s)) {}
+  rpc_stream_writer(rpc_stream_writer &&) noexcept = default;
+  rpc_stream_writer &operator=(rpc_stream_writer &&) noexcept = default;
+
+  /// \brief resolves once the peer granted a credit *and* the message was
+  /// handed to the connection
+  seastar::future<>
+  write(rpc_typed_envelope<T> x) {
+    return stream_->write(x.serialize_data());
+  }
+  seastar::future<>
+  write(rpc_envelope e) {
+    return stream_->write(std::move(e));
+  }
+  seastar::future<>
+  close() {
+    return stream_->close();
+  }
+  /// \brief server side: final status of the call, HTTP style
+  seastar::future<>
+  close(uint32_t status) {
+    return stream_->close(status);
+  }
+  seastar::lw_shared_ptr<rpc_stream>
+  stream() const {
+    return stream_;
+  }
+
+ private:
+  seastar::lw_shared_ptr<rpc_stream> stream_;
+};
+
+/// \brief client side of client-streaming and bidi-streaming methods.
+/// For client streaming: write(), close() and read() the single response
+template <typename Out, typename In>
+struct rpc_bidi_stream {
+  explicit rpc_bidi_stream(seastar::lw_shared_ptr<rpc_stream> s)
+    : writer(s), reader(s) {}
+  rpc_bidi_stream(rpc_bidi_stream &&) noexcept = default;
+
+  rpc_stream_writer<Out> writer;
+  rpc_stream_reader<In> reader;
+};
+
+}  // namespace smf
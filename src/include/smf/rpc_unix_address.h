@@ -0,0 +1,28 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <string>
+
+#include <seastar/core/sstring.hh>
+#include <seastar/net/socket_defs.hh>
+#include <seastar/net/unix_address.hh>
+
+namespace smf {
+
+/// \brief address of a unix domain socket, for
+/// rpc_client_opts::server_address and rpc_server_args::unix_address.
+/// Same-host callers skip the tcp loopback stack entirely
+inline seastar::socket_address
+make_unix_address(const seastar::sstring &path) {
+  return seastar::socket_address(
+    seastar::unix_domain_addr(std::string(path.c_str(), path.size())));
+}
+
+/// \brief removes the socket file a previous listener left at `path`, so it
+/// can be bound again. Throws if anything but a socket is there. Abstract
+/// names - starting with '\0' - have no file
+void remove_stale_unix_socket(const char *path);
+
+}  // namespace smf
@@ -0,0 +1,105 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "smf/macros.h"
+
+namespace smf {
+
+/// \brief single-producer/single-consumer byte ring living in memory shared
+/// by two processes - see shm_transport.h.
+///
+/// The ring does not own its memory; it is a view over
+/// `shm_ring::mapping_size(capacity)` bytes. One side calls create() to
+/// format it, the peer calls attach(). Positions only ever grow, so
+/// `head - tail` is the number of readable bytes.
+///
+/// The `*_waiting` flags implement wakeups without a syscall per write: a
+/// side that is about to sleep raises its flag, and the other side only
+/// signals - i.e.: writes an eventfd - when it sees the flag up.
+///
+class shm_ring {
+ public:
+  static constexpr uint64_t kMagic = 0x736d6672696e6701;  // "smfring" + v1
+  static constexpr size_t kCacheLine = 64;
+
+  /// \brief lives at the start of the mapping. Producer and consumer
+  /// fields sit on different cache lines
+  struct control {
+    uint64_t magic;
+    uint64_t capacity;
+    alignas(kCacheLine) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> writer_closed;
+    std::atomic<uint32_t> writer_waiting;
+    alignas(kCacheLine) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> reader_closed;
+    std::atomic<uint32_t> reader_waiting;
+  };
+
+  /// \brief bytes of shared memory needed for `capacity` bytes of data
+  static constexpr size_t
+  mapping_size(size_t capacity) {
+    return ((sizeof(control) + kCacheLine - 1) / kCacheLine) * kCacheLine +
+           capacity;
+  }
+  /// \brief formats a new ring. `capacity` must be a power of 2
+  static shm_ring create(char *base, size_t capacity);
+  /// \brief attaches to a ring formatted by the peer. Throws if the memory
+  /// does not hold a ring of `capacity` bytes
+  static shm_ring attach(char *base, size_t capacity);
+
+  /// \brief copies up to `size` bytes in. Returns the bytes written;
+  /// 0 if the ring is full. Producer only. Throws if the positions were
+  /// corrupted, i.e.: by a misbehaving peer; the ring is unusable then
+  size_t write(const char *data, size_t size);
+  /// \brief copies up to `size` bytes out. Returns the bytes read;
+  /// 0 if the ring is empty. Consumer only. Throws like write()
+  size_t read(char *data, size_t size);
+
+  SMF_ALWAYS_INLINE size_t
+  readable() const {
+    return ctrl_->head.load(std::memory_order_acquire) -
+           ctrl_->tail.load(std::memory_order_relaxed);
+  }
+  SMF_ALWAYS_INLINE size_t
+  writable() const {
+    return capacity_ - (ctrl_->head.load(std::memory_order_relaxed) -
+                        ctrl_->tail.load(std::memory_order_acquire));
+  }
+  SMF_ALWAYS_INLINE size_t
+  capacity() const {
+    return capacity_;
+  }
+
+  /// \brief the producer will not write anymore. The consumer sees eof once
+  /// the ring is drained
+  void close_writer();
+  bool writer_closed() const;
+  /// \brief the consumer will not read anymore. Writes fail from now on
+  void close_reader();
+  bool reader_closed() const;
+
+  /// \brief consumer: raise the flag, then re-check readable() before
+  /// sleeping. Producer: signal the consumer if this returns true after a
+  /// write. Same for the writer side, with writable()
+  void set_reader_waiting(bool waiting);
+  bool reader_waiting() const;
+  void set_writer_waiting(bool waiting);
+  bool writer_waiting() const;
+
+ private:
+  shm_ring(control *ctrl, char *data, size_t capacity)
+    : ctrl_(ctrl), data_(data), capacity_(capacity) {}
+
+ private:
+  control *ctrl_;
+  char *data_;
+  size_t capacity_;
+};
+
+}  // namespace smf
@@ -0,0 +1,46 @@
+// Copyright 2019 SMF Authors
+//
+
+#pragma once
+
+#include <cstdint>
+
+#include <seastar/core/future.hh>
+#include <seastar/core/sstring.hh>
+#include <seastar/net/api.hh>
+
+namespace smf {
+
+struct shm_transport_opts {
+  static constexpr uint32_t kMinRingSize = 4096;
+  /// \brief bytes per direction. Must be a power of 2, at least
+  /// kMinRingSize. Chosen by the connecting side; the listening side
+  /// refuses rings larger than its own
+  uint32_t ring_size = 1 << 20;
+  /// \brief spin on the ring instead of sleeping on an eventfd. Trades one
+  /// core for the lowest latency
+  bool busy_poll = false;
+};
+
+/// \brief shared-memory transport for processes on the same host.
+///
+/// A connection is two shm_ring's - one per direction - in one memfd. The
+/// connecting side creates the memfd and four eventfds and hands them to
+/// the listener over a unix domain socket at `path` with SCM_RIGHTS. That
+/// socket then stays open only to notice when the peer goes away.
+///
+/// Both functions return plain seastar sockets, so rpc_connection, and
+/// with it rpc_server, rpc_client and every filter, work unchanged. Data is
+/// copied once into the ring and once out of it; no syscall is made unless a
+/// side is asleep.
+///
+/// See rpc_server_args::shm_path and rpc_client_opts::shm_path
+///
+seastar::future<seastar::connected_socket>
+shm_connect(const seastar::sstring &path, shm_transport_opts opts = {});
+
+/// \brief removes a stale socket file at `path` first
+seastar::server_socket shm_listen(const seastar::sstring &path,
+                                  shm_transport_opts opts = {});
+
+}  // namespace smf
@@ -0,0 +1,145 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <atomic>
+#include <chrono>
+#include <string>
+// seastar
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+#include <seastar/core/timer.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+
+/// \brief handlers that saw their request cancelled, on every core
+static std::atomic<uint32_t> observed{0};
+
+/// \brief runs until the client gives up on it
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+wait_for_cancel(smf::rpc_recv_typed_context<request_t> &&rec) {
+  LOG_THROW_IF(!rec, "Request without a body");
+  auto cancellation = rec.ctx->cancellation;
+  LOG_THROW_IF(!cancellation, "Server side request without cancellation");
+  return seastar::sleep_abortable(10s, *cancellation)
+    .then([]() -> smf::rpc_typed_envelope<response_t> {
+      LOG_THROW("Handler ran to completion");
+    })
+    .handle_exception_type([cancellation](seastar::sleep_aborted &) {
+      LOG_THROW_IF(!cancellation->abort_requested(), "Not cancelled");
+      observed++;
+      return seastar::make_exception_future<
+        smf::rpc_typed_envelope<response_t>>(seastar::sleep_aborted());
+    });
+}
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+ public:
+  storage_service() {
+    // `name` is the core: one of them is forwarded, whichever core accepted
+    // the connection
+    ShardPut([](const request_t &r) { return std::stoul(r.name()->str()); });
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return wait_for_cancel(std::move(rec));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Put(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return wait_for_cancel(std::move(rec));
+  }
+};
+
+template <typename Fn>
+static seastar::future<>
+cancel_after(std::chrono::milliseconds after, Fn send) {
+  return seastar::do_with(
+    seastar::abort_source{}, seastar::timer<>{},
+    [after, send](seastar::abort_source &as, seastar::timer<> &t) mutable {
+      t.set_callback([&as] { as.request_abort(); });
+      t.arm(after);
+      return send(as)
+        .then([](auto) { LOG_THROW("Request should have been cancelled"); })
+        .handle_exception_type([](seastar::abort_requested_exception &) {});
+    });
+}
+
+static seastar::future<>
+put(seastar::shared_ptr<smf_gen::demo::SmfStorageClient> client,
+    uint32_t core) {
+  return cancel_after(100ms, [client, core](seastar::abort_source &as) {
+    smf::rpc_typed_envelope<request_t> req;
+    req.data->name = std::to_string(core);
+    return client->Put(std::move(req), as);
+  });
+}
+
+static seastar::future<>
+cancellations(uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  auto client =
+    seastar::make_shared<smf_gen::demo::SmfStorageClient>(std::move(opts));
+  return client->connect()
+    .then([client] {
+      return cancel_after(100ms, [client](seastar::abort_source &as) {
+        smf::rpc_typed_envelope<request_t> req;
+        req.data->name = "get";
+        return client->Get(std::move(req), as);
+      });
+    })
+    .then([client] { return put(client, 0); })
+    .then([client] { return put(client, 1); })
+    .then([] {
+      // the cancel frames are on their way
+      return seastar::do_until([] { return observed == 3; },
+                               [] { return seastar::sleep(10ms); });
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] {
+        return seastar::with_timeout(
+          seastar::timer<>::clock::now() + 10s, cancellations(random_port));
+      })
+      .then([] {
+        LOG_INFO("Handlers saw {} cancellations", observed.load());
+        return seastar::make_ready_future<int>(0);
+      });
+  });
+}
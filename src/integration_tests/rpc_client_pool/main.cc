@@ -0,0 +1,174 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_client_pool.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+using pool_t = smf::rpc_client_pool<client_t>;
+
+/// \brief "hold" requests stay in flight for a while
+class storage_service final : public smf_gen::demo::SmfStorage {
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    LOG_THROW_IF(!rec, "Request without a body");
+    auto delay = rec->name()->str() == "hold" ? 200ms : 0ms;
+    return seastar::sleep(delay).then([] {
+      smf::rpc_typed_envelope<response_t> data;
+      data.data->name = "reply";
+      data.envelope.set_status(200);
+      return data;
+    });
+  }
+};
+
+static seastar::future<>
+request(seastar::shared_ptr<client_t> c, std::string name) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->name = name;
+  return c->Get(std::move(req)).then([c](auto reply) {
+    LOG_THROW_IF(!reply, "No reply");
+    LOG_THROW_IF(reply.ctx->status() != 200, "Bad status: {}",
+                 reply.ctx->status());
+  });
+}
+
+static smf::rpc_client_pool_opts<client_t>
+pool_opts(uint16_t port, uint32_t min, uint32_t max) {
+  smf::rpc_client_pool_opts<client_t> opts;
+  smf::rpc_client_opts endpoint{};
+  endpoint.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  opts.endpoints.push_back(std::move(endpoint));
+  opts.min_connections_per_endpoint = min;
+  opts.max_connections_per_endpoint = max;
+  return opts;
+}
+
+static seastar::future<>
+least_loaded(uint16_t port) {
+  auto pool = seastar::make_lw_shared<pool_t>(pool_opts(port, 2, 2));
+  return pool->connect()
+    .then([pool] {
+      auto busy = pool->get();
+      auto held = request(busy, "hold");
+      // the request is written
+      return seastar::sleep(20ms)
+        .then([pool, busy] {
+          LOG_THROW_IF(busy->outstanding() != 1, "Nothing in flight");
+          // of two connections, get() always compares both
+          for (auto i = 0; i < 100; ++i) {
+            LOG_THROW_IF(pool->get() == busy, "Picked the busy connection");
+          }
+          LOG_INFO("get() prefers the less loaded connection");
+        })
+        .then([held = std::move(held)]() mutable { return std::move(held); });
+    })
+    .finally([pool] { return pool->stop().finally([pool] {}); });
+}
+
+static seastar::future<>
+reconnects(uint16_t port) {
+  auto pool = seastar::make_lw_shared<pool_t>(pool_opts(port, 2, 2));
+  return pool->connect()
+    .then([pool] {
+      auto broken = pool->get();
+      return broken->stop().then([pool, broken] {
+        LOG_THROW_IF(broken->is_conn_valid(), "Connection still valid");
+        for (auto i = 0; i < 100; ++i) {
+          LOG_THROW_IF(pool->get() == broken, "Picked a broken connection");
+        }
+        // the first get() started a reconnect in the background
+        return seastar::do_until([broken] { return broken->is_conn_valid(); },
+                                 [] { return seastar::sleep(10ms); })
+          .then([pool, broken] {
+            LOG_THROW_IF(pool->size() != 2, "Pool has {} connections",
+                         pool->size());
+            LOG_INFO("Broken connections are skipped and reconnected");
+            return request(broken, "after reconnect");
+          });
+      });
+    })
+    .finally([pool] { return pool->stop().finally([pool] {}); });
+}
+
+static seastar::future<>
+grows_up_to_max(uint16_t port) {
+  constexpr const uint32_t kMaxConnections = 3;
+  auto opts = pool_opts(port, 1, kMaxConnections);
+  opts.max_outstanding_per_connection = 1;
+  auto pool = seastar::make_lw_shared<pool_t>(std::move(opts));
+  return pool->connect()
+    .then([pool] {
+      LOG_THROW_IF(pool->size() != 1, "Pool opened {} connections",
+                   pool->size());
+      auto held = seastar::make_lw_shared<std::vector<seastar::future<>>>();
+      // every connection is busy: each get() wants one more
+      return seastar::do_for_each(
+               boost::counting_iterator<uint32_t>(0),
+               boost::counting_iterator<uint32_t>(10),
+               [pool, held](uint32_t) {
+                 held->push_back(request(pool->get(), "hold"));
+                 return seastar::sleep(10ms).then([pool] {
+                   LOG_THROW_IF(pool->size() > kMaxConnections,
+                                "Pool grew to {} connections", pool->size());
+                 });
+               })
+        .then([pool, held] {
+          LOG_THROW_IF(pool->size() != kMaxConnections,
+                       "Pool has {} connections", pool->size());
+          LOG_INFO("Pool grew to {} connections", pool->size());
+          return seastar::when_all_succeed(held->begin(), held->end());
+        });
+    })
+    .finally([pool] { return pool->stop().finally([pool] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] { return least_loaded(random_port); })
+      .then([random_port] { return reconnects(random_port); })
+      .then([random_port] { return grows_up_to_max(random_port); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
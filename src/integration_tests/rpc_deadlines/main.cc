@@ -0,0 +1,190 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <string>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+/// \brief every request spends this long in the incoming filters
+constexpr const auto kFilterDelay = 50ms;
+constexpr const auto kTimeout = 5s;
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+
+static uint32_t handler_calls = 0;
+/// \brief of the server, to itself; for downstream calls
+static seastar::shared_ptr<client_t> downstream;
+
+struct delay_filter {
+  seastar::future<smf::rpc_recv_context>
+  operator()(smf::rpc_recv_context &&ctx) {
+    return seastar::sleep(kFilterDelay).then(
+      [ctx = std::move(ctx)]() mutable { return std::move(ctx); });
+  }
+};
+
+/// \brief `name` goes in the body and, as a payload header, next to it
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+reply(std::string name) {
+  smf::rpc_typed_envelope<response_t> data;
+  data.envelope.add_dynamic_header("remaining", name.c_str());
+  data.data->name = std::move(name);
+  data.envelope.set_status(200);
+  return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+    std::move(data));
+}
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+  /// \brief milliseconds left, or "none"
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    ++handler_calls;
+    if (!rec.ctx->deadline) {
+      LOG_THROW_IF(rec.ctx->remaining() != seastar::timer<>::duration::max(),
+                   "Request without a deadline has a budget");
+      return reply("none");
+    }
+    return reply(std::to_string(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        rec.ctx->remaining())
+        .count()));
+  }
+  /// \brief Get, downstream, within the budget of this request
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Put(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    ++handler_calls;
+    smf::rpc_typed_envelope<request_t> req;
+    if (rec.ctx->deadline) { req.envelope.set_deadline(*rec.ctx->deadline); }
+    return downstream->Get(std::move(req)).then([](auto r) {
+      LOG_THROW_IF(!r || r.ctx->status() != 200, "Downstream call failed");
+      return reply(r->name()->str());
+    });
+  }
+};
+
+/// \brief replies with dynamic headers carry a control_type::payload_headers
+/// frame too
+static void
+check_header(const smf::rpc_recv_typed_context<response_t> &r) {
+  auto it = r.ctx->dynamic_headers.find("remaining");
+  LOG_THROW_IF(it == r.ctx->dynamic_headers.end() ||
+                 it->second != r->name()->str(),
+               "Reply without its payload header");
+}
+
+static bool
+deadline_exceeded(const smf::rpc_recv_typed_context<response_t> &r) {
+  return r && r.ctx->status() == smf::rpc_server::kDeadlineExceededStatus;
+}
+
+static seastar::future<>
+expired(seastar::shared_ptr<client_t> client,
+        seastar::distributed<smf::rpc_server> &rpc) {
+  // already late when it arrives: dropped before the filters
+  smf::rpc_typed_envelope<request_t> late;
+  late.envelope.set_deadline(seastar::timer<>::clock::now() - 1s);
+  return client->Get(std::move(late))
+    .then([client](auto r) {
+      LOG_THROW_IF(!deadline_exceeded(r), "Late request was not rejected");
+      // expires while it is in the filters
+      smf::rpc_typed_envelope<request_t> req;
+      req.envelope.set_timeout(kFilterDelay / 5);
+      return client->Get(std::move(req));
+    })
+    .then([&rpc](auto r) {
+      LOG_THROW_IF(!deadline_exceeded(r),
+                   "Request expired in the filters was not rejected");
+      LOG_THROW_IF(handler_calls != 0, "Handler ran for an expired request");
+      auto &stats = rpc.local().stats();
+      LOG_THROW_IF(stats.deadline_exceeded_requests != 2,
+                   "{} deadline exceeded requests",
+                   stats.deadline_exceeded_requests);
+      LOG_INFO("504 for expired requests, the handler never ran");
+    });
+}
+
+static seastar::future<>
+propagated(seastar::shared_ptr<client_t> client) {
+  return client->Put(smf::rpc_typed_envelope<request_t>{})
+    .then([client](auto r) {
+      LOG_THROW_IF(!r || r->name()->str() != "none",
+                   "Deadline out of nowhere: {}", r->name()->str());
+      check_header(r);
+      smf::rpc_typed_envelope<request_t> req;
+      req.envelope.set_timeout(kTimeout);
+      return client->Put(std::move(req));
+    })
+    .then([](auto r) {
+      LOG_THROW_IF(!r || r.ctx->status() != 200, "Put failed");
+      check_header(r);
+      const auto left = std::chrono::milliseconds(std::stoul(r->name()->str()));
+      // two trips through the filters: the client's, then Put's own call
+      LOG_THROW_IF(left <= 0ms || left > kTimeout - 2 * kFilterDelay,
+                   "{}ms left downstream of a {}ms budget", left.count(),
+                   std::chrono::milliseconds(kTimeout).count());
+      LOG_INFO("remaining() propagates downstream: {}ms left", left.count());
+      LOG_INFO("Dynamic headers of replies reach the client");
+    });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_incoming_filter<delay_filter>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([&rpc, random_port] {
+        auto connect_to = [random_port] {
+          smf::rpc_client_opts opts{};
+          opts.server_addr = seastar::ipv4_addr{"127.0.0.1", random_port};
+          return seastar::make_shared<client_t>(std::move(opts));
+        };
+        auto client = connect_to();
+        downstream = connect_to();
+        return downstream->connect()
+          .then([client] { return client->connect(); })
+          .then([client, &rpc] { return expired(client, rpc); })
+          .then([client] { return propagated(client); })
+          .finally([client] {
+            return client->stop().then([] { return downstream->stop(); });
+          })
+          .finally([client] { downstream = nullptr; });
+      })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
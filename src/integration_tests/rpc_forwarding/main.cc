@@ -0,0 +1,169 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/service_attributes.smf.fb.h"
+
+/// \brief the client splits larger bodies in fragments
+constexpr const uint32_t kFragmentSize = 4096;
+constexpr const uint32_t kKeys = 16;
+
+using request_t = smf_gen::attributes::Request;
+using response_t = smf_gen::attributes::Response;
+using client_t = smf_gen::attributes::ShardedClient;
+
+struct by_key {
+  uint64_t
+  operator()(const request_t &r) const {
+    return r.key();
+  }
+};
+
+/// \brief on the core owning `rec->key()`
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+echo(smf::rpc_recv_typed_context<request_t> &&rec) {
+  LOG_THROW_IF(!rec, "Request without a body");
+  const auto owner = rec->key() % seastar::smp::count;
+  LOG_THROW_IF(owner != seastar::engine().cpu_id(),
+               "Request of core {} ran on core {}", owner,
+               seastar::engine().cpu_id());
+  smf::rpc_typed_envelope<response_t> data;
+  data.data->key = rec->key();
+  data.data->blob.assign(rec->blob()->begin(), rec->blob()->end());
+  data.envelope.set_status(200);
+  return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+    std::move(data));
+}
+
+class sharded_service final : public smf_gen::attributes::Sharded {
+ public:
+  sharded_service() {
+    ShardEcho(by_key{});
+    ShardUpload(by_key{});
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Echo(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return echo(std::move(rec));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Upload(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return echo(std::move(rec));
+  }
+};
+
+static smf::rpc_typed_envelope<request_t>
+request(uint64_t key, uint32_t size) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->key = key;
+  req.data->blob.resize(size);
+  for (auto i = 0u; i < size; ++i) {
+    req.data->blob[i] = static_cast<uint8_t>(key + i);
+  }
+  return req;
+}
+
+/// \brief the reply was built on the owner core, and read here
+static void
+check(uint64_t key, uint32_t size,
+      const smf::rpc_recv_typed_context<response_t> &reply) {
+  LOG_THROW_IF(!reply, "No reply for key {}", key);
+  LOG_THROW_IF(reply.ctx->status() != 200, "Bad status: {}",
+               reply.ctx->status());
+  auto expected = request(key, size);
+  const auto *blob = reply.get()->blob();
+  LOG_THROW_IF(reply.get()->key() != key || blob->size() != size ||
+                 !std::equal(blob->begin(), blob->end(),
+                             expected.data->blob.begin()),
+               "Reply of key {} does not match the request", key);
+}
+
+template <typename Send>
+static seastar::future<>
+each_key(uint32_t size, Send send) {
+  return seastar::do_for_each(
+    boost::counting_iterator<uint64_t>(0),
+    boost::counting_iterator<uint64_t>(kKeys), [size, send](uint64_t key) {
+      return send(request(key, size)).then([key, size](auto reply) {
+        check(key, size, reply);
+      });
+    });
+}
+
+static seastar::future<>
+forward(seastar::distributed<smf::rpc_server> &rpc, uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  opts.max_fragment_size = kFragmentSize;
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] {
+      return each_key(kFragmentSize / 2, [client](auto req) {
+        return client->Echo(std::move(req));
+      });
+    })
+    .then([client] {
+      LOG_INFO("Echo ran on the owner core of every key");
+      // many fragments per request
+      return each_key(16 * kFragmentSize, [client](auto req) {
+        return client->Upload(std::move(req));
+      });
+    })
+    .then([client] {
+      LOG_INFO("Fragmented Upload ran on the owner core of every key");
+    })
+    .then([&rpc] {
+      return rpc.map_reduce0(
+        [](smf::rpc_server &s) { return s.stats().forwarded_requests; },
+        uint64_t(0), std::plus<uint64_t>());
+    })
+    .then([](uint64_t n) {
+      // one connection, so one core read every request
+      const uint64_t expected = 2 * kKeys * (seastar::smp::count - 1) /
+                                seastar::smp::count;
+      LOG_THROW_IF(n != expected, "{} requests forwarded, expected {}", n,
+                   expected);
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<sharded_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([&rpc, random_port] { return forward(rpc, random_port); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
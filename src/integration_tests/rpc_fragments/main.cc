@@ -0,0 +1,204 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <algorithm>
+#include <chrono>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/service_attributes.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+/// \brief the client splits larger bodies in fragments
+constexpr const uint32_t kFragmentSize = 4096;
+/// \brief of the blob; the flatbuffer adds a few bytes
+constexpr const uint32_t kBodySize = 16 * kFragmentSize;
+/// \brief of the core. Half of it may be held by partial messages
+constexpr const uint64_t kMemory = 64 * kFragmentSize;
+
+using request_t = smf_gen::attributes::Request;
+using response_t = smf_gen::attributes::Response;
+using client_t = smf_gen::attributes::ShardedClient;
+
+/// \brief of the only core
+static seastar::lw_shared_ptr<smf::rpc_connection_limits> limits;
+
+static uint64_t
+reserved() {
+  return limits->max_memory - limits->resources_available.current();
+}
+
+/// \brief every fragment still holds its reservation
+static void
+check_reserved(const smf::rpc_recv_context &c) {
+  limits = c.rpc_server_limits;
+  LOG_THROW_IF(!limits, "Request without limits");
+  LOG_THROW_IF(reserved() < c.header.size(),
+               "{} bytes reserved for a body of {}", reserved(),
+               c.header.size());
+}
+
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+echo(smf::rpc_recv_typed_context<request_t> &&rec) {
+  LOG_THROW_IF(!rec, "Request without a body");
+  smf::rpc_typed_envelope<response_t> data;
+  data.data->key = rec->key();
+  data.data->blob.assign(rec->blob()->begin(), rec->blob()->end());
+  data.envelope.set_status(200);
+  return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+    std::move(data));
+}
+
+class fragments_service final : public smf_gen::attributes::Sharded {
+ public:
+  /// \brief no `fragmented` attribute: the server reassembles the body
+  virtual seastar::future<smf::rpc_envelope>
+  RawEcho(smf::rpc_recv_context &&c) final {
+    LOG_THROW_IF(c.is_fragmented(), "Echo got {} fragments",
+                 c.fragments.size());
+    LOG_THROW_IF(c.payload.size() != c.header.size(),
+                 "Echo got {} bytes of {}", c.payload.size(), c.header.size());
+    check_reserved(c);
+    return smf_gen::attributes::Sharded::RawEcho(std::move(c));
+  }
+  /// \brief `fragmented`: the fragments as they came off the socket
+  virtual seastar::future<smf::rpc_envelope>
+  RawUpload(smf::rpc_recv_context &&c) final {
+    LOG_THROW_IF(!c.is_fragmented(), "Upload body was reassembled");
+    const auto expected = (c.header.size() + kFragmentSize - 1) / kFragmentSize;
+    LOG_THROW_IF(c.fragments.size() != expected,
+                 "{} fragments for {} bytes, expected {}", c.fragments.size(),
+                 c.header.size(), expected);
+    uint64_t total = 0;
+    for (auto &f : c.fragments) {
+      LOG_THROW_IF(f.size() > kFragmentSize, "Fragment of {} bytes", f.size());
+      total += f.size();
+    }
+    LOG_THROW_IF(total != c.header.size(), "Fragments add up to {} of {}",
+                 total, c.header.size());
+    check_reserved(c);
+    return smf_gen::attributes::Sharded::RawUpload(std::move(c));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Echo(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return echo(std::move(rec));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Upload(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return echo(std::move(rec));
+  }
+};
+
+static smf::rpc_typed_envelope<request_t>
+request(uint64_t key, uint32_t size = kBodySize) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->key = key;
+  req.data->blob.resize(size);
+  for (auto i = 0u; i < size; ++i) {
+    req.data->blob[i] = static_cast<uint8_t>(key + i);
+  }
+  return req;
+}
+
+static void
+check(uint64_t key, const smf::rpc_recv_typed_context<response_t> &reply) {
+  LOG_THROW_IF(!reply, "No reply for key {}", key);
+  LOG_THROW_IF(reply.ctx->status() != 200, "Bad status: {}",
+               reply.ctx->status());
+  auto expected = request(key);
+  const auto *blob = reply.get()->blob();
+  LOG_THROW_IF(reply.get()->key() != key || blob->size() != kBodySize ||
+                 !std::equal(blob->begin(), blob->end(),
+                             expected.data->blob.begin()),
+               "Reply of key {} does not match the request", key);
+}
+
+/// \brief memory is given back once the reply is written
+static seastar::future<>
+wait_released() {
+  return seastar::do_with(0, [](int &tries) {
+    return seastar::do_until(
+      [&tries] {
+        LOG_THROW_IF(++tries > 1000, "{} bytes still reserved", reserved());
+        return reserved() == 0;
+      },
+      [] { return seastar::sleep(1ms); });
+  });
+}
+
+static seastar::future<>
+requests(seastar::distributed<smf::rpc_server> &rpc, uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  opts.max_fragment_size = kFragmentSize;
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] { return client->Echo(request(1)); })
+    .then([client](auto reply) {
+      check(1, reply);
+      LOG_INFO("Fragments reassembled for a method without `fragmented`");
+      return client->Upload(request(2));
+    })
+    .then([client](auto reply) {
+      check(2, reply);
+      LOG_INFO("Fragments handed as they came to a `fragmented` method");
+      return wait_released();
+    })
+    .then([client] {
+      LOG_INFO("Every fragment released its reservation");
+      // more than the memory of the core: the server drops the connection
+      return client->Upload(request(3, kMemory + kFragmentSize))
+        .then_wrapped([](auto f) {
+          LOG_THROW_IF(!f.failed(), "Upload larger than the core memory");
+          f.ignore_ready_future();
+        });
+    })
+    .then([&rpc] {
+      LOG_THROW_IF(rpc.local().stats().too_large_requests != 1,
+                   "too_large_requests: {}",
+                   rpc.local().stats().too_large_requests);
+      return wait_released();
+    })
+    .then([] { LOG_INFO("Message over the core memory was dropped"); })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+    sargs.memory_avail_per_core = kMemory;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<fragments_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([&rpc, random_port] { return requests(rpc, random_port); })
+      .then([] {
+        limits = nullptr;
+        return seastar::make_ready_future<int>(0);
+      });
+  });
+}
@@ -0,0 +1,164 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_client_pool.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+
+constexpr const uint32_t kFastRequests = 50;
+constexpr const uint32_t kSlowRequests = 50;
+constexpr const double kHedgeRatio = 0.1;
+
+/// \brief requests cancelled while the handler waited
+static uint32_t cancelled = 0;
+
+/// \brief "fast*" requests reply right away. The first copy of a "slow*"
+/// request takes 100ms; the second, a hedge, replies right away
+class storage_service final : public smf_gen::demo::SmfStorage {
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    LOG_THROW_IF(!rec, "Request without a body");
+    auto name = rec->name()->str();
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->name = name;
+    data.envelope.set_status(200);
+    if (name.rfind("slow", 0) != 0 || ++copies_[name] > 1) {
+      return seastar::make_ready_future<
+        smf::rpc_typed_envelope<response_t>>(std::move(data));
+    }
+    auto cancellation = rec.ctx->cancellation;
+    return seastar::sleep_abortable(100ms, *cancellation)
+      .then([data = std::move(data)]() mutable { return std::move(data); })
+      .handle_exception_type([cancellation](seastar::sleep_aborted &) {
+        cancelled++;
+        return seastar::make_exception_future<
+          smf::rpc_typed_envelope<response_t>>(seastar::sleep_aborted());
+      });
+  }
+
+  std::unordered_map<std::string, uint32_t> copies_;
+};
+
+static seastar::future<>
+hedged_get(smf::rpc_client_pool<client_t> &pool, std::string name) {
+  return pool
+    .hedged([name](client_t &c, seastar::abort_source &as) {
+      smf::rpc_typed_envelope<request_t> req;
+      req.data->name = name;
+      return c.Get(std::move(req), as);
+    })
+    .then([name](auto reply) {
+      LOG_THROW_IF(!reply, "No reply for {}", name);
+      LOG_THROW_IF(reply->name()->str() != name, "Reply of {} for {}",
+                   reply->name()->str(), name);
+    });
+}
+
+static seastar::future<>
+hedging(uint16_t port) {
+  smf::rpc_client_pool_opts<client_t> opts;
+  smf::rpc_client_opts endpoint{};
+  endpoint.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  opts.endpoints.push_back(std::move(endpoint));
+  // a hedge goes to the other one
+  opts.min_connections_per_endpoint = 2;
+  opts.max_connections_per_endpoint = 2;
+  opts.hedging.enabled = true;
+  opts.hedging.percentile = 50;
+  opts.hedging.min_delay = 10ms;
+  opts.hedging.max_hedge_ratio = kHedgeRatio;
+  opts.hedging.max_burst = 1000;
+  opts.hedging.refresh = 0ms;
+  auto pool = seastar::make_lw_shared<smf::rpc_client_pool<client_t>>(
+    std::move(opts));
+  return pool->connect()
+    .then([pool] {
+      // fills the latency window
+      return seastar::do_for_each(
+        boost::counting_iterator<uint32_t>(0),
+        boost::counting_iterator<uint32_t>(kFastRequests), [pool](uint32_t i) {
+          return hedged_get(*pool, "fast" + std::to_string(i));
+        });
+    })
+    .then([pool] {
+      return seastar::do_for_each(
+        boost::counting_iterator<uint32_t>(0),
+        boost::counting_iterator<uint32_t>(kSlowRequests), [pool](uint32_t i) {
+          return hedged_get(*pool, "slow" + std::to_string(i));
+        });
+    })
+    .then([pool] {
+      const auto &stats = pool->hedging_stats();
+      LOG_INFO("requests: {}, hedges: {}, won: {}", stats.requests,
+               stats.hedges, stats.hedges_won);
+      LOG_THROW_IF(stats.requests != kFastRequests + kSlowRequests,
+                   "Counted {} requests", stats.requests);
+      // every slow request wants a hedge; the budget caps them
+      const auto budget =
+        static_cast<uint64_t>(stats.requests * kHedgeRatio + 1e-9);
+      LOG_THROW_IF(stats.hedges == 0 || stats.hedges > budget,
+                   "{} hedges for a budget of {}", stats.hedges, budget);
+      LOG_THROW_IF(stats.hedges_won == 0, "No hedge won");
+      // the loser of every race is cancelled on the server
+      return seastar::do_until(
+        [pool] { return cancelled >= pool->hedging_stats().hedges_won; },
+        [] { return seastar::sleep(10ms); });
+    })
+    .finally([pool] { return pool->stop().finally([pool] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] {
+        return seastar::with_timeout(seastar::timer<>::clock::now() + 30s,
+                                     hedging(random_port));
+      })
+      .then([] {
+        LOG_INFO("Losers cancelled on the server: {}", cancelled);
+        return seastar::make_ready_future<int>(0);
+      });
+  });
+}
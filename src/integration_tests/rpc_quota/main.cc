@@ -0,0 +1,219 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <algorithm>
+#include <chrono>
+#include <vector>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/service_attributes.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+constexpr const uint32_t kMaxPayloadSize = 1024;
+/// \brief of the client sending fragments
+constexpr const uint32_t kFragmentSize = 256;
+/// \brief larger than a read of the socket: the body is skipped, not read
+constexpr const uint32_t kTooLarge = 1 << 20;
+constexpr const uint32_t kMaxConcurrency = 2;
+constexpr const uint32_t kMaxInflightBytes = 8192;
+/// \brief two fit in kMaxInflightBytes, three do not
+constexpr const uint32_t kBulkSize = 3000;
+
+using request_t = smf_gen::attributes::Request;
+using response_t = smf_gen::attributes::Response;
+using client_t = smf_gen::attributes::LimitedClient;
+
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+reply_after(smf::rpc_recv_typed_context<request_t> &&rec) {
+  LOG_THROW_IF(!rec, "Request without a body");
+  const auto key = rec->key();
+  return seastar::sleep(std::chrono::milliseconds(key)).then([key] {
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->key = key;
+    data.envelope.set_status(200);
+    return data;
+  });
+}
+
+class limited_service final : public smf_gen::attributes::Limited {
+ public:
+  limited_service() {
+    smf::rpc_method_quota put;
+    put.max_payload_size = kMaxPayloadSize;
+    QuotaPut(put);
+    smf::rpc_method_quota slow;
+    slow.max_concurrency = kMaxConcurrency;
+    QuotaSlow(slow);
+    smf::rpc_method_quota bulk;
+    bulk.max_inflight_bytes = kMaxInflightBytes;
+    QuotaBulk(bulk);
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Put(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply_after(std::move(rec));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Slow(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply_after(std::move(rec));
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Bulk(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply_after(std::move(rec));
+  }
+};
+
+static smf::rpc_typed_envelope<request_t>
+request(uint64_t key, uint32_t size) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->key = key;
+  req.data->blob.resize(size);
+  return req;
+}
+
+static uint32_t
+status(const smf::rpc_recv_typed_context<response_t> &reply) {
+  LOG_THROW_IF(!reply, "No reply");
+  return reply.ctx->status();
+}
+
+/// \brief statuses of `n` concurrent requests, in any order
+template <typename Send>
+static seastar::future<std::vector<uint32_t>>
+concurrently(uint32_t n, Send send) {
+  std::vector<seastar::future<uint32_t>> replies;
+  for (auto i = 0u; i < n; ++i) {
+    replies.push_back(send().then([](auto r) { return status(r); }));
+  }
+  return seastar::when_all_succeed(replies.begin(), replies.end());
+}
+
+static uint32_t
+count(const std::vector<uint32_t> &statuses, uint32_t s) {
+  return std::count(statuses.begin(), statuses.end(), s);
+}
+
+static seastar::future<>
+too_large(seastar::shared_ptr<client_t> client) {
+  return client->Put(request(0, kTooLarge))
+    .then([client](auto reply) {
+      LOG_THROW_IF(status(reply) != smf::rpc_server::kPayloadTooLargeStatus,
+                   "Large request got status {}", status(reply));
+      // the skipped body did not desync the connection
+      return client->Put(request(0, kMaxPayloadSize / 2));
+    })
+    .then([client](auto reply) {
+      LOG_THROW_IF(status(reply) != 200, "Request after a skipped body got {}",
+                   status(reply));
+      LOG_INFO("413 skips the body, the connection stays usable");
+    });
+}
+
+/// \brief the fragments add up to more than max_payload_size, each is under
+static seastar::future<>
+too_large_fragmented(seastar::shared_ptr<client_t> client) {
+  return client->Put(request(0, 4 * kMaxPayloadSize))
+    .then([client](auto reply) {
+      LOG_THROW_IF(status(reply) != smf::rpc_server::kPayloadTooLargeStatus,
+                   "Large fragmented request got status {}", status(reply));
+      // the fragments after the 413 were dropped, not taken as a request
+      return client->Put(request(0, kMaxPayloadSize / 2));
+    })
+    .then([client](auto reply) {
+      LOG_THROW_IF(status(reply) != 200,
+                   "Fragmented request after a 413 got {}", status(reply));
+      LOG_INFO("413 once the fragments exceed max_payload_size");
+    });
+}
+
+static seastar::future<>
+too_many(seastar::shared_ptr<client_t> client) {
+  return concurrently(kMaxConcurrency + 2, [client] {
+           return client->Slow(request(100, 0));
+         })
+    .then([](std::vector<uint32_t> statuses) {
+      LOG_THROW_IF(count(statuses, 200) != kMaxConcurrency ||
+                     count(statuses, smf::rpc_server::kOverQuotaStatus) != 2,
+                   "max_concurrency: {} ok, {} over quota",
+                   count(statuses, 200),
+                   count(statuses, smf::rpc_server::kOverQuotaStatus));
+      LOG_INFO("429 over max_concurrency");
+    });
+}
+
+static seastar::future<>
+too_many_bytes(seastar::shared_ptr<client_t> client) {
+  return concurrently(3, [client] {
+           return client->Bulk(request(100, kBulkSize));
+         })
+    .then([](std::vector<uint32_t> statuses) {
+      LOG_THROW_IF(count(statuses, 200) != 2 ||
+                     count(statuses, smf::rpc_server::kOverQuotaStatus) != 1,
+                   "max_inflight_bytes: {} ok, {} over quota",
+                   count(statuses, 200),
+                   count(statuses, smf::rpc_server::kOverQuotaStatus));
+      LOG_INFO("429 over max_inflight_bytes");
+    });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<limited_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] {
+        smf::rpc_client_opts opts{};
+        opts.server_addr = seastar::ipv4_addr{"127.0.0.1", random_port};
+        opts.max_fragment_size = kFragmentSize;
+        auto client = seastar::make_shared<client_t>(std::move(opts));
+        return client->connect()
+          .then([client] { return too_large_fragmented(client); })
+          .finally([client] { return client->stop().finally([client] {}); });
+      })
+      .then([&rpc, random_port] {
+        smf::rpc_client_opts opts{};
+        opts.server_addr = seastar::ipv4_addr{"127.0.0.1", random_port};
+        auto client = seastar::make_shared<client_t>(std::move(opts));
+        return client->connect()
+          .then([client] { return too_large(client); })
+          .then([client] { return too_many(client); })
+          .then([client] { return too_many_bytes(client); })
+          .then([&rpc] {
+            auto &stats = rpc.local().stats();
+            LOG_THROW_IF(stats.too_large_requests != 2 ||
+                           stats.over_quota_requests != 3,
+                         "Counted {} too large, {} over quota",
+                         stats.too_large_requests, stats.over_quota_requests);
+          })
+          .finally([client] { return client->stop().finally([client] {}); });
+      })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
@@ -0,0 +1,260 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <string>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/sleep.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_checksum.h"
+#include "smf/rpc_response_cache.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/service_attributes.smf.fb.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+constexpr const uint32_t kRequestId = 42;
+constexpr const auto kTtl = 60000ms;
+/// \brief the body of the replies of the lru test
+constexpr const size_t kReplySize = 1000;
+
+using request_t = smf_gen::attributes::Request;
+using response_t = smf_gen::attributes::Response;
+using client_t = smf_gen::attributes::CachedClient;
+
+/// \brief rpc_response_cache, fed by hand
+struct cache_test {
+  explicit cache_test(size_t max_bytes) : cache(max_bytes) {}
+
+  /// \brief replies to `body` with `status` and a copy of `reply` as body
+  seastar::future<smf::rpc_envelope>
+  apply(uint16_t session, std::string body, uint32_t status = 200,
+        std::chrono::milliseconds ttl = kTtl, std::string reply = "") {
+    smf::rpc::header hdr;
+    hdr.mutate_meta(kRequestId);
+    hdr.mutate_session(session);
+    hdr.mutate_size(body.size());
+    smf::set_rpc_checksum_type(hdr,
+                               smf::rpc::checksum_type::checksum_type_none);
+    smf::rpc_recv_context ctx(
+      nullptr, seastar::make_ipv4_address(seastar::ipv4_addr{}), hdr,
+      seastar::temporary_buffer<char>(body.data(), body.size()));
+    if (reply.empty()) { reply = body; }
+    return cache.apply(
+      std::move(ctx), hdr, ttl,
+      [this, status, reply = std::move(reply)](smf::rpc_recv_context &&) {
+        ++calls;
+        smf::rpc_envelope e;
+        e.set_status(status);
+        e.letter.body =
+          seastar::temporary_buffer<char>(reply.data(), reply.size());
+        return seastar::make_ready_future<smf::rpc_envelope>(std::move(e));
+      });
+  }
+
+  smf::rpc_response_cache cache;
+  uint32_t calls{0};
+};
+
+static void
+check_reply(const smf::rpc_envelope &e, uint16_t session,
+            const std::string &body) {
+  LOG_THROW_IF(e.letter.header.session() != session,
+               "Reply for session {} went to session {}", session,
+               e.letter.header.session());
+  LOG_THROW_IF(std::string(e.letter.body.get(), e.letter.body.size()) != body,
+               "Session {} got the reply of another request", session);
+}
+
+static seastar::future<>
+hits_and_misses() {
+  auto t = seastar::make_lw_shared<cache_test>(1 << 20);
+  return t->apply(1, "a")
+    .then([t](smf::rpc_envelope e) {
+      check_reply(e, 1, "a");
+      return t->apply(2, "a");
+    })
+    .then([t](smf::rpc_envelope e) {
+      check_reply(e, 2, "a");
+      LOG_THROW_IF(t->calls != 1, "Handler ran on a hit");
+      return t->apply(3, "b");
+    })
+    .then([t](smf::rpc_envelope e) {
+      check_reply(e, 3, "b");
+      auto &stats = t->cache.stats();
+      LOG_THROW_IF(t->calls != 2 || stats.hits != 1 || stats.misses != 2,
+                   "{} calls, {} hits, {} misses", t->calls, stats.hits,
+                   stats.misses);
+      LOG_THROW_IF(t->cache.size() != 2, "{} entries", t->cache.size());
+      LOG_INFO("Identical requests hit, others miss");
+    });
+}
+
+static seastar::future<>
+expires_after_ttl() {
+  auto t = seastar::make_lw_shared<cache_test>(1 << 20);
+  return t->apply(1, "a", 200, 20ms)
+    .then([](smf::rpc_envelope) {
+      // plus the granularity of the lowres_clock
+      return seastar::sleep(50ms);
+    })
+    .then([t] { return t->apply(2, "a", 200, 20ms); })
+    .then([t](smf::rpc_envelope e) {
+      check_reply(e, 2, "a");
+      auto &stats = t->cache.stats();
+      LOG_THROW_IF(t->calls != 2 || stats.hits != 0,
+                   "Expired entry served: {} calls, {} hits", t->calls,
+                   stats.hits);
+      LOG_THROW_IF(stats.evictions != 1, "{} evictions", stats.evictions);
+      LOG_INFO("Entries expire after their ttl");
+    });
+}
+
+static seastar::future<>
+evicts_least_recently_used() {
+  // room for two entries of kReplySize, not three
+  auto t = seastar::make_lw_shared<cache_test>(kReplySize * 5 / 2);
+  const std::string reply(kReplySize, 'x');
+  return t->apply(1, "a", 200, kTtl, reply)
+    .then([t, reply](smf::rpc_envelope) {
+      return t->apply(2, "b", 200, kTtl, reply);
+    })
+    .then([t](smf::rpc_envelope) {
+      // "a" is now the most recently used
+      return t->apply(3, "a");
+    })
+    .then([t, reply](smf::rpc_envelope e) {
+      check_reply(e, 3, reply);
+      return t->apply(4, "c", 200, kTtl, reply);
+    })
+    .then([t](smf::rpc_envelope) {
+      LOG_THROW_IF(t->cache.size() != 2, "{} entries", t->cache.size());
+      LOG_THROW_IF(t->cache.size_bytes() > kReplySize * 5 / 2,
+                   "{} bytes held", t->cache.size_bytes());
+      LOG_THROW_IF(t->cache.stats().evictions != 1, "{} evictions",
+                   t->cache.stats().evictions);
+      const auto calls = t->calls;
+      return t->apply(5, "a").then([t, calls](smf::rpc_envelope) {
+        LOG_THROW_IF(t->calls != calls, "Recently used entry evicted");
+        return t->apply(6, "b");
+      });
+    })
+    .then([t](smf::rpc_envelope) {
+      LOG_THROW_IF(t->calls != 4, "Least recently used entry kept");
+      LOG_INFO("Least recently used entries make room");
+    });
+}
+
+static seastar::future<>
+caches_only_2xx() {
+  auto t = seastar::make_lw_shared<cache_test>(1 << 20);
+  return t->apply(1, "a", 500)
+    .then([t](smf::rpc_envelope) { return t->apply(2, "a", 500); })
+    .then([t](smf::rpc_envelope) { return t->apply(3, "b", 404); })
+    .then([t](smf::rpc_envelope) { return t->apply(4, "b", 404); })
+    .then([t](smf::rpc_envelope) {
+      LOG_THROW_IF(t->calls != 4 || t->cache.size() != 0,
+                   "Errors cached: {} calls, {} entries", t->calls,
+                   t->cache.size());
+      return t->apply(5, "c", 204);
+    })
+    .then([t](smf::rpc_envelope) { return t->apply(6, "c", 204); })
+    .then([t](smf::rpc_envelope e) {
+      LOG_THROW_IF(t->calls != 5, "2xx reply not cached");
+      LOG_THROW_IF(e.letter.header.meta() != 204, "Cached status {}",
+                   e.letter.header.meta());
+      LOG_INFO("Only 2xx replies are cached");
+    });
+}
+
+static uint32_t handler_calls = 0;
+
+/// \brief both methods carry the smfc `cache_ttl_ms` attribute
+class cached_service final : public smf_gen::attributes::Cached {
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply(std::move(rec), 200);
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Status(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    const uint32_t status = rec->key();
+    return reply(std::move(rec), status);
+  }
+  static seastar::future<smf::rpc_typed_envelope<response_t>>
+  reply(smf::rpc_recv_typed_context<request_t> &&rec, uint32_t status) {
+    ++handler_calls;
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->key = rec->key();
+    data.envelope.set_status(status);
+    return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+      std::move(data));
+  }
+};
+
+static smf::rpc_typed_envelope<request_t>
+request(uint64_t key) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->key = key;
+  return req;
+}
+
+static seastar::future<>
+end_to_end(uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] { return client->Get(request(7)); })
+    .then([client](auto) { return client->Get(request(7)); })
+    .then([client](auto reply) {
+      LOG_THROW_IF(!reply || reply->key() != 7, "Wrong cached reply");
+      LOG_THROW_IF(handler_calls != 1, "Handler ran {} times for one key",
+                   handler_calls);
+      return client->Status(request(503));
+    })
+    .then([client](auto) { return client->Status(request(503)); })
+    .then([client](auto reply) {
+      LOG_THROW_IF(!reply || reply.ctx->status() != 503, "Wrong status");
+      LOG_THROW_IF(handler_calls != 3, "503 served from the cache");
+      LOG_INFO("cache_ttl_ms methods are served from the cache");
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return hits_and_misses()
+      .then([] { return expires_after_ttl(); })
+      .then([] { return evicts_least_recently_used(); })
+      .then([] { return caches_only_2xx(); })
+      .then([&rpc, sargs] { return rpc.start(sargs); })
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<cached_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] { return end_to_end(random_port); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
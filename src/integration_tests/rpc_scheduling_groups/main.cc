@@ -0,0 +1,104 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <string>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/reactor.hh>
+#include <seastar/core/scheduling.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/service_attributes.smf.fb.h"
+
+using request_t = smf_gen::attributes::Request;
+using response_t = smf_gen::attributes::Response;
+using client_t = smf_gen::attributes::GroupedClient;
+
+static seastar::future<smf::rpc_typed_envelope<response_t>>
+reply_in(const char *group) {
+  const auto current = seastar::current_scheduling_group().name();
+  smf::rpc_typed_envelope<response_t> data;
+  data.envelope.set_status(current == group ? 200 : 500);
+  if (current != group) {
+    LOG_ERROR("Expected scheduling group {}, ran in {}", group, current);
+  }
+  return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+    std::move(data));
+}
+
+/// \brief groups come from the smfc `scheduling_group` attribute
+class grouped_service final : public smf_gen::attributes::Grouped {
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Work(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply_in("batch");
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Ping(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    return reply_in("interactive");
+  }
+};
+
+static void
+check(const char *method,
+      const smf::rpc_recv_typed_context<response_t> &reply) {
+  LOG_THROW_IF(!reply, "No reply for {}", method);
+  LOG_THROW_IF(reply.ctx->status() != 200,
+               "{} ran in the wrong scheduling group", method);
+}
+
+static seastar::future<>
+requests(uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] {
+      return client->Work(smf::rpc_typed_envelope<request_t>{});
+    })
+    .then([client](auto reply) {
+      check("Work", reply);
+      return client->Ping(smf::rpc_typed_envelope<request_t>{});
+    })
+    .then([](auto reply) {
+      check("Ping", reply);
+      LOG_INFO("Service and method scheduling groups honored");
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    return smf::rpc_server::create_scheduling_groups(
+             {{"batch", 100}, {"interactive", 1000}})
+      .then([&](auto groups) {
+        smf::rpc_server_args sargs;
+        sargs.ip = "127.0.0.1";
+        sargs.rpc_port = random_port;
+        sargs.http_port = smf::non_root_port(
+          rand.next() % std::numeric_limits<uint16_t>::max());
+        sargs.flags |=
+          smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+        sargs.scheduling_groups = std::move(groups);
+        return rpc.start(sargs);
+      })
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<grouped_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] { return requests(random_port); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
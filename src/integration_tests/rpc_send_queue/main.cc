@@ -0,0 +1,255 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/iostream.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "smf/log.h"
+#include "smf/rpc_generated.h"
+#include "smf/rpc_send_queue.h"
+
+constexpr const uint32_t kFrames = 10;
+
+/// \brief what reached the socket
+struct wire {
+  std::string bytes;
+  uint32_t puts{0};
+  bool fail{false};
+  /// \brief if set, the next write waits for it
+  std::optional<seastar::promise<>> hold;
+};
+
+class recording_sink final : public seastar::data_sink_impl {
+ public:
+  explicit recording_sink(seastar::lw_shared_ptr<wire> w) : w_(std::move(w)) {}
+  seastar::future<>
+  put(seastar::net::packet p) final {
+    if (w_->fail) {
+      return seastar::make_exception_future<>(
+        std::runtime_error("broken pipe"));
+    }
+    w_->puts++;
+    for (auto &f : p.fragments()) {
+      w_->bytes.append(f.base, f.size);
+    }
+    if (w_->hold) { return w_->hold->get_future(); }
+    return seastar::make_ready_future<>();
+  }
+  seastar::future<>
+  close() final {
+    return seastar::make_ready_future<>();
+  }
+
+ private:
+  seastar::lw_shared_ptr<wire> w_;
+};
+
+/// \brief an rpc_connection, minus the socket
+struct connection {
+  explicit connection(seastar::lw_shared_ptr<wire> w)
+    : out(seastar::data_sink(std::make_unique<recording_sink>(w)), 8192),
+      queue(&out) {}
+  seastar::output_stream<char> out;
+  smf::rpc_send_queue queue;
+};
+
+static smf::rpc_envelope
+frame(uint16_t session) {
+  smf::rpc_envelope e;
+  e.letter.header.mutate_session(session);
+  auto body = std::to_string(session);
+  e.letter.body = seastar::temporary_buffer<char>(body.data(), body.size());
+  return e;
+}
+
+static smf::rpc_envelope
+high_priority_frame(uint16_t session, size_t size) {
+  smf::rpc_envelope e;
+  e.letter.header.mutate_session(session);
+  e.letter.body = seastar::temporary_buffer<char>(size);
+  std::memset(e.letter.body.get_write(), 'x', size);
+  e.set_priority(smf::rpc_priority::high);
+  return e;
+}
+
+/// \brief sessions of the frames on the wire, in order
+static std::vector<uint16_t>
+sessions(const std::string &bytes) {
+  std::vector<uint16_t> ret;
+  size_t i = 0;
+  while (i + sizeof(smf::rpc::header) <= bytes.size()) {
+    smf::rpc::header hdr;
+    std::memcpy(&hdr, bytes.data() + i, sizeof(hdr));
+    ret.push_back(hdr.session());
+    i += sizeof(hdr) + hdr.size();
+  }
+  LOG_THROW_IF(i != bytes.size(), "Truncated frame at byte {}", i);
+  return ret;
+}
+
+template <typename Fn>
+static seastar::future<>
+with_connection(seastar::lw_shared_ptr<wire> w, Fn fn) {
+  auto c = seastar::make_lw_shared<connection>(w);
+  return fn(*c).finally([c] { return c->queue.close().finally([c] {}); });
+}
+
+static seastar::future<>
+coalesces_in_order() {
+  auto w = seastar::make_lw_shared<wire>();
+  return with_connection(w, [w](connection &c) {
+    std::vector<seastar::future<>> sent;
+    for (uint16_t i = 1; i <= kFrames; ++i) {
+      sent.push_back(c.queue.enqueue(frame(i)));
+    }
+    return seastar::when_all_succeed(sent.begin(), sent.end())
+      .then([w, &c] {
+        LOG_THROW_IF(c.queue.stats().flushes != 1, "{} flushes for {} frames",
+                     c.queue.stats().flushes, kFrames);
+        LOG_THROW_IF(c.queue.stats().frames != kFrames, "{} frames written",
+                     c.queue.stats().frames);
+        LOG_THROW_IF(w->puts != 1, "{} writes for {} frames", w->puts,
+                     kFrames);
+        auto s = sessions(w->bytes);
+        std::vector<uint16_t> expected(boost::counting_iterator<uint16_t>(1),
+                                       boost::counting_iterator<uint16_t>(
+                                         kFrames + 1));
+        LOG_THROW_IF(s != expected, "Frames out of order");
+        LOG_INFO("{} enqueues, one write, in order", kFrames);
+      });
+  });
+}
+
+static seastar::future<>
+failures_propagate() {
+  auto w = seastar::make_lw_shared<wire>();
+  w->fail = true;
+  return with_connection(w, [](connection &c) {
+    std::vector<seastar::future<>> sent;
+    for (uint16_t i = 1; i <= kFrames; ++i) {
+      sent.push_back(c.queue.enqueue(frame(i)));
+    }
+    return seastar::when_all(sent.begin(), sent.end())
+      .then([&c](std::vector<seastar::future<>> results) {
+        for (auto &f : results) {
+          LOG_THROW_IF(!f.failed(), "Write to a broken sink succeeded");
+          f.ignore_ready_future();
+        }
+        // the connection is broken for good
+        return c.queue.enqueue(frame(kFrames + 1))
+          .then([] { LOG_THROW("Enqueued after a failed write"); })
+          .handle_exception_type([](std::runtime_error &) {
+            LOG_INFO("Failed writes fail every caller");
+          });
+      });
+  });
+}
+
+static seastar::future<>
+close_after_failed_flush() {
+  auto w = seastar::make_lw_shared<wire>();
+  w->fail = true;
+  auto c = seastar::make_lw_shared<connection>(w);
+  return c->queue.enqueue(frame(1))
+    .then([] { LOG_THROW("Write to a broken sink succeeded"); })
+    .handle_exception_type([](std::runtime_error &) {})
+    // what a peer that went away mid-write leads to
+    .then([c] { return c->queue.close(); })
+    .then([c] { return c->queue.close(); })
+    .then([c] {
+      return c->queue.enqueue(frame(2))
+        .then([] { LOG_THROW("Enqueued after close()"); })
+        .handle_exception_type([](std::runtime_error &) {
+          LOG_INFO("close() after a failed flush keeps the write error");
+        });
+    })
+    .finally([c] {});
+}
+
+static seastar::future<>
+close_waits_for_flush() {
+  auto w = seastar::make_lw_shared<wire>();
+  auto c = seastar::make_lw_shared<connection>(w);
+  // the flush is scheduled, not started
+  auto sent = c->queue.enqueue(frame(1));
+  return c->queue.close()
+    .then([w, c, sent = std::move(sent)]() mutable {
+      LOG_THROW_IF(!sent.available() || sent.failed(),
+                   "close() did not wait for the scheduled flush");
+      sent.ignore_ready_future();
+      LOG_THROW_IF(sessions(w->bytes) != std::vector<uint16_t>{1},
+                   "Frame not written");
+    })
+    .then([c] {
+      return c->queue.enqueue(frame(2))
+        .then([] { LOG_THROW("Enqueued after close()"); })
+        .handle_exception_type([](seastar::gate_closed_exception &) {
+          LOG_INFO("close() waits for the queue");
+        });
+    })
+    .finally([c] {});
+}
+
+static seastar::future<>
+high_priority_does_not_starve_bulk() {
+  constexpr uint16_t kBulk = 1;
+  constexpr uint16_t kHighFrames = 4;
+  // two fill the high priority budget of a flush
+  constexpr size_t kHighSize =
+    smf::rpc_send_queue::kMaxPriorityBytesPerFlush / 2;
+  auto w = seastar::make_lw_shared<wire>();
+  w->hold.emplace();
+  return with_connection(w, [w](connection &c) {
+    // everything below queues behind this write
+    std::vector<seastar::future<>> sent;
+    sent.push_back(c.queue.enqueue(frame(kBulk + kHighFrames + 1)));
+    return seastar::do_until([w] { return w->puts > 0; },
+                             [] { return seastar::later(); })
+      .then([w, &c]() mutable {
+        std::vector<seastar::future<>> queued;
+        queued.push_back(c.queue.enqueue(frame(kBulk)));
+        for (uint16_t i = 1; i <= kHighFrames; ++i) {
+          queued.push_back(
+            c.queue.enqueue(high_priority_frame(kBulk + i, kHighSize)));
+        }
+        auto hold = std::exchange(w->hold, std::nullopt);
+        hold->set_value();
+        return seastar::when_all_succeed(queued.begin(), queued.end());
+      })
+      .then([sent = std::move(sent)]() mutable {
+        return seastar::when_all_succeed(sent.begin(), sent.end());
+      })
+      .then([w] {
+        auto s = sessions(w->bytes);
+        auto bulk = std::find(s.begin(), s.end(), kBulk) - s.begin();
+        // the blocked write, then two high priority frames
+        LOG_THROW_IF(bulk != 3, "Normal frame written at position {} of {}",
+                     bulk, s.size());
+        LOG_INFO("Normal frames go out under a flood of high priority ones");
+      });
+  });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::app_template app;
+  return app.run(args, argv, [] {
+    return coalesces_in_order()
+      .then([] { return failures_propagate(); })
+      .then([] { return close_after_failed_flush(); })
+      .then([] { return close_waits_for_flush(); })
+      .then([] { return high_priority_does_not_starve_bulk(); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
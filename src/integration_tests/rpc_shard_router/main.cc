@@ -0,0 +1,143 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <functional>
+#include <string>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+#include "smf/rpc_shard_router.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+constexpr const uint32_t kRequests = 100;
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+
+/// \brief shared by the service and the router
+struct by_name {
+  uint64_t
+  operator()(const request_t &r) const {
+    return smf::rpc_shard_hash(r.name()->str());
+  }
+};
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+ public:
+  storage_service() { ShardGet(by_name{}); }
+
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    LOG_THROW_IF(!rec, "Request without a body");
+    const auto owner = by_name{}(*rec.get()) % seastar::smp::count;
+    LOG_THROW_IF(owner != seastar::engine().cpu_id(),
+                 "Request of core {} ran on core {}", owner,
+                 seastar::engine().cpu_id());
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->name = rec->name()->str();
+    data.envelope.set_status(200);
+    return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+      std::move(data));
+  }
+};
+
+static seastar::future<uint64_t>
+forwarded(seastar::distributed<smf::rpc_server> &rpc) {
+  return rpc.map_reduce0(
+    [](smf::rpc_server &s) { return s.stats().forwarded_requests; },
+    uint64_t(0), std::plus<uint64_t>());
+}
+
+/// \brief `pick` chooses the connection of each request
+template <typename Pick>
+static seastar::future<>
+send_all(seastar::lw_shared_ptr<smf::rpc_shard_router<client_t>> router,
+         Pick pick) {
+  return seastar::do_for_each(
+    boost::counting_iterator<uint32_t>(0),
+    boost::counting_iterator<uint32_t>(kRequests),
+    [router, pick](uint32_t i) mutable {
+      smf::rpc_typed_envelope<request_t> req;
+      req.data->name = "key" + std::to_string(i);
+      auto e = req.serialize_data();
+      return pick(*router, e).Get(std::move(e)).then([](auto reply) {
+        LOG_THROW_IF(!reply, "No reply");
+        LOG_THROW_IF(reply.ctx->status() != 200, "Bad status: {}",
+                     reply.ctx->status());
+      });
+    });
+}
+
+static seastar::future<>
+route(seastar::distributed<smf::rpc_server> &rpc, uint16_t port) {
+  smf::rpc_client_opts opts{};
+  opts.server_addr = seastar::ipv4_addr{"127.0.0.1", port};
+  auto router =
+    seastar::make_lw_shared<smf::rpc_shard_router<client_t>>(std::move(opts));
+  return router->connect()
+    .then([router] {
+      LOG_THROW_IF(router->shard_count() != seastar::smp::count,
+                   "Router has {} connections for {} cores",
+                   router->shard_count(), seastar::smp::count);
+      return send_all(router,
+                      [](auto &r, const smf::rpc_envelope &e) -> auto & {
+                        return r.template route<request_t>(e, by_name{});
+                      });
+    })
+    .then([&rpc] { return forwarded(rpc); })
+    .then([&rpc, router](uint64_t n) {
+      LOG_THROW_IF(n != 0, "route() sent {} requests to the wrong core", n);
+      LOG_INFO("Routed {} requests, none forwarded", kRequests);
+      // the control: one connection for all, most of them forwarded
+      return send_all(router, [](auto &r, const smf::rpc_envelope &) -> auto & {
+        return r.shard_for(0);
+      });
+    })
+    .then([&rpc] { return forwarded(rpc); })
+    .then([](uint64_t n) {
+      LOG_THROW_IF(n == 0, "One connection for every core, nothing forwarded");
+      LOG_INFO("Forwarded {} requests sent to core 0", n);
+    })
+    .finally([router] { return router->stop().finally([router] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  // room for the port of every core above it
+  uint16_t random_port = smf::non_root_port(
+    rand.next() % (std::numeric_limits<uint16_t>::max() - 256));
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port = smf::non_root_port(
+      rand.next() % (std::numeric_limits<uint16_t>::max() - 256));
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_shard_ports;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([&rpc, random_port] { return route(rpc, random_port); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
@@ -0,0 +1,108 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <string>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+#include "smf/shm_transport.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+constexpr const uint32_t kRequests = 32;
+/// \brief the largest requests are 4 times the ring: they wrap around and
+/// wait for the reader
+constexpr const uint32_t kRingSize = 1 << 16;
+constexpr const uint32_t kStep = 8192;
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+  /// \brief echoes the name
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    LOG_THROW_IF(!rec, "Request without a body");
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->name = rec->name()->str();
+    data.envelope.set_status(200);
+    return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+      std::move(data));
+  }
+};
+
+/// \brief concurrent requests of growing size, over shared memory
+static seastar::future<>
+echo(seastar::sstring path, bool busy_poll) {
+  smf::rpc_client_opts opts{};
+  opts.shm_path = path;
+  opts.shm.ring_size = kRingSize;
+  opts.shm.busy_poll = busy_poll;
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] {
+      return seastar::parallel_for_each(
+        boost::counting_iterator<uint32_t>(0),
+        boost::counting_iterator<uint32_t>(kRequests), [client](uint32_t i) {
+          smf::rpc_typed_envelope<request_t> req;
+          req.data->name = std::string(i * kStep + 1, 'a' + i % 26);
+          auto expected = req.data->name;
+          return client->Get(std::move(req))
+            .then([expected = std::move(expected)](auto reply) {
+              LOG_THROW_IF(!reply || reply.ctx->status() != 200,
+                           "Bad reply over shared memory");
+              LOG_THROW_IF(reply->name()->str() != expected,
+                           "Reply of {} bytes does not match the request",
+                           reply->name()->size());
+            });
+        });
+    })
+    .then([busy_poll] {
+      LOG_INFO("Requests served over shared memory, busy_poll: {}",
+               busy_poll);
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  const seastar::sstring path =
+    "/tmp/smf_rpc_shm_transport_" + seastar::to_sstring(random_port) + ".sock";
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+    sargs.shm_path = path;
+    sargs.shm.ring_size = kRingSize;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      // a second connection after the first one went away
+      .then([path] { return echo(path, false); })
+      .then([path] { return echo(path, true); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
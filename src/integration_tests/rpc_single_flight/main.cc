@@ -0,0 +1,176 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <string>
+#include <vector>
+// seastar
+#include <seastar/core/abort_source.hh>
+#include <seastar/core/app-template.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "smf/log.h"
+#include "smf/rpc_single_flight.h"
+
+constexpr const uint32_t kRequestId = 42;
+
+/// \brief a handler that returns when the test says so
+struct handler {
+  uint32_t calls{0};
+  std::vector<seastar::promise<smf::rpc_envelope>> replies;
+  std::vector<seastar::lw_shared_ptr<seastar::abort_source>> cancellations;
+
+  smf::rpc_single_flight::apply_fn
+  fn() {
+    return [this](smf::rpc_recv_context &&ctx) {
+      ++calls;
+      cancellations.push_back(ctx.cancellation);
+      replies.emplace_back();
+      return replies.back().get_future();
+    };
+  }
+  void
+  reply(size_t i, std::string body) {
+    smf::rpc_envelope e;
+    e.letter.body = seastar::temporary_buffer<char>(body.data(), body.size());
+    replies[i].set_value(std::move(e));
+  }
+};
+
+static smf::rpc_recv_context
+request(uint16_t session, std::string body,
+        seastar::lw_shared_ptr<seastar::abort_source> cancellation) {
+  smf::rpc::header hdr;
+  hdr.mutate_meta(kRequestId);
+  hdr.mutate_session(session);
+  hdr.mutate_size(body.size());
+  smf::rpc_recv_context ctx(
+    nullptr, seastar::make_ipv4_address(seastar::ipv4_addr{}), hdr,
+    seastar::temporary_buffer<char>(body.data(), body.size()));
+  ctx.cancellation = std::move(cancellation);
+  return ctx;
+}
+
+static seastar::lw_shared_ptr<seastar::abort_source>
+cancellation() {
+  return seastar::make_lw_shared<seastar::abort_source>();
+}
+
+static void
+check_reply(smf::rpc_envelope &e, uint16_t session, const std::string &body) {
+  LOG_THROW_IF(e.letter.header.session() != session,
+               "Reply for session {} went to session {}", session,
+               e.letter.header.session());
+  LOG_THROW_IF(std::string(e.letter.body.get(), e.letter.body.size()) != body,
+               "Session {} got the reply of another request", session);
+}
+
+static uint64_t
+collide(const char *, size_t) {
+  return 0;
+}
+
+static seastar::future<>
+coalesces_identical_requests() {
+  auto flights = seastar::make_lw_shared<smf::rpc_single_flight>();
+  auto h = seastar::make_lw_shared<handler>();
+  std::vector<seastar::future<smf::rpc_envelope>> replies;
+  for (uint16_t session = 1; session <= 3; ++session) {
+    replies.push_back(
+      flights->apply(request(session, "same", cancellation()), h->fn()));
+  }
+  LOG_THROW_IF(h->calls != 1, "Handler ran {} times for 3 identical requests",
+               h->calls);
+  LOG_THROW_IF(flights->coalesced() != 2, "{} coalesced",
+               flights->coalesced());
+  h->reply(0, "reply");
+  return seastar::when_all_succeed(replies.begin(), replies.end())
+    .then([flights, h](std::vector<smf::rpc_envelope> replies) {
+      for (uint16_t i = 0; i < replies.size(); ++i) {
+        check_reply(replies[i], i + 1, "reply");
+      }
+      LOG_THROW_IF(flights->size() != 0, "Flight not removed");
+      // a new flight after the reply
+      auto late = flights->apply(request(4, "same", cancellation()), h->fn());
+      LOG_THROW_IF(h->calls != 2, "Coalesced with a finished flight");
+      h->reply(1, "late");
+      return late.then([](smf::rpc_envelope e) { check_reply(e, 4, "late"); });
+    })
+    .then([] { LOG_INFO("Identical requests share one handler call"); });
+}
+
+static seastar::future<>
+compares_bytes_on_collision() {
+  auto flights = seastar::make_lw_shared<smf::rpc_single_flight>(collide);
+  auto h = seastar::make_lw_shared<handler>();
+  std::vector<seastar::future<smf::rpc_envelope>> replies;
+  replies.push_back(flights->apply(request(1, "a", cancellation()), h->fn()));
+  replies.push_back(flights->apply(request(2, "b", cancellation()), h->fn()));
+  replies.push_back(flights->apply(request(3, "a", cancellation()), h->fn()));
+  LOG_THROW_IF(h->calls != 2, "Handler ran {} times for 2 distinct payloads",
+               h->calls);
+  LOG_THROW_IF(flights->coalesced() != 1, "{} coalesced",
+               flights->coalesced());
+  h->reply(0, "a");
+  h->reply(1, "b");
+  return seastar::when_all_succeed(replies.begin(), replies.end())
+    .then([flights, h](std::vector<smf::rpc_envelope> replies) {
+      check_reply(replies[0], 1, "a");
+      check_reply(replies[1], 2, "b");
+      check_reply(replies[2], 3, "a");
+      LOG_INFO("Equal hashes of different payloads never coalesce");
+    });
+}
+
+static seastar::future<>
+cancels_once_every_waiter_cancelled() {
+  auto flights = seastar::make_lw_shared<smf::rpc_single_flight>();
+  auto h = seastar::make_lw_shared<handler>();
+  std::vector<seastar::lw_shared_ptr<seastar::abort_source>> clients{
+    cancellation(), cancellation(), cancellation()};
+  std::vector<seastar::future<smf::rpc_envelope>> replies;
+  for (uint16_t i = 0; i < clients.size(); ++i) {
+    replies.push_back(
+      flights->apply(request(i + 1, "same", clients[i]), h->fn()));
+  }
+  auto handler_cancelled = [h] {
+    return h->cancellations[0]->abort_requested();
+  };
+
+  clients[1]->request_abort();
+  LOG_THROW_IF(!replies[1].available() || !replies[1].failed(),
+               "A cancelled follower still waits for the handler");
+  replies[1].ignore_ready_future();
+  LOG_THROW_IF(handler_cancelled(), "Cancelled with 2 requests waiting");
+
+  clients[0]->request_abort();
+  LOG_THROW_IF(handler_cancelled(), "Cancelled with a follower waiting");
+
+  clients[2]->request_abort();
+  LOG_THROW_IF(!replies[2].available() || !replies[2].failed(),
+               "A cancelled follower still waits for the handler");
+  replies[2].ignore_ready_future();
+  LOG_THROW_IF(!handler_cancelled(), "Every waiter cancelled, handler runs");
+
+  // e.g.: seastar::sleep_abortable()
+  h->replies[0].set_exception(seastar::abort_requested_exception());
+  return std::move(replies[0])
+    .then([](smf::rpc_envelope) {
+      LOG_THROW("Cancelled handler returned a reply");
+    })
+    .handle_exception_type([flights, h](seastar::abort_requested_exception &) {
+      LOG_THROW_IF(flights->size() != 0, "Flight not removed");
+      LOG_INFO("Handler cancelled once every waiter cancelled");
+    });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::app_template app;
+  return app.run(args, argv, [] {
+    return coalesces_identical_requests()
+      .then([] { return compares_bytes_on_collision(); })
+      .then([] { return cancels_once_every_waiter_cancelled(); })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
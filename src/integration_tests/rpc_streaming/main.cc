@@ -0,0 +1,203 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+// more than rpc_stream::kDefaultWindow, so credits must flow back
+constexpr const uint32_t kMessages = 100;
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+
+class stream_service final : public smf_gen::demo::SmfStream {
+  virtual seastar::future<>
+  Scan(smf::rpc_recv_typed_context<request_t> &&rec,
+       smf::rpc_stream_writer<response_t> out) final {
+    LOG_THROW_IF(!rec, "Scan without a request");
+    std::string name = rec->name()->str();
+    return seastar::do_with(
+      std::move(out), [name](smf::rpc_stream_writer<response_t> &out) {
+        return seastar::do_for_each(
+          boost::counting_iterator<uint32_t>(0),
+          boost::counting_iterator<uint32_t>(kMessages),
+          [&out, name](uint32_t i) {
+            smf::rpc_typed_envelope<response_t> x;
+            x.data->name = name + std::to_string(i);
+            return out.write(std::move(x));
+          });
+      });
+  }
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Upload(smf::rpc_stream_reader<request_t> in) final {
+    return seastar::do_with(
+      std::move(in), uint32_t(0),
+      [](smf::rpc_stream_reader<request_t> &in, uint32_t &count) {
+        return seastar::repeat([&in, &count] {
+                 return in.read().then([&count](auto msg) {
+                   if (!msg) { return seastar::stop_iteration::yes; }
+                   ++count;
+                   return seastar::stop_iteration::no;
+                 });
+               })
+          .then([&count] {
+            smf::rpc_typed_envelope<response_t> x;
+            x.data->name = std::to_string(count);
+            x.envelope.set_status(200);
+            return x;
+          });
+      });
+  }
+  virtual seastar::future<>
+  Echo(smf::rpc_stream_reader<request_t> in,
+       smf::rpc_stream_writer<response_t> out) final {
+    return seastar::do_with(
+      std::move(in), std::move(out),
+      [](smf::rpc_stream_reader<request_t> &in,
+         smf::rpc_stream_writer<response_t> &out) {
+        return seastar::repeat([&in, &out] {
+          return in.read().then([&out](auto msg) {
+            if (!msg) {
+              return seastar::make_ready_future<seastar::stop_iteration>(
+                seastar::stop_iteration::yes);
+            }
+            smf::rpc_typed_envelope<response_t> x;
+            x.data->name = msg->name()->str();
+            return out.write(std::move(x)).then(
+              [] { return seastar::stop_iteration::no; });
+          });
+        });
+      });
+  }
+};
+
+static seastar::future<>
+scan(seastar::shared_ptr<smf_gen::demo::SmfStreamClient> client) {
+  smf::rpc_typed_envelope<request_t> req;
+  req.data->name = "scan";
+  return client->Scan(std::move(req)).then([](auto reader) {
+    return seastar::do_with(
+      std::move(reader), uint32_t(0),
+      [](smf::rpc_stream_reader<response_t> &r, uint32_t &count) {
+        return seastar::repeat([&r, &count] {
+                 return r.read().then([&count](auto msg) {
+                   if (!msg) { return seastar::stop_iteration::yes; }
+                   auto expected = "scan" + std::to_string(count++);
+                   LOG_THROW_IF(msg->name()->str() != expected,
+                                "Out of order message: {}, expected: {}",
+                                msg->name()->str(), expected);
+                   return seastar::stop_iteration::no;
+                 });
+               })
+          .then([&r, &count] {
+            LOG_THROW_IF(count != kMessages, "Scan got {} messages", count);
+            LOG_THROW_IF(r.status() != 200, "Bad status: {}", r.status());
+            LOG_INFO("Server streaming: {} messages", count);
+          });
+      });
+  });
+}
+
+static seastar::future<>
+upload(seastar::shared_ptr<smf_gen::demo::SmfStreamClient> client) {
+  return client->Upload().then([](auto s) {
+    return seastar::do_with(std::move(s), [](auto &s) {
+      return seastar::do_for_each(
+               boost::counting_iterator<uint32_t>(0),
+               boost::counting_iterator<uint32_t>(kMessages),
+               [&s](uint32_t i) {
+                 smf::rpc_typed_envelope<request_t> x;
+                 x.data->name = "upload";
+                 return s.writer.write(std::move(x));
+               })
+        .then([&s] { return s.writer.close(); })
+        .then([&s] { return s.reader.read(); })
+        .then([](auto msg) {
+          LOG_THROW_IF(!msg, "Upload had no response");
+          LOG_THROW_IF(msg->name()->str() != std::to_string(kMessages),
+                       "Upload counted: {}", msg->name()->str());
+          LOG_INFO("Client streaming: {} messages", kMessages);
+        });
+    });
+  });
+}
+
+static seastar::future<>
+echo(seastar::shared_ptr<smf_gen::demo::SmfStreamClient> client) {
+  return client->Echo().then([](auto s) {
+    return seastar::do_with(std::move(s), [](auto &s) {
+      return seastar::do_for_each(
+               boost::counting_iterator<uint32_t>(0),
+               boost::counting_iterator<uint32_t>(kMessages),
+               [&s](uint32_t i) {
+                 smf::rpc_typed_envelope<request_t> x;
+                 x.data->name = std::to_string(i);
+                 return s.writer.write(std::move(x))
+                   .then([&s] { return s.reader.read(); })
+                   .then([i](auto msg) {
+                     LOG_THROW_IF(!msg, "Echo stream ended early");
+                     LOG_THROW_IF(msg->name()->str() != std::to_string(i),
+                                  "Echo mismatch: {}", msg->name()->str());
+                   });
+               })
+        .then([&s] { return s.writer.close(); })
+        .then([&s] { return s.reader.read(); })
+        .then([](auto msg) {
+          LOG_THROW_IF(!!msg, "Echo should have ended");
+          LOG_INFO("Bidi streaming: {} messages", kMessages);
+        });
+    });
+  });
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<stream_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([random_port] {
+        smf::rpc_client_opts opts{};
+        opts.server_addr = seastar::ipv4_addr{"127.0.0.1", random_port};
+        auto client = seastar::make_shared<smf_gen::demo::SmfStreamClient>(
+          std::move(opts));
+        return client->connect()
+          .then([client] { return scan(client); })
+          .then([client] { return upload(client); })
+          .then([client] { return echo(client); })
+          .finally([client] { return client->stop().finally([client] {}); });
+      })
+      .then([] { return seastar::make_ready_future<int>(0); });
+  });
+}
@@ -0,0 +1,137 @@
+// Copyright 2019 SMF Authors
+//
+// std
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/iterator/counting_iterator.hpp>
+// seastar
+#include <seastar/core/app-template.hh>
+#include <seastar/core/distributed.hh>
+#include <seastar/core/future-util.hh>
+#include <seastar/core/posix.hh>
+#include <seastar/core/reactor.hh>
+// smf
+#include "integration_tests/non_root_port.h"
+#include "smf/log.h"
+#include "smf/random.h"
+#include "smf/rpc_server.h"
+#include "smf/rpc_unix_address.h"
+// generated-templates
+#include "integration_tests/demo_service.smf.fb.h"
+
+constexpr const uint32_t kRequests = 64;
+
+using request_t = smf_gen::demo::Request;
+using response_t = smf_gen::demo::Response;
+using client_t = smf_gen::demo::SmfStorageClient;
+
+class storage_service final : public smf_gen::demo::SmfStorage {
+  /// \brief echoes the name
+  virtual seastar::future<smf::rpc_typed_envelope<response_t>>
+  Get(smf::rpc_recv_typed_context<request_t> &&rec) final {
+    LOG_THROW_IF(!rec, "Request without a body");
+    smf::rpc_typed_envelope<response_t> data;
+    data.data->name = rec->name()->str();
+    data.envelope.set_status(200);
+    return seastar::make_ready_future<smf::rpc_typed_envelope<response_t>>(
+      std::move(data));
+  }
+};
+
+/// \brief concurrent requests of growing size, over the unix socket
+static seastar::future<>
+echo(seastar::sstring path) {
+  smf::rpc_client_opts opts{};
+  opts.server_address = smf::make_unix_address(path);
+  auto client = seastar::make_shared<client_t>(std::move(opts));
+  return client->connect()
+    .then([client] {
+      return seastar::parallel_for_each(
+        boost::counting_iterator<uint32_t>(0),
+        boost::counting_iterator<uint32_t>(kRequests), [client](uint32_t i) {
+          smf::rpc_typed_envelope<request_t> req;
+          req.data->name = std::string(i * 1024 + 1, 'a' + i % 26);
+          auto expected = req.data->name;
+          return client->Get(std::move(req))
+            .then([expected = std::move(expected)](auto reply) {
+              LOG_THROW_IF(!reply || reply.ctx->status() != 200,
+                           "Bad reply over the unix socket");
+              LOG_THROW_IF(reply->name()->str() != expected,
+                           "Reply of {} bytes does not match the request",
+                           reply->name()->size());
+            });
+        });
+    })
+    .finally([client] { return client->stop().finally([client] {}); });
+}
+
+/// \brief e.g.: left by a server that crashed. Bound, never unlinked
+static void
+make_stale_socket(const seastar::sstring &path) {
+  auto a = smf::make_unix_address(path);
+  auto fd = seastar::file_desc::socket(AF_UNIX, SOCK_STREAM, 0);
+  fd.bind(a.u.sa, sizeof(a.u.un));
+}
+
+/// \brief a mistyped path must not cost the user a file
+static void
+keeps_regular_file(const seastar::sstring &path) {
+  const auto file = path + ".txt";
+  std::ofstream(file.c_str()) << "not a socket";
+  bool threw = false;
+  try {
+    smf::remove_stale_unix_socket(file.c_str());
+  } catch (const std::exception &) { threw = true; }
+  const bool kept = std::ifstream(file.c_str()).good();
+  ::unlink(file.c_str());
+  LOG_THROW_IF(!threw || !kept, "Regular file at a socket path was removed");
+  LOG_INFO("Listening refuses to remove a regular file");
+}
+
+int
+main(int args, char **argv, char **env) {
+  seastar::distributed<smf::rpc_server> rpc;
+  seastar::app_template app;
+  smf::random rand;
+  uint16_t random_port =
+    smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+  const seastar::sstring path =
+    "/tmp/smf_rpc_unix_socket_" + seastar::to_sstring(random_port) + ".sock";
+  return app.run(args, argv, [&]() -> seastar::future<int> {
+    seastar::engine().at_exit([&] { return rpc.stop(); });
+    keeps_regular_file(path);
+    make_stale_socket(path);
+    smf::rpc_server_args sargs;
+    sargs.ip = "127.0.0.1";
+    sargs.rpc_port = random_port;
+    sargs.http_port =
+      smf::non_root_port(rand.next() % std::numeric_limits<uint16_t>::max());
+    sargs.flags |= smf::rpc_server_flags::rpc_server_flags_disable_http_server;
+    sargs.unix_address = smf::make_unix_address(path);
+
+    return rpc.start(sargs)
+      .then([&rpc] {
+        return rpc.invoke_on_all(
+          &smf::rpc_server::register_service<storage_service>);
+      })
+      .then([&rpc] { return rpc.invoke_on_all(&smf::rpc_server::start); })
+      .then([path] {
+        // only core 0 listens; clients of every core reach it
+        return seastar::parallel_for_each(
+          boost::counting_iterator<uint32_t>(0),
+          boost::counting_iterator<uint32_t>(seastar::smp::count),
+          [path](uint32_t core) {
+            return seastar::smp::submit_to(core, [path] { return echo(path); });
+          });
+      })
+      .then([] {
+        LOG_INFO("Requests of every core served over the unix socket");
+        return seastar::make_ready_future<int>(0);
+      });
+  });
+}
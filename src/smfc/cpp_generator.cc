@@ -92,6 +92,22 @@ print_header_service_ctor_dtor(smf_printer &printer,
     vars["InType"] = method->input_type_name();
     vars["OutType"] = method->output_type_name();
     vars["MethodId"] = std::to_string(method->method_id());
+    vars["RpcType"] = method->rpc_type();
+    if (method->is_streaming()) {
+      // the server stamps the session on every frame of the stream
+      printer.print("smf::rpc_service_method_handle(\n");
+      printer.indent();
+      printer.print(vars,
+                    "smf::rpc_service_method_handle::$RpcType$,\n"
+                    "[this](seastar::lw_shared_ptr<smf::rpc_stream> s) -> "
+                    "seastar::future<> {\n");
+      printer.indent();
+      printer.print(vars, "return $RawMethodName$(std::move(s));\n");
+      printer.outdent();
+      printer.print(i < max - 1 ? "}),\n" : "})\n");
+      printer.outdent();
+      continue;
+    }
     printer.print("smf::rpc_service_method_handle(\n");
     printer.indent();
     printer.print("[this](smf::rpc_recv_context c) -> "
@@ -115,7 +131,35 @@ print_header_service_ctor_dtor(smf_printer &printer,
     printer.outdent();
   }
   printer.outdent();
-  printer.print("}} {}\n");
+  printer.print("}} {\n");
+  printer.indent();
+  for (int32_t i = 0, max = service->methods().size(); i < max; ++i) {
+    if (!service->methods()[i]->accepts_fragments()) { continue; }
+    vars["MethodIdx"] = std::to_string(i);
+    printer.print(vars, "handles_[$MethodIdx$].accepts_fragments = true;\n");
+  }
+  for (int32_t i = 0, max = service->methods().size(); i < max; ++i) {
+    auto ttl = service->methods()[i]->cache_ttl_ms();
+    if (ttl == 0) { continue; }
+    vars["MethodIdx"] = std::to_string(i);
+    vars["CacheTtl"] = std::to_string(ttl);
+    printer.print(vars, "handles_[$MethodIdx$].cache_ttl = "
+                        "std::chrono::milliseconds($CacheTtl$);\n");
+  }
+  if (!service->scheduling_group().empty()) {
+    vars["SchedulingGroup"] = service->scheduling_group();
+    printer.print(vars, "scheduling_group = \"$SchedulingGroup$\";\n");
+  }
+  for (int32_t i = 0, max = service->methods().size(); i < max; ++i) {
+    auto group = service->methods()[i]->scheduling_group();
+    if (group.empty()) { continue; }
+    vars["MethodIdx"] = std::to_string(i);
+    vars["SchedulingGroup"] = group;
+    printer.print(vars, "handles_[$MethodIdx$].scheduling_group = "
+                        "\"$SchedulingGroup$\";\n");
+  }
+  printer.outdent();
+  printer.print("}\n");
 }
 
 static void
@@ -142,6 +186,23 @@ print_header_service_handle_request_id(smf_printer &printer,
   printer.print("}\n");
   printer.outdent();
   printer.print("}\n");
+
+  printer.print("virtual std::vector<uint32_t>\n"
+                "request_ids() const override final {\n");
+  printer.indent();
+  printer.print("return {\n");
+  printer.indent();
+  for (auto i = 0u; i < service->methods().size(); ++i) {
+    std::map<std::string, std::string> vars;
+    auto &method = service->methods()[i];
+    vars["ServiceID"] = std::to_string(method->service_id());
+    vars["MethodId"] = std::to_string(method->method_id());
+    printer.print(vars, "($ServiceID$ ^ $MethodId$),\n");
+  }
+  printer.outdent();
+  printer.print("};\n");
+  printer.outdent();
+  printer.print("}\n");
 }
 
 static void
@@ -158,9 +219,173 @@ print_header_service_handles(smf_printer &printer, const smf_service *service) {
   printer.print("}\n");
 }
 
+static void
+print_header_service_shard_keys(smf_printer &printer,
+                                const smf_service *service) {
+  for (auto i = 0u; i < service->methods().size(); ++i) {
+    auto &method = service->methods()[i];
+    if (method->is_streaming()) { continue; }
+    std::map<std::string, std::string> vars;
+    vars["MethodName"] = method->name();
+    vars["ShardMethodName"] = proper_prefix_token("shard", method->name());
+    vars["InType"] = method->input_type_name();
+    vars["VectorIdx"] = std::to_string(i);
+    printer.print(vars,
+                  "/// \\brief runs $MethodName$ on the core owning\n"
+                  "/// `fn(const $InType$ &) % seastar::smp::count`\n"
+                  "template <typename Fn>\n"
+                  "void\n"
+                  "$ShardMethodName$(Fn fn) {\n");
+    printer.indent();
+    printer.print(
+      vars, "handles_[$VectorIdx$].shard_key =\n"
+            "  smf::rpc_typed_shard_key<$InType$>(std::move(fn));\n");
+    printer.outdent();
+    printer.print("}\n");
+  }
+}
+
+static void
+print_header_service_single_flight(smf_printer &printer,
+                                   const smf_service *service) {
+  for (auto i = 0u; i < service->methods().size(); ++i) {
+    auto &method = service->methods()[i];
+    if (method->is_streaming()) { continue; }
+    std::map<std::string, std::string> vars;
+    vars["MethodName"] = method->name();
+    vars["CoalesceMethodName"] = proper_prefix_token("coalesce", method->name());
+    vars["VectorIdx"] = std::to_string(i);
+    printer.print(vars,
+                  "/// \\brief identical concurrent $MethodName$ requests\n"
+                  "/// share one reply. See smf::rpc_single_flight\n"
+                  "void\n"
+                  "$CoalesceMethodName$(bool enable = true) {\n");
+    printer.print(vars,
+                  "  handles_[$VectorIdx$].single_flight = enable;\n");
+    printer.print("}\n");
+  }
+}
+
+static void
+print_header_service_quotas(smf_printer &printer, const smf_service *service) {
+  for (auto i = 0u; i < service->methods().size(); ++i) {
+    auto &method = service->methods()[i];
+    if (method->is_streaming()) { continue; }
+    std::map<std::string, std::string> vars;
+    vars["MethodName"] = method->name();
+    vars["QuotaMethodName"] = proper_prefix_token("quota", method->name());
+    vars["VectorIdx"] = std::to_string(i);
+    printer.print(vars,
+                  "/// \\brief per core admission limits of $MethodName$.\n"
+                  "/// See smf::rpc_method_quota\n"
+                  "void\n"
+                  "$QuotaMethodName$(smf::rpc_method_quota q) {\n");
+    printer.print(vars, "  handles_[$VectorIdx$].quota = q;\n");
+    printer.print("}\n");
+  }
+}
+
+static void
+print_header_service_streaming_method(smf_printer &printer,
+                                      const smf_method *method) {
+  VLOG(1) << "print_header_service_streaming_method: " << method->name();
+
+  std::map<std::string, std::string> vars;
+  vars["RawMethodName"] = proper_prefix_token("raw", method->name());
+  vars["MethodName"] = method->name();
+  vars["InType"] = method->input_type_name();
+  vars["OutType"] = method->output_type_name();
+
+  switch (method->streaming()) {
+  case smf_method::kServer:
+    printer.print(vars,
+                  "inline virtual seastar::future<>\n"
+                  "$MethodName$(smf::rpc_recv_typed_context<$InType$> &&rec,\n"
+                  "  smf::rpc_stream_writer<$OutType$> out) {\n");
+    printer.indent();
+    printer.print("// User should override this method.\n"
+                  "// i.e. 501 == Method not implemented\n"
+                  "return out.close(501);\n");
+    printer.outdent();
+    printer.print("}\n");
+    printer.print(vars, "inline virtual seastar::future<>\n"
+                        "$RawMethodName$("
+                        "seastar::lw_shared_ptr<smf::rpc_stream> s) {\n");
+    printer.indent();
+    printer.print(
+      vars,
+      "using input_t = smf::rpc_recv_typed_context<$InType$>;\n"
+      "return s->read().then([this, s](std::optional<smf::rpc_recv_context> "
+      "c) {\n"
+      "  return $MethodName$(input_t(std::move(c)),\n"
+      "    smf::rpc_stream_writer<$OutType$>(s));\n"
+      "});\n");
+    printer.outdent();
+    printer.print("}\n");
+    break;
+  case smf_method::kClient:
+    printer.print(vars,
+                  "inline virtual\n"
+                  "seastar::future<smf::rpc_typed_envelope<$OutType$>>\n"
+                  "$MethodName$(smf::rpc_stream_reader<$InType$> in) {\n");
+    printer.indent();
+    printer.print(vars,
+                  "using env_t = smf::rpc_typed_envelope<$OutType$>;\n"
+                  "env_t data;\n"
+                  "// User should override this method.\n"
+                  "// i.e. 501 == Method not implemented\n"
+                  "data.envelope.set_status(501);\n"
+                  "return seastar::make_ready_future<env_t>(std::move(data));\n");
+    printer.outdent();
+    printer.print("}\n");
+    printer.print(vars, "inline virtual seastar::future<>\n"
+                        "$RawMethodName$("
+                        "seastar::lw_shared_ptr<smf::rpc_stream> s) {\n");
+    printer.indent();
+    printer.print(
+      vars,
+      "using mid_t = smf::rpc_typed_envelope<$OutType$>;\n"
+      "return $MethodName$(smf::rpc_stream_reader<$InType$>(s))"
+      ".then([s](mid_t x) {\n"
+      "  auto status = x.envelope.letter.header.meta();\n"
+      "  return s->write(x.serialize_data()).then([s, status] {\n"
+      "    return s->close(status == 0 ? 200 : status);\n"
+      "  });\n"
+      "});\n");
+    printer.outdent();
+    printer.print("}\n");
+    break;
+  case smf_method::kBiDi:
+    printer.print(vars, "inline virtual seastar::future<>\n"
+                        "$MethodName$(smf::rpc_stream_reader<$InType$> in,\n"
+                        "  smf::rpc_stream_writer<$OutType$> out) {\n");
+    printer.indent();
+    printer.print("// User should override this method.\n"
+                  "// i.e. 501 == Method not implemented\n"
+                  "return out.close(501);\n");
+    printer.outdent();
+    printer.print("}\n");
+    printer.print(vars, "inline virtual seastar::future<>\n"
+                        "$RawMethodName$("
+                        "seastar::lw_shared_ptr<smf::rpc_stream> s) {\n");
+    printer.indent();
+    printer.print(vars, "return $MethodName$(smf::rpc_stream_reader<$InType$>(s),\n"
+                        "  smf::rpc_stream_writer<$OutType$>(s));\n");
+    printer.outdent();
+    printer.print("}\n");
+    break;
+  default:
+    LOG(FATAL) << "Method is not streaming: " << method->name();
+  }
+}
+
 static void
 print_header_service_method(smf_printer &printer, const smf_method *method) {
   VLOG(1) << "print_header_service_method: " << method->name();
+  if (method->is_streaming()) {
+    print_header_service_streaming_method(printer, method);
+    return;
+  }
 
   std::map<std::string, std::string> vars;
   vars["RawMethodName"] = proper_prefix_token("raw", method->name());
@@ -193,6 +418,10 @@ print_header_service_method(smf_printer &printer, const smf_method *method) {
                       "seastar::future<smf::rpc_envelope>\n");
   printer.print(vars, "$RawMethodName$(smf::rpc_recv_context &&c) {\n");
   printer.indent();
+  if (method->accepts_fragments()) {
+    printer.print("// Override to consume c.fragments without a copy\n"
+                  "if (c.is_fragmented()) { c.linearize(); }\n");
+  }
   printer.print(
     vars,
     "using inner_t = $InType$;\n"
@@ -249,6 +478,9 @@ print_header_service(smf_printer &printer, const smf_service *service) {
 
   print_header_service_handles(printer, service);
   print_header_service_handle_request_id(printer, service);
+  print_header_service_shard_keys(printer, service);
+  print_header_service_single_flight(printer, service);
+  print_header_service_quotas(printer, service);
 
   for (auto &method : service->methods()) {
     print_header_service_method(printer, method.get());
@@ -258,8 +490,68 @@ print_header_service(smf_printer &printer, const smf_service *service) {
   printer.print(vars, "}; // end of service: $Service$\n");
 }
 
+static void
+print_header_client_streaming_method(smf_printer &printer,
+                                     const smf_method *method) {
+  std::map<std::string, std::string> vars;
+  vars["MethodName"] = method->name();
+  vars["MethodID"] = std::to_string(method->method_id());
+  vars["ServiceID"] = std::to_string(method->service_id());
+  vars["InType"] = method->input_type_name();
+  vars["OutType"] = method->output_type_name();
+
+  if (method->streaming() == smf_method::kServer) {
+    printer.print(vars,
+                  "inline virtual\n"
+                  "seastar::future<smf::rpc_stream_reader<$OutType$>>\n"
+                  "$MethodName$(smf::rpc_typed_envelope<$InType$> x) {\n");
+    printer.print(vars, "  return $MethodName$(x.serialize_data());\n");
+    printer.print("}\n");
+    printer.print(vars,
+                  "inline virtual\n"
+                  "seastar::future<smf::rpc_stream_reader<$OutType$>>\n"
+                  "$MethodName$(smf::rpc_envelope e) {\n");
+    printer.indent();
+    printer.print(
+      vars,
+      "/// ServiceID: $ServiceID$\n"
+      "/// MethodID:  $MethodID$\n"
+      "using reader_t = smf::rpc_stream_reader<$OutType$>;\n"
+      "return open_stream($ServiceID$ ^ $MethodID$).then(\n"
+      "  [e = std::move(e)](seastar::lw_shared_ptr<smf::rpc_stream> s) "
+      "mutable {\n"
+      "    return s->write(std::move(e))\n"
+      "      .then([s] { return s->close(); })\n"
+      "      .then([s] { return reader_t(s); });\n"
+      "  });\n");
+    printer.outdent();
+    printer.print("}\n");
+    return;
+  }
+  // client and bidi streaming
+  printer.print(vars,
+                "inline virtual\n"
+                "seastar::future<smf::rpc_bidi_stream<$InType$, $OutType$>>\n"
+                "$MethodName$() {\n");
+  printer.indent();
+  printer.print(vars, "/// ServiceID: $ServiceID$\n"
+                      "/// MethodID:  $MethodID$\n"
+                      "using stream_t = smf::rpc_bidi_stream<$InType$, "
+                      "$OutType$>;\n"
+                      "return open_stream($ServiceID$ ^ $MethodID$).then(\n"
+                      "  [](seastar::lw_shared_ptr<smf::rpc_stream> s) {\n"
+                      "    return stream_t(std::move(s));\n"
+                      "  });\n");
+  printer.outdent();
+  printer.print("}\n");
+}
+
 static void
 print_header_client_method(smf_printer &printer, const smf_method *method) {
+  if (method->is_streaming()) {
+    print_header_client_streaming_method(printer, method);
+    return;
+  }
   std::map<std::string, std::string> vars;
   vars["RawMethodName"] = proper_prefix_token("raw", method->name());
   vars["MethodName"] = method->name();
@@ -289,6 +581,25 @@ print_header_client_method(smf_printer &printer, const smf_method *method) {
                       "return send<$OutType$>(std::move(e));\n");
   printer.outdent();
   printer.print("}\n");
+
+  // cancellable
+  printer.print(vars,
+                "inline virtual\n"
+                "seastar::future<smf::rpc_recv_typed_context<$OutType$>>\n"
+                "$MethodName$(smf::rpc_typed_envelope<$InType$> x,\n"
+                "  seastar::abort_source &as) {\n");
+  printer.print(vars, "  return $MethodName$(x.serialize_data(), as);\n");
+  printer.print("}\n");
+  printer.print(vars,
+                "inline virtual\n"
+                "seastar::future<smf::rpc_recv_typed_context<$OutType$>>\n"
+                "$MethodName$(smf::rpc_envelope e, seastar::abort_source &as) "
+                "{\n");
+  printer.indent();
+  printer.print(vars, "e.set_request_id($ServiceID$ ^ $MethodID$);\n"
+                      "return send<$OutType$>(std::move(e), as);\n");
+  printer.outdent();
+  printer.print("}\n");
 }
 
 static void
@@ -441,9 +752,10 @@ cpp_generator::generate_header_prologue_includes() {
   std::map<std::string, std::string> vars;
   static const std::vector<std::string> headers = {
         "ostream", "seastar/core/sstring.hh",
-        "smf/rpc_service.h",
+        "smf/rpc_service.h", "smf/rpc_shard_key.h",
         "smf/rpc_client.h", "smf/rpc_recv_typed_context.h",
-        "smf/rpc_typed_envelope.h", "smf/log.h" };
+        "smf/rpc_typed_envelope.h", "smf/rpc_typed_stream.h",
+        "smf/log.h" };
 
   for (auto &hdr : headers) {
     vars["header"] = hdr;
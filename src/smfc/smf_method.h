@@ -3,6 +3,8 @@
 #pragma once
 #include <deque>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 #include <boost/algorithm/string/join.hpp>
 #include <flatbuffers/idl.h>
@@ -18,7 +20,7 @@ class smf_method {
   smf_method(const flatbuffers::RPCCall *method, std::string service_name,
              uint32_t service_id)
     : method_(method), service_name_(service_name), service_id_(service_id) {
-    streaming_ = kNone;
+    streaming_ = parse_streaming(method_);
     // you can have the same method name w/ different arguments, so in that
     // case you should change the hash id
     std::string method_id_str =
@@ -33,6 +35,61 @@ class smf_method {
   method_id() const {
     return id_;
   }
+  Streaming
+  streaming() const {
+    return streaming_;
+  }
+  bool
+  is_streaming() const {
+    return streaming_ != kNone;
+  }
+  /// \brief rpc_service S { M(In):Out (fragmented); }
+  /// the raw handler receives large requests as the list of fragments
+  /// that came off the wire. Needs `attribute "fragmented";` in the schema
+  bool
+  accepts_fragments() const {
+    return !is_streaming() &&
+           method_->attributes.Lookup("fragmented") != nullptr;
+  }
+  /// \brief rpc_service S { M(In):Out (cache_ttl_ms: 500); }
+  /// replies are cached per core for that long; see
+  /// smf::rpc_response_cache. 0 if not set. Needs
+  /// `attribute "cache_ttl_ms";` in the schema
+  uint32_t
+  cache_ttl_ms() const {
+    if (is_streaming()) { return 0; }
+    auto attr = method_->attributes.Lookup("cache_ttl_ms");
+    if (attr == nullptr) { return 0; }
+    try {
+      return static_cast<uint32_t>(std::stoul(attr->constant));
+    } catch (const std::exception &) {
+      throw std::runtime_error("Invalid cache_ttl_ms attribute: `" +
+                               attr->constant + "` for method: " +
+                               method_->name + ". Expected milliseconds");
+    }
+  }
+  /// \brief rpc_service S { M(In):Out (scheduling_group: "batch"); }
+  /// requests run in that smf::rpc_server_args::scheduling_groups entry.
+  /// Empty if not set. Needs `attribute "scheduling_group";` in the schema
+  std::string
+  scheduling_group() const {
+    auto attr = method_->attributes.Lookup("scheduling_group");
+    return attr == nullptr ? "" : attr->constant;
+  }
+  /// \brief name of the smf::rpc_service_method_handle::rpc_type enum
+  std::string
+  rpc_type() const {
+    switch (streaming_) {
+    case kClient:
+      return "CLIENT_STREAMING";
+    case kServer:
+      return "SERVER_STREAMING";
+    case kBiDi:
+      return "BIDI_STREAMING";
+    default:
+      return "NORMAL_RPC";
+    }
+  }
 
   std::string
   service_name() const {
@@ -75,6 +132,23 @@ class smf_method {
     return type(*method_->response, l);
   }
 
+ private:
+  /// \brief same values as flatc's grpc generator:
+  /// rpc_service S { M(In):Out (streaming: "server"); }
+  static Streaming
+  parse_streaming(const flatbuffers::RPCCall *m) {
+    auto attr = m->attributes.Lookup("streaming");
+    if (attr == nullptr) { return kNone; }
+    const auto &v = attr->constant;
+    if (v == "none") { return kNone; }
+    if (v == "client") { return kClient; }
+    if (v == "server") { return kServer; }
+    if (v == "bidi") { return kBiDi; }
+    throw std::runtime_error("Unknown streaming attribute: `" + v +
+                             "` for method: " + m->name +
+                             ". Expected one of: none, client, server, bidi");
+  }
+
  private:
   const flatbuffers::RPCCall *method_;
   const std::string service_name_;
@@ -34,6 +34,14 @@ class smf_service {
     return id_;
   }
 
+  /// \brief rpc_service S (scheduling_group: "batch") { ... }
+  /// default group of every method; see smf_method::scheduling_group()
+  std::string
+  scheduling_group() const {
+    auto attr = service_->attributes.Lookup("scheduling_group");
+    return attr == nullptr ? "" : attr->constant;
+  }
+
   const std::vector<std::unique_ptr<smf_method>> &
   methods() const {
     return methods_;
@@ -0,0 +1,52 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_checksum.h"
+
+TEST(rpc_checksum, crc32c_known_vector) {
+  const std::string s = "123456789";
+  ASSERT_EQ(0xe3069283, smf::crc32c(s.data(), s.size()));
+  ASSERT_EQ(0u, smf::crc32c(nullptr, 0));
+}
+
+TEST(rpc_checksum, crc32c_unaligned_tails) {
+  std::string s(1027, 'x');
+  for (auto i = 0u; i < s.size(); ++i) {
+    s[i] = static_cast<char>(i * 31);
+  }
+  // same bytes from a different alignment must hash the same
+  std::string copy = " " + s;
+  ASSERT_EQ(smf::crc32c(s.data(), s.size()),
+            smf::crc32c(copy.data() + 1, s.size()));
+}
+
+TEST(rpc_checksum, header_type_roundtrip) {
+  using namespace smf::rpc;  // NOLINT
+  header hdr;
+  hdr.mutate_bitflags(header_bit_flags_has_payload_headers);
+  ASSERT_EQ(checksum_type_xxhash64, smf::rpc_checksum_type(hdr));
+  for (auto t : {checksum_type_crc32c, checksum_type_xxhash3,
+                 checksum_type_none, checksum_type_xxhash64}) {
+    smf::set_rpc_checksum_type(hdr, t);
+    ASSERT_EQ(t, smf::rpc_checksum_type(hdr));
+    // other flags are untouched
+    ASSERT_TRUE(hdr.bitflags() & header_bit_flags_has_payload_headers);
+  }
+}
+
+TEST(rpc_checksum, none_is_zero) {
+  const char buf[] = "hello";
+  ASSERT_EQ(0u, smf::rpc_checksum(smf::rpc::checksum_type_none, buf,
+                                  std::strlen(buf)));
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
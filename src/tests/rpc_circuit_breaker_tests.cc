@@ -0,0 +1,127 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_circuit_breaker.h"
+
+using namespace std::chrono_literals;  // NOLINT
+using state = smf::rpc_circuit_breaker::state;
+using time_point = smf::rpc_circuit_breaker::clock_type::time_point;
+
+static time_point
+at(std::chrono::milliseconds ms) {
+  return time_point(ms);
+}
+
+static smf::rpc_circuit_breaker_opts
+test_opts() {
+  smf::rpc_circuit_breaker_opts o;
+  o.min_requests = 10;
+  o.max_error_rate = 0.5;
+  o.open_duration = 1000ms;
+  o.half_open_probes = 2;
+  return o;
+}
+
+static void
+run(smf::rpc_circuit_breaker &b, time_point now, uint32_t n, bool failed,
+    std::chrono::milliseconds latency = 1ms) {
+  for (auto i = 0u; i < n; ++i) {
+    auto p = b.allow(now);
+    ASSERT_TRUE(p);
+    b.record(*p, now, failed, latency);
+  }
+}
+
+TEST(rpc_circuit_breaker, trips_on_error_rate) {
+  smf::rpc_circuit_breaker b(test_opts());
+  run(b, at(0ms), 6, false);
+  run(b, at(0ms), 3, true);
+  // 9 requests: below min_requests
+  ASSERT_EQ(state::closed, b.current_state());
+  run(b, at(0ms), 3, true);
+  ASSERT_EQ(state::open, b.current_state());
+  ASSERT_FALSE(b.allow(at(10ms)));
+  ASSERT_EQ(1u, b.stats().rejected);
+  ASSERT_EQ(1u, b.stats().trips);
+}
+
+TEST(rpc_circuit_breaker, old_buckets_expire) {
+  smf::rpc_circuit_breaker b(test_opts());
+  run(b, at(0ms), 9, true);
+  // the window is 10 x 1s
+  run(b, at(11000ms), 9, false);
+  run(b, at(11000ms), 1, true);
+  ASSERT_EQ(state::closed, b.current_state());
+}
+
+TEST(rpc_circuit_breaker, trips_on_latency_percentile) {
+  auto o = test_opts();
+  o.latency_threshold = 100ms;
+  o.latency_percentile = 90;
+  smf::rpc_circuit_breaker b(o);
+  run(b, at(0ms), 18, false, 1ms);
+  // 2 of 20 slow: p90 is not above the threshold yet
+  run(b, at(0ms), 2, false, 200ms);
+  ASSERT_EQ(state::closed, b.current_state());
+  run(b, at(0ms), 1, false, 200ms);
+  ASSERT_EQ(state::open, b.current_state());
+}
+
+TEST(rpc_circuit_breaker, half_open_closes_after_probes) {
+  smf::rpc_circuit_breaker b(test_opts());
+  run(b, at(0ms), 10, true);
+  ASSERT_EQ(state::open, b.current_state());
+  auto p1 = b.allow(at(1000ms));
+  ASSERT_TRUE(p1);
+  ASSERT_EQ(state::half_open, b.current_state());
+  auto p2 = b.allow(at(1000ms));
+  ASSERT_TRUE(p2);
+  // only half_open_probes in flight
+  ASSERT_FALSE(b.allow(at(1000ms)));
+  b.record(*p1, at(1001ms), false, 1ms);
+  ASSERT_EQ(state::half_open, b.current_state());
+  b.record(*p2, at(1001ms), false, 1ms);
+  ASSERT_EQ(state::closed, b.current_state());
+  // the window starts over
+  run(b, at(1002ms), 9, true);
+  ASSERT_EQ(state::closed, b.current_state());
+}
+
+TEST(rpc_circuit_breaker, failed_probe_reopens) {
+  smf::rpc_circuit_breaker b(test_opts());
+  run(b, at(0ms), 10, true);
+  auto p = b.allow(at(1000ms));
+  ASSERT_TRUE(p);
+  b.record(*p, at(1001ms), true, 1ms);
+  ASSERT_EQ(state::open, b.current_state());
+  ASSERT_EQ(2u, b.stats().trips);
+  ASSERT_FALSE(b.allow(at(1500ms)));
+  ASSERT_TRUE(b.allow(at(2001ms)));
+}
+
+TEST(rpc_circuit_breaker, stale_and_cancelled_permits) {
+  smf::rpc_circuit_breaker b(test_opts());
+  auto stale = b.allow(at(0ms));
+  ASSERT_TRUE(stale);
+  run(b, at(0ms), 10, true);
+  auto p = b.allow(at(1000ms));
+  ASSERT_TRUE(p);
+  // issued while closed; must not count as a probe
+  b.record(*stale, at(1000ms), false, 1ms);
+  ASSERT_EQ(state::half_open, b.current_state());
+  // a cancelled probe frees its slot
+  b.cancel(*p);
+  ASSERT_TRUE(b.allow(at(1000ms)));
+  ASSERT_TRUE(b.allow(at(1000ms)));
+  ASSERT_FALSE(b.allow(at(1000ms)));
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,68 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_codel.h"
+
+using namespace std::chrono_literals;  // NOLINT
+using time_point = smf::rpc_codel::clock_type::time_point;
+
+static time_point
+at(std::chrono::milliseconds ms) {
+  return time_point(ms);
+}
+
+static smf::rpc_codel_opts
+test_opts() {
+  smf::rpc_codel_opts o;
+  o.target = 5ms;
+  o.interval = 100ms;
+  return o;
+}
+
+TEST(rpc_codel, bursts_are_not_shed) {
+  smf::rpc_codel c(test_opts());
+  for (auto ms = 0; ms < 1000; ms += 10) {
+    // one request in every interval gets through quickly
+    ASSERT_FALSE(c.should_drop(at(ms * 1ms), ms % 100 == 50 ? 1ms : 50ms));
+  }
+  ASSERT_FALSE(c.overloaded());
+}
+
+TEST(rpc_codel, standing_queue_is_shed) {
+  smf::rpc_codel c(test_opts());
+  // the first interval only measures
+  for (auto ms = 0; ms < 100; ms += 10) {
+    ASSERT_FALSE(c.should_drop(at(ms * 1ms), 20ms));
+  }
+  ASSERT_TRUE(c.should_drop(at(100ms), 20ms));
+  ASSERT_TRUE(c.overloaded());
+  // only requests over 2 * target
+  ASSERT_FALSE(c.should_drop(at(110ms), 8ms));
+  ASSERT_TRUE(c.should_drop(at(120ms), 11ms));
+}
+
+TEST(rpc_codel, recovers_once_the_queue_drains) {
+  smf::rpc_codel c(test_opts());
+  for (auto ms = 0; ms <= 100; ms += 10) { c.should_drop(at(ms * 1ms), 20ms); }
+  ASSERT_TRUE(c.overloaded());
+  c.should_drop(at(150ms), 1ms);
+  ASSERT_FALSE(c.should_drop(at(200ms), 20ms));
+  ASSERT_FALSE(c.overloaded());
+}
+
+TEST(rpc_codel, memory_pressure_sheds_right_away) {
+  smf::rpc_codel c(test_opts());
+  ASSERT_FALSE(c.should_drop(at(0ms), 4ms, true));
+  ASSERT_TRUE(c.should_drop(at(1ms), 6ms, true));
+  ASSERT_FALSE(c.overloaded());
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,95 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_concurrency_limiter.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+static smf::rpc_concurrency_limiter_opts
+test_opts() {
+  smf::rpc_concurrency_limiter_opts o;
+  o.initial_limit = 20;
+  o.min_limit = 4;
+  o.max_limit = 200;
+  return o;
+}
+
+/// \brief fills the limit, then releases every request with `rtt`
+static void
+saturate(smf::rpc_concurrency_limiter &l, std::chrono::microseconds rtt) {
+  uint32_t n = 0;
+  while (l.try_acquire()) { ++n; }
+  for (auto i = 0u; i < n; ++i) { l.release(rtt); }
+}
+
+TEST(rpc_concurrency_limiter, rejects_over_limit) {
+  smf::rpc_concurrency_limiter l(test_opts());
+  for (auto i = 0; i < 20; ++i) { ASSERT_TRUE(l.try_acquire()); }
+  ASSERT_FALSE(l.try_acquire());
+  ASSERT_EQ(20u, l.inflight());
+  l.release(100us);
+  ASSERT_TRUE(l.try_acquire());
+}
+
+TEST(rpc_concurrency_limiter, grows_at_baseline_latency) {
+  smf::rpc_concurrency_limiter l(test_opts());
+  saturate(l, 100us);
+  ASSERT_EQ(100us, l.baseline());
+  const auto before = l.limit();
+  saturate(l, 100us);
+  ASSERT_GT(l.limit(), before);
+}
+
+TEST(rpc_concurrency_limiter, shrinks_when_queueing) {
+  smf::rpc_concurrency_limiter l(test_opts());
+  saturate(l, 100us);
+  const auto before = l.limit();
+  // 10x the baseline: most requests in flight are queued
+  saturate(l, 1000us);
+  ASSERT_LT(l.limit(), before);
+  // settles where the queue is between 3l and 6l requests
+  for (auto i = 0; i < 100; ++i) { saturate(l, 1000us); }
+  ASSERT_LE(l.limit(), 6u);
+  ASSERT_GE(l.limit(), 4u);
+}
+
+TEST(rpc_concurrency_limiter, ignores_app_limited_samples) {
+  smf::rpc_concurrency_limiter l(test_opts());
+  saturate(l, 100us);
+  const auto before = l.limit();
+  for (auto i = 0; i < 50; ++i) {
+    ASSERT_TRUE(l.try_acquire());
+    l.release(1000us);
+  }
+  ASSERT_EQ(before, l.limit());
+}
+
+TEST(rpc_concurrency_limiter, drops_shrink_the_limit) {
+  smf::rpc_concurrency_limiter l(test_opts());
+  ASSERT_TRUE(l.try_acquire());
+  l.release(100us, true);
+  ASSERT_LT(l.limit(), 20u);
+}
+
+TEST(rpc_concurrency_limiter, baseline_is_remeasured) {
+  auto o = test_opts();
+  o.baseline_samples = 10;
+  smf::rpc_concurrency_limiter l(o);
+  ASSERT_TRUE(l.try_acquire());
+  l.release(100us);
+  for (auto i = 0; i < 9; ++i) {
+    ASSERT_TRUE(l.try_acquire());
+    l.release(500us);
+  }
+  ASSERT_EQ(500us, l.baseline());
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,75 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_fair_queue.h"
+
+using queue = smf::rpc_fair_queue<int>;
+
+static std::vector<int>
+drain(queue &q, uint64_t budget) {
+  std::vector<int> ret;
+  q.drain(budget, [&ret](uint64_t, int w) { ret.push_back(w); });
+  return ret;
+}
+
+TEST(rpc_fair_queue, round_robin_across_flows) {
+  queue q(100);
+  for (auto i = 0; i < 3; ++i) { q.push(1, 1, 100, 10 + i); }
+  q.push(2, 1, 100, 20);
+  q.push(3, 1, 100, 30);
+  ASSERT_EQ(5u, q.size());
+  ASSERT_EQ(std::vector<int>({10, 20, 30, 11, 12}), drain(q, 1000));
+  ASSERT_TRUE(q.empty());
+}
+
+TEST(rpc_fair_queue, small_waiters_pass_large_ones) {
+  queue q(100);
+  q.push(1, 1, 250, 10);
+  for (auto i = 0; i < 3; ++i) { q.push(2, 1, 50, 20 + i); }
+  // flow 1 needs three turns of credit
+  ASSERT_EQ(std::vector<int>({20, 21, 22, 10}), drain(q, 1000));
+}
+
+TEST(rpc_fair_queue, weights) {
+  queue q(100);
+  for (auto i = 0; i < 4; ++i) {
+    q.push(1, 1, 100, 10 + i);
+    q.push(2, 3, 100, 20 + i);
+  }
+  ASSERT_EQ(std::vector<int>({10, 20, 21, 22, 11, 23}), drain(q, 600));
+}
+
+TEST(rpc_fair_queue, stops_when_out_of_budget) {
+  queue q(100);
+  q.push(1, 1, 80, 10);
+  q.push(2, 1, 80, 20);
+  ASSERT_EQ(std::vector<int>({10}), drain(q, 100));
+  // flow 2 keeps its turn for when memory comes back
+  q.push(1, 1, 10, 11);
+  ASSERT_EQ(80u, q.waiting(2));
+  ASSERT_EQ(std::vector<int>({20, 11}), drain(q, 100));
+}
+
+TEST(rpc_fair_queue, skips_flows_that_do_not_fit) {
+  queue q(100);
+  q.push(1, 1, 90, 10);
+  q.push(2, 1, 30, 20);
+  q.push(3, 1, 40, 30);
+  // flow 1 does not fit; the others are not held behind it
+  ASSERT_EQ(std::vector<int>({20}), drain(q, 50));
+  ASSERT_EQ(std::vector<int>({30}), drain(q, 50));
+  q.push(2, 1, 10, 21);
+  // and it goes first once memory comes back
+  ASSERT_EQ(std::vector<int>({10, 21}), drain(q, 100));
+  ASSERT_TRUE(q.empty());
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,97 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <string>
+
+#include <gtest/gtest.h>
+#include <seastar/net/socket_defs.hh>
+
+#include "smf/rpc_fragment_assembler.h"
+#include "smf/rpc_recv_context.h"
+
+using result = smf::rpc_fragment_assembler::result;
+
+static smf::rpc_recv_context
+frame(uint16_t session, uint32_t size, bool last) {
+  smf::rpc::header hdr;
+  hdr.mutate_session(session);
+  hdr.mutate_size(size);
+  if (!last) {
+    hdr.mutate_bitflags(smf::rpc::header_bit_flags::header_bit_flags_fragment);
+  }
+  return smf::rpc_recv_context(
+    nullptr, seastar::make_ipv4_address(seastar::ipv4_addr{}), hdr,
+    seastar::temporary_buffer<char>(size));
+}
+
+TEST(rpc_fragment_assembler, reassembles) {
+  smf::rpc_fragment_assembler a(1024);
+  auto f1 = frame(1, 100, false);
+  ASSERT_EQ(result::buffered, a.add(f1));
+  ASSERT_EQ(100u, a.buffered_bytes());
+  auto f2 = frame(1, 50, true);
+  ASSERT_EQ(result::complete, a.add(f2));
+  ASSERT_EQ(0u, a.buffered_bytes());
+  ASSERT_EQ(2u, f2.fragments.size());
+  ASSERT_EQ(150u, f2.header.size());
+}
+
+TEST(rpc_fragment_assembler, message_over_max_size) {
+  smf::rpc_fragment_assembler a(256);
+  auto f1 = frame(1, 200, false);
+  ASSERT_EQ(result::buffered, a.add(f1));
+  auto f2 = frame(1, 100, false);
+  ASSERT_EQ(result::too_large, a.add(f2));
+  ASSERT_EQ(0u, a.buffered_bytes());
+}
+
+TEST(rpc_fragment_assembler, partial_messages_over_budget) {
+  // each message fits, both together do not
+  smf::rpc_fragment_assembler a(1024, 300);
+  auto f1 = frame(1, 200, false);
+  ASSERT_EQ(result::buffered, a.add(f1));
+  auto f2 = frame(2, 50, false);
+  ASSERT_EQ(result::buffered, a.add(f2));
+  auto f3 = frame(2, 100, false);
+  ASSERT_EQ(result::too_large, a.add(f3));
+  // only the session going over was dropped
+  ASSERT_EQ(200u, a.buffered_bytes());
+  auto f4 = frame(1, 300, true);
+  ASSERT_EQ(result::complete, a.add(f4));
+  ASSERT_EQ(500u, f4.header.size());
+  ASSERT_EQ(0u, a.buffered_bytes());
+}
+
+TEST(rpc_fragment_assembler, discard_drops_the_rest_of_the_message) {
+  smf::rpc_fragment_assembler a(1024);
+  auto f1 = frame(1, 100, false);
+  ASSERT_EQ(result::buffered, a.add(f1));
+  auto f2 = frame(1, 100, false);
+  ASSERT_EQ(100u, a.discard(f2));
+  ASSERT_EQ(0u, a.buffered_bytes());
+  ASSERT_TRUE(a.discarding(1));
+  auto f3 = frame(1, 100, false);
+  ASSERT_EQ(result::discarded, a.add(f3));
+  auto f4 = frame(1, 100, true);
+  ASSERT_EQ(result::discarded, a.add(f4));
+  ASSERT_FALSE(a.discarding(1));
+  // the session can be reused by the next message
+  auto f5 = frame(1, 100, true);
+  ASSERT_EQ(result::complete, a.add(f5));
+}
+
+TEST(rpc_fragment_assembler, discard_of_the_last_frame) {
+  smf::rpc_fragment_assembler a(1024);
+  auto f1 = frame(1, 100, false);
+  ASSERT_EQ(result::buffered, a.add(f1));
+  auto f2 = frame(1, 100, true);
+  ASSERT_EQ(100u, a.discard(f2));
+  ASSERT_FALSE(a.discarding(1));
+  ASSERT_EQ(0u, a.partial_size(1));
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
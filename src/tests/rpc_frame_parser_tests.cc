@@ -0,0 +1,117 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <cstring>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_checksum.h"
+#include "smf/rpc_frame_parser.h"
+
+using tmp_buf = smf::rpc_frame_parser::tmp_buf;
+
+/// \brief header and body of a request, as they are on the wire
+static std::string
+frame(uint32_t request_id, const std::string &body) {
+  smf::rpc::header hdr;
+  hdr.mutate_meta(request_id);
+  hdr.mutate_size(body.size());
+  smf::set_rpc_checksum_type(hdr, smf::rpc::checksum_type::checksum_type_none);
+  std::string ret(reinterpret_cast<const char *>(&hdr), sizeof(hdr));
+  return ret + body;
+}
+
+static tmp_buf
+buf(const std::string &s) {
+  return tmp_buf(s.data(), s.size());
+}
+
+static std::string
+str(const tmp_buf &b) {
+  return std::string(b.get(), b.size());
+}
+
+/// \brief what the parser hands back to the input_stream
+static smf::rpc_frame_parser::unconsumed_remainder
+consume(smf::rpc_frame_parser &p, tmp_buf data) {
+  auto f = p.consume(std::move(data));
+  EXPECT_TRUE(f.available());
+  return f.get0();
+}
+
+TEST(rpc_frame_parser, multiple_frames_per_read) {
+  smf::rpc_frame_parser p;
+  auto r = consume(p, buf(frame(1, "a") + frame(2, "bb") + frame(3, "ccc")));
+  // stop, nothing left over
+  ASSERT_TRUE(r);
+  ASSERT_TRUE(r->empty());
+  ASSERT_FALSE(p.batch.pending);
+  ASSERT_EQ(3u, p.batch.frames.size());
+  ASSERT_EQ(1u, p.batch.frames[0].header.meta());
+  ASSERT_EQ("a", str(p.batch.frames[0].body));
+  ASSERT_EQ("bb", str(p.batch.frames[1].body));
+  ASSERT_EQ(3u, p.batch.frames[2].header.meta());
+  ASSERT_EQ("ccc", str(p.batch.frames[2].body));
+}
+
+TEST(rpc_frame_parser, header_split_across_reads) {
+  smf::rpc_frame_parser p;
+  const auto bytes = frame(7, "body");
+  // needs more bytes
+  ASSERT_FALSE(consume(p, buf(bytes.substr(0, 5))));
+  ASSERT_TRUE(p.batch.empty());
+  auto r = consume(p, buf(bytes.substr(5)));
+  ASSERT_TRUE(r && r->empty());
+  ASSERT_EQ(1u, p.batch.frames.size());
+  ASSERT_EQ(7u, p.batch.frames[0].header.meta());
+  ASSERT_EQ("body", str(p.batch.frames[0].body));
+}
+
+TEST(rpc_frame_parser, frames_before_a_partial_header) {
+  smf::rpc_frame_parser p;
+  const auto next = frame(2, "b");
+  auto r = consume(p, buf(frame(1, "a") + next.substr(0, 5)));
+  ASSERT_EQ(1u, p.batch.frames.size());
+  // the next parse() starts from these
+  ASSERT_TRUE(r);
+  ASSERT_EQ(next.substr(0, 5), str(*r));
+}
+
+TEST(rpc_frame_parser, pending_body_stays_in_the_stream) {
+  smf::rpc_frame_parser p;
+  const std::string body(100, 'x');
+  const auto bytes = frame(1, "a") + frame(2, body);
+  const auto split = bytes.size() - body.size() / 2;
+  auto r = consume(p, buf(bytes.substr(0, split)));
+  ASSERT_EQ(1u, p.batch.frames.size());
+  ASSERT_TRUE(p.batch.pending);
+  ASSERT_EQ(2u, p.batch.pending->meta());
+  ASSERT_EQ(body.size(), p.batch.pending->size());
+  // read with read_exactly() once memory is reserved
+  ASSERT_TRUE(r);
+  ASSERT_EQ(body.substr(0, body.size() / 2), str(*r));
+}
+
+TEST(rpc_frame_parser, small_frames_do_not_pin_the_buffer) {
+  smf::rpc_frame_parser p;
+  const std::string large(4096, 'x');
+  auto data = buf(frame(1, "small") + frame(2, large));
+  const char *begin = data.get();
+  const char *end = begin + data.size();
+  auto inside = [begin, end](const tmp_buf &b) {
+    return b.get() >= begin && b.get() < end;
+  };
+  consume(p, data.share());
+  ASSERT_EQ(2u, p.batch.frames.size());
+  ASSERT_EQ("small", str(p.batch.frames[0].body));
+  ASSERT_FALSE(inside(p.batch.frames[0].body));
+  ASSERT_EQ(large, str(p.batch.frames[1].body));
+  ASSERT_TRUE(inside(p.batch.frames[1].body));
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,175 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_filter.h"
+#include "smf/rpc_handle_router.h"
+
+using log_t = seastar::lw_shared_ptr<std::vector<std::string>>;
+
+/// \brief what smfc generates, with two unary methods: request_id
+/// `id ^ 1` and `id ^ 2`
+class fake_service final : public smf::rpc_service {
+ public:
+  fake_service(const char *name, uint32_t id)
+    : name_(name), id_(id), handles_{{smf::rpc_service_method_handle(reply),
+                                      smf::rpc_service_method_handle(reply)}} {}
+  const char *
+  service_name() const final {
+    return name_;
+  }
+  uint32_t
+  service_id() const final {
+    return id_;
+  }
+  smf::rpc_service_method_handle *
+  method_for_request_id(uint32_t idx) final {
+    if (idx == (id_ ^ 1)) { return &handles_[0]; }
+    if (idx == (id_ ^ 2)) { return &handles_[1]; }
+    return nullptr;
+  }
+  std::vector<uint32_t>
+  request_ids() const final {
+    return {id_ ^ 1, id_ ^ 2};
+  }
+  std::ostream &
+  print(std::ostream &o) const final {
+    return o << name_;
+  }
+
+ private:
+  static seastar::future<smf::rpc_envelope>
+  reply(smf::rpc_recv_context &&) {
+    return seastar::make_ready_future<smf::rpc_envelope>(smf::rpc_envelope{});
+  }
+
+  const char *name_;
+  const uint32_t id_;
+  std::array<smf::rpc_service_method_handle, 2> handles_;
+};
+
+/// \brief records `name` and how many times this instance ran
+struct logging_filter {
+  logging_filter(log_t l, std::string n) : log(l), name(std::move(n)) {}
+  seastar::future<smf::rpc_envelope>
+  operator()(smf::rpc_envelope e) {
+    log->push_back(name + std::to_string(++calls));
+    return seastar::make_ready_future<smf::rpc_envelope>(std::move(e));
+  }
+  log_t log;
+  std::string name;
+  uint32_t calls{0};
+};
+
+static seastar::future<smf::rpc_recv_context>
+pass(smf::rpc_recv_context c) {
+  return seastar::make_ready_future<smf::rpc_recv_context>(std::move(c));
+}
+
+static smf::rpc_outgoing_filter
+out_filter(log_t log, std::string name) {
+  return smf::rpc_shared_filter<smf::rpc_outgoing_filter, logging_filter>(
+    log, std::move(name));
+}
+
+static void
+run(const smf::rpc_outgoing_chain &chain) {
+  ASSERT_TRUE(chain);
+  auto f = smf::rpc_filter_apply(chain.get(), smf::rpc_envelope{});
+  ASSERT_TRUE(f.available());
+  ASSERT_FALSE(f.failed());
+  f.ignore_ready_future();
+}
+
+class rpc_handle_router_test : public ::testing::Test {
+ protected:
+  void
+  SetUp() override {
+    router.register_service(std::make_unique<fake_service>("a", 10));
+    router.register_service(std::make_unique<fake_service>("b", 20));
+  }
+  smf::rpc_service_method_handle *
+  method(uint32_t request_id) {
+    return router.get_handle_for_request(request_id);
+  }
+
+  smf::rpc_handle_router router;
+  std::vector<smf::rpc_incoming_filter> in;
+  std::vector<smf::rpc_outgoing_filter> out;
+  log_t log = seastar::make_lw_shared<std::vector<std::string>>();
+};
+
+TEST_F(rpc_handle_router_test, no_filters_no_chain) {
+  router.resolve_filters(in, out);
+  for (auto id : {10 ^ 1, 10 ^ 2, 20 ^ 1, 20 ^ 2}) {
+    ASSERT_FALSE(method(id)->incoming_filters);
+    ASSERT_FALSE(method(id)->outgoing_filters);
+  }
+}
+
+TEST_F(rpc_handle_router_test, service_then_method_filters) {
+  router.service_filters("a").incoming.push_back(pass);
+  router.service_filters("a").outgoing.push_back(out_filter(log, "service"));
+  router.method_filters(10 ^ 1).incoming.push_back(pass);
+  router.method_filters(10 ^ 1).outgoing.push_back(out_filter(log, "method"));
+  out.push_back(out_filter(log, "server"));
+  router.resolve_filters(in, out);
+
+  ASSERT_EQ(2u, method(10 ^ 1)->incoming_filters->size());
+  run(method(10 ^ 1)->outgoing_filters);
+  ASSERT_EQ(std::vector<std::string>({"method1", "service1", "server1"}),
+            *log);
+
+  log->clear();
+  ASSERT_EQ(1u, method(10 ^ 2)->incoming_filters->size());
+  run(method(10 ^ 2)->outgoing_filters);
+  // one instance per registration, not per method
+  ASSERT_EQ(std::vector<std::string>({"service2", "server2"}), *log);
+
+  // another service: only the server's filters; none incoming, so the
+  // incoming stage is skipped
+  ASSERT_FALSE(method(20 ^ 1)->incoming_filters);
+  ASSERT_EQ(1u, method(20 ^ 1)->outgoing_filters->size());
+}
+
+TEST_F(rpc_handle_router_test, requests_keep_their_chain) {
+  router.method_filters(20 ^ 2).outgoing.push_back(out_filter(log, "first"));
+  router.resolve_filters(in, out);
+  // what a request in flight holds
+  auto held = method(20 ^ 2)->outgoing_filters;
+
+  router.method_filters(20 ^ 2).outgoing.push_back(out_filter(log, "second"));
+  router.resolve_filters(in, out);
+  ASSERT_EQ(1u, held->size());
+  ASSERT_EQ(2u, method(20 ^ 2)->outgoing_filters->size());
+  run(held);
+  ASSERT_EQ(std::vector<std::string>({"first1"}), *log);
+}
+
+TEST(rpc_handle_router, unknown_scheduling_group_throws_on_register) {
+  smf::rpc_handle_router router;
+  router.set_scheduling_groups({{"batch", seastar::scheduling_group()}});
+  auto service = std::make_unique<fake_service>("a", 10);
+  service->scheduling_group = "batch";
+  router.register_service(std::move(service));
+  ASSERT_TRUE(router.get_handle_for_request(10 ^ 1)->bound_group);
+  // the default group is named "main"; metrics use the key
+  ASSERT_EQ("batch", router.get_handle_for_request(10 ^ 1)->bound_group_key);
+
+  service = std::make_unique<fake_service>("b", 20);
+  service->method_for_request_id(20 ^ 2)->scheduling_group = "bacth";
+  ASSERT_THROW(router.register_service(std::move(service)),
+               std::runtime_error);
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
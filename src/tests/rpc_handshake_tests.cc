@@ -0,0 +1,90 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <limits>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_handshake.h"
+
+using namespace smf::rpc;  // NOLINT
+
+static constexpr uint32_t kAll = std::numeric_limits<uint32_t>::max();
+
+static uint32_t
+bit(uint32_t v) {
+  return uint32_t(1) << v;
+}
+
+TEST(rpc_handshake, cheapest_shared_codec) {
+  auto a = smf::rpc_handshake::make(smf::rpc_handshake::kDefaultCodecs, kAll,
+                                    1024);
+  auto b = smf::rpc_handshake::make(bit(compression_flags_zstd), kAll, 2048);
+  auto ab = smf::rpc_handshake::negotiate(a, b, 0);
+  auto ba = smf::rpc_handshake::negotiate(b, a, 0);
+  ASSERT_EQ(compression_flags_zstd, ab.compression);
+  ASSERT_EQ(ab.compression, ba.compression);
+  ASSERT_EQ(ab.checksum, ba.checksum);
+  ASSERT_EQ(2048u, ab.peer_max_frame_size);
+  ASSERT_EQ(1024u, ba.peer_max_frame_size);
+
+  auto both = smf::rpc_handshake::negotiate(a, a, 0);
+  ASSERT_EQ(compression_flags_lz4, both.compression);
+}
+
+TEST(rpc_handshake, no_shared_codec) {
+  auto a = smf::rpc_handshake::make(bit(compression_flags_lz4), kAll, 1024);
+  auto b = smf::rpc_handshake::make(0, kAll, 1024);
+  auto n = smf::rpc_handshake::negotiate(a, b, 0);
+  ASSERT_EQ(compression_flags_none, n.compression);
+}
+
+TEST(rpc_handshake, checksum_none_needs_both) {
+  const uint32_t no_none = kAll & ~bit(checksum_type_none);
+  auto a = smf::rpc_handshake::make(0, kAll, 1024);
+  auto b = smf::rpc_handshake::make(0, no_none, 1024);
+  ASSERT_NE(checksum_type_none,
+            smf::rpc_handshake::negotiate(a, b, 0).checksum);
+  ASSERT_EQ(checksum_type_none,
+            smf::rpc_handshake::negotiate(a, a, 0).checksum);
+  // xxhash64 is always there
+  auto c = smf::rpc_handshake::make(0, bit(checksum_type_xxhash64), 1024);
+  ASSERT_EQ(checksum_type_xxhash64,
+            smf::rpc_handshake::negotiate(a, c, 0).checksum);
+}
+
+TEST(rpc_handshake, default_checksums_skip_none) {
+  // i.e.: a server with the default rpc_server_args::checksums
+  auto server = smf::rpc_handshake::make(
+    0, smf::rpc_handshake::kDefaultChecksums, 1024);
+  ASSERT_FALSE(server.checksums() & bit(checksum_type_none));
+  auto client = smf::rpc_handshake::make(0, kAll, 1024);
+  ASSERT_NE(checksum_type_none,
+            smf::rpc_handshake::negotiate(server, client, 0).checksum);
+}
+
+TEST(rpc_handshake, fragment_size) {
+  auto a = smf::rpc_handshake::make(0, kAll, 4096);
+  auto n = smf::rpc_handshake::negotiate(a, a, 0);
+  ASSERT_EQ(4096u, n.fragment_size(0));
+  ASSERT_EQ(1024u, n.fragment_size(1024));
+  ASSERT_EQ(4096u, n.fragment_size(8192));
+  n.peer_features = 0;
+  ASSERT_EQ(0u, n.fragment_size(1024));
+}
+
+TEST(rpc_handshake, shard_layout) {
+  auto server = smf::rpc_handshake::make(0, kAll, 1024, 8, 11226);
+  auto client = smf::rpc_handshake::make(0, kAll, 1024);
+  auto n = smf::rpc_handshake::negotiate(client, server, 0);
+  ASSERT_EQ(8u, n.peer_shard_count);
+  ASSERT_EQ(11226u, n.peer_shard_port_base);
+  ASSERT_EQ(0u, smf::rpc_handshake::negotiate(server, client, 0)
+                  .peer_shard_count);
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
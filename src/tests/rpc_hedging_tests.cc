@@ -0,0 +1,62 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "smf/rpc_hedging.h"
+
+using namespace std::chrono_literals;  // NOLINT
+
+static smf::rpc_hedging_opts
+opts() {
+  smf::rpc_hedging_opts o;
+  o.enabled = true;
+  o.percentile = 50;
+  o.min_delay = 1ms;
+  // recomputed on every request
+  o.refresh = 0ms;
+  return o;
+}
+
+TEST(rpc_hedging, no_delay_before_a_reply) {
+  smf::rpc_hedging_policy p(opts());
+  ASSERT_FALSE(p.begin());
+}
+
+TEST(rpc_hedging, disabled) {
+  auto o = opts();
+  o.enabled = false;
+  smf::rpc_hedging_policy p(o);
+  p.record(10ms);
+  ASSERT_FALSE(p.begin());
+  ASSERT_EQ(0u, p.stats().requests);
+}
+
+TEST(rpc_hedging, delay_follows_recent_replies) {
+  smf::rpc_hedging_policy p(opts());
+  for (int i = 0; i < 100; ++i) { p.record(100ms); }
+  auto slow = p.begin();
+  ASSERT_TRUE(slow);
+  ASSERT_GE(*slow, 99ms);
+  // the servers recovered: old replies no longer count
+  for (int i = 0; i < 10; ++i) { p.record(5ms); }
+  auto fast = p.begin();
+  ASSERT_TRUE(fast);
+  ASSERT_LE(*fast, 6ms);
+  // no reply since: the last delay is kept
+  ASSERT_EQ(*fast, *p.begin());
+}
+
+TEST(rpc_hedging, min_delay) {
+  smf::rpc_hedging_policy p(opts());
+  p.record(10us);
+  ASSERT_EQ(std::chrono::nanoseconds(1ms), *p.begin());
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,122 @@
+// Copyright 2019 SMF Authors
+//
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "smf/shm_ring.h"
+
+static constexpr size_t kCapacity = 64;
+
+struct shm_ring_memory {
+  // mmap'ed memory in real life; only the alignment matters here
+  alignas(smf::shm_ring::kCacheLine) char
+    data[smf::shm_ring::mapping_size(kCapacity)];
+};
+
+TEST(shm_ring, write_read_wraps_around) {
+  shm_ring_memory mem;
+  auto w = smf::shm_ring::create(mem.data, kCapacity);
+  auto r = smf::shm_ring::attach(mem.data, kCapacity);
+  std::string out(kCapacity, '\0');
+  for (int i = 0; i < 10; ++i) {
+    // 40 bytes per round: every other round straddles the end
+    std::string in(40, static_cast<char>('a' + i));
+    ASSERT_EQ(40u, w.write(in.data(), in.size()));
+    ASSERT_EQ(40u, r.readable());
+    ASSERT_EQ(40u, r.read(out.data(), out.size()));
+    ASSERT_EQ(in, out.substr(0, 40));
+  }
+  ASSERT_EQ(0u, r.readable());
+  ASSERT_EQ(kCapacity, w.writable());
+}
+
+TEST(shm_ring, full_ring_takes_partial_writes) {
+  shm_ring_memory mem;
+  auto w = smf::shm_ring::create(mem.data, kCapacity);
+  std::string in(100, 'x');
+  ASSERT_EQ(kCapacity, w.write(in.data(), in.size()));
+  ASSERT_EQ(0u, w.write(in.data(), in.size()));
+  ASSERT_EQ(0u, w.writable());
+  char c;
+  ASSERT_EQ(1u, w.read(&c, 1));
+  ASSERT_EQ(1u, w.write(in.data(), in.size()));
+}
+
+TEST(shm_ring, close_and_waiting_flags) {
+  shm_ring_memory mem;
+  auto w = smf::shm_ring::create(mem.data, kCapacity);
+  auto r = smf::shm_ring::attach(mem.data, kCapacity);
+  ASSERT_FALSE(r.writer_closed());
+  w.close_writer();
+  ASSERT_TRUE(r.writer_closed());
+  r.close_reader();
+  ASSERT_TRUE(w.reader_closed());
+  r.set_reader_waiting(true);
+  ASSERT_TRUE(w.reader_waiting());
+  r.set_reader_waiting(false);
+  ASSERT_FALSE(w.reader_waiting());
+}
+
+TEST(shm_ring, forged_positions_throw) {
+  shm_ring_memory mem;
+  auto w = smf::shm_ring::create(mem.data, kCapacity);
+  auto r = smf::shm_ring::attach(mem.data, kCapacity);
+  auto ctrl = reinterpret_cast<smf::shm_ring::control *>(mem.data);
+  std::string buf(4 * kCapacity, 'x');
+  // more readable bytes than the ring holds
+  ctrl->head.store(3 * kCapacity);
+  ASSERT_ANY_THROW(r.read(buf.data(), buf.size()));
+  // tail ahead of head
+  ctrl->head.store(0);
+  ctrl->tail.store(1);
+  ASSERT_ANY_THROW(w.write(buf.data(), buf.size()));
+}
+
+TEST(shm_ring, attach_validates) {
+  shm_ring_memory mem;
+  smf::shm_ring::create(mem.data, kCapacity);
+  ASSERT_ANY_THROW(smf::shm_ring::attach(mem.data, kCapacity / 2));
+  ASSERT_ANY_THROW(smf::shm_ring::create(mem.data, 48));
+}
+
+TEST(shm_ring, spsc_threads) {
+  shm_ring_memory mem;
+  auto w = smf::shm_ring::create(mem.data, kCapacity);
+  auto r = smf::shm_ring::attach(mem.data, kCapacity);
+  constexpr uint32_t kCount = 1 << 14;
+  std::thread producer([&w] {
+    for (uint32_t i = 0; i < kCount;) {
+      if (w.write(reinterpret_cast<const char *>(&i), sizeof(i)) == 0) {
+        std::this_thread::yield();
+        continue;
+      }
+      // capacity is a multiple of the record size: never a partial write
+      ++i;
+    }
+    w.close_writer();
+  });
+  uint32_t expected = 0;
+  while (true) {
+    uint32_t v;
+    if (r.readable() < sizeof(v)) {
+      if (r.writer_closed() && r.readable() == 0) { break; }
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(sizeof(v), r.read(reinterpret_cast<char *>(&v), sizeof(v)));
+    ASSERT_EQ(expected++, v);
+  }
+  producer.join();
+  ASSERT_EQ(kCount, expected);
+}
+
+int
+main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}